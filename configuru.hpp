@@ -64,6 +64,7 @@ www.github.com/emilk/configuru
 #include <atomic>
 #include <cmath>
 #include <cstddef>
+#include <cstdio>
 #include <cstring>
 #include <functional>
 #include <initializer_list>
@@ -118,6 +119,51 @@ www.github.com/emilk/configuru
 	#define CONFIGURU_VALUE_SEMANTICS 0
 #endif
 
+#ifndef CONFIGURU_COPY_ON_WRITE
+	/// Only used when CONFIGURU_VALUE_SEMANTICS is 1.
+	/// If set, copies of an array or object share their contents until one of them is
+	/// changed through a non-const method, so copying is cheap.
+	/// A copy needs keys of its own to record which of them have been accessed, so while access tracking
+	/// is on (see set_access_tracking) only packed arrays are shared. An array or object that has handed out
+	/// a non-const reference into itself (see LentFlag) is never shared again.
+	#define CONFIGURU_COPY_ON_WRITE 0
+#endif
+
+#ifndef CONFIGURU_HASH_CACHE
+	/// Only used when CONFIGURU_VALUE_SEMANTICS is 1.
+	/// If set, arrays and objects remember their Config::hash() until they are changed,
+	/// which also makes Config::deep_eq of two different values fast.
+	/// A change made through a reference from operator[] or as_object() is seen too (see ChangeLink),
+	/// but an array that has handed out its std::vector with the non-const as_array() never
+	/// remembers its hash again, nor does an array or object it is in.
+	#define CONFIGURU_HASH_CACHE 0
+#endif
+
+#ifndef CONFIGURU_DUMP_CACHE
+	/// Only used when CONFIGURU_VALUE_SEMANTICS is 1.
+	/// If set, arrays and objects can remember what they were written as (see FormatOptions::cache_output)
+	/// until they are changed, so dumping a big config again after a small change only formats what changed.
+	/// Changes made through references are seen the same way as with CONFIGURU_HASH_CACHE. Comments handed out
+	/// by the non-const Config::comments() are not: the arrays and objects around them are then always written anew.
+	#define CONFIGURU_DUMP_CACHE 0
+#endif
+
+/// Set if arrays and objects remember something about their contents (see ContentCache).
+#define CONFIGURU_CONTENT_CACHE (CONFIGURU_VALUE_SEMANTICS && (CONFIGURU_HASH_CACHE || CONFIGURU_DUMP_CACHE))
+
+#ifndef CONFIGURU_ATOMIC_REF_COUNT
+	/// Only used when CONFIGURU_VALUE_SEMANTICS is 0 or CONFIGURU_COPY_ON_WRITE is 1.
+	/// If 1, shallow copies of the same array or object may be created and destroyed on different threads.
+	/// Set to 0 if you only use Configuru from one thread at a time, which makes copying cheaper.
+	#define CONFIGURU_ATOMIC_REF_COUNT 1
+#endif
+
+#ifndef CONFIGURU_ACCESS_TRACKING
+	/// If 0, Configuru does not track which keys are accessed, and check_dangling() never complains.
+	/// Tracking can also be turned off at runtime with set_access_tracking(false).
+	#define CONFIGURU_ACCESS_TRACKING 1
+#endif
+
 #undef Bool // Needed on Ubuntu 14.04 with GCC 4.8.5
 #undef check // Needed on OSX
 
@@ -153,13 +199,371 @@ namespace configuru
 
 	struct BadLookupInfo;
 
+	/// Reference count for the shared nodes when CONFIGURU_VALUE_SEMANTICS is 0 or CONFIGURU_COPY_ON_WRITE is 1.
+	/// A copied node starts out with a count of one.
+	class RefCount
+	{
+	public:
+		RefCount() {}
+		RefCount(const RefCount&) {}
+		RefCount& operator=(const RefCount&) { return *this; }
+
+		void increment()
+		{
+		#if CONFIGURU_ATOMIC_REF_COUNT
+			_count.fetch_add(1, std::memory_order_relaxed);
+		#else
+			++_count;
+		#endif
+		}
+
+		/// Returns true if this was the last reference.
+		bool decrement()
+		{
+		#if CONFIGURU_ATOMIC_REF_COUNT
+			return _count.fetch_sub(1, std::memory_order_acq_rel) == 1;
+		#else
+			return --_count == 0;
+		#endif
+		}
+
+		bool is_shared() const
+		{
+		#if CONFIGURU_ATOMIC_REF_COUNT
+			return _count.load(std::memory_order_acquire) > 1;
+		#else
+			return _count > 1;
+		#endif
+		}
+
+	private:
+	#if CONFIGURU_ATOMIC_REF_COUNT
+		std::atomic<unsigned> _count { 1 };
+	#else
+		unsigned _count = 1;
+	#endif
+	};
+
+	/// Set on an array or object once it has handed out a non-const reference into itself which it cannot
+	/// keep track of. We cannot tell when the references are gone, so the flag is never cleared.
+	/// A copied node starts out unset.
+	/// When CONFIGURU_COPY_ON_WRITE is 1, every copy of a node which has lent out a reference (from operator[],
+	/// as_array() or as_object()) gets contents of its own rather than sharing, since a reference could still
+	/// change them behind its back. See also ContentCache.
+	class LentFlag
+	{
+	public:
+		LentFlag() {}
+		LentFlag(const LentFlag&) {}
+		LentFlag& operator=(const LentFlag&) { return *this; }
+
+		void set() { _lent.store(true, std::memory_order_relaxed); }
+
+		bool is_set() const { return _lent.load(std::memory_order_relaxed); }
+
+	private:
+		std::atomic<bool> _lent { false };
+	};
+
+	class ChangeLink;
+
+	/// Holds a reference to a ChangeLink.
+	class ChangeLinkPtr
+	{
+	public:
+		ChangeLinkPtr() {}
+		explicit ChangeLinkPtr(ChangeLink* link) : _link(link) {} // Takes over the reference of a new link.
+		ChangeLinkPtr(const ChangeLinkPtr& o);
+		ChangeLinkPtr& operator=(const ChangeLinkPtr& o);
+		~ChangeLinkPtr() { reset(); }
+
+		void reset();
+
+		ChangeLink* get()        const { return _link; }
+		ChangeLink* operator->() const { return _link; }
+		explicit operator bool() const { return _link != nullptr; }
+
+	private:
+		ChangeLink* _link = nullptr;
+	};
+
+	/// How an array or object hears about changes made through a non-const reference it has handed out
+	/// to one of its values (has "lent" it). The lent value points to the link of the container it is in,
+	/// and the link of a container points to the link of the container it is in in turn.
+	/// Changing the value bumps the version of every link above it, so what a container remembers
+	/// about its contents is good for as long as the version of its link stays the same (see ContentCache).
+	class ChangeLink
+	{
+	public:
+		uint64_t version() const { return _version.load(std::memory_order_acquire); }
+
+		/// Called when a value below us is changed.
+		void changed()
+		{
+			for (ChangeLink* link = this; link; link = link->_parent.get()) {
+				link->_version.fetch_add(1, std::memory_order_acq_rel);
+				// A link that has changed since it was last looked at has changed links all the way up (see looked_at):
+				if (link->_changed.exchange(true, std::memory_order_relaxed)) { break; }
+			}
+		}
+
+		/// Called when everything below us has been looked at as it is now, for something that is remembered.
+		/// Until then, no container above us remembers anything, so a change below us can stop going up here.
+		void looked_at() const
+		{
+			if (_changed.load(std::memory_order_relaxed)) {
+				_changed.store(false, std::memory_order_relaxed);
+			}
+		}
+
+		/// The link of the container we are in.
+		void set_parent(const ChangeLinkPtr& parent)
+		{
+			if (_parent.get() != parent.get()) { _parent = parent; }
+		}
+
+	private:
+		friend class ChangeLinkPtr;
+
+		RefCount                  _ref_count;
+		std::atomic<uint64_t>     _version { 0 };
+		mutable std::atomic<bool> _changed { false };
+		ChangeLinkPtr             _parent;
+	};
+
+	inline ChangeLinkPtr::ChangeLinkPtr(const ChangeLinkPtr& o) : _link(o._link)
+	{
+		if (_link) { _link->_ref_count.increment(); }
+	}
+
+	inline ChangeLinkPtr& ChangeLinkPtr::operator=(const ChangeLinkPtr& o)
+	{
+		if (o._link) { o._link->_ref_count.increment(); }
+		reset();
+		_link = o._link;
+		return *this;
+	}
+
+	inline void ChangeLinkPtr::reset()
+	{
+		// The links of a deep config make a long chain, so we release it without recursion:
+		ChangeLink* link = _link;
+		_link = nullptr;
+		while (link && link->_ref_count.decrement()) {
+			ChangeLink* parent = link->_parent._link;
+			link->_parent._link = nullptr;
+			delete link;
+			link = parent;
+		}
+	}
+
+	/// What an array or object remembers about its contents: its hash when CONFIGURU_HASH_CACHE is 1,
+	/// and what it was written as when CONFIGURU_DUMP_CACHE is 1.
+	/// Changes made through our own methods forget it (see forget), and changes made through a reference
+	/// we have lent out bump our ChangeLink, which we only make the first time we lend a value.
+	/// Once the std::vector of an array has been handed out, values can be added or removed behind our back,
+	/// so from then on we never remember anything, and neither does a container we are in.
+	/// A copy keeps what is still good, and has lent nothing.
+	class ContentCache
+	{
+	public:
+		struct DumpEntry
+		{
+			size_t      format; ///< Which FormatOptions it was written with.
+			const void* doc;    ///< Which document it was written as a part of, if that matters.
+			unsigned    indent;
+			std::string text;
+		};
+		using DumpEntry_SP = std::shared_ptr<const DumpEntry>;
+
+		ContentCache() {}
+		ContentCache(const ContentCache& o) { copy_from(o); }
+		ContentCache& operator=(const ContentCache& o) { forget(); copy_from(o); return *this; }
+
+		/// The link to give a value we lend out. `holder` is the link we were given, if we were lent.
+		const ChangeLinkPtr& lend(const ChangeLinkPtr& holder)
+		{
+			if (!_link) { _link = ChangeLinkPtr(new ChangeLink()); }
+			_link->set_parent(holder);
+			return _link;
+		}
+
+		/// Called when the array has handed out its std::vector.
+		void lend_all() { _lent_all.set(); }
+
+		/// False if we may not remember anything (see lend_all).
+		bool can_remember() const { return !_lent_all.is_set(); }
+
+		/// Our link, if we have lent a value.
+		const ChangeLinkPtr& link() const { return _link; }
+
+		/// Call before remembering anything worked out from what is in us now (see ChangeLink::looked_at).
+		void looked_at() const
+		{
+			if (_link) { _link->looked_at(); }
+		}
+
+		/// Called when we are changed through our own methods.
+		void forget()
+		{
+		#if CONFIGURU_HASH_CACHE
+			_hash.store(0, std::memory_order_relaxed);
+		#endif
+		#if CONFIGURU_DUMP_CACHE
+			forget_dump();
+		#endif
+		}
+
+	#if CONFIGURU_HASH_CACHE
+		/// Zero means unknown.
+		size_t hash() const
+		{
+			const uint64_t version = _hash_version.load(std::memory_order_acquire);
+			const size_t   hash    = _hash.load(std::memory_order_relaxed);
+			return version == this->version() ? hash : 0;
+		}
+
+		void set_hash(size_t hash) const
+		{
+			looked_at();
+			_hash.store(hash, std::memory_order_relaxed);
+			_hash_version.store(version(), std::memory_order_release);
+		}
+	#endif
+
+	#if CONFIGURU_DUMP_CACHE
+		DumpEntry_SP dump() const
+		{
+			if (!_has_dump.load(std::memory_order_relaxed)) { return nullptr; }
+			const uint64_t version = _dump_version.load(std::memory_order_acquire);
+			DumpEntry_SP entry = std::atomic_load(&_dump);
+			return version == this->version() ? entry : nullptr;
+		}
+
+		void set_dump(DumpEntry_SP entry) const
+		{
+			looked_at();
+			_has_dump.store(entry != nullptr, std::memory_order_relaxed);
+			std::atomic_store(&_dump, std::move(entry));
+			_dump_version.store(version(), std::memory_order_release);
+		}
+
+		/// Cheap when there is nothing to forget.
+		void forget_dump() const
+		{
+			if (_has_dump.load(std::memory_order_relaxed)) {
+				_has_dump.store(false, std::memory_order_relaxed);
+				std::atomic_store(&_dump, DumpEntry_SP());
+			}
+		}
+	#endif
+
+	private:
+		uint64_t version() const { return _link ? _link->version() : 0; }
+
+		void copy_from(const ContentCache& o)
+		{
+			if (!o.can_remember()) { return; }
+		#if CONFIGURU_HASH_CACHE
+			if (const size_t hash = o.hash()) { set_hash(hash); }
+		#endif
+		#if CONFIGURU_DUMP_CACHE
+			if (DumpEntry_SP entry = o.dump()) { set_dump(std::move(entry)); }
+		#endif
+		}
+
+		ChangeLinkPtr                 _link;
+		LentFlag                      _lent_all;
+	#if CONFIGURU_HASH_CACHE
+		mutable std::atomic<size_t>   _hash { 0 };
+		mutable std::atomic<uint64_t> _hash_version { 0 };
+	#endif
+	#if CONFIGURU_DUMP_CACHE
+		mutable std::atomic<bool>     _has_dump { false };
+		mutable DumpEntry_SP          _dump;
+		mutable std::atomic<uint64_t> _dump_version { 0 };
+	#endif
+	};
+
+	/// A read-only view of values stored contiguously, e.g. the numbers of a packed array.
+	template<typename T>
+	class Span
+	{
+	public:
+		Span() : _data(nullptr), _size(0) {}
+		Span(const T* data, size_t size) : _data(data), _size(size) {}
+
+		const T* data()  const { return _data;         }
+		size_t   size()  const { return _size;         }
+		bool     empty() const { return _size == 0;    }
+		const T* begin() const { return _data;         }
+		const T* end()   const { return _data + _size; }
+
+		const T& operator[](size_t ix) const { return _data[ix]; }
+
+	private:
+		const T* _data;
+		size_t   _size;
+	};
+
+	/// The runtime switch behind set_access_tracking().
+	inline std::atomic<bool>& access_tracking_enabled()
+	{
+		static std::atomic<bool> s_enabled { true };
+		return s_enabled;
+	}
+
+	/// Turn the tracking of accessed keys on or off (default on).
+	/// While off, lookups do not record anything and check_dangling() reports nothing.
+	inline void set_access_tracking(bool enabled)
+	{
+		access_tracking_enabled().store(enabled, std::memory_order_relaxed);
+	}
+
+	/// Is access tracking both compiled in and turned on?
+	inline bool access_tracking()
+	{
+		return CONFIGURU_ACCESS_TRACKING && access_tracking_enabled().load(std::memory_order_relaxed);
+	}
+
+	/// Records if a key has been accessed.
+	/// Lookups may come from many threads at once, so this is a relaxed atomic,
+	/// and it is only written the first time, so repeated reads do not dirty the cache line.
+	class AccessFlag
+	{
+	public:
+	#if CONFIGURU_ACCESS_TRACKING
+		AccessFlag() {}
+		AccessFlag(const AccessFlag& o) : _accessed(o.get()) {}
+		AccessFlag& operator=(const AccessFlag& o) { set(o.get()); return *this; }
+
+		bool get() const { return _accessed.load(std::memory_order_relaxed); }
+		void set(bool v) const { _accessed.store(v, std::memory_order_relaxed); }
+
+		/// Called on lookup.
+		void mark() const
+		{
+			if (access_tracking_enabled().load(std::memory_order_relaxed) && !get()) {
+				set(true);
+			}
+		}
+
+	private:
+		mutable std::atomic<bool> _accessed { false };
+	#else
+		bool get() const { return true; }
+		void set(bool) const {}
+		void mark() const {}
+	#endif
+	};
+
 	/// Helper: value in an object.
 	template<typename Config_T>
 	struct Config_Entry
 	{
 		Config_T     _value;
 		Index        _nr       = BAD_INDEX; ///< Size of the object prior to adding this entry
-		mutable bool _accessed = false;     ///< Set to true if accessed.
+		AccessFlag   _accessed;             ///< Set when accessed.
 
 		Config_Entry() {}
 		Config_Entry(Config_T value, Index nr) : _value(std::move(value)), _nr(nr) {}
@@ -177,6 +581,10 @@ namespace configuru
 		Comments postfix; ///< After the value, on the same line. Like this.
 		Comments pre_end_brace; /// Before the closing } or ]
 
+	#if CONFIGURU_VALUE_SEMANTICS && CONFIGURU_DUMP_CACHE
+		LentFlag _lent; ///< Set once handed out by the non-const Config::comments().
+	#endif
+
 		ConfigComments() {}
 
 		bool empty() const;
@@ -186,6 +594,12 @@ namespace configuru
 	/// A dynamic config variable.
 	class Config;
 
+	/// An immutable snapshot of a Config. See Config::freeze().
+	class FrozenConfig;
+
+	/// Worker threads for the parallel versions of some Config operations.
+	class ThreadPool;
+
 	/** Overload this (in cofiguru namespace) for you own types, e.g:
 
 		```
@@ -222,12 +636,84 @@ namespace configuru
 
 		using ConfigArrayImpl = std::vector<Config>;
 		using ConfigObjectImpl = std::map<std::string, ObjectEntry>;
+
+		class ArrayView;
+		class Element;
+		class ElementRef;
+
+		/// How the elements of an array are stored.
+		enum class ArrayPacking
+		{
+			None,   ///< As a std::vector<Config>.
+			Ints,   ///< All elements are integers, stored contiguously as int64_t.
+			Floats, ///< All elements are floats, stored contiguously as double.
+		};
+
+		/// The numbers of a packed array made into Configs, for the const as_array(), which hands out a std::vector.
+		/// Made the first time it is needed and dropped when the array changes.
+		/// Several threads may read the array at once, so it is put in place atomically. A copy starts out empty.
+		class UnpackedCache
+		{
+		public:
+			UnpackedCache() {}
+			UnpackedCache(const UnpackedCache&) {}
+			UnpackedCache& operator=(const UnpackedCache&) { clear(); return *this; }
+			~UnpackedCache() { clear(); }
+
+			const ConfigArrayImpl& get(const Config& array) const
+			{
+				ConfigArrayImpl* elements = _elements.load(std::memory_order_acquire);
+				if (elements == nullptr) {
+					std::unique_ptr<ConfigArrayImpl> made(new ConfigArrayImpl(array.unpacked_elements()));
+					if (_elements.compare_exchange_strong(elements, made.get(), std::memory_order_acq_rel)) {
+						elements = made.release();
+					} // else another thread beat us to it, and elements is what it made.
+				}
+				return *elements;
+			}
+
+			/// Hands over what was made, if anything.
+			std::unique_ptr<ConfigArrayImpl> release()
+			{
+				return std::unique_ptr<ConfigArrayImpl>(_elements.exchange(nullptr, std::memory_order_acq_rel));
+			}
+
+			void clear() { delete _elements.exchange(nullptr, std::memory_order_acq_rel); }
+
+		private:
+			mutable std::atomic<ConfigArrayImpl*> _elements { nullptr };
+		};
+
+		/// A packed array is turned into a normal one when it is accessed with the non-const as_array(),
+		/// or when something else than a number of the packed type is put in it.
+		/// Reading it, and writing numbers of the packed type to it through operator[], leaves it packed
+		/// (see elements(), Element and ElementRef).
+		/// Packed numbers has no comments, and their where() is that of the array.
 		struct ConfigArray
 		{
-			#if !CONFIGURU_VALUE_SEMANTICS
-				std::atomic<unsigned> _ref_count { 1 };
+			#if !CONFIGURU_VALUE_SEMANTICS || CONFIGURU_COPY_ON_WRITE
+				RefCount _ref_count;
+			#endif
+			#if CONFIGURU_VALUE_SEMANTICS && CONFIGURU_COPY_ON_WRITE
+				LentFlag _lent;
 			#endif
-			ConfigArrayImpl _impl;
+			#if CONFIGURU_CONTENT_CACHE
+				ContentCache _cache;
+			#endif
+			ConfigArrayImpl      _impl;                        ///< Used iff _packing == None.
+			ArrayPacking         _packing = ArrayPacking::None;
+			std::vector<int64_t> _ints;                        ///< Used iff _packing == Ints.
+			std::vector<double>  _floats;                      ///< Used iff _packing == Floats.
+			UnpackedCache        _unpacked;                    ///< Only ever made when _packing != None.
+
+			size_t size() const
+			{
+				switch (_packing) {
+					case ArrayPacking::Ints:   return _ints.size();
+					case ArrayPacking::Floats: return _floats.size();
+					default:                   return _impl.size();
+				}
+			}
 		};
 		struct ConfigObject;
 
@@ -277,15 +763,12 @@ namespace configuru
 		*/
 		Config(std::initializer_list<std::pair<std::string, Config>> values);
 
-		/// Array constructor
+		/// Array constructor. Vectors of numbers result in a packed array.
 		template<typename T>
 		Config(const std::vector<T>& values) : _type(Uninitialized)
 		{
 			make_array();
-			_u.array->_impl.reserve(values.size());
-			for (const auto& v : values) {
-				push_back(v);
-			}
+			fill_array(values, PackingOf<T>());
 		}
 
 		/// Array constructor
@@ -304,7 +787,7 @@ namespace configuru
 		{
 			make_object();
 			for (const auto& p : values) {
-				(*this)[p.first] = p.second;
+				insert_or_assign(p.first, Config(p.second));
 			}
 		}
 
@@ -314,6 +797,10 @@ namespace configuru
 		/// Used by the parser - no need to use directly.
 		void make_array();
 
+		/// Used by the parser - no need to use directly.
+		/// Like make_array, but numbers pushed to it are packed until something else is pushed.
+		void make_packed_array();
+
 		/// Used by the parser - no need to use directly.
 		void tag(const DocInfo_SP& doc, Index line, Index column);
 
@@ -330,16 +817,14 @@ namespace configuru
 		static Config array(std::initializer_list<Config> values);
 
 		/// Preferred way to create an array from an STL container.
+		/// Containers of integers or floats result in a packed array (see as_int_span/as_float_span).
 		template<typename Container>
 		static Config array(const Container& container)
 		{
+			using Value = typename std::decay<decltype(*std::begin(container))>::type;
 			Config ret;
 			ret.make_array();
-			auto& impl = ret._u.array->_impl;
-			impl.reserve(container.size());
-			for (auto&& v : container) {
-				impl.emplace_back(v);
-			}
+			ret.fill_array(container, PackingOf<Value>());
 			return ret;
 		}
 
@@ -354,6 +839,10 @@ namespace configuru
 		/// Will still remember file/line when assigned an object which has no file/line
 		Config& operator=(Config&& o) noexcept;
 
+		/// `Config c = std::move(cfg[ix]);` moves the element out of the array (see ElementRef).
+		Config(ElementRef&& o);
+		Config& operator=(ElementRef&& o);
+
 		/// Swaps file/line too.
 		void swap(Config& o) noexcept;
 
@@ -384,7 +873,7 @@ namespace configuru
 
 		/// Handle to document.
 		const DocInfo_SP& doc() const { return _doc; }
-		void set_doc(const DocInfo_SP& doc) { _doc = doc; }
+		void set_doc(const DocInfo_SP& doc) { note_change(); _doc = doc; }
 
 		// ----------------------------------------
 		// Convertors:
@@ -408,41 +897,20 @@ namespace configuru
 		inline operator float()                   const { return as_float();  }
 		inline operator double()                  const { return as_double(); }
 		inline operator std::string()             const { return as_string(); }
-		inline operator Config::ConfigArrayImpl() const { return as_array();  }
+		inline operator Config::ConfigArrayImpl() const;
 
 		/// Convenience conversion to std::vector
 		template<typename T>
-		operator std::vector<T>() const
-		{
-			const auto& array = as_array();
-			std::vector<T> ret;
-			ret.reserve(array.size());
-			for (auto&& config : array) {
-				ret.push_back((T)config);
-			}
-			return ret;
-		}
+		operator std::vector<T>() const;
 
 		/// Convenience conversion to std::array
 		template<typename T, size_t N>
-		operator std::array<T, N>() const
-		{
-			const auto& array = as_array();
-			check(array.size() == N, "Array size mismatch.");
-			std::array<T, N> ret;
-			std::copy(array.begin(), array.end(), ret.begin());
-			return ret;
-		}
+		operator std::array<T, N>() const;
 
 		/// Convenience conversion of an array of length 2 to an std::pair.
 		/// TODO: generalize for tuples.
 		template<typename Left, typename Right>
-		operator std::pair<Left, Right>() const
-		{
-			const auto& array = as_array();
-			check(array.size() == 2u, "Mismatched array length.");
-			return {(Left)array[0], (Right)array[1]};
-		}
+		operator std::pair<Left, Right>() const;
 #else
 		/// Explicit casting, since C++ handles implicit casts real badly.
 		template<typename T>
@@ -450,39 +918,16 @@ namespace configuru
 
 		/// Convenience conversion to std::vector
 		template<typename T>
-		explicit operator std::vector<T>() const
-		{
-			const auto& array = as_array();
-			std::vector<T> ret;
-			ret.reserve(array.size());
-			for (auto&& config : array) {
-				ret.push_back(static_cast<T>(config));
-			}
-			return ret;
-		}
+		explicit operator std::vector<T>() const;
 
 		/// Convenience conversion to std::array
 		template<typename T, size_t N>
-		explicit operator std::array<T, N>() const
-		{
-			const auto& array = as_array();
-			check(array.size() == N, "Array size mismatch.");
-			std::array<T, N> ret;
-			for (size_t i =0; i < N; ++i) {
-				ret[i] = static_cast<T>(array[i]);
-			}
-			return ret;
-		}
+		explicit operator std::array<T, N>() const;
 
 		/// Convenience conversion of an array of length 2 to an std::pair.
 		/// TODO: generalize for tuples.
 		template<typename Left, typename Right>
-		explicit operator std::pair<Left, Right>() const
-		{
-			const auto& array = as_array();
-			check(array.size() == 2u, "Mismatched array length.");
-			return {static_cast<Left>(array[0]), static_cast<Right>(array[1])};
-		}
+		explicit operator std::pair<Left, Right>() const;
 #endif
 
 		const std::string& as_string() const { assert_type(String); return *_u.str; }
@@ -545,45 +990,73 @@ namespace configuru
 		/// Length of an array
 		size_t array_size() const
 		{
-			return as_array().size();
+			assert_type(Array);
+			return _u.array->size();
 		}
 
-		/// Only use this for iterating over an array: `for (Config& e : cfg.as_array()) { ... }`
-		ConfigArrayImpl& as_array()
+		/// How the elements of this array are stored.
+		ArrayPacking array_packing() const
 		{
 			assert_type(Array);
-			return _u.array->_impl;
+			return _u.array->_packing;
 		}
 
+		/// Zero-copy access to a packed array of integers. Calls on_error on any other non-empty array.
+		Span<int64_t> as_int_span() const;
+
+		/// Zero-copy access to a packed array of floats. Calls on_error on any other non-empty array.
+		Span<double> as_float_span() const;
+
 		/// Only use this for iterating over an array: `for (Config& e : cfg.as_array()) { ... }`
-		const ConfigArrayImpl& as_array() const
+		/// This unpacks a packed array. Values could then be added or removed through the vector without us
+		/// knowing, so with CONFIGURU_HASH_CACHE or CONFIGURU_DUMP_CACHE the array stops remembering its hash
+		/// and output (see ContentCache).
+		/// operator[], push_back(), insert() and erase() do not do that.
+		ConfigArrayImpl& as_array()
 		{
-			assert_type(Array);
-			return _u.array->_impl;
+			auto& array = array_for_mutation();
+			lend_array();
+			return array;
 		}
 
-		/// Array indexing
-		Config& operator[](size_t ix)
-		{
-			auto&& array = as_array();
-			check(ix < array.size(), "Array index out of range");
-			return array[ix];
-		}
+		/// Only use this for iterating over an array: `for (const Config& e : cfg.as_array()) { ... }`
+		/// A packed array stays packed, but the first call makes a Config of each of its numbers
+		/// and keeps them until the array changes. Use elements() to read it without doing that.
+		const ConfigArrayImpl& as_array() const;
 
-		/// Array indexing
-		const Config& operator[](size_t ix) const
-		{
-			auto&& array = as_array();
-			check(ix < array.size(), "Array index out of range");
-			return array[ix];
-		}
+		/// Iterate over the elements of any array without making Configs of the numbers of a packed array:
+		/// `for (const Config& e : cfg.elements()) { ... }` (see ArrayView).
+		ArrayView elements() const;
+
+		/// Array indexing. Acts like a `Config&` to the element, and gives one with `cfg[ix].ref()` (see ElementRef).
+		/// Writing a number of the packed type to an element of a packed array leaves it packed.
+		ElementRef operator[](size_t ix);
+
+		/// Array indexing. Acts like a `const Config&` to the element, without making a Config of each number
+		/// of a packed array (see Element).
+		const Element operator[](size_t ix) const;
+
+		/// Element `ix` of a packed array, by value. Calls on_error on an array which is not packed.
+		Config get_packed(size_t ix) const;
 
 		/// Append a value to this array.
 		void push_back(Config value)
 		{
-			as_array().push_back(std::move(value));
+			assert_type(Array);
+			before_mutation();
+			if (_u.array->_packing == ArrayPacking::None || !push_back_packed(value)) {
+				auto& array = array_for_mutation();
+				array.push_back(std::move(value));
+				adopt(array.back());
+			}
 		}
 
+		/// Insert a value before element `ix` of this array, or at the end if `ix == array_size()`.
+		void insert(size_t ix, Config value);
+
+		/// Remove element `ix` of this array.
+		void erase(size_t ix);
+
 		// ----------------------------------------
 		// Object:
 
@@ -595,6 +1068,8 @@ namespace configuru
 		ConfigObject& as_object()
 		{
 			assert_type(Object);
+			before_lending();
+			lend_values();
 			return *_u.object;
 		}
 
@@ -628,7 +1103,7 @@ namespace configuru
 		bool emplace(std::string key, Config value);
 
 		/// Like `foo[key] = value`, but faster.
-		void insert_or_assign(const std::string& key, Config&& value);
+		void insert_or_assign(const std::string& key, Config value);
 
 		/// Erase a key from an object.
 		bool erase(const std::string& key);
@@ -665,11 +1140,35 @@ namespace configuru
 		/// Compare Config values recursively.
 		static bool deep_eq(const Config& a, const Config& b);
 
+		/// Like deep_eq, but compares big arrays and objects near the root on several threads.
+		static bool deep_eq(const Config& a, const Config& b, ThreadPool& pool);
+
+		/// A hash of the value, so that equal (deep_eq) values have equal hashes.
+		/// Comments, file and line does not affect it.
+		/// Recursive, but remembered for arrays and objects with CONFIGURU_HASH_CACHE.
+		size_t hash() const;
+
+		/// The remembered hash of an array or object (see CONFIGURU_HASH_CACHE), or 0 if there is none.
+		/// Never computes anything.
+		size_t cached_hash() const;
+
+		/// Are these the same array or object, e.g. a shallow or copy-on-write copy of each other?
+		/// Never compares anything.
+		bool shares_contents(const Config& other) const;
+
+		/// Create an immutable snapshot of this Config which many threads can read at once.
+		/// Reading a FrozenConfig does not mark anything as accessed.
+		FrozenConfig freeze() const;
+
 #if !CONFIGURU_VALUE_SEMANTICS // No need for a deep_clone method when all copies are deep clones.
 		/// Copy this Config value recursively.
 		Config deep_clone() const;
 #endif
 
+		/// Copy this Config value recursively, with the arrays and objects near the root copied on several threads.
+		/// With CONFIGURU_VALUE_SEMANTICS this is the same as a copy, but faster.
+		Config deep_clone(ThreadPool& pool) const;
+
 		// ----------------------------------------
 
 		/// Visit dangling (unaccessed) object keys recursively.
@@ -681,6 +1180,17 @@ namespace configuru
 		/// Set the 'access' flag recursively,
 		void mark_accessed(bool v) const;
 
+		/// Like visit_dangling, but searches big configs on several threads.
+		/// The visitor and CONFIGURU_ON_DANGLING are then called on this thread, in the same order and
+		/// with the same arguments as without the pool.
+		void visit_dangling(const std::function<void(const std::string& key, const Config& value)>& visitor, ThreadPool& pool) const;
+
+		/// Like check_dangling, but searches big configs on several threads. Reports the same as check_dangling().
+		void check_dangling(ThreadPool& pool) const;
+
+		/// Like mark_accessed, but big configs are marked on several threads.
+		void mark_accessed(bool v, ThreadPool& pool) const;
+
 		// ----------------------------------------
 
 		/// Was there any comments about this value in the input?
@@ -690,12 +1200,16 @@ namespace configuru
 		}
 
 		/// Read/write of comments.
+		/// With CONFIGURU_DUMP_CACHE, the arrays and objects around us no longer remember what they were written as
+		/// (see FormatOptions::cache_output), since the comments could be changed through the reference at any time.
 		ConfigComments& comments()
 		{
-			if (!_comments) {
-				_comments.reset(new ConfigComments());
-			}
-			return *_comments;
+			note_change();
+		#if CONFIGURU_VALUE_SEMANTICS && CONFIGURU_DUMP_CACHE
+			if (const ContentCache* cache = content_cache()) { cache->forget_dump(); }
+			parsed_comments()._lent.set();
+		#endif
+			return parsed_comments();
 		}
 
 		/// Read comments.
@@ -730,32 +1244,224 @@ namespace configuru
 		void on_error(const std::string& msg) const CONFIGURU_NORETURN;
 
 	private:
+		friend class ConfigReclaimer;
+		friend class FrozenValue;
+		friend class PersistentConfig;
+		friend struct Writer;
+		friend struct Parser;
+		friend struct ParseCacheNotes;
+
+		/// Frees our contents. Nested arrays and objects are freed with a worklist rather than
+		/// by recursion, so freeing a very deep tree will not overflow the stack.
 		void free();
 
-		using ConfigComments_UP = std::unique_ptr<ConfigComments>;
+		/// Frees this node only, dropping our reference to the contents.
+		void free_node();
 
-		union {
-			bool               b;
-			int64_t            i;
-			double             f;
-			const std::string* str;
-			ConfigObject*      object;
-			ConfigArray*       array;
-			BadLookupInfo*     bad_lookup;
-		} _u;
+		/// True if we are an array or object and nobody else refers to our contents.
+		bool owns_contents() const;
 
-		DocInfo_SP        _doc; // So we can name the file
-		ConfigComments_UP _comments;
-		Index             _line = BAD_INDEX; // Where in the source, or BAD_INDEX. Lines are 1-indexed.
-		Type              _type = Uninitialized;
+		/// Moves out all children which own their contents (see owns_contents) to the back of `pending`.
+		void move_nested_into(std::vector<Config>& pending);
+
+		/// Removes our last element or key. If that owns its contents it is moved to `pending`,
+		/// otherwise it is freed. Returns false if we had nothing left to remove.
+		bool release_last_child(std::vector<Config>& pending);
+
+		/// Called before the contents of an array or object are changed.
+		/// With CONFIGURU_COPY_ON_WRITE this gives us our own copy of shared contents,
+		/// and with CONFIGURU_HASH_CACHE and CONFIGURU_DUMP_CACHE it forgets the remembered hash and output.
+		inline void before_mutation();
+
+		/// Called before we are changed or replaced. Tells the arrays and objects above us, if we have been lent
+		/// (see ChangeLink).
+		inline void note_change();
+
+		/// Called before a non-const reference to one of our values is handed out. With CONFIGURU_COPY_ON_WRITE
+		/// this gives us our own copy of shared contents, like before_mutation, but what we remember stays good.
+		inline void before_lending();
+
+		/// Called when a non-const reference to `value`, one of our values, is handed out (see LentFlag and ChangeLink).
+		inline void lend_value(Config& value);
+
+		/// lend_value for each value of an object.
+		inline void lend_values();
+
+		/// Called when the non-const as_array() hands out our std::vector (see ContentCache).
+		inline void lend_array();
+
+		/// Called when `value` has been put in us by one of our own methods.
+		inline void adopt(Config& value);
+
+		/// Called when our contents have been swapped with those of another Config: the ChangeLink of an array
+		/// or object we now hold is pointed to the container we are in, if we have been lent.
+		inline void relink();
+
+		/// Like swap, but tells nobody. For taking apart values that are being freed.
+		void swap_values(Config& o) noexcept;
+
+		/// Like the non-const comments(), for the parser, which keeps no references to them.
+		ConfigComments& parsed_comments()
+		{
+			if (!_comments) {
+				_comments.reset(new ConfigComments());
+			}
+			return *_comments;
+		}
+
+	#if CONFIGURU_CONTENT_CACHE
+		/// What our array or object remembers, or nullptr.
+		inline ContentCache* content_cache() const;
+	#endif
+
+		/// The elements of an array for visit_configs, which are lent one by one rather than
+		/// handing out the vector (see as_array).
+		ConfigArrayImpl& lent_elements();
+		friend ConfigArrayImpl& visited_elements(Config& array);
+
+		/// Like hash(), but sets `remembered` to false if this or a value in it could not remember its hash.
+		size_t hash_tree(bool& remembered) const;
+
+		/// The element `ix` of this array, for a non-const reference to it. This unpacks a packed array.
+		Config& lent_element(size_t ix);
+
+		/// Is this a packed array which can hold `value` as it is?
+		bool packs(const Config& value) const;
+
+		/// Writes `value` to element `ix` of a packed array, if it is a number of the packed type.
+		bool set_packed(size_t ix, const Config& value);
+
+		/// Like the non-const as_array, but for changes made here which hand out no references.
+		ConfigArrayImpl& array_for_mutation()
+		{
+			assert_type(Array);
+			before_mutation();
+			if (_u.array->_packing != ArrayPacking::None) { unpack_array(); }
+			return _u.array->_impl;
+		}
+
+		/// Like the non-const as_object, but for changes made here which hand out no references.
+		ConfigObjectImpl& object_for_mutation();
+
+		void detach();
+
+		/// With CONFIGURU_COPY_ON_WRITE: may a copy of this array or object share its contents?
+		/// Not if it has lent out a reference (see LentFlag), nor if the copy would then
+		/// share which keys have been accessed.
+		bool can_share_contents() const;
+
+		static Config clone_tree(const Config& src, ThreadPool* pool, unsigned depth);
+		static bool deep_eq_tree(const Config& a, const Config& b, ThreadPool* pool, unsigned depth);
+
+		/// A dangling key to visit, or (if key is null) a message for CONFIGURU_ON_DANGLING.
+		struct DanglingEvent
+		{
+			const std::string* key;
+			const Config*      value;
+			std::string        message;
+		};
+		using DanglingEvents = std::vector<DanglingEvent>;
+		static std::string dangling_key_line(const std::string& key, const Config& value);
+		static void collect_dangling(const Config& config, DanglingEvents& out, ThreadPool& pool, unsigned depth);
+		static void collect_nested_dangling(const Config& config, DanglingEvents& out, ThreadPool& pool, unsigned depth);
+		static void mark_accessed_tree(const Config& config, bool v, ThreadPool& pool, unsigned depth);
+
+		template<typename T>
+		using PackingOf = std::integral_constant<ArrayPacking,
+			std::is_same<T, bool>::value     ? ArrayPacking::None   :
+			std::is_integral<T>::value       ? ArrayPacking::Ints   :
+			std::is_floating_point<T>::value ? ArrayPacking::Floats :
+			                                   ArrayPacking::None>;
+
+		template<typename Container>
+		void fill_array(const Container& container, std::integral_constant<ArrayPacking, ArrayPacking::None>)
+		{
+			auto& impl = _u.array->_impl;
+			impl.reserve(container.size());
+			for (auto&& v : container) {
+				impl.emplace_back(v);
+			}
+		}
+
+		template<typename Container>
+		void fill_array(const Container& container, std::integral_constant<ArrayPacking, ArrayPacking::Ints>)
+		{
+			auto& ints = _u.array->_ints;
+			_u.array->_packing = ArrayPacking::Ints;
+			ints.reserve(container.size());
+			for (auto&& v : container) {
+				ints.push_back(Config(v)._u.i); // Range-checked by the constructor.
+			}
+		}
+
+		template<typename Container>
+		void fill_array(const Container& container, std::integral_constant<ArrayPacking, ArrayPacking::Floats>)
+		{
+			auto& floats = _u.array->_floats;
+			_u.array->_packing = ArrayPacking::Floats;
+			floats.reserve(container.size());
+			for (auto&& v : container) {
+				floats.push_back(static_cast<double>(v));
+			}
+		}
+
+		/// Converts each packed number with the same rules as a single Config.
+		template<typename T>
+		void append_packed(std::vector<T>& out) const
+		{
+			const auto& array = *_u.array;
+			if (array._packing == ArrayPacking::Ints) {
+				for (const auto i : array._ints) {
+					out.push_back(static_cast<T>(Config(i)));
+				}
+			} else {
+				for (const auto f : array._floats) {
+					out.push_back(static_cast<T>(Config(f)));
+				}
+			}
+		}
+
+		/// Returns false if the value cannot be added without unpacking the array.
+		bool push_back_packed(const Config& value);
+
+		void unpack_array();
+
+		/// The numbers of a packed array as Configs.
+		ConfigArrayImpl unpacked_elements() const;
+
+		using ConfigComments_UP = std::unique_ptr<ConfigComments>;
+
+		union {
+			bool               b;
+			int64_t            i;
+			double             f;
+			const std::string* str;
+			ConfigObject*      object;
+			ConfigArray*       array;
+			BadLookupInfo*     bad_lookup;
+		} _u;
+
+		DocInfo_SP        _doc; // So we can name the file
+		ConfigComments_UP _comments;
+		Index             _line = BAD_INDEX; // Where in the source, or BAD_INDEX. Lines are 1-indexed.
+		Type              _type = Uninitialized;
+	#if CONFIGURU_CONTENT_CACHE
+		ChangeLinkPtr     _container_link; // Of the array or object we are in, once it has lent us. Stays with the slot.
+	#endif
 	};
 
 	// ------------------------------------------------------------------------
 
 	struct Config::ConfigObject
 	{
-		#if !CONFIGURU_VALUE_SEMANTICS
-			std::atomic<unsigned> _ref_count { 1 };
+		#if !CONFIGURU_VALUE_SEMANTICS || CONFIGURU_COPY_ON_WRITE
+			RefCount _ref_count;
+		#endif
+		#if CONFIGURU_VALUE_SEMANTICS && CONFIGURU_COPY_ON_WRITE
+			LentFlag _lent;
+		#endif
+		#if CONFIGURU_CONTENT_CACHE
+			ContentCache _cache;
 		#endif
 		ConfigObjectImpl      _impl;
 
@@ -766,7 +1472,7 @@ namespace configuru
 			explicit iterator(ConfigObjectImpl::iterator it) : _it(std::move(it)) {}
 
 			const iterator& operator*() const {
-				_it->second._accessed = true;
+				_it->second._accessed.mark();
 				return *this;
 			}
 
@@ -797,7 +1503,7 @@ namespace configuru
 			explicit const_iterator(ConfigObjectImpl::const_iterator it) : _it(std::move(it)) {}
 
 			const const_iterator& operator*() const {
-				_it->second._accessed = true;
+				_it->second._accessed.mark();
 				return *this;
 			}
 
@@ -829,6 +1535,417 @@ namespace configuru
 		const_iterator cend()   const { return const_iterator{_impl.cend()};   }
 	};
 
+	/// What indexing an array through a const Config gives: a Config which is element `ix` of the array itself
+	/// rather than a copy of it, or which holds the number if the array is packed. So it can be read like a
+	/// `const Config&` to the element, and like one, it must not outlive the array, or be used after it is changed.
+	/// A copy of it owns a copy of the element.
+	class Config::Element : public Config
+	{
+	public:
+		Element(const Config& array, size_t ix) { point_at(array, ix); }
+		Element(const Element& o) : Config(o) {}
+		Element(Element&& o) noexcept : Config(std::move(o)), _view(o._view) {}
+		~Element() { drop_view(); }
+
+		Element& operator=(const Element&) = delete;
+
+	protected:
+		void point_at(const Config& array, size_t ix)
+		{
+			array.check(ix < array.array_size(), "Array index out of range");
+			drop_view();
+			const auto& impl = *array._u.array;
+			switch (impl._packing) {
+				case ArrayPacking::Ints:   _type = Int;   _u.i = impl._ints[ix];   tag(array._doc, array._line, BAD_INDEX); break;
+				case ArrayPacking::Floats: _type = Float; _u.f = impl._floats[ix]; tag(array._doc, array._line, BAD_INDEX); break;
+				default: {
+					const Config& element = impl._impl[ix];
+					_type = element._type;
+					_u    = element._u;
+					_doc  = element._doc;
+					_line = element._line;
+					_comments.reset(element._comments.get());
+					_view = true;
+				}
+			}
+		}
+
+		/// What we refer to belongs to the array.
+		void drop_view()
+		{
+			if (_view) {
+				_comments.release();
+				_type = Uninitialized;
+				_view = false;
+			}
+		}
+
+		bool _view = false;
+	};
+
+	/// What indexing an array through a non-const Config gives. It reads like Element, and changes like a
+	/// `Config&` to the element, which ref() gives. Changing the element through it, other than by
+	/// assigning a number of the packed type to an element of a packed array, unpacks the array first.
+	/// It can't be kept (`auto e = cfg[ix];` does not compile); use `Config& e = cfg[ix].ref();` for that,
+	/// or `Config e = cfg[ix];` for a copy. Moving it moves the element out of the array.
+	class Config::ElementRef : public Element
+	{
+	public:
+		/// The element itself. This unpacks a packed array.
+		Config& ref() const { return _array->lent_element(_ix); }
+
+		ElementRef& operator=(Config value);
+		ElementRef& operator=(const ElementRef& o) { return *this = Config(o); }
+
+		// What a non-const Config can do:
+		using Config::as_array;
+		using Config::as_object;
+		using Config::comments;
+		using Config::operator[];
+		ConfigArrayImpl& as_array()                                   { return ref().as_array();                        }
+		ElementRef       operator[](size_t ix)                        { return ref()[ix];                               }
+		void             push_back(Config value)                      { ref().push_back(std::move(value));             }
+		void             insert(size_t ix, Config value)              { ref().insert(ix, std::move(value));            }
+		void             erase(size_t ix)                             { ref().erase(ix);                                }
+		ConfigObject&    as_object()                                  { return ref().as_object();                       }
+		Config&          operator[](const std::string& key)           { return ref()[key];                              }
+		template<std::size_t N>
+		Config&          operator[](const char (&key)[N])             { return ref()[std::string(key)];                 }
+		bool             emplace(std::string key, Config value)       { return ref().emplace(std::move(key), std::move(value)); }
+		void             insert_or_assign(const std::string& key, Config value) { ref().insert_or_assign(key, std::move(value)); }
+		bool             erase(const std::string& key)                { return ref().erase(key);                        }
+		ConfigComments&  comments()                                   { return ref().comments();                        }
+		void             set_doc(const DocInfo_SP& doc)               { ref().set_doc(doc);                             }
+		void             swap(Config& o) noexcept                     { ref().swap(o);                                  }
+		void             make_object()                                { ref().make_object();                            }
+		void             make_array()                                 { ref().make_array();                             }
+		void             make_packed_array()                          { ref().make_packed_array();                      }
+		void             tag(const DocInfo_SP& doc, Index line, Index column) { ref().tag(doc, line, column);          }
+
+	private:
+		friend class Config;
+
+		ElementRef(Config& array, size_t ix) : Element(array, ix), _array(&array), _ix(ix) {}
+		ElementRef(ElementRef&& o) noexcept : Element(std::move(o)), _array(o._array), _ix(o._ix) {}
+
+		Config* _array;
+		size_t  _ix;
+	};
+
+	inline Config::ElementRef Config::operator[](size_t ix)
+	{
+		assert_type(Array);
+		return ElementRef(*this, ix);
+	}
+
+	inline const Config::Element Config::operator[](size_t ix) const
+	{
+		assert_type(Array);
+		return Element(*this, ix);
+	}
+
+	inline Config::Config(ElementRef&& o) : _type(Uninitialized)
+	{
+		*this = std::move(o);
+	}
+
+	inline Config& Config::operator=(ElementRef&& o)
+	{
+		if (o._view) {
+			return *this = std::move(o.ref());
+		}
+		return *this = static_cast<const Config&>(o);
+	}
+
+	inline Config::ElementRef& Config::ElementRef::operator=(Config value)
+	{
+		if (!_array->set_packed(_ix, value)) {
+			ref() = std::move(value);
+		}
+		point_at(*_array, _ix);
+		return *this;
+	}
+
+	/// The elements of an array, as returned by elements().
+	/// A packed array is read as it is: its numbers are made into a Config one at a time,
+	/// so the reference you get from an iterator is only good until the iterator moves on.
+	class Config::ArrayView
+	{
+	public:
+		class iterator
+		{
+		public:
+			using iterator_category = std::input_iterator_tag;
+			using value_type        = Config;
+			using difference_type   = std::ptrdiff_t;
+			using pointer           = const Config*;
+			using reference         = const Config&;
+
+			iterator(const Config& array, size_t ix) : _array(&array), _ix(ix)
+			{
+				if (array._u.array->_packing != ArrayPacking::None) {
+					_element.tag(array._doc, array._line, BAD_INDEX);
+				}
+			}
+
+			const Config& operator*() const
+			{
+				const auto& array = *_array->_u.array;
+				switch (array._packing) {
+					case ArrayPacking::Ints:   _element._type = Int;   _element._u.i = array._ints[_ix];   return _element;
+					case ArrayPacking::Floats: _element._type = Float; _element._u.f = array._floats[_ix]; return _element;
+					default:                   return array._impl[_ix];
+				}
+			}
+
+			const Config* operator->() const { return &**this; }
+
+			iterator& operator++() { ++_ix; return *this; }
+
+			/// So that a range of the elements can start anywhere, like with std::vector.
+			iterator operator+(size_t n) const { return iterator(*_array, _ix + n); }
+
+			friend bool operator==(const iterator& a, const iterator& b) { return a._ix == b._ix; }
+			friend bool operator!=(const iterator& a, const iterator& b) { return a._ix != b._ix; }
+
+		private:
+			const Config*  _array;
+			size_t         _ix;
+			mutable Config _element; // The current element of a packed array.
+		};
+
+		explicit ArrayView(const Config& array) : _array(&array) {}
+
+		size_t size()  const { return _array->_u.array->size(); }
+		bool   empty() const { return size() == 0;               }
+
+		iterator begin() const { return iterator(*_array, 0);      }
+		iterator end()   const { return iterator(*_array, size()); }
+
+		/// Element `ix`, read as it is.
+		const Element operator[](size_t ix) const { return Element(*_array, ix); }
+
+	private:
+		const Config* _array;
+	};
+
+	inline const Config::ConfigArrayImpl& Config::as_array() const
+	{
+		assert_type(Array);
+		const auto& array = *_u.array;
+		if (array._packing == ArrayPacking::None) {
+			return array._impl;
+		} else {
+			return array._unpacked.get(*this);
+		}
+	}
+
+	inline Config::ArrayView Config::elements() const
+	{
+		assert_type(Array);
+		return ArrayView(*this);
+	}
+
+	inline Config Config::get_packed(size_t ix) const
+	{
+		check(array_packing() != ArrayPacking::None, "Expected a packed array");
+		return elements()[ix];
+	}
+
+#if CONFIGURU_IMPLICIT_CONVERSIONS
+	inline Config::operator Config::ConfigArrayImpl() const
+	{
+		const auto array = elements();
+		return ConfigArrayImpl(array.begin(), array.end());
+	}
+
+	template<typename T>
+	Config::operator std::vector<T>() const
+	{
+		std::vector<T> ret;
+		ret.reserve(array_size());
+		if (array_packing() != ArrayPacking::None) {
+			append_packed(ret);
+		} else {
+			for (auto&& config : as_array()) {
+				ret.push_back((T)config);
+			}
+		}
+		return ret;
+	}
+
+	template<typename T, size_t N>
+	Config::operator std::array<T, N>() const
+	{
+		const auto array = elements();
+		check(array.size() == N, "Array size mismatch.");
+		std::array<T, N> ret;
+		std::copy(array.begin(), array.end(), ret.begin());
+		return ret;
+	}
+
+	template<typename Left, typename Right>
+	Config::operator std::pair<Left, Right>() const
+	{
+		const auto array = elements();
+		check(array.size() == 2u, "Mismatched array length.");
+		auto it = array.begin();
+		Left left = (Left)*it;
+		++it;
+		return {std::move(left), (Right)*it};
+	}
+#else
+	template<typename T>
+	Config::operator std::vector<T>() const
+	{
+		std::vector<T> ret;
+		ret.reserve(array_size());
+		if (array_packing() != ArrayPacking::None) {
+			append_packed(ret);
+		} else {
+			for (auto&& config : as_array()) {
+				ret.push_back(static_cast<T>(config));
+			}
+		}
+		return ret;
+	}
+
+	template<typename T, size_t N>
+	Config::operator std::array<T, N>() const
+	{
+		const auto array = elements();
+		check(array.size() == N, "Array size mismatch.");
+		std::array<T, N> ret;
+		size_t i = 0;
+		for (const Config& element : array) {
+			ret[i++] = static_cast<T>(element);
+		}
+		return ret;
+	}
+
+	template<typename Left, typename Right>
+	Config::operator std::pair<Left, Right>() const
+	{
+		const auto array = elements();
+		check(array.size() == 2u, "Mismatched array length.");
+		auto it = array.begin();
+		Left left = static_cast<Left>(*it);
+		++it;
+		return {std::move(left), static_cast<Right>(*it)};
+	}
+#endif
+
+#if CONFIGURU_CONTENT_CACHE
+	inline ContentCache* Config::content_cache() const
+	{
+		if (_type == Array)  { return &_u.array->_cache;  }
+		if (_type == Object) { return &_u.object->_cache; }
+		return nullptr;
+	}
+#endif
+
+	inline void Config::before_mutation()
+	{
+	#if CONFIGURU_VALUE_SEMANTICS && CONFIGURU_COPY_ON_WRITE
+		if ((_type == Array  && _u.array->_ref_count.is_shared()) ||
+		    (_type == Object && _u.object->_ref_count.is_shared())) {
+			detach();
+		}
+	#endif
+	#if CONFIGURU_CONTENT_CACHE
+		if (ContentCache* cache = content_cache()) {
+			cache->forget();
+			// In case we were put in a container by its own methods, and so were never lent:
+			if (cache->link()) { cache->link()->changed(); }
+		}
+	#endif
+		note_change();
+	}
+
+	inline void Config::note_change()
+	{
+	#if CONFIGURU_CONTENT_CACHE
+		if (_container_link) { _container_link->changed(); }
+	#endif
+	}
+
+	inline void Config::before_lending()
+	{
+	#if CONFIGURU_VALUE_SEMANTICS && CONFIGURU_COPY_ON_WRITE
+		if (_type == Array) {
+			if (_u.array->_ref_count.is_shared()) { detach(); }
+			_u.array->_lent.set();
+		}
+		if (_type == Object) {
+			if (_u.object->_ref_count.is_shared()) { detach(); }
+			_u.object->_lent.set();
+		}
+	#endif
+	}
+
+	inline void Config::lend_value(Config& value)
+	{
+	#if CONFIGURU_CONTENT_CACHE
+		const ChangeLinkPtr& link = content_cache()->lend(_container_link);
+		if (value._container_link.get() != link.get()) {
+			value._container_link = link;
+		}
+	#else
+		(void)value;
+	#endif
+	}
+
+	inline void Config::lend_values()
+	{
+	#if CONFIGURU_CONTENT_CACHE
+		for (auto& p : _u.object->_impl) {
+			lend_value(p.second._value);
+		}
+	#endif
+	}
+
+	inline void Config::lend_array()
+	{
+		before_lending();
+	#if CONFIGURU_CONTENT_CACHE
+		_u.array->_cache.lend_all();
+	#endif
+	}
+
+	inline void Config::adopt(Config& value)
+	{
+	#if CONFIGURU_CONTENT_CACHE
+		// A value which has lent something must tell us when that is changed:
+		const ContentCache* value_cache = value.content_cache();
+		if (value_cache && value_cache->link()) {
+			value_cache->link()->set_parent(content_cache()->lend(_container_link));
+		#if CONFIGURU_COPY_ON_WRITE
+			if (_type == Array)  { _u.array->_lent.set();  }
+			if (_type == Object) { _u.object->_lent.set(); }
+		#endif
+		}
+	#else
+		(void)value;
+	#endif
+	}
+
+	inline void Config::relink()
+	{
+	#if CONFIGURU_CONTENT_CACHE
+		const ContentCache* cache = content_cache();
+		if (_container_link && cache && cache->link()) {
+			cache->link()->set_parent(_container_link);
+		}
+	#endif
+	}
+
+	inline Config::ConfigObjectImpl& Config::object_for_mutation()
+	{
+		assert_type(Object);
+		before_mutation();
+		return _u.object->_impl;
+	}
+
 	// ------------------------------------------------------------------------
 
 	inline bool operator==(const Config& a, const Config& b)
@@ -859,6 +1976,7 @@ namespace configuru
 	template<> inline const std::string&             Config::get() const { return as_string(); }
 	template<> inline std::string                    Config::get() const { return as_string(); }
 	template<> inline const Config::ConfigArrayImpl& Config::get() const { return as_array();  }
+	template<> inline Config::ArrayView              Config::get() const { return elements();  }
 	// template<> inline std::vector<std::string>     Config::get() const { return as_vector<T>();   }
 
 	// ------------------------------------------------------------------------
@@ -878,7 +1996,7 @@ namespace configuru
 			return default_value;
 		} else {
 			const auto& entry = it->second;
-			entry._accessed = true;
+			entry._accessed.mark();
 			return as<T>(entry._value);
 		}
 	}
@@ -905,6 +2023,10 @@ namespace configuru
 
 	// ------------------------------------------------------------------------
 
+	/// The elements of an array to visit. A packed array is only unpacked if the visitor may change it.
+	inline Config::ConfigArrayImpl& visited_elements(Config& array)      { return array.lent_elements(); }
+	inline Config::ArrayView        visited_elements(const Config& array) { return array.elements(); }
+
 	/// Recursively visit all values in a config.
 	template<class Config, class Visitor>
 	void visit_configs(Config&& config, Visitor&& visitor)
@@ -915,7 +2037,7 @@ namespace configuru
 				visit_configs(p.value(), visitor);
 			}
 		} else if (config.is_array()) {
-			for (auto&& e : config.as_array()) {
+			for (auto&& e : visited_elements(config)) {
 				visit_configs(e, visitor);
 			}
 		}
@@ -950,2708 +2072,10032 @@ namespace configuru
 	 */
 
 	// ----------------------------------------------------------
+	// Thread pool:
 
-	/// Thrown on a syntax error.
-	class ParseError : public std::exception
+	/// Worker threads which take turns at one shared queue of tasks. It is not work-stealing: the work
+	/// Configuru hands it is split into a few ranges per thread up front, so one queue is contended little.
+	/// A thread waiting for a parallel_for to finish runs other queued tasks meanwhile, and sleeps when there are none.
+	class ThreadPool
 	{
 	public:
-		ParseError(const DocInfo_SP& doc, Index line, Index column, const std::string& msg)
-			: _line(line), _column(column)
-		{
-			_what = doc->filename + ":" + std::to_string(line) + ":" + std::to_string(column);
-			doc->append_include_info(_what);
-			_what += ": " + msg;
-		}
+		/// num_threads == 0 means one thread per hardware thread.
+		explicit ThreadPool(size_t num_threads = 0);
+		~ThreadPool();
 
-		/// Will name the file name, line number, column and description.
-		const char* what() const noexcept override
-		{
-			return _what.c_str();
-		}
+		ThreadPool(const ThreadPool&) = delete;
+		ThreadPool& operator=(const ThreadPool&) = delete;
 
-		Index line()   const noexcept { return _line; }
-		Index column() const noexcept { return _column; }
+		size_t num_threads() const;
+
+		/// Calls fun(i) for every i in [0, count), spread over the workers and the calling thread.
+		/// Returns when all calls are done. If any call throws, the first exception is rethrown here.
+		/// The calling thread works too, so it is fine to call parallel_for from inside fun.
+		void parallel_for(size_t count, const std::function<void(size_t)>& fun);
+
+		/// How many ranges parallel_for_ranges splits `count` items into.
+		/// This only depends on count and num_threads(), so the split is deterministic.
+		size_t num_ranges(size_t count) const;
+
+		/// Splits [0, count) into num_ranges(count) consecutive ranges and calls fun(range_index, begin, end)
+		/// for each of them, spread over the threads like parallel_for.
+		void parallel_for_ranges(size_t count, const std::function<void(size_t, size_t, size_t)>& fun);
+
+		/// Used by the parallel traversals to decide if the `count` children of a value `depth` levels
+		/// down the tree should be split over the threads: those in the top few levels, and all big ones.
+		static bool should_split(unsigned depth, size_t count)
+		{
+			return count > 1 && (depth < 3 || count >= 1024);
+		}
 
 	private:
-		Index _line, _column;
-		std::string _what;
+		friend struct ParallelForBatch;
+
+		struct Impl;
+		std::unique_ptr<Impl> _impl;
 	};
 
 	// ----------------------------------------------------------
+	// Parallel traversal:
+
+	/// Like visit_configs, but big arrays and objects, and those near the root,
+	/// have their children visited on several threads.
+	/// A value is always visited before its children, but `visitor` must be safe to call concurrently.
+	/// `depth` is how far down the tree `config` is, and is only used to decide what to split.
+	template<class ConfigT, class Visitor>
+	void parallel_visit_configs(ConfigT& config, const Visitor& visitor, ThreadPool& pool, unsigned depth = 0)
+	{
+		visitor(config);
+		if (config.is_object()) {
+			if (ThreadPool::should_split(depth, config.object_size())) {
+				std::vector<ConfigT*> children;
+				children.reserve(config.object_size());
+				for (auto&& p : config.as_object()) {
+					children.push_back(&p.value());
+				}
+				pool.parallel_for_ranges(children.size(), [&](size_t, size_t begin, size_t end) {
+					for (size_t i = begin; i < end; ++i) {
+						parallel_visit_configs(*children[i], visitor, pool, depth + 1);
+					}
+				});
+			} else {
+				for (auto&& p : config.as_object()) {
+					parallel_visit_configs(p.value(), visitor, pool, depth + 1);
+				}
+			}
+		} else if (config.is_array()) {
+			auto&& array = visited_elements(config);
+			if (ThreadPool::should_split(depth, array.size())) {
+				pool.parallel_for_ranges(array.size(), [&](size_t, size_t begin, size_t end) {
+					auto it = array.begin() + begin;
+					for (size_t i = begin; i < end; ++i, ++it) {
+						parallel_visit_configs(*it, visitor, pool, depth + 1);
+					}
+				});
+			} else {
+				for (auto&& e : array) {
+					parallel_visit_configs(e, visitor, pool, depth + 1);
+				}
+			}
+		}
+	}
 
-	/// This struct basically contain all the way we can tweak the file format.
-	struct FormatOptions
+	/// Calls map(value) on every value in the tree, and combines the results with reduce(a, b).
+	/// The results are combined in the same order as by a single thread visiting parents before children,
+	/// so the result is deterministic as long as reduce is associative, even if it is not commutative
+	/// (e.g. collecting the values into a vector).
+	/// `identity` must not change anything when reduced with (0 for addition, an empty vector for concatenation).
+	/// map must be safe to call concurrently. `depth` is as for parallel_visit_configs.
+	template<class T, class Map, class Reduce>
+	T parallel_reduce(const Config& config, const T& identity, const Map& map, const Reduce& reduce,
+	                  ThreadPool& pool, unsigned depth = 0)
 	{
-		/// Indentation should be a single tab,
-		/// multiple spaces or an empty string.
-		/// An empty string means the output will be compact.
-		std::string indentation              = "\t";
-		bool        enforce_indentation      = true;  ///< Must have correct indentation?
-		bool        end_with_newline         = true;  ///< End each file with a newline (unless compact).
+		T result = reduce(identity, map(config));
+		if (config.is_object()) {
+			if (ThreadPool::should_split(depth, config.object_size())) {
+				std::vector<const Config*> children;
+				children.reserve(config.object_size());
+				for (auto&& p : config.as_object()) {
+					children.push_back(&p.value());
+				}
+				std::vector<T> partial(pool.num_ranges(children.size()), identity);
+				pool.parallel_for_ranges(children.size(), [&](size_t range, size_t begin, size_t end) {
+					for (size_t i = begin; i < end; ++i) {
+						partial[range] = reduce(std::move(partial[range]), parallel_reduce(*children[i], identity, map, reduce, pool, depth + 1));
+					}
+				});
+				for (auto&& p : partial) {
+					result = reduce(std::move(result), std::move(p));
+				}
+			} else {
+				for (auto&& p : config.as_object()) {
+					result = reduce(std::move(result), parallel_reduce(p.value(), identity, map, reduce, pool, depth + 1));
+				}
+			}
+		} else if (config.is_array()) {
+			const auto array = config.elements();
+			if (ThreadPool::should_split(depth, array.size())) {
+				std::vector<T> partial(pool.num_ranges(array.size()), identity);
+				pool.parallel_for_ranges(array.size(), [&](size_t range, size_t begin, size_t end) {
+					auto it = array.begin() + begin;
+					for (size_t i = begin; i < end; ++i, ++it) {
+						partial[range] = reduce(std::move(partial[range]), parallel_reduce(*it, identity, map, reduce, pool, depth + 1));
+					}
+				});
+				for (auto&& p : partial) {
+					result = reduce(std::move(result), std::move(p));
+				}
+			} else {
+				for (auto&& e : array) {
+					result = reduce(std::move(result), parallel_reduce(e, identity, map, reduce, pool, depth + 1));
+				}
+			}
+		}
+		return result;
+	}
 
-		// Top file:
-		bool        empty_file               = false; ///< If true, an empty file is an empty object.
-		bool        implicit_top_object      = true;  ///< Ok with key-value pairs top-level?
-		bool        implicit_top_array       = true;  ///< Ok with several values top-level?
+	// ----------------------------------------------------------
+	// Deferred destruction:
+
+	/// Frees configs you are done with, away from threads which can not afford to wait for it.
+	/// Use it when replacing a big config on a latency-critical thread:
+	///
+	///   std::swap(live_config, new_config);
+	///   reclaimer.retire(std::move(new_config)); // O(1), frees nothing
+	///
+	/// All member functions are thread safe.
+	class ConfigReclaimer
+	{
+	public:
+		/// With background == true a worker thread frees retired configs as soon as it can.
+		/// Otherwise nothing is freed until you call reclaim() or reclaim_all().
+		explicit ConfigReclaimer(bool background = false);
 
-		// Comments:
-		bool        single_line_comments     = true;  ///< Allow this?
-		bool        block_comments           = true;  /* Allow this? */
-		bool        nesting_block_comments   = true;  ///< /* Allow /*    this? */ */
+		/// Frees everything still retired, after stopping the worker thread (if any).
+		~ConfigReclaimer();
 
-		// Numbers:
-		bool        inf                      = true;  ///< Allow +inf, -inf
-		bool        nan                      = true;  ///< Allow +NaN
-		bool        hexadecimal_integers     = true;  ///< Allow 0xff
-		bool        binary_integers          = true;  ///< Allow 0b1010
-		bool        unary_plus               = true;  ///< Allow +42
-		bool        distinct_floats          = true;  ///< Print 9.0 as "9.0", not just "9". A must for round-tripping.
+		ConfigReclaimer(const ConfigReclaimer&) = delete;
+		ConfigReclaimer& operator=(const ConfigReclaimer&) = delete;
 
-		// Arrays
-		bool        array_omit_comma         = true;  ///< Allow [1 2 3]
-		bool        array_trailing_comma     = true;  ///< Allow [1, 2, 3,]
+		/// Hand over a config to be freed later. Does not look at the contents.
+		void retire(Config&& config);
 
-		// Objects:
-		bool        identifiers_keys         = true;  ///< { is_this_ok: true }
-		bool        object_separator_equal   = false; ///< { "is_this_ok" = true }
-		bool        allow_space_before_colon = false; ///< { "is_this_ok" : true }
-		bool        omit_colon_before_object = false; ///< { "nested_object" { } }
-		bool        object_omit_comma        = true;  ///< Allow {a:1 b:2}
-		bool        object_trailing_comma    = true;  ///< Allow {a:1, b:2,}
-		bool        object_duplicate_keys    = false; ///< Allow {"a":1, "a":2}
-		bool        object_align_values      = true;  ///< Add spaces after keys to align subsequent values.
+		/// Free at most about max_nodes values (array elements, object entries, arrays and objects).
+		/// Call this repeatedly to free big configs in bounded time slices.
+		/// Returns true when everything retired so far has been freed.
+		bool reclaim(size_t max_nodes);
 
-		// Strings
-		bool        str_csharp_verbatim      = true;  ///< Allow @"Verbatim\strings"
-		bool        str_python_multiline     = true;  ///< Allow """ Python\nverbatim strings """
-		bool        str_32bit_unicode        = true;  ///< Allow "\U0030dbfd"
-		bool        str_allow_tab            = true;  ///< Allow unescaped tab in string.
+		/// Free everything retired so far.
+		void reclaim_all();
 
-		// Special
-		bool        allow_macro              = true;  ///< Allow `#include "some_other_file.cfg"`
+		/// True if everything retired so far has been freed.
+		bool empty() const;
 
-		// When writing:
-		bool        write_comments           = true;
+	private:
+		struct Impl;
+		std::unique_ptr<Impl> _impl;
+	};
 
-		/// Sort keys lexicographically. If false, sort by order they where added.
-		bool        sort_keys                = false;
+	// ----------------------------------------------------------
+	// Diff and patch:
+
+	/// Returns a JSON Patch (RFC 6902) which turns `from` into `to` when given to apply_patch.
+	/// The patch is an array of operations like `{ "op": "replace", "path": "/a/b/0", "value": 42 }`,
+	/// using only the ops "add", "remove" and "replace". Only the changed keys and elements are in the patch.
+	/// Equal elements at the start and end of an array are skipped, so inserting or removing elements in one
+	/// place gives just those "add" or "remove" ops. What is left in between is compared position by position,
+	/// so this is not always the smallest patch.
+	/// Shared subtrees are skipped without being visited. So are arrays and objects with different remembered
+	/// hashes (see CONFIGURU_HASH_CACHE), while those with equal remembered hashes are compared in full to rule
+	/// out a collision, unless `trust_hashes` is set. Does not mark anything as accessed.
+	Config diff(const Config& from, const Config& to, bool trust_hashes = false);
+
+	/// Apply a JSON Patch (RFC 6902), as created by diff().
+	/// Supports all its ops: "add", "remove", "replace", "move", "copy" and "test".
+	/// Calls CONFIGURU_ONERROR on a malformed patch, or if a path is not found.
+	void apply_patch(Config& config, const Config& patch);
 
-		/// When printing, write uninitialized values as UNINITIALIZED. Useful for debugging.
-		bool        write_uninitialized      = false;
+	// ----------------------------------------------------------
+	// Overlays:
 
-		/// Dumping should mark the json as accessed?
-		bool        mark_accessed            = true;
+	/// A read-only view of several Config layers stacked on top of each other, e.g. defaults, a file and overrides.
+	/// Objects are merged recursively, and any other value in a higher layer replaces what is below it.
+	/// Nothing is copied: lookups and iteration go through the layers as they are now.
+	/// The layers must outlive the OverlayConfig. Lookups mark the keys found as accessed in each layer.
+	class OverlayConfig
+	{
+	public:
+		OverlayConfig() {}
 
-		bool compact() const { return indentation.empty(); }
-	};
+		/// The first layer is the bottom one (e.g. defaults), the last one the top (e.g. overrides).
+		explicit OverlayConfig(const std::vector<const Config*>& layers);
 
-	/// Returns FormatOptions that are describe a JSON file format.
-	inline FormatOptions make_json_options()
-	{
-		FormatOptions options;
+		/// Put a new layer on top of all others.
+		void push_layer(const Config& layer);
 
-		options.indentation              = "\t";
-		options.enforce_indentation      = false;
+		/// Number of layers which contribute to this value.
+		size_t num_layers() const { return _layers.size(); }
 
-		// Top file:
-		options.empty_file               = false;
-		options.implicit_top_object      = false;
-		options.implicit_top_array       = false;
+		/// The value of the top layer.
+		const Config& top() const;
 
-		// Comments:
-		options.single_line_comments     = false;
-		options.block_comments           = false;
-		options.nesting_block_comments   = false;
+		Config::Type type() const { return top().type(); }
 
-		// Numbers:
-		options.inf                      = false;
-		options.nan                      = false;
-		options.hexadecimal_integers     = false;
-		options.binary_integers          = false;
-		options.unary_plus               = false;
-		options.distinct_floats          = true;
+		bool is_object() const { return !_layers.empty() && _layers[0]->is_object(); }
 
-		// Arrays
-		options.array_omit_comma         = false;
-		options.array_trailing_comma     = false;
+		/// Extract the value of the top layer.
+		template<typename T>
+		T get() const { return as<T>(top()); }
 
-		// Objects:
-		options.identifiers_keys         = false;
-		options.object_separator_equal   = false;
-		options.allow_space_before_colon = true;
-		options.omit_colon_before_object = false;
-		options.object_omit_comma        = false;
-		options.object_trailing_comma    = false;
-		options.object_duplicate_keys    = false; // To be 100% JSON compatile, this should be true, but it is error prone.
-		options.object_align_values      = true;  // Looks better.
+		/// Explicit casting, for overloads of as<T>
+		template<typename T>
+		explicit operator T() const { return get<T>(); }
 
-		// Strings
-		options.str_csharp_verbatim      = false;
-		options.str_python_multiline     = false;
-		options.str_32bit_unicode        = false;
-		options.str_allow_tab            = false;
+		bool has_key(const std::string& key) const;
 
-		// Special
-		options.allow_macro              = false;
+		/// Look up a key in all layers. Calls CONFIGURU_ONERROR if no layer has it.
+		OverlayConfig operator[](const std::string& key) const;
 
-		// When writing:
-		options.write_comments           = false;
-		options.sort_keys                = false;
+		/// For indexing with string literals:
+		template<std::size_t N>
+		OverlayConfig operator[](const char (&key)[N]) const { return operator[](std::string(key)); }
 
-		return options;
-	}
+		/// Look for the given key in all layers, and return default_value on failure.
+		template<typename T>
+		T get_or(const std::string& key, const T& default_value) const
+		{
+			return has_key(key) ? (*this)[key].get<T>() : default_value;
+		}
 
-	/// Returns format options that allow us parsing most files.
-	inline FormatOptions make_forgiving_options()
-	{
-		FormatOptions options;
+		/// Look for the given key in all layers, and return default_value on failure.
+		std::string get_or(const std::string& key, const char* default_value) const
+		{
+			return get_or<std::string>(key, default_value);
+		}
 
-		options.indentation              = "\t";
-		options.enforce_indentation      = false;
+		/// Iterates the union of the keys of all layers, in sorted order, merging the layers as it goes.
+		class ObjectIterator
+		{
+		public:
+			using MapIterator = Config::ConfigObjectImpl::const_iterator;
 
-		// Top file:
-		options.empty_file               = true;
-		options.implicit_top_object      = true;
-		options.implicit_top_array       = true;
+			ObjectIterator() {}
+			explicit ObjectIterator(const std::vector<const Config*>& layers);
 
-		// Comments:
-		options.single_line_comments     = true;
-		options.block_comments           = true;
-		options.nesting_block_comments   = true;
+			const ObjectIterator& operator*() const { return *this; }
 
-		// Numbers:
-		options.inf                      = true;
-		options.nan                      = true;
-		options.hexadecimal_integers     = true;
-		options.binary_integers          = true;
-		options.unary_plus               = true;
-		options.distinct_floats          = true;
+			ObjectIterator& operator++();
 
-		// Arrays
-		options.array_omit_comma         = true;
-		options.array_trailing_comma     = true;
+			friend bool operator==(const ObjectIterator& a, const ObjectIterator& b) { return a._key == b._key; }
+			friend bool operator!=(const ObjectIterator& a, const ObjectIterator& b) { return a._key != b._key; }
 
-		// Objects:
-		options.identifiers_keys         = true;
-		options.object_separator_equal   = true;
-		options.allow_space_before_colon = true;
-		options.omit_colon_before_object = true;
-		options.object_omit_comma        = true;
-		options.object_trailing_comma    = true;
-		options.object_duplicate_keys    = true;
+			const std::string& key() const { return *_key; }
+			OverlayConfig      value() const;
 
-		// Strings
-		options.str_csharp_verbatim      = true;
-		options.str_python_multiline     = true;
-		options.str_32bit_unicode        = true;
-		options.str_allow_tab            = true;
+		private:
+			void find_next_key();
 
-		// Special
-		options.allow_macro              = true;
+			std::vector<std::pair<MapIterator, MapIterator>> _cursors; ///< Per layer, top first.
+			const std::string* _key = nullptr; ///< nullptr at end.
+		};
 
-		// When writing:
-		options.write_comments           = false;
-		options.sort_keys                = false;
+		struct ObjectRange
+		{
+			ObjectIterator _begin, _end;
+			ObjectIterator begin() const { return _begin; }
+			ObjectIterator end()   const { return _end;   }
+		};
 
-		return options;
-	}
+		/// For iterating: `for (auto&& p : overlay.as_object()) { std::cout << p.key() << ": " << p.value().top(); }`
+		ObjectRange as_object() const;
 
-	/// The CFG file format.
-	static const FormatOptions CFG       = FormatOptions();
+		/// Merge all layers into one new Config.
+		/// Keys keep the order of the lowest layer they are in, and keys new in higher layers come after.
+		Config flatten() const;
 
-	/// The JSON file format.
-	static const FormatOptions JSON      = make_json_options();
+	private:
+		/// Drop the layers hidden by a non-object above them.
+		void normalize();
 
-	/// A very forgiving file format, when parsing stuff that is not strict.
-	static const FormatOptions FORGIVING = make_forgiving_options();
+		std::vector<const Config*> _layers; ///< Top first.
+	};
 
-	struct ParseInfo
+	// ----------------------------------------------------------
+	// Frozen configs:
+
+	/// A value in a FrozenConfig. The children of an array or object are stored contiguously.
+	struct FrozenNode
 	{
-		std::map<std::string, Config> parsed_files; // Two #include gives same Config tree.
+		uint8_t  type;     ///< A Config::Type.
+		uint8_t  packing;  ///< A Config::ArrayPacking, for arrays.
+		uint16_t reserved;
+		uint32_t size;     ///< Number of children, or length of string.
+
+		union
+		{
+			bool     b;
+			int64_t  i;
+			double   f;
+			uint64_t offset; ///< String: into FrozenTables::strings. Packed array: into ints/floats.
+			struct
+			{
+				uint32_t first;     ///< Index of the first child.
+				uint32_t first_key; ///< Index of the key of the first child, for objects.
+			} children;
+		} u;
 	};
 
-	/// The parser may throw ParseError.
-	/// `str` should be a zero-ended Utf-8 encoded string of characters.
-	/// The `name` should be something akin to a filename. It is only for error reporting.
-	Config parse_string(const char* str, const FormatOptions& options, const char* name);
-	Config parse_file(const std::string& path, const FormatOptions& options);
+	/// The key of an object entry in a FrozenConfig. The keys of each object are sorted.
+	struct FrozenKey
+	{
+		uint64_t offset; ///< Into FrozenTables::strings.
+		uint32_t size;
+		uint32_t nr;     ///< Insertion order, like Config_Entry::_nr.
+	};
 
-	/// Advanced usage:
-	Config parse_string(const char* str, const FormatOptions& options, DocInfo _doc, ParseInfo& info);
-	Config parse_file(const std::string& path, const FormatOptions& options, DocInfo_SP doc, ParseInfo& info);
+	/// All the data of a FrozenConfig. nodes[0] is the root.
+	/// All strings in `strings` are zero-terminated.
+	struct FrozenTables
+	{
+		const FrozenNode* nodes        = nullptr;
+		const FrozenKey*  keys         = nullptr;
+		const int64_t*    ints         = nullptr;
+		const double*     floats       = nullptr;
+		const char*       strings      = nullptr;
+		size_t            num_nodes    = 0;
+		size_t            num_keys     = 0;
+		size_t            num_ints     = 0;
+		size_t            num_floats   = 0;
+		size_t            strings_size = 0;
+	};
 
-	// ----------------------------------------------------------
-	/// Writes the config as a string in the given format.
-	/// May call CONFIGURU_ONERROR if the given config is invalid. This can happen if
-	/// a Config is unitialized (and options write_uninitialized is not set) or
-	/// a Config contains inf/nan (and options.inf/options.nan aren't set).
-	std::string dump_string(const Config& config, const FormatOptions& options);
+	class FrozenValue;
 
-	/// Writes the config to a file. Like dump_string, but can may also call CONFIGURU_ONERROR
-	/// if it fails to write to the given path.
-	void dump_file(const std::string& path, const Config& config, const FormatOptions& options);
+	/// Iterates the elements of a frozen array.
+	class FrozenArrayIterator
+	{
+	public:
+		FrozenArrayIterator(const FrozenTables* tables, const FrozenNode& array, size_t ix)
+			: _tables(tables), _array(array), _ix(ix) {}
 
-	// ----------------------------------------------------------
-	// Automatic (de)serialize of most things.
-	// Include <visit_struct/visit_struct.hpp> (from https://github.com/cbeck88/visit_struct)
-	// before including <configuru.hpp> to get this feature.
+		FrozenValue operator*() const;
 
-	#ifdef VISITABLE_STRUCT
-		template <typename Type> struct is_container : std::false_type { };
-		// template <typename... Ts> struct is_container<std::list<Ts...> > : std::true_type { };
-		template <typename... Ts> struct is_container<std::vector<Ts...> > : std::true_type { };
+		FrozenArrayIterator& operator++() { ++_ix; return *this; }
 
-		template <typename Type> struct is_map : std::false_type { };
-		template <typename... Ts> struct is_map<std::map<Ts...> > : std::true_type { };
-		template <typename... Ts> struct is_map<std::unordered_map<Ts...> > : std::true_type { };
+		friend bool operator==(const FrozenArrayIterator& a, const FrozenArrayIterator& b) { return a._ix == b._ix; }
+		friend bool operator!=(const FrozenArrayIterator& a, const FrozenArrayIterator& b) { return a._ix != b._ix; }
 
-		// ----------------------------------------------------------------------------
+	private:
+		const FrozenTables* _tables;
+		FrozenNode          _array;
+		size_t              _ix;
+	};
 
-		Config serialize(const std::string& some_string);
+	/// Iterates the entries of a frozen object, in key order.
+	/// Like Config::ConfigObject::const_iterator, the entry is the iterator itself.
+	class FrozenObjectIterator
+	{
+	public:
+		FrozenObjectIterator(const FrozenTables* tables, const FrozenNode& object, size_t ix)
+			: _tables(tables), _object(object), _ix(ix) {}
 
-		template<typename T>
-		typename std::enable_if<std::is_arithmetic<T>::value, Config>::type
-		serialize(const T& some_value);
+		const FrozenObjectIterator& operator*() const { return *this; }
 
-		template<typename T>
-		typename std::enable_if<std::is_enum<T>::value, Config>::type
-		serialize(const T& some_enum);
+		FrozenObjectIterator& operator++() { ++_ix; return *this; }
 
-		template<typename T, size_t N>
-		Config serialize(T (&some_array)[N]);
+		friend bool operator==(const FrozenObjectIterator& a, const FrozenObjectIterator& b) { return a._ix == b._ix; }
+		friend bool operator!=(const FrozenObjectIterator& a, const FrozenObjectIterator& b) { return a._ix != b._ix; }
 
-		template<typename T>
-		typename std::enable_if<is_container<T>::value, Config>::type
-		serialize(const T& some_container);
+		const char* key()   const;
+		FrozenValue value() const;
 
-		template<typename T>
-		typename std::enable_if<is_map<T>::value, Config>::type
-		serialize(const T& some_map);
+	private:
+		const FrozenTables* _tables;
+		FrozenNode          _object;
+		size_t              _ix;
+	};
 
-		template<typename T>
-		typename std::enable_if<visit_struct::traits::is_visitable<T>::value, Config>::type
-		serialize(const T& some_struct);
+	template<typename Iterator>
+	struct FrozenRange
+	{
+		Iterator _begin, _end;
+		Iterator begin() const { return _begin; }
+		Iterator end()   const { return _end;   }
+	};
 
-		// ----------------------------------------------------------------------------
+	/// A read-only handle to a value in a FrozenConfig. Cheap to copy.
+	/// Reading it never writes to memory, so any number of threads may read at once.
+	/// Only valid for as long as the FrozenConfig it came from is alive.
+	class FrozenValue
+	{
+	public:
+		FrozenValue(const FrozenTables* tables, const FrozenNode& node) : _tables(tables), _node(node) {}
 
-		inline Config serialize(const std::string& some_string)
-		{
-			return Config(some_string);
-		}
+		// ----------------------------------------
+		// Inspectors:
 
-		template<typename T>
-		typename std::enable_if<std::is_arithmetic<T>::value, Config>::type
-		serialize(const T& some_value)
-		{
-			return Config(some_value);
-		}
+		Config::Type type() const { return static_cast<Config::Type>(_node.type); }
+
+		bool is_uninitialized() const { return type() == Config::Uninitialized; }
+		bool is_null()          const { return type() == Config::Null;          }
+		bool is_bool()          const { return type() == Config::Bool;          }
+		bool is_int()           const { return type() == Config::Int;           }
+		bool is_float()         const { return type() == Config::Float;         }
+		bool is_string()        const { return type() == Config::String;        }
+		bool is_object()        const { return type() == Config::Object;        }
+		bool is_array()         const { return type() == Config::Array;         }
+		bool is_number()        const { return is_int() || is_float();          }
 
+		// ----------------------------------------
+		// Convertors:
+
+		/// Explicit casting, for overloads of as<T>
 		template<typename T>
-		typename std::enable_if<std::is_enum<T>::value, Config>::type
-		serialize(const T& some_enum)
+		explicit operator T() const { return get<T>(); }
+
+		bool as_bool() const
 		{
-			return Config(static_cast<int>(some_enum));
+			assert_type(Config::Bool);
+			return _node.u.b;
 		}
 
-		template<typename T, size_t N>
-		Config serialize(T (&some_array)[N])
+		template<typename IntT>
+		IntT as_integer() const
 		{
-			auto config = Config::array();
-			for (size_t i = 0; i < N; ++i) {
-				config.push_back(serialize(some_array[i]));
-			}
-			return config;
+			static_assert(std::is_integral<IntT>::value, "Not an integer.");
+			assert_type(Config::Int);
+			check(static_cast<int64_t>(static_cast<IntT>(_node.u.i)) == _node.u.i, "Integer out of range");
+			return static_cast<IntT>(_node.u.i);
 		}
 
-		template<typename T>
-		typename std::enable_if<is_container<T>::value, Config>::type
-		serialize(const T& some_container)
+		float as_float() const { return static_cast<float>(as_double()); }
+
+		double as_double() const
 		{
-			auto config = Config::array();
-			for (const auto& value : some_container) {
-				config.push_back(serialize(value));
+			if (is_int()) {
+				return static_cast<double>(_node.u.i);
+			} else {
+				assert_type(Config::Float);
+				return _node.u.f;
 			}
-			return config;
 		}
 
-		template<typename T>
-		typename std::enable_if<is_map<T>::value, Config>::type
-		serialize(const T& some_map)
+		/// Zero-terminated. Valid as long as the FrozenConfig is.
+		const char* c_str() const
 		{
-			auto config = Config::array();
-			for (const auto& pair : some_map) {
-				config.push_back(Config::array({serialize(pair.first), serialize(pair.second)}));
-			}
-			return config;
+			assert_type(Config::String);
+			return _tables->strings + _node.u.offset;
 		}
 
-		template<typename T>
-		typename std::enable_if<visit_struct::traits::is_visitable<T>::value, Config>::type
-		serialize(const T& some_struct)
+		size_t string_size() const
 		{
-			auto config = Config::object();
-			visit_struct::apply_visitor([&config](const std::string& name, const auto& value) {
-				config[name] = serialize(value);
-			}, some_struct);
-			return config;
+			assert_type(Config::String);
+			return _node.size;
 		}
 
-		// ----------------------------------------------------------------------------
-
-		/// Called when there is a problem in deserialize.
-		using ConversionError = std::function<void(std::string)>;
-
-		void deserialize(std::string* some_string, const Config& config, const ConversionError& on_error);
-
-		template<typename T>
-		typename std::enable_if<std::is_arithmetic<T>::value>::type
-		deserialize(T* some_value, const Config& config, const ConversionError& on_error);
+		std::string as_string() const { return std::string(c_str(), _node.size); }
 
+		/// Extract the value.
 		template<typename T>
-		typename std::enable_if<std::is_enum<T>::value>::type
-		deserialize(T* some_enum, const Config& config, const ConversionError& on_error);
+		T get() const;
 
-		template<typename T, size_t N>
-		typename std::enable_if<std::is_arithmetic<T>::value>::type
-		deserialize(T (*some_array)[N], const Config& config, const ConversionError& on_error);
+		// ----------------------------------------
+		// Array:
 
-		template<typename T>
-		typename std::enable_if<is_container<T>::value>::type
-		deserialize(T* some_container, const Config& config, const ConversionError& on_error);
+		size_t array_size() const
+		{
+			assert_type(Config::Array);
+			return _node.size;
+		}
 
-		template<typename T>
-		typename std::enable_if<is_map<T>::value>::type
-		deserialize(T* some_map, const Config& config, const ConversionError& on_error);
+		Config::ArrayPacking array_packing() const
+		{
+			assert_type(Config::Array);
+			return static_cast<Config::ArrayPacking>(_node.packing);
+		}
 
-		template<typename T>
-		typename std::enable_if<visit_struct::traits::is_visitable<T>::value>::type
-		deserialize(T* some_struct, const Config& config, const ConversionError& on_error);
+		/// Zero-copy access to a packed array of integers. Calls on_error on any other non-empty array.
+		Span<int64_t> as_int_span() const;
 
-		// ----------------------------------------------------------------------------
+		/// Zero-copy access to a packed array of floats. Calls on_error on any other non-empty array.
+		Span<double> as_float_span() const;
 
-		inline void deserialize(std::string* some_string, const Config& config, const ConversionError& on_error)
+		/// For iterating: `for (FrozenValue e : frozen.as_array()) { ... }`
+		FrozenRange<FrozenArrayIterator> as_array() const
 		{
-			*some_string = config.as_string();
+			return {{_tables, _node, 0}, {_tables, _node, array_size()}};
 		}
 
-		template<typename T>
-		typename std::enable_if<std::is_arithmetic<T>::value>::type
-		deserialize(T* some_value, const Config& config, const ConversionError& on_error)
-		{
-			*some_value = as<T>(config);
-		}
+		FrozenValue operator[](size_t ix) const;
 
-		template<typename T>
-		typename std::enable_if<std::is_enum<T>::value>::type
-		deserialize(T* some_enum, const Config& config, const ConversionError& on_error)
+		// ----------------------------------------
+		// Object:
+
+		size_t object_size() const
 		{
-			*some_enum = static_cast<T>(as<int>(config));
+			assert_type(Config::Object);
+			return _node.size;
 		}
 
-		template<typename T, size_t N>
-		typename std::enable_if<std::is_arithmetic<T>::value>::type
-		deserialize(T (*some_array)[N], const Config& config, const ConversionError& on_error)
+		/// For iterating: `for (auto&& p : frozen.as_object()) { std::cout << p.key() << ": " << p.value(); }`
+		FrozenRange<FrozenObjectIterator> as_object() const
 		{
-			if (!config.is_array()) {
-				if (on_error) {
-					on_error(config.where() + "Expected array");
-				}
-			} else if (config.array_size() != N) {
-				if (on_error) {
-					on_error(config.where() + "Expected array to be " + std::to_string(N) + " long.");
-				}
-			} else {
-				for (size_t i = 0; i < N; ++i) {
-					deserialize(&(*some_array)[i], config[i], on_error);
-				}
-			}
+			return {{_tables, _node, 0}, {_tables, _node, object_size()}};
 		}
 
+		/// Look up a value in an object. Calls on_error if the key is missing.
+		FrozenValue operator[](const std::string& key) const;
+
+		/// For indexing with string literals:
+		template<std::size_t N>
+		FrozenValue operator[](const char (&key)[N]) const { return operator[](std::string(key)); }
+
+		bool has_key(const std::string& key) const { return find(key) != nullptr; }
+
+		/// Look for the given key in this object, and return default_value on failure.
 		template<typename T>
-		typename std::enable_if<is_container<T>::value>::type
-		deserialize(T* some_container, const Config& config, const ConversionError& on_error)
+		T get_or(const std::string& key, const T& default_value) const
 		{
-			if (!config.is_array()) {
-				if (on_error) {
-					on_error(config.where() + "Failed to deserialize container: config is not an array.");
-				}
-			} else {
-				some_container->clear();
-				some_container->reserve(config.array_size());
-				for (const auto& value : config.as_array()) {
-					some_container->push_back({});
-					deserialize(&some_container->back(), value, on_error);
-				}
-			}
+			const FrozenNode* node = find(key);
+			return node ? FrozenValue(_tables, *node).get<T>() : default_value;
 		}
 
-		template<typename T>
-		typename std::enable_if<is_map<T>::value>::type
-		deserialize(T* some_map, const Config& config, const ConversionError& on_error)
+		/// Look for the given key in this object, and return default_value on failure.
+		std::string get_or(const std::string& key, const char* default_value) const
 		{
-			if (!config.is_array()) {
-				if (on_error) {
-					on_error(config.where() + "Failed to deserialize map: config is not an array.");
-				}
-			} else {
-				some_map->clear();
-				for (const auto& pair : config.as_array()) {
-					if (pair.is_array() && pair.array_size() == 2) {
-						typename T::key_type key;
-						deserialize(&key, pair[0], on_error);
-						typename T::mapped_type value;
-						deserialize(&value, pair[1], on_error);
-						some_map->emplace(std::make_pair(std::move(key), std::move(value)));
-					} else {
-						if (on_error) {
-							on_error(config.where() + "Failed to deserialize map: expected array of [key, value] array-pairs.");
-						}
-					}
-				}
-			}
+			return get_or<std::string>(key, default_value);
 		}
 
-		template<typename T>
-		typename std::enable_if<visit_struct::traits::is_visitable<T>::value>::type
-		deserialize(T* some_struct, const Config& config, const ConversionError& on_error)
+		// ----------------------------------------
+
+		/// Convert back into a mutable Config.
+		/// If `doc` is set, all values are tagged with it (without line numbers), so errors name that file.
+		/// Arrays and objects nested deeper than BINARY_MAX_DEPTH are an error.
+		Config thaw(const DocInfo_SP& doc = nullptr) const;
+
+		void assert_type(Config::Type t) const;
+
+		void on_error(const std::string& msg) const CONFIGURU_NORETURN;
+
+		inline void check(bool b, const char* msg) const
 		{
-			if (!config.is_object()) {
-				if (on_error) {
-					on_error(config.where() + "Failed to deserialize object: config is not an object.");
-				}
-			} else {
-				visit_struct::apply_visitor([&config, &on_error](const std::string& name, auto& value) {
-					if (config.has_key(name)) {
-						deserialize(&value, config[name], on_error);
-					}
-				}, *some_struct);
+			if (!b) {
+				on_error(msg);
 			}
 		}
-	#endif // VISITABLE_STRUCT
 
-} // namespace configuru
+	protected:
+		/// Returns nullptr if the key is not in this object.
+		const FrozenNode* find(const std::string& key) const;
 
-#endif // CONFIGURU_HEADER_HPP
+		Config thaw_tree(const DocInfo_SP& doc, unsigned depth) const;
 
-// ----------------------------------------------------------------------------
-// 88 8b    d8 88""Yb 88     888888 8b    d8 888888 88b 88 888888    db    888888 88  dP"Yb  88b 88
-// 88 88b  d88 88__dP 88     88__   88b  d88 88__   88Yb88   88     dPYb     88   88 dP   Yb 88Yb88
-// 88 88YbdP88 88"""  88  .o 88""   88YbdP88 88""   88 Y88   88    dP__Yb    88   88 Yb   dP 88 Y88
-// 88 88 YY 88 88     88ood8 888888 88 YY 88 888888 88  Y8   88   dP""""Yb   88   88  YbodP  88  Y8
+		const FrozenTables* _tables;
+		FrozenNode          _node;   // Copied, so that packed numbers can be values too.
+	};
 
-/* In one of your .cpp files you need to do the following:
-#define CONFIGURU_IMPLEMENTATION
-#include <configuru.hpp>
+	/// An immutable snapshot of a Config, stored compactly in a few contiguous tables.
+	/// Create with Config::freeze(). Copies share the same tables.
+	/// Use it like a const Config. Everything returned is a FrozenValue,
+	/// which is only valid for as long as the FrozenConfig is.
+	class FrozenConfig : public FrozenValue
+	{
+	public:
+		/// Owns or references the memory of the tables.
+		struct Storage
+		{
+			FrozenTables            tables;
+			std::vector<FrozenNode> nodes;
+			std::vector<FrozenKey>  keys;
+			std::vector<int64_t>    ints;
+			std::vector<double>     floats;
+			std::string             strings;
+			std::shared_ptr<const void> mapping; ///< Keeps a mapped snapshot file alive, if the tables are in one.
+		};
 
-This will define all the Configuru functions so that the linker may find them.
-*/
+		explicit FrozenConfig(std::shared_ptr<const Storage> storage)
+			: FrozenValue(&storage->tables, storage->tables.nodes[0]), _storage(std::move(storage)) {}
 
-#if defined(CONFIGURU_IMPLEMENTATION) && !defined(CONFIGURU_HAS_BEEN_IMPLEMENTED)
-#define CONFIGURU_HAS_BEEN_IMPLEMENTED
+		const FrozenTables& tables() const { return _storage->tables; }
 
-#include <algorithm>
-#include <limits>
-#include <ostream>
+	private:
+		std::shared_ptr<const Storage> _storage;
+	};
 
-// ----------------------------------------------------------------------------
-namespace configuru
-{
-	void DocInfo::append_include_info(std::string& ret, const std::string& indent) const
+	inline FrozenValue FrozenArrayIterator::operator*() const { return FrozenValue(_tables, _array)[_ix]; }
+
+	template<> inline bool               FrozenValue::get() const { return as_bool();   }
+	template<> inline signed char        FrozenValue::get() const { return as_integer<signed char>();        }
+	template<> inline unsigned char      FrozenValue::get() const { return as_integer<unsigned char>();      }
+	template<> inline signed short       FrozenValue::get() const { return as_integer<signed short>();       }
+	template<> inline unsigned short     FrozenValue::get() const { return as_integer<unsigned short>();     }
+	template<> inline signed int         FrozenValue::get() const { return as_integer<signed int>();         }
+	template<> inline unsigned int       FrozenValue::get() const { return as_integer<unsigned int>();       }
+	template<> inline signed long        FrozenValue::get() const { return as_integer<signed long>();        }
+	template<> inline unsigned long      FrozenValue::get() const { return as_integer<unsigned long>();      }
+	template<> inline signed long long   FrozenValue::get() const { return as_integer<signed long long>();   }
+	template<> inline unsigned long long FrozenValue::get() const { return as_integer<unsigned long long>(); }
+	template<> inline float              FrozenValue::get() const { return as_float();  }
+	template<> inline double             FrozenValue::get() const { return as_double(); }
+	template<> inline std::string        FrozenValue::get() const { return as_string(); }
+
+	template<typename T>
+	inline T as(const FrozenValue& value)
 	{
-		if (!includers.empty()) {
-			ret += ", included at:\n";
-			for (auto&& includer : includers) {
-				ret += indent + includer.doc->filename + ":" + std::to_string(includer.line);
-				includer.doc->append_include_info(ret, indent + "    ");
-				ret += "\n";
-			}
-			ret.pop_back();
-		}
+		return value.get<T>();
 	}
 
-	struct BadLookupInfo
+	// ----------------------------------------------------------
+	// Persistent configs:
+
+	/// An immutable config value where changes create a new version.
+	/// `with`, `without` and `with_appended` return a new PersistentConfig which shares
+	/// every unchanged array, object and string with the old one, so keeping many versions is cheap.
+	/// Old versions are never changed and can be read while new ones are created.
+	/// Arrays and objects are trees, so a change copies O(log n) of each array or object on the way to it.
+	/// Copies are cheap. Reading does not mark anything as accessed.
+	class PersistentConfig
 	{
-		const DocInfo_SP      doc;      // Of parent object
-		const unsigned        line;     // Of parent object
-		const std::string     key;
+	public:
+		struct Node;
+		struct ArrayChunk;
+		struct ObjectTree;
 
-		#if !CONFIGURU_VALUE_SEMANTICS
-			std::atomic<unsigned> _ref_count { 1 };
-		#endif
+		// ----------------------------------------
+		// Constructors:
 
-		BadLookupInfo(DocInfo_SP doc_, Index line_, std::string key_)
-			: doc(std::move(doc_)), line(line_), key(std::move(key_)) {}
-	};
+		/// Creates an uninitialized value.
+		PersistentConfig() : _type(Config::Uninitialized) { }
+		PersistentConfig(std::nullptr_t)       : _type(Config::Null)  { }
+		PersistentConfig(float f)              : _type(Config::Float) { _u.f = f; }
+		PersistentConfig(double f)             : _type(Config::Float) { _u.f = f; }
+		PersistentConfig(bool b)               : _type(Config::Bool)  { _u.b = b; }
+		PersistentConfig(int i)                : _type(Config::Int)   { _u.i = i; }
+		PersistentConfig(unsigned int i)       : _type(Config::Int)   { _u.i = i; }
+		PersistentConfig(long i)               : _type(Config::Int)   { _u.i = i; }
+		PersistentConfig(unsigned long i)      : PersistentConfig(Config(i)) { }
+		PersistentConfig(long long i)          : _type(Config::Int)   { _u.i = i; }
+		PersistentConfig(unsigned long long i) : PersistentConfig(Config(i)) { }
+		PersistentConfig(const char* str);
+		PersistentConfig(std::string str);
+
+		/// Converts the whole tree.
+		explicit PersistentConfig(const Config& config);
+
+		/// An empty object.
+		static PersistentConfig object();
+
+		/// An empty array.
+		static PersistentConfig array();
+
+		/// Convert back into a mutable Config.
+		Config to_config() const;
 
-	Config::Config(const char* str) : _type(String)
-	{
-		CONFIGURU_ASSERT(str != nullptr);
-		_u.str = new std::string(str);
-	}
+		// ----------------------------------------
+		// Inspectors:
 
-	Config::Config(std::string str) : _type(String)
-	{
-		_u.str = new std::string(move(str));
-	}
+		Config::Type type() const { return _type; }
 
-	Config::Config(std::initializer_list<std::pair<std::string, Config>> values) : _type(Uninitialized)
-	{
-		make_object();
-		for (auto&& v : values) {
-			(*this)[v.first] = std::move(v.second);
-		}
-	}
+		bool is_uninitialized() const { return _type == Config::Uninitialized; }
+		bool is_null()          const { return _type == Config::Null;          }
+		bool is_bool()          const { return _type == Config::Bool;          }
+		bool is_int()           const { return _type == Config::Int;           }
+		bool is_float()         const { return _type == Config::Float;         }
+		bool is_string()        const { return _type == Config::String;        }
+		bool is_object()        const { return _type == Config::Object;        }
+		bool is_array()         const { return _type == Config::Array;         }
+		bool is_number()        const { return is_int() || is_float();         }
 
-	void Config::make_object()
-	{
-		assert_type(Uninitialized);
-		_type = Object;
-		_u.object = new ConfigObject();
-	}
+		// ----------------------------------------
+		// Convertors:
 
-	void Config::make_array()
-	{
-		assert_type(Uninitialized);
-		_type = Array;
-		_u.array = new ConfigArray();
-	}
+		/// Explicit casting, for overloads of as<T>
+		template<typename T>
+		explicit operator T() const { return get<T>(); }
 
-	Config Config::object()
-	{
-		Config ret;
-		ret.make_object();
-		return ret;
-	}
+		bool as_bool() const
+		{
+			assert_type(Config::Bool);
+			return _u.b;
+		}
 
-	Config Config::object(std::initializer_list<std::pair<std::string, Config>> values)
-	{
-		Config ret;
-		ret.make_object();
-		for (auto&& p : values) {
-			ret[static_cast<std::string>(p.first)] = std::move(p.second);
+		template<typename IntT>
+		IntT as_integer() const
+		{
+			static_assert(std::is_integral<IntT>::value, "Not an integer.");
+			assert_type(Config::Int);
+			check(static_cast<int64_t>(static_cast<IntT>(_u.i)) == _u.i, "Integer out of range");
+			return static_cast<IntT>(_u.i);
 		}
-		return ret;
-	}
 
-	Config Config::array()
-	{
-		Config ret;
-		ret.make_array();
-		return ret;
-	}
+		float as_float() const { return static_cast<float>(as_double()); }
 
-	Config Config::array(std::initializer_list<Config> values)
-	{
-		Config ret;
-		ret.make_array();
-		ret._u.array->_impl.reserve(values.size());
-		for (auto&& v : values) {
-			ret.push_back(std::move(v));
+		double as_double() const
+		{
+			if (_type == Config::Int) {
+				return static_cast<double>(_u.i);
+			} else {
+				assert_type(Config::Float);
+				return _u.f;
+			}
 		}
-		return ret;
-	}
 
-	void Config::tag(const DocInfo_SP& doc, Index line, Index column)
-	{
-		_doc = doc;
-		_line = line;
-		(void)column; // TODO: include this info too.
-	}
+		const std::string& as_string() const;
 
-	// ------------------------------------------------------------------------
+		const char* c_str() const { return as_string().c_str(); }
 
-	Config::Config(const Config& o) : _type(Uninitialized)
-	{
-		*this = o;
-	}
+		/// Extract the value.
+		template<typename T>
+		T get() const;
 
-	Config::Config(Config&& o) noexcept : _type(Uninitialized)
-	{
-		this->swap(o);
-	}
+		// ----------------------------------------
+		// Array:
 
-	void Config::swap(Config& o) noexcept
-	{
-		if (&o == this) { return; }
-		std::swap(_type,     o._type);
-		std::swap(_u,        o._u);
-		std::swap(_doc,      o._doc);
-		std::swap(_line,     o._line);
-		std::swap(_comments, o._comments);
-	}
+		size_t array_size() const;
 
-	Config& Config::operator=(Config&& o) noexcept
-	{
-		if (&o == this) { return *this; }
+		/// Iterates the elements of an array.
+		class ArrayIterator
+		{
+		public:
+			ArrayIterator(const Node* node, size_t ix) : _node(node), _ix(ix), _chunk(nullptr) {}
 
-		std::swap(_type, o._type);
-		std::swap(_u,    o._u);
+			const PersistentConfig& operator*() const;
 
-		// Remember where we come from even when assigned a new value:
-		if (o._doc || o._line != BAD_INDEX) {
-			std::swap(_doc,  o._doc);
-			std::swap(_line, o._line);
-		}
+			ArrayIterator& operator++();
 
-		if (o._comments) {
-			std::swap(_comments, o._comments);
-		}
+			friend bool operator==(const ArrayIterator& a, const ArrayIterator& b) { return a._ix == b._ix; }
+			friend bool operator!=(const ArrayIterator& a, const ArrayIterator& b) { return a._ix != b._ix; }
 
-		return *this;
-	}
+		private:
+			const Node*               _node;
+			size_t                    _ix;
+			mutable const ArrayChunk* _chunk; // Where _ix is, once looked up.
+		};
 
-	Config& Config::operator=(const Config& o)
-	{
-		if (&o == this) { return *this; }
+		struct ArrayRange
+		{
+			ArrayIterator _begin, _end;
+			ArrayIterator begin() const { return _begin; }
+			ArrayIterator end()   const { return _end;   }
+		};
 
-		free();
+		/// For iterating: `for (const PersistentConfig& e : version.as_array()) { ... }`
+		ArrayRange as_array() const;
 
-		_type = o._type;
+		const PersistentConfig& operator[](size_t ix) const;
 
-		#if CONFIGURU_VALUE_SEMANTICS
-			if (_type == String) {
-				_u.str = new std::string(*o._u.str);
-			} else if (_type == BadLookupType) {
-				_u.bad_lookup = new BadLookupInfo(*o._u.bad_lookup);
-			} else if (_type == Object) {
-				_u.object = new ConfigObject(*o._u.object);
-			} else if (_type == Array) {
-				_u.array = new ConfigArray(*o._u.array);
-			} else {
-				memcpy(&_u, &o._u, sizeof(_u));
-			}
-		#else // !CONFIGURU_VALUE_SEMANTICS:
-			if (_type == String) {
-				_u.str = new std::string(*o._u.str);
-			} else {
-				memcpy(&_u, &o._u, sizeof(_u));
-				if (_type == BadLookupType) { ++_u.bad_lookup->_ref_count; }
-				if (_type == Array)         { ++_u.array->_ref_count; }
-				if (_type == Object)        { ++_u.object->_ref_count; }
-			}
-		#endif // !CONFIGURU_VALUE_SEMANTICS
+		/// A new version with the element at the given index replaced.
+		PersistentConfig with(size_t ix, PersistentConfig value) const;
 
-		// Remember where we come from even when assigned a new value:
-		if (o._doc || o._line != BAD_INDEX) {
-			_doc  = o._doc;
-			_line = o._line;
-		}
+		/// A new version with the value added to the end of this array.
+		PersistentConfig with_appended(PersistentConfig value) const;
 
-		if (o._comments) {
-			_comments.reset(new ConfigComments(*o._comments));
-		}
+		// ----------------------------------------
+		// Object:
 
-		#if CONFIGURU_VALUE_SEMANTICS
-			o.mark_accessed(true);
-		#endif
+		size_t object_size() const;
 
-		return *this;
-	}
+		/// Iterates the entries of an object, in key order.
+		class ObjectIterator
+		{
+		public:
+			/// At the first entry of `tree`, or at the end if it is null.
+			explicit ObjectIterator(const ObjectTree* tree) { push_left(tree); }
 
-	Config::~Config()
-	{
-		free();
-	}
+			const ObjectIterator& operator*() const { return *this; }
 
-	void Config::free()
-	{
-		#if CONFIGURU_VALUE_SEMANTICS
-			if (_type == BadLookupType) {
-				delete _u.bad_lookup;
-			} else if (_type == Object) {
-				delete _u.object;
-			} else if (_type == Array) {
-				delete _u.array;
-			} else if (_type == String) {
-				delete _u.str;
-			}
-		#else // !CONFIGURU_VALUE_SEMANTICS:
-			if (_type == BadLookupType) {
-				if (--_u.bad_lookup->_ref_count == 0) {
-					delete _u.bad_lookup;
-				}
-			} else if (_type == Object) {
-				if (--_u.object->_ref_count == 0) {
-					delete _u.object;
-				}
-			} else if (_type == Array) {
-				if (--_u.array->_ref_count == 0) {
-					delete _u.array;
-				}
-			} else if (_type == String) {
-				delete _u.str;
-			}
-		#endif // !CONFIGURU_VALUE_SEMANTICS
+			ObjectIterator& operator++();
 
-		_type = Uninitialized;
+			friend bool operator==(const ObjectIterator& a, const ObjectIterator& b) { return a.current() == b.current(); }
+			friend bool operator!=(const ObjectIterator& a, const ObjectIterator& b) { return a.current() != b.current(); }
 
-		// Keep _doc, _line, _comments until overwritten/destructor.
-	}
+			const std::string&      key()   const;
+			const PersistentConfig& value() const;
 
-	// ------------------------------------------------------------------------
+		private:
+			friend class PersistentConfig;
 
-	size_t Config::object_size() const
-	{
-		return as_object()._impl.size();
-	}
+			const ObjectTree* current() const { return _stack.empty() ? nullptr : _stack.back(); }
+			void push_left(const ObjectTree* tree);
 
-	const Config& Config::operator[](const std::string& key) const
-	{
-		auto&& object = as_object()._impl;
-		auto it = object.find(key);
-		if (it == object.end()) {
-			on_error("Key '" + key + "' not in object");
-		} else {
-			const auto& entry = it->second;
-			entry._accessed = true;
-			return entry._value;
-		}
-	}
+			std::vector<const ObjectTree*> _stack; // The current entry last, after the ones still to come on the way up.
+		};
 
-	Config& Config::operator[](const std::string& key)
-	{
-		auto&& object = as_object()._impl;
-		auto&& entry = object[key];
-		if (entry._nr == BAD_INDEX) {
-			// New entry
-			entry._nr = static_cast<Index>(object.size()) - 1;
-			entry._value._type = BadLookupType;
-			entry._value._u.bad_lookup = new BadLookupInfo{_doc, _line, key};
-		} else {
-			entry._accessed = true;
-		}
-		return entry._value;
-	}
+		struct ObjectRange
+		{
+			ObjectIterator _begin, _end;
+			ObjectIterator begin() const { return _begin; }
+			ObjectIterator end()   const { return _end;   }
+		};
 
-	bool Config::has_key(const std::string& key) const
-	{
-		return as_object()._impl.count(key) != 0;
-	}
+		/// For iterating: `for (auto&& p : version.as_object()) { std::cout << p.key() << ": " << p.value(); }`
+		ObjectRange as_object() const;
 
-	bool Config::emplace(std::string key, Config value)
-	{
-		auto&& object = as_object()._impl;
-		return object.emplace(
-			std::move(key),
-			Config::ObjectEntry{std::move(value), (unsigned)object.size()}).second;
-	}
+		/// Look up a value in an object. Calls on_error if the key is missing.
+		const PersistentConfig& operator[](const std::string& key) const;
 
-	void Config::insert_or_assign(const std::string& key, Config&& config)
-	{
-		auto&& object = as_object()._impl;
-		auto&& entry = object[key];
-		if (entry._nr == BAD_INDEX) {
-			// New entry
-			entry._nr = static_cast<Index>(object.size()) - 1;
-		} else {
-			entry._accessed = true;
-		}
-		entry._value = std::move(config);
-	}
+		/// For indexing with string literals:
+		template<std::size_t N>
+		const PersistentConfig& operator[](const char (&key)[N]) const { return operator[](std::string(key)); }
 
-	bool Config::erase(const std::string& key)
-	{
-		auto& object = as_object()._impl;
-		auto it = object.find(key);
-		if (it == object.end()) {
-			return false;
-		} else {
-			object.erase(it);
-			return true;
-		}
-	}
+		bool has_key(const std::string& key) const { return find(key) != nullptr; }
 
-	bool Config::deep_eq(const Config& a, const Config& b)
-	{
-		if (a._type != b._type) { return false; }
-		if (a._type == Null)   { return true; }
-		if (a._type == Bool)   { return a._u.b    == b._u.b;    }
-		if (a._type == Int)    { return a._u.i    == b._u.i;    }
-		if (a._type == Float)  { return a._u.f    == b._u.f;    }
-		if (a._type == String) { return *a._u.str == *b._u.str; }
-		if (a._type == Object)    {
-			if (a._u.object == b._u.object) { return true; }
-			auto&& a_object = a.as_object()._impl;
-			auto&& b_object = b.as_object()._impl;
-			if (a_object.size() != b_object.size()) { return false; }
-			for (auto&& p: a_object) {
-				auto it = b_object.find(p.first);
-				if (it == b_object.end()) { return false; }
-				if (!deep_eq(p.second._value, it->second._value)) { return false; }
-			}
-			return true;
-		}
-		if (a._type == Array)    {
-			if (a._u.array == b._u.array) { return true; }
-			auto&& a_array = a.as_array();
-			auto&& b_array = b.as_array();
-			if (a_array.size() != b_array.size()) { return false; }
-			for (size_t i=0; i<a_array.size(); ++i) {
-				if (!deep_eq(a_array[i], a_array[i])) {
-					return false;
-				}
-			}
-			return true;
+		/// Look for the given key in this object, and return default_value on failure.
+		template<typename T>
+		T get_or(const std::string& key, const T& default_value) const
+		{
+			const PersistentConfig* value = find(key);
+			return value ? value->get<T>() : default_value;
 		}
 
-		return false;
-	}
-
-#if !CONFIGURU_VALUE_SEMANTICS
-	Config Config::deep_clone() const
-	{
-		Config ret = *this;
-		if (ret._type == Object) {
-			ret = Config::object();
-			for (auto&& p : this->as_object()._impl) {
-				auto& dst = ret._u.object->_impl[p.first];
-				dst._nr    = p.second._nr;
-				dst._value = p.second._value.deep_clone();
-			}
-		}
-		if (ret._type == Array) {
-			ret = Config::array();
-			for (auto&& value : this->as_array()) {
-				ret.push_back( value.deep_clone() );
-			}
+		/// Look for the given key in this object, and return default_value on failure.
+		std::string get_or(const std::string& key, const char* default_value) const
+		{
+			return get_or<std::string>(key, default_value);
 		}
-		return ret;
-	}
-#endif
 
-	void Config::visit_dangling(const std::function<void(const std::string& key, const Config& value)>& visitor) const
-	{
-		if (is_object()) {
-			for (auto&& p : as_object()._impl) {
-				auto&& entry = p.second;
-				auto&& value = entry._value;
-				if (entry._accessed) {
-					value.check_dangling();
-				} else {
-					visitor(p.first, value);
-				}
-			}
-		} else if (is_array()) {
-			for (auto&& e : as_array()) {
-				e.check_dangling();
-			}
-		}
-	}
+		/// A new version with the key set to the given value. New keys are added last.
+		PersistentConfig with(const std::string& key, PersistentConfig value) const;
 
-	void Config::check_dangling() const
-	{
-		std::string message = "";
+		/// with({"a", "b", "c"}, 42) - like with("a", ...["b"]["c"] = 42).
+		/// Missing objects on the way are created.
+		PersistentConfig with(std::initializer_list<std::string> path, PersistentConfig value) const;
 
-		visit_dangling([&](const std::string& key, const Config& value){
-			message += "\n    " + value.where() + "Key '" + key + "' never accessed.";
-		});
+		/// A new version without the given key. Returns this version if there was no such key.
+		PersistentConfig without(const std::string& key) const;
 
-		if (!message.empty()) {
-			message = "Dangling keys:" + message;
-			CONFIGURU_ON_DANGLING(message);
-		}
-	}
+		// ----------------------------------------
 
-	void Config::mark_accessed(bool v) const
-	{
-		if (is_object()) {
-			for (auto&& p : as_object()._impl) {
-				auto&& entry = p.second;
-				entry._accessed = v;
-				entry._value.mark_accessed(v);
-			}
-		} else if (is_array()) {
-			for (auto&& e : as_array()) {
-				e.mark_accessed(v);
-			}
-		}
-	}
+		/// Compare values recursively. Subtrees shared between the two versions are not visited.
+		static bool deep_eq(const PersistentConfig& a, const PersistentConfig& b);
 
-	const char* Config::debug_descr() const
-	{
-		switch (_type) {
-			case Bool:   return _u.b ? "true" : "false";
-			case String: return _u.str->c_str();
-			default:     return type_str(_type);
-		}
-	}
+		void assert_type(Config::Type t) const;
 
-	const char* Config::type_str(Type t)
-	{
-		switch (t) {
-			case Uninitialized: return "uninitialized";
-			case BadLookupType: return "undefined";
-			case Null:          return "null";
-			case Bool:          return "bool";
-			case Int:           return "integer";
-			case Float:         return "float";
-			case String:        return "string";
-			case Array:         return "array";
-			case Object:        return "object";
-		}
-		return "BROKEN Config";
-	}
+		void on_error(const std::string& msg) const CONFIGURU_NORETURN;
 
-	std::string where_is(const DocInfo_SP& doc, Index line)
-	{
-		if (doc) {
-			std::string ret = doc->filename;
-			if (line != BAD_INDEX) {
-				ret += ":" + std::to_string(line);
+		inline void check(bool b, const char* msg) const
+		{
+			if (!b) {
+				on_error(msg);
 			}
-			doc->append_include_info(ret);
-			ret += ": ";
-			return ret;
-		} else if (line != BAD_INDEX) {
-			return "line " + std::to_string(line) + ": ";
-		} else {
-			return "";
 		}
-	}
-
-	std::string Config::where() const
-	{
-		return where_is(_doc, _line);
-	}
 
-	void Config::on_error(const std::string& msg) const
-	{
-		CONFIGURU_ONERROR(where() + msg);
-		abort(); // We shouldn't get here.
-	}
+	private:
+		/// Returns nullptr if the key is not in this object.
+		const PersistentConfig* find(const std::string& key) const;
 
-	void Config::assert_type(Type exepected) const
-	{
-		if (_type == BadLookupType) {
-			auto where = where_is(_u.bad_lookup->doc, _u.bad_lookup->line);
-			CONFIGURU_ONERROR(where + "Failed to find key '" + _u.bad_lookup->key + "'");
-		} else if (_type != exepected) {
-			const auto message = where() + "Expected " + type_str(exepected) + ", got " + type_str(_type);
-			if (_type == Uninitialized && exepected == Object) {
-				CONFIGURU_ONERROR(message + ". Did you forget to call Config::object()?");
-			} else if (_type == Uninitialized && exepected == Array) {
-				CONFIGURU_ONERROR(message + ". Did you forget to call Config::array()?");
-			} else {
-				CONFIGURU_ONERROR(message);
-			}
-		}
-	}
+		PersistentConfig with_path(const std::string* begin, const std::string* end, PersistentConfig value) const;
 
-	std::ostream& operator<<(std::ostream& os, const Config& cfg)
-	{
-		auto format = JSON;
-		// Make sure that all config types are serializable:
-		format.inf                 = true;
-		format.nan                 = true;
-		format.write_uninitialized = true;
-		format.end_with_newline    = false;
-		format.mark_accessed       = false;
-		return os << dump_string(cfg, format);
-	}
-}
+		Config::Type _type;
 
-// ----------------------------------------------------------------------------
-// 88""Yb    db    88""Yb .dP"Y8 888888 88""Yb
-// 88__dP   dPYb   88__dP `Ybo." 88__   88__dP
-// 88"""   dP__Yb  88"Yb  o.`Y8b 88""   88"Yb
-// 88     dP""""Yb 88  Yb 8bodP' 888888 88  Yb
+		union
+		{
+			bool    b;
+			int64_t i;
+			double  f;
+		} _u;
 
-#include <cerrno>
-#include <cstdlib>
+		std::shared_ptr<const Node> _node; ///< String, array or object.
+	};
 
-namespace configuru
-{
-	void append(Comments& a, Comments&& b)
+	inline bool operator==(const PersistentConfig& a, const PersistentConfig& b)
 	{
-		for (auto&& entry : b) {
-			a.emplace_back(std::move(entry));
-		}
+		return PersistentConfig::deep_eq(a, b);
 	}
 
-	bool ConfigComments::empty() const
+	inline bool operator!=(const PersistentConfig& a, const PersistentConfig& b)
 	{
-		return prefix.empty()
-			&& postfix.empty()
-			&& pre_end_brace.empty();
+		return !PersistentConfig::deep_eq(a, b);
 	}
 
-	void ConfigComments::append(ConfigComments&& other)
+	template<> inline bool               PersistentConfig::get() const { return as_bool();   }
+	template<> inline signed char        PersistentConfig::get() const { return as_integer<signed char>();        }
+	template<> inline unsigned char      PersistentConfig::get() const { return as_integer<unsigned char>();      }
+	template<> inline signed short       PersistentConfig::get() const { return as_integer<signed short>();       }
+	template<> inline unsigned short     PersistentConfig::get() const { return as_integer<unsigned short>();     }
+	template<> inline signed int         PersistentConfig::get() const { return as_integer<signed int>();         }
+	template<> inline unsigned int       PersistentConfig::get() const { return as_integer<unsigned int>();       }
+	template<> inline signed long        PersistentConfig::get() const { return as_integer<signed long>();        }
+	template<> inline unsigned long      PersistentConfig::get() const { return as_integer<unsigned long>();      }
+	template<> inline signed long long   PersistentConfig::get() const { return as_integer<signed long long>();   }
+	template<> inline unsigned long long PersistentConfig::get() const { return as_integer<unsigned long long>(); }
+	template<> inline float              PersistentConfig::get() const { return as_float();  }
+	template<> inline double             PersistentConfig::get() const { return as_double(); }
+	template<> inline std::string        PersistentConfig::get() const { return as_string(); }
+
+	template<typename T>
+	inline T as(const PersistentConfig& value)
 	{
-		configuru::append(this->prefix,        std::move(other.prefix));
-		configuru::append(this->postfix,       std::move(other.postfix));
-		configuru::append(this->pre_end_brace, std::move(other.pre_end_brace));
+		return value.get<T>();
 	}
 
-	// Returns the number of bytes written, or 0 on error
-	size_t encode_utf8(std::string& dst, uint64_t c)
+	// ----------------------------------------------------------
+
+	/// Thrown on a syntax error.
+	class ParseError : public std::exception
 	{
-		if (c <= 0x7F)  // 0XXX XXXX - one byte
-		{
-			dst += static_cast<char>(c);
-			return 1;
-		}
-		else if (c <= 0x7FF)  // 110X XXXX - two bytes
-		{
-			dst += static_cast<char>( 0xC0 | (c >> 6) );
-			dst += static_cast<char>( 0x80 | (c & 0x3F) );
-			return 2;
-		}
-		else if (c <= 0xFFFF)  // 1110 XXXX - three bytes
+	public:
+		ParseError(const DocInfo_SP& doc, Index line, Index column, const std::string& msg)
+			: _line(line), _column(column)
 		{
-			dst += static_cast<char>(0xE0 | (c >> 12));
-			dst += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
-			dst += static_cast<char>(0x80 | (c & 0x3F));
-			return 3;
+			_what = doc->filename + ":" + std::to_string(line) + ":" + std::to_string(column);
+			doc->append_include_info(_what);
+			_what += ": " + msg;
 		}
-		else if (c <= 0x1FFFFF)  // 1111 0XXX - four bytes
+
+		/// For the binary formats, which have no lines. `offset` is where in the input the problem is.
+		ParseError(const std::string& name, size_t offset, const std::string& msg)
+			: _line(BAD_INDEX), _column(BAD_INDEX), _offset(offset)
 		{
-			dst += static_cast<char>(0xF0 | (c >> 18));
-			dst += static_cast<char>(0x80 | ((c >> 12) & 0x3F));
-			dst += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
-			dst += static_cast<char>(0x80 | (c & 0x3F));
-			return 4;
+			_what = name + ": byte " + std::to_string(offset) + ": " + msg;
 		}
-		else if (c <= 0x3FFFFFF)  // 1111 10XX - five bytes
+
+		/// Will name the file name, line number, column and description.
+		const char* what() const noexcept override
 		{
-			dst += static_cast<char>(0xF8 | (c >> 24));
-			dst += static_cast<char>(0x80 | (c >> 18));
-			dst += static_cast<char>(0x80 | ((c >> 12) & 0x3F));
-			dst += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
-			dst += static_cast<char>(0x80 | (c & 0x3F));
-			return 5;
+			return _what.c_str();
 		}
-		else if (c <= 0x7FFFFFFF)  // 1111 110X - six bytes
-		{
-			dst += static_cast<char>(0xFC | (c >> 30));
-			dst += static_cast<char>(0x80 | ((c >> 24) & 0x3F));
-			dst += static_cast<char>(0x80 | ((c >> 18) & 0x3F));
-			dst += static_cast<char>(0x80 | ((c >> 12) & 0x3F));
-			dst += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
-			dst += static_cast<char>(0x80 | (c & 0x3F));
-			return 6;
-		}
-		else {
-			return 0; // Error
-		}
-	}
 
-	std::string quote(char c)
-	{
-		if (c == 0)    { return "<eof>";   }
-		if (c == ' ')  { return "<space>"; }
-		if (c == '\n') { return "'\\n'";   }
-		if (c == '\t') { return "'\\t'";   }
-		if (c == '\r') { return "'\\r'";   }
-		if (c == '\b') { return "'\\b'";   }
-		return std::string("'") + c + "'";
-	}
+		Index line()   const noexcept { return _line; }
+		Index column() const noexcept { return _column; }
 
-	struct State
-	{
-		const char* ptr;
-		unsigned    line_nr;
-		const char* line_start;
+		/// The byte offset for errors in the binary formats, else size_t(-1).
+		size_t offset() const noexcept { return _offset; }
+
+	private:
+		Index _line, _column;
+		size_t _offset = static_cast<size_t>(-1);
+		std::string _what;
 	};
 
-	struct Parser
+	// ----------------------------------------------------------
+
+	/// This struct basically contain all the way we can tweak the file format.
+	struct FormatOptions
 	{
-		Parser(const char* str, const FormatOptions& options, DocInfo_SP doc, ParseInfo& info);
+		/// Indentation should be a single tab,
+		/// multiple spaces or an empty string.
+		/// An empty string means the output will be compact.
+		std::string indentation              = "\t";
+		bool        enforce_indentation      = true;  ///< Must have correct indentation?
+		bool        end_with_newline         = true;  ///< End each file with a newline (unless compact).
 
-		bool skip_white(Comments* out_comments, int& out_indentation, bool break_on_newline);
+		// Top file:
+		bool        empty_file               = false; ///< If true, an empty file is an empty object.
+		bool        implicit_top_object      = true;  ///< Ok with key-value pairs top-level?
+		bool        implicit_top_array       = true;  ///< Ok with several values top-level?
 
-		bool skip_white_ignore_comments()
-		{
-			int indentation;
-			return skip_white(nullptr, indentation, false);
-		}
+		// Comments:
+		bool        single_line_comments     = true;  ///< Allow this?
+		bool        block_comments           = true;  /* Allow this? */
+		bool        nesting_block_comments   = true;  ///< /* Allow /*    this? */ */
 
-		bool skip_pre_white(Config* config, int& out_indentation)
-		{
-			if (!MAYBE_WHITE[static_cast<uint8_t>(_ptr[0])]) {
-				// Early out
-				out_indentation = -1;
-				return false;
-			}
+		// Numbers:
+		bool        inf                      = true;  ///< Allow +inf, -inf
+		bool        nan                      = true;  ///< Allow +NaN
+		bool        hexadecimal_integers     = true;  ///< Allow 0xff
+		bool        binary_integers          = true;  ///< Allow 0b1010
+		bool        unary_plus               = true;  ///< Allow +42
+		bool        distinct_floats          = true;  ///< Print 9.0 as "9.0", not just "9". A must for round-tripping.
 
-			Comments comments;
-			bool did_skip = skip_white(&comments, out_indentation, false);
-			if (!comments.empty()) {
-				append(config->comments().prefix, std::move(comments));
-			}
-			return did_skip;
-		}
+		// Arrays
+		bool        array_omit_comma         = true;  ///< Allow [1 2 3]
+		bool        array_trailing_comma     = true;  ///< Allow [1, 2, 3,]
 
-		bool skip_post_white(Config* config)
-		{
-			if (!MAYBE_WHITE[static_cast<uint8_t>(_ptr[0])]) {
-				// Early out
-				return false;
-			}
+		// Objects:
+		bool        identifiers_keys         = true;  ///< { is_this_ok: true }
+		bool        object_separator_equal   = false; ///< { "is_this_ok" = true }
+		bool        allow_space_before_colon = false; ///< { "is_this_ok" : true }
+		bool        omit_colon_before_object = false; ///< { "nested_object" { } }
+		bool        object_omit_comma        = true;  ///< Allow {a:1 b:2}
+		bool        object_trailing_comma    = true;  ///< Allow {a:1, b:2,}
+		bool        object_duplicate_keys    = false; ///< Allow {"a":1, "a":2}
+		bool        object_align_values      = true;  ///< Add spaces after keys to align subsequent values.
 
-			Comments comments;
-			int indentation;
-			bool did_skip = skip_white(&comments, indentation, true);
-			if (!comments.empty()) {
-				append(config->comments().postfix, std::move(comments));
-			}
-			return did_skip;
-		}
+		// Strings
+		bool        str_csharp_verbatim      = true;  ///< Allow @"Verbatim\strings"
+		bool        str_python_multiline     = true;  ///< Allow """ Python\nverbatim strings """
+		bool        str_32bit_unicode        = true;  ///< Allow "\U0030dbfd"
+		bool        str_allow_tab            = true;  ///< Allow unescaped tab in string.
 
-		Config top_level();
-		void parse_value(Config& out, bool* out_did_skip_postwhites);
-		void parse_array(Config& dst);
-		void parse_array_contents(Config& dst);
-		void parse_object(Config& dst);
-		void parse_object_contents(Config& dst);
-		void parse_int(Config& out);
-		void parse_float(Config& out);
-		void parse_finite_number(Config& dst);
-		std::string parse_string();
-		std::string parse_c_sharp_string();
-		uint64_t parse_hex(int count);
-		void parse_macro(Config& dst);
+		// Special
+		bool        allow_macro              = true;  ///< Allow `#include "some_other_file.cfg"`
 
-		void tag(Config& var)
-		{
-			var.tag(_doc, _line_nr, column());
-		}
+		/// parse_file keeps a compiled copy of what it parsed next to the file (as "<path>.cache"), and loads that
+		/// instead of parsing when neither the file, nor anything it #includes, nor these options have changed.
+		/// Values loaded from the cache are the same as parsed ones, with their comments, lines and #includes.
+		bool        parse_cache              = false;
 
-		State get_state() const
-		{
-			return { _ptr, _line_nr, _line_start };
-		}
+		// When writing:
+		bool        write_comments           = true;
 
-		void set_state(State s) {
-			_ptr        = s.ptr;
-			_line_nr    = s.line_nr;
-			_line_start = s.line_start;
-		}
+		/// Sort keys lexicographically. If false, sort by order they where added.
+		bool        sort_keys                = false;
 
-		Index column() const
-		{
-			return static_cast<unsigned>(_ptr - _line_start + 1);
-		}
+		/// When printing, write uninitialized values as UNINITIALIZED. Useful for debugging.
+		bool        write_uninitialized      = false;
 
-		const char* start_of_line() const
-		{
-			return _line_start;
-		}
+		/// Write all non-ASCII characters as \uXXXX (with surrogate pairs above U+FFFF), so the output is pure ASCII.
+		/// Bytes which are not valid UTF-8 are written as U+FFFD.
+		bool        ensure_ascii             = false;
 
-		const char* end_of_line() const
-		{
-			const char* p = _ptr;
-			while (*p && *p != '\r' && *p != '\n') {
-				++p;
-			}
-			return p;
-		}
+		/// Remember what each array and object was written as, and reuse that in the next dump with the same
+		/// options if it has not been changed since. Needs CONFIGURU_DUMP_CACHE (and CONFIGURU_VALUE_SEMANTICS).
+		bool        cache_output             = false;
 
-		void throw_error(const std::string& desc) CONFIGURU_NORETURN {
-			const char* sol = start_of_line();
-			const char* eol = end_of_line();
-			std::string orientation;
-			for (const char* p = sol; p != eol; ++p) {
-				if (*p == '\t') {
-					orientation += "    ";
-				} else {
-					orientation.push_back(*p);
-				}
-			}
+		/// Dumping should mark the json as accessed?
+		bool        mark_accessed            = true;
 
-			orientation += "\n";
-			for (const char* p = sol; p != _ptr; ++p) {
-				if (*p == '\t') {
-					orientation += "    ";
-				} else {
-					orientation.push_back(' ');
-				}
-			}
-			orientation += "^";
+		bool compact() const { return indentation.empty(); }
+	};
 
-			throw ParseError(_doc, _line_nr, column(), desc + "\n" + orientation);
-		}
+	/// Returns FormatOptions that are describe a JSON file format.
+	inline FormatOptions make_json_options()
+	{
+		FormatOptions options;
 
-		void throw_indentation_error(int found_tabs, int expected_tabs) {
-			if (_options.enforce_indentation) {
-				char buff[128];
-				snprintf(buff, sizeof(buff), "Bad indentation: expected %d tabs, found %d", found_tabs, expected_tabs);
-				throw_error(buff);
-			}
-		}
+		options.indentation              = "\t";
+		options.enforce_indentation      = false;
 
-		void parse_assert(bool b, const char* error_msg) {
-			if (!b) {
-				throw_error(error_msg);
-			}
-		}
+		// Top file:
+		options.empty_file               = false;
+		options.implicit_top_object      = false;
+		options.implicit_top_array       = false;
 
-		void parse_assert(bool b, const char* error_msg, const State& error_state) {
-			if (!b) {
-				set_state(error_state);
-				throw_error(error_msg);
-			}
-		}
+		// Comments:
+		options.single_line_comments     = false;
+		options.block_comments           = false;
+		options.nesting_block_comments   = false;
 
-		void swallow(char c) {
-			if (_ptr[0] == c) {
-				_ptr += 1;
-			} else {
-				throw_error("Expected " + quote(c));
-			}
-		}
+		// Numbers:
+		options.inf                      = false;
+		options.nan                      = false;
+		options.hexadecimal_integers     = false;
+		options.binary_integers          = false;
+		options.unary_plus               = false;
+		options.distinct_floats          = true;
 
-		bool try_swallow(const char* str) {
-			auto n = strlen(str);
-			if (strncmp(str, _ptr, n) == 0) {
-				_ptr += n;
-				return true;
-			} else {
-				return false;
-			}
-		}
+		// Arrays
+		options.array_omit_comma         = false;
+		options.array_trailing_comma     = false;
 
-		void swallow(const char* str, const char* error_msg) {
-			parse_assert(try_swallow(str), error_msg);
-		}
+		// Objects:
+		options.identifiers_keys         = false;
+		options.object_separator_equal   = false;
+		options.allow_space_before_colon = true;
+		options.omit_colon_before_object = false;
+		options.object_omit_comma        = false;
+		options.object_trailing_comma    = false;
+		options.object_duplicate_keys    = false; // To be 100% JSON compatile, this should be true, but it is error prone.
+		options.object_align_values      = true;  // Looks better.
 
-		bool is_reserved_identifier(const char* ptr)
-		{
-			if (strncmp(ptr, "true", 4)==0 || strncmp(ptr, "null", 4)==0) {
-				return !IDENT_CHARS[static_cast<uint8_t>(ptr[4])];
-			} else if (strncmp(ptr, "false", 5)==0) {
+		// Strings
+		options.str_csharp_verbatim      = false;
+		options.str_python_multiline     = false;
+		options.str_32bit_unicode        = false;
+		options.str_allow_tab            = false;
+
+		// Special
+		options.allow_macro              = false;
+
+		// When writing:
+		options.write_comments           = false;
+		options.sort_keys                = false;
+
+		return options;
+	}
+
+	/// Returns format options that allow us parsing most files.
+	inline FormatOptions make_forgiving_options()
+	{
+		FormatOptions options;
+
+		options.indentation              = "\t";
+		options.enforce_indentation      = false;
+
+		// Top file:
+		options.empty_file               = true;
+		options.implicit_top_object      = true;
+		options.implicit_top_array       = true;
+
+		// Comments:
+		options.single_line_comments     = true;
+		options.block_comments           = true;
+		options.nesting_block_comments   = true;
+
+		// Numbers:
+		options.inf                      = true;
+		options.nan                      = true;
+		options.hexadecimal_integers     = true;
+		options.binary_integers          = true;
+		options.unary_plus               = true;
+		options.distinct_floats          = true;
+
+		// Arrays
+		options.array_omit_comma         = true;
+		options.array_trailing_comma     = true;
+
+		// Objects:
+		options.identifiers_keys         = true;
+		options.object_separator_equal   = true;
+		options.allow_space_before_colon = true;
+		options.omit_colon_before_object = true;
+		options.object_omit_comma        = true;
+		options.object_trailing_comma    = true;
+		options.object_duplicate_keys    = true;
+
+		// Strings
+		options.str_csharp_verbatim      = true;
+		options.str_python_multiline     = true;
+		options.str_32bit_unicode        = true;
+		options.str_allow_tab            = true;
+
+		// Special
+		options.allow_macro              = true;
+
+		// When writing:
+		options.write_comments           = false;
+		options.sort_keys                = false;
+
+		return options;
+	}
+
+	/// The CFG file format.
+	static const FormatOptions CFG       = FormatOptions();
+
+	/// The JSON file format.
+	static const FormatOptions JSON      = make_json_options();
+
+	/// A very forgiving file format, when parsing stuff that is not strict.
+	static const FormatOptions FORGIVING = make_forgiving_options();
+
+	/// The size and a hash of the contents of a file, to tell if it has changed.
+	struct FileStamp
+	{
+		uint64_t size = 0;
+		uint64_t hash = 0;
+	};
+
+	struct ParseInfo
+	{
+		std::map<std::string, Config> parsed_files; // Two #include gives same Config tree.
+		std::map<std::string, FileStamp> read_files; ///< Every file read. Only filled in if FormatOptions::parse_cache is set.
+	};
+
+	/// The parser may throw ParseError.
+	/// `str` should be a zero-ended Utf-8 encoded string of characters.
+	/// The `name` should be something akin to a filename. It is only for error reporting.
+	Config parse_string(const char* str, const FormatOptions& options, const char* name);
+	Config parse_file(const std::string& path, const FormatOptions& options);
+
+	/// Advanced usage:
+	Config parse_string(const char* str, const FormatOptions& options, DocInfo _doc, ParseInfo& info);
+	Config parse_file(const std::string& path, const FormatOptions& options, DocInfo_SP doc, ParseInfo& info);
+
+	struct Parser;
+
+	/// Reads the text formats one value at a time without building a Config,
+	/// so they can be read straight into your own types (see parse_into).
+	/// Follows the same grammar and FormatOptions as parse_string, and reports problems with the same ParseError.
+	/// Comments are skipped. An #include is read as if the value of the included file was written in its place.
+	///
+	/// Before each value, call next() to see what it is, then read it with one of the read_ functions,
+	/// begin_array, begin_object or skip_value. At the top level, Object means key-value pairs with or without braces.
+	class PullParser
+	{
+	public:
+		enum class Next { Null, Bool, Number, String, Array, Object };
+
+		/// `str` should be a zero-ended Utf-8 encoded string, and must outlive the PullParser.
+		/// The `name` should be something akin to a filename. It is only for error reporting.
+		PullParser(const char* str, const FormatOptions& options, const char* name);
+		/// Reads the file at `path`.
+		PullParser(const std::string& path, const FormatOptions& options);
+		~PullParser();
+
+		PullParser(const PullParser&) = delete;
+		PullParser& operator=(const PullParser&) = delete;
+
+		/// What the next value is. Throws if there is no value there.
+		Next next();
+
+		/// Reads the next value, which must be of the given type, else throws a ParseError.
+		bool        read_bool();
+		int64_t     read_int();
+		double      read_double(); ///< Integers are fine too.
+		std::string read_string();
+
+		/// Reads past the next value, whatever it is.
+		void skip_value();
+
+		/// Enters the next value, which must be an array. Then call next_element() before each element.
+		void begin_array();
+		/// Returns false at the end of the array, and leaves it.
+		bool next_element();
+
+		/// Enters the next value, which must be an object. Then call next_key() before each value.
+		void begin_object();
+		/// Sets `key` to the key of the next value, or returns false at the end of the object, and leaves it.
+		bool next_key(std::string& key);
+
+		/// Call after reading the top-level value, to check that nothing follows it.
+		void finish();
+
+		const FormatOptions& options() const { return _options; }
+
+		/// Throws a ParseError pointing at the key or value last started on,
+		/// or at the start of the array or object just left.
+		void throw_error(const std::string& msg) CONFIGURU_NORETURN;
+
+	private:
+		struct Source;
+
+		Parser& parser() { return *_parser; }
+		void enter_includes();
+		void end_value();
+
+		FormatOptions                        _options;
+		ParseInfo                            _info;
+		std::vector<std::unique_ptr<Source>> _sources; ///< The file we are in last, after the ones that #include it.
+		Parser*                              _parser = nullptr; ///< The one of _sources.back().
+	};
+
+	// ----------------------------------------------------------
+	/// Writes the config as a string in the given format.
+	/// May call CONFIGURU_ONERROR if the given config is invalid. This can happen if
+	/// a Config is unitialized (and options write_uninitialized is not set) or
+	/// a Config contains inf/nan (and options.inf/options.nan aren't set).
+	std::string dump_string(const Config& config, const FormatOptions& options);
+
+	/// Where the streaming dump functions send their output.
+	class OutputSink
+	{
+	public:
+		virtual ~OutputSink() = default;
+
+		/// Called with consecutive pieces of the output. Report errors with CONFIGURU_ONERROR.
+		virtual void write(const char* data, size_t size) = 0;
+	};
+
+	/// Like dump_string, but sends the output to `sink` in pieces of about `buffer_size` bytes
+	/// as it is produced, instead of building it all in memory first.
+	/// If the dump fails part way, what has already been sent stays sent.
+	void dump(OutputSink& sink, const Config& config, const FormatOptions& options, size_t buffer_size = 64 * 1024);
+
+	/// Streams the config to `os`. Calls CONFIGURU_ONERROR if the stream fails.
+	void dump(std::ostream& os, const Config& config, const FormatOptions& options);
+
+	/// Streams the config to `fp`. Calls CONFIGURU_ONERROR if writing fails. Does not close `fp`.
+	void dump(FILE* fp, const Config& config, const FormatOptions& options);
+
+	/// Streams the config to the file descriptor `fd`. Calls CONFIGURU_ONERROR if writing fails. Does not close `fd`.
+	void dump_fd(int fd, const Config& config, const FormatOptions& options);
+
+	/// Writes the config to a file. Like dump_string, but can may also call CONFIGURU_ONERROR
+	/// if it fails to write to the given path.
+	/// The output is streamed to the file as it is produced, so if the dump fails part way
+	/// the file is left partially written.
+	void dump_file(const std::string& path, const Config& config, const FormatOptions& options);
+
+	/// Like the above, but the children of big arrays and objects, and of those near the root,
+	/// are written on the threads of `pool` into separate buffers that are then put together in order.
+	/// The output is exactly the same as without the pool.
+	/// The streaming versions keep what a split value writes in memory until it is done.
+	/// If more than one value fails to serialize, which of the errors is reported may differ.
+	std::string dump_string(const Config& config, const FormatOptions& options, ThreadPool& pool);
+	void dump(OutputSink& sink, const Config& config, const FormatOptions& options, ThreadPool& pool,
+	          size_t buffer_size = 64 * 1024);
+	void dump_file(const std::string& path, const Config& config, const FormatOptions& options, ThreadPool& pool);
+
+	struct Writer;
+
+	/// Dumps many configs with the same options. Keeps its lookup tables between calls,
+	/// and can write into a string you reuse, so dumping small configs in a loop does not allocate.
+	/// Not thread safe: use one Serializer per thread.
+	class Serializer
+	{
+	public:
+		explicit Serializer(const FormatOptions& options);
+		~Serializer();
+
+		Serializer(const Serializer&) = delete;
+		Serializer& operator=(const Serializer&) = delete;
+
+		const FormatOptions& options() const;
+
+		/// Same as dump_string(config, options()).
+		std::string dump(const Config& config);
+
+		/// Like dump, but replaces the contents of `out`, reusing its capacity.
+		void dump_into(const Config& config, std::string& out);
+
+		/// A quick guess at the size of the output, from a walk over the config without any formatting.
+		/// Used to reserve space before dumping. Does not mark anything as accessed.
+		size_t estimate_size(const Config& config) const;
+
+	private:
+		std::unique_ptr<Writer> _writer;
+	};
+
+	/// Writes the text formats one value at a time without building a Config,
+	/// so your own types can be dumped straight to text (see dump_struct).
+	/// The output is the same as dump_string gives for the Config holding the same values, as long as
+	/// the keys of each object are written in sorted order when options().sort_keys is set,
+	/// and begin_object is told the length of the longest key when options().object_align_values is set.
+	/// Reuse one to dump many values without allocating. Not thread safe.
+	class PushWriter
+	{
+	public:
+		explicit PushWriter(const FormatOptions& options);
+		~PushWriter();
+
+		PushWriter(const PushWriter&) = delete;
+		PushWriter& operator=(const PushWriter&) = delete;
+
+		const FormatOptions& options() const;
+
+		/// May call CONFIGURU_ONERROR, e.g. for inf/nan (unless options().inf/options().nan are set).
+		void write_null();
+		void write_bool(bool value);
+		void write_int(int64_t value);
+		void write_double(double value);
+		void write_string(const std::string& value);
+
+		void begin_array();
+		void end_array();
+
+		void begin_object(size_t longest_key = 0);
+		/// Call before each value in the object.
+		void write_key(const std::string& key);
+		void end_object();
+
+		/// Call after writing the top-level value. Swaps the output into `out`,
+		/// and keeps what was in `out` to write the next one into.
+		void finish(std::string& out);
+
+		/// Throws away anything written since the last finish, e.g. after an error.
+		void clear();
+
+	private:
+		struct Impl;
+		std::unique_ptr<Impl> _impl;
+	};
+
+	// ----------------------------------------------------------
+	// Binary formats: CBOR (RFC 8949) and MessagePack.
+	// They map directly to the Config types, without going through text:
+	// * Integers are 64 bit signed, so reading a bigger unsigned one is an error.
+	// * Floats that are exactly a 32 bit float are written as such. Half floats can be read.
+	// * Byte strings are read as strings, and CBOR tags are skipped. Object keys must be strings.
+	// * Objects are written in the order the keys were added, like dump_string does.
+	// * Comments, and which file and line a value came from, are not kept.
+	// Parse errors are thrown as ParseError naming the byte offset of the problem.
+	// Dumping marks everything as accessed, like dump_string does by default.
+
+	/// Arrays and objects nested deeper than this are a parse error, so bad input can't overflow the stack.
+	const unsigned BINARY_MAX_DEPTH = 512;
+
+	std::string dump_cbor(const Config& config);
+
+	/// Sends the output to `sink` in pieces of about `buffer_size` bytes, as it is produced.
+	void dump_cbor(OutputSink& sink, const Config& config, size_t buffer_size = 64 * 1024);
+
+	/// Parses exactly one value taking up all of the `size` bytes. `name` is only for error messages.
+	Config parse_cbor(const void* data, size_t size, const char* name);
+
+	/// Reads exactly one value from `is`, and nothing after it.
+	Config parse_cbor(std::istream& is, const char* name);
+
+	std::string dump_msgpack(const Config& config);
+	void dump_msgpack(OutputSink& sink, const Config& config, size_t buffer_size = 64 * 1024);
+	Config parse_msgpack(const void* data, size_t size, const char* name);
+	Config parse_msgpack(std::istream& is, const char* name);
+
+	// ----------------------------------------------------------
+	// Snapshots: the tables of a FrozenConfig as a file, which is used straight from memory when loaded.
+	// No parsing and no allocation, so even a huge config loads instantly when the file is mapped.
+	// The tables are stored as they are in memory, so a snapshot can only be read on a machine
+	// with the same endianness (this is checked). The layout is a 64 byte header,
+	// then the nodes, keys, ints, floats and strings tables back to back, all 8 byte aligned.
+
+	/// Only change for incompatible changes to the snapshot layout.
+	const uint32_t SNAPSHOT_VERSION = 1;
+
+	std::string dump_snapshot(const FrozenConfig& frozen);
+	void dump_snapshot(OutputSink& sink, const FrozenConfig& frozen);
+	void dump_snapshot_file(const std::string& path, const FrozenConfig& frozen);
+
+	enum class SnapshotCheck
+	{
+		Validate, ///< Check every node, key and string before use. Linear in the size, but cheap next to parsing.
+		Trusted,  ///< Only check the header. Only for files you wrote yourself: a bad file can crash you.
+	};
+
+	/// Is `data` a snapshot which is safe to use? If not, `error` (if given) is set to what is wrong.
+	bool validate_snapshot(const void* data, size_t size, std::string* error = nullptr);
+
+	/// A FrozenConfig using the snapshot in `data` in place. The memory must be 8 byte aligned,
+	/// and must outlive the returned FrozenConfig and everything you get from it.
+	/// A bad snapshot is reported as a ParseError. `name` is only for error messages.
+	FrozenConfig view_snapshot(const void* data, size_t size, const char* name,
+	                           SnapshotCheck check = SnapshotCheck::Validate);
+
+	/// Maps the snapshot file into memory and uses it in place. The mapping lives as long as the FrozenConfig.
+	FrozenConfig map_snapshot_file(const std::string& path, SnapshotCheck check = SnapshotCheck::Validate);
+
+	// ----------------------------------------------------------
+	// Automatic (de)serialize of most things.
+	// Include <visit_struct/visit_struct.hpp> (from https://github.com/cbeck88/visit_struct)
+	// before including <configuru.hpp> to get this feature.
+
+	#ifdef VISITABLE_STRUCT
+		template <typename Type> struct is_container : std::false_type { };
+		// template <typename... Ts> struct is_container<std::list<Ts...> > : std::true_type { };
+		template <typename... Ts> struct is_container<std::vector<Ts...> > : std::true_type { };
+
+		template <typename Type> struct is_std_array : std::false_type { };
+		template <typename T, size_t N> struct is_std_array<std::array<T, N> > : std::true_type { };
+
+		template <typename Type> struct is_map : std::false_type { };
+		template <typename... Ts> struct is_map<std::map<Ts...> > : std::true_type { };
+		template <typename... Ts> struct is_map<std::unordered_map<Ts...> > : std::true_type { };
+
+		/// Specialize as std::true_type for a visitable struct to have deserialize report keys
+		/// that are not fields of it as errors. By default they are ignored (and not marked as accessed).
+		template <typename Type> struct report_unknown_keys : std::false_type { };
+
+		// ----------------------------------------------------------------------------
+
+		Config serialize(const std::string& some_string);
+
+		template<typename T>
+		typename std::enable_if<std::is_arithmetic<T>::value, Config>::type
+		serialize(const T& some_value);
+
+		template<typename T>
+		typename std::enable_if<std::is_enum<T>::value, Config>::type
+		serialize(const T& some_enum);
+
+		template<typename T, size_t N>
+		Config serialize(T (&some_array)[N]);
+
+		template<typename T>
+		typename std::enable_if<is_container<T>::value || is_std_array<T>::value, Config>::type
+		serialize(const T& some_container);
+
+		template<typename T>
+		typename std::enable_if<is_map<T>::value, Config>::type
+		serialize(const T& some_map);
+
+		template<typename T>
+		typename std::enable_if<visit_struct::traits::is_visitable<T>::value, Config>::type
+		serialize(const T& some_struct);
+
+		// ----------------------------------------------------------------------------
+
+		inline Config serialize(const std::string& some_string)
+		{
+			return Config(some_string);
+		}
+
+		template<typename T>
+		typename std::enable_if<std::is_arithmetic<T>::value, Config>::type
+		serialize(const T& some_value)
+		{
+			return Config(some_value);
+		}
+
+		template<typename T>
+		typename std::enable_if<std::is_enum<T>::value, Config>::type
+		serialize(const T& some_enum)
+		{
+			return Config(static_cast<int>(some_enum));
+		}
+
+		template<typename T, size_t N>
+		Config serialize(T (&some_array)[N])
+		{
+			auto config = Config::array();
+			for (size_t i = 0; i < N; ++i) {
+				config.push_back(serialize(some_array[i]));
+			}
+			return config;
+		}
+
+		template<typename T>
+		typename std::enable_if<is_container<T>::value || is_std_array<T>::value, Config>::type
+		serialize(const T& some_container)
+		{
+			auto config = Config::array();
+			for (const auto& value : some_container) {
+				config.push_back(serialize(value));
+			}
+			return config;
+		}
+
+		template<typename T>
+		typename std::enable_if<is_map<T>::value, Config>::type
+		serialize(const T& some_map)
+		{
+			auto config = Config::array();
+			for (const auto& pair : some_map) {
+				config.push_back(Config::array({serialize(pair.first), serialize(pair.second)}));
+			}
+			return config;
+		}
+
+		template<typename T>
+		typename std::enable_if<visit_struct::traits::is_visitable<T>::value, Config>::type
+		serialize(const T& some_struct)
+		{
+			auto config = Config::object();
+			visit_struct::apply_visitor([&config](const std::string& name, const auto& value) {
+				config[name] = serialize(value);
+			}, some_struct);
+			return config;
+		}
+
+		// ----------------------------------------------------------------------------
+
+		/// Called when there is a problem in deserialize.
+		using ConversionError = std::function<void(std::string)>;
+
+		void deserialize(std::string* some_string, const Config& config, const ConversionError& on_error);
+
+		template<typename T>
+		typename std::enable_if<std::is_arithmetic<T>::value>::type
+		deserialize(T* some_value, const Config& config, const ConversionError& on_error);
+
+		template<typename T>
+		typename std::enable_if<std::is_enum<T>::value>::type
+		deserialize(T* some_enum, const Config& config, const ConversionError& on_error);
+
+		template<typename T, size_t N>
+		typename std::enable_if<std::is_arithmetic<T>::value>::type
+		deserialize(T (*some_array)[N], const Config& config, const ConversionError& on_error);
+
+		template<typename T>
+		typename std::enable_if<is_std_array<T>::value>::type
+		deserialize(T* some_array, const Config& config, const ConversionError& on_error);
+
+		template<typename T>
+		typename std::enable_if<is_container<T>::value>::type
+		deserialize(T* some_container, const Config& config, const ConversionError& on_error);
+
+		template<typename T>
+		typename std::enable_if<is_map<T>::value>::type
+		deserialize(T* some_map, const Config& config, const ConversionError& on_error);
+
+		template<typename T>
+		typename std::enable_if<visit_struct::traits::is_visitable<T>::value>::type
+		deserialize(T* some_struct, const Config& config, const ConversionError& on_error);
+
+		// ----------------------------------------------------------------------------
+
+		void parse_into(PullParser& p, std::string* some_string);
+
+		template<typename T>
+		typename std::enable_if<std::is_arithmetic<T>::value>::type
+		parse_into(PullParser& p, T* some_value);
+
+		template<typename T>
+		typename std::enable_if<std::is_enum<T>::value>::type
+		parse_into(PullParser& p, T* some_enum);
+
+		template<typename T, size_t N>
+		void parse_into(PullParser& p, T (*some_array)[N]);
+
+		template<typename T>
+		typename std::enable_if<is_std_array<T>::value>::type
+		parse_into(PullParser& p, T* some_array);
+
+		template<typename T>
+		typename std::enable_if<is_container<T>::value>::type
+		parse_into(PullParser& p, T* some_container);
+
+		template<typename T>
+		typename std::enable_if<is_map<T>::value>::type
+		parse_into(PullParser& p, T* some_map);
+
+		template<typename T>
+		typename std::enable_if<visit_struct::traits::is_visitable<T>::value>::type
+		parse_into(PullParser& p, T* some_struct);
+
+		// ----------------------------------------------------------------------------
+
+		void serialize(PushWriter& w, const std::string& some_string);
+
+		template<typename T>
+		typename std::enable_if<std::is_arithmetic<T>::value>::type
+		serialize(PushWriter& w, const T& some_value);
+
+		template<typename T>
+		typename std::enable_if<std::is_enum<T>::value>::type
+		serialize(PushWriter& w, const T& some_enum);
+
+		template<typename T, size_t N>
+		void serialize(PushWriter& w, const T (&some_array)[N]);
+
+		template<typename T>
+		typename std::enable_if<is_container<T>::value || is_std_array<T>::value>::type
+		serialize(PushWriter& w, const T& some_container);
+
+		template<typename T>
+		typename std::enable_if<is_map<T>::value>::type
+		serialize(PushWriter& w, const T& some_map);
+
+		template<typename T>
+		typename std::enable_if<visit_struct::traits::is_visitable<T>::value>::type
+		serialize(PushWriter& w, const T& some_struct);
+
+		/// The fields of a visitable struct sorted by name, each with how to deserialize,
+		/// parse into and write it. Built once per struct type.
+		template<typename T>
+		struct StructFields
+		{
+			struct Field
+			{
+				std::string name;
+				std::function<void(T*, const Config&, const ConversionError&)> read;
+				std::function<void(T*, PullParser&)> parse;
+				std::function<void(const T&, PushWriter&)> write;
+			};
+
+			static const std::vector<Field>& sorted()
+			{
+				static const std::vector<Field> s_fields = make_fields();
+				return s_fields;
+			}
+
+			/// The same fields, in the order they are declared in.
+			static const std::vector<const Field*>& declared()
+			{
+				static const std::vector<const Field*> s_declared = make_declared();
+				return s_declared;
+			}
+
+			static size_t longest_name()
+			{
+				static const size_t s_longest = [] {
+					size_t longest = 0;
+					for (const auto& field : sorted()) {
+						longest = (std::max)(longest, field.name.size());
+					}
+					return longest;
+				}();
+				return s_longest;
+			}
+
+		private:
+			static std::vector<Field> make_fields()
+			{
+				std::vector<Field> fields;
+				visit_struct::apply_visitor<T>([&fields](const char* name, auto member) {
+					fields.push_back({name, [member](T* some_struct, const Config& config, const ConversionError& on_error) {
+						deserialize(&(some_struct->*member), config, on_error);
+					}, [member](T* some_struct, PullParser& p) {
+						parse_into(p, &(some_struct->*member));
+					}, [member](const T& some_struct, PushWriter& w) {
+						serialize(w, some_struct.*member);
+					}});
+				});
+				std::sort(fields.begin(), fields.end(), [](const Field& a, const Field& b) { return a.name < b.name; });
+				return fields;
+			}
+
+			static std::vector<const Field*> make_declared()
+			{
+				const auto& fields = sorted();
+				std::vector<const Field*> declared;
+				visit_struct::apply_visitor<T>([&](const char* name, auto) {
+					declared.push_back(&*std::lower_bound(fields.begin(), fields.end(), name,
+						[](const Field& field, const char* key) { return field.name < key; }));
+				});
+				return declared;
+			}
+		};
+
+		// ----------------------------------------------------------------------------
+
+		inline void deserialize(std::string* some_string, const Config& config, const ConversionError& on_error)
+		{
+			*some_string = config.as_string();
+		}
+
+		template<typename T>
+		typename std::enable_if<std::is_arithmetic<T>::value>::type
+		deserialize(T* some_value, const Config& config, const ConversionError& on_error)
+		{
+			*some_value = as<T>(config);
+		}
+
+		template<typename T>
+		typename std::enable_if<std::is_enum<T>::value>::type
+		deserialize(T* some_enum, const Config& config, const ConversionError& on_error)
+		{
+			*some_enum = static_cast<T>(as<int>(config));
+		}
+
+		template<typename T, size_t N>
+		typename std::enable_if<std::is_arithmetic<T>::value>::type
+		deserialize(T (*some_array)[N], const Config& config, const ConversionError& on_error)
+		{
+			if (!config.is_array()) {
+				if (on_error) {
+					on_error(config.where() + "Expected array");
+				}
+			} else if (config.array_size() != N) {
+				if (on_error) {
+					on_error(config.where() + "Expected array to be " + std::to_string(N) + " long.");
+				}
+			} else {
+				for (size_t i = 0; i < N; ++i) {
+					deserialize(&(*some_array)[i], config[i], on_error);
+				}
+			}
+		}
+
+		template<typename T>
+		typename std::enable_if<is_std_array<T>::value>::type
+		deserialize(T* some_array, const Config& config, const ConversionError& on_error)
+		{
+			if (!config.is_array()) {
+				if (on_error) {
+					on_error(config.where() + "Expected array");
+				}
+			} else if (config.array_size() != some_array->size()) {
+				if (on_error) {
+					on_error(config.where() + "Expected array to be " + std::to_string(some_array->size()) + " long.");
+				}
+			} else {
+				for (size_t i = 0; i < some_array->size(); ++i) {
+					deserialize(&(*some_array)[i], config[i], on_error);
+				}
+			}
+		}
+
+		template<typename T>
+		typename std::enable_if<is_container<T>::value>::type
+		deserialize(T* some_container, const Config& config, const ConversionError& on_error)
+		{
+			if (!config.is_array()) {
+				if (on_error) {
+					on_error(config.where() + "Failed to deserialize container: config is not an array.");
+				}
+			} else {
+				some_container->clear();
+				some_container->reserve(config.array_size());
+				for (const auto& value : config.elements()) {
+					some_container->push_back({});
+					deserialize(&some_container->back(), value, on_error);
+				}
+			}
+		}
+
+		template<typename T>
+		typename std::enable_if<is_map<T>::value>::type
+		deserialize(T* some_map, const Config& config, const ConversionError& on_error)
+		{
+			if (!config.is_array()) {
+				if (on_error) {
+					on_error(config.where() + "Failed to deserialize map: config is not an array.");
+				}
+			} else {
+				some_map->clear();
+				for (const auto& pair : config.as_array()) {
+					if (pair.is_array() && pair.array_size() == 2) {
+						typename T::key_type key;
+						deserialize(&key, pair[0], on_error);
+						typename T::mapped_type value;
+						deserialize(&value, pair[1], on_error);
+						some_map->emplace(std::make_pair(std::move(key), std::move(value)));
+					} else {
+						if (on_error) {
+							on_error(config.where() + "Failed to deserialize map: expected array of [key, value] array-pairs.");
+						}
+					}
+				}
+			}
+		}
+
+		template<typename T>
+		typename std::enable_if<visit_struct::traits::is_visitable<T>::value>::type
+		deserialize(T* some_struct, const Config& config, const ConversionError& on_error)
+		{
+			if (!config.is_object()) {
+				if (on_error) {
+					on_error(config.where() + "Failed to deserialize object: config is not an object.");
+				}
+			} else {
+				// Both are sorted by key, so we can match them up in one pass:
+				const auto& fields = StructFields<T>::sorted();
+				auto field = fields.begin();
+				for (auto&& p : config.as_object()._impl) {
+					int cmp = -1;
+					while (field != fields.end() && (cmp = field->name.compare(p.first)) < 0) {
+						++field;
+					}
+					if (cmp == 0) {
+						p.second._accessed.mark();
+						field->read(some_struct, p.second._value, on_error);
+					} else if (report_unknown_keys<T>::value && on_error) {
+						on_error(p.second._value.where() + "Failed to deserialize object: unknown key '" + p.first + "'.");
+					}
+				}
+			}
+		}
+
+		// ----------------------------------------------------------------------------
+		// parse_into: like deserialize of parse_string, but without the Config in between.
+
+		/// Parses `str` straight into `out`. Gives the same result as deserializing what parse_string returns,
+		/// but is faster and needs much less memory, since no Config is built.
+		/// Keys that are not fields of a struct are skipped, or reported if report_unknown_keys is set for it.
+		/// Fields that are not in the input are left as they were.
+		/// Anything wrong, including values of the wrong type, is reported as a ParseError with its line and column.
+		/// The input must be a single value (which can be key-value pairs without braces, as usual).
+		template<typename T>
+		void parse_into(const char* str, const FormatOptions& options, T& out, const char* name = "string")
+		{
+			PullParser p(str, options, name);
+			parse_into(p, &out);
+			p.finish();
+		}
+
+		/// Like parse_into, but reads the file at `path`.
+		template<typename T>
+		void parse_file_into(const std::string& path, const FormatOptions& options, T& out)
+		{
+			PullParser p(path, options);
+			parse_into(p, &out);
+			p.finish();
+		}
+
+		inline void parse_into(PullParser& p, std::string* some_string)
+		{
+			*some_string = p.read_string();
+		}
+
+		template<typename T>
+		typename std::enable_if<std::is_arithmetic<T>::value>::type
+		parse_into(PullParser& p, T* some_value)
+		{
+			if (std::is_same<T, bool>::value) {
+				*some_value = p.read_bool();
+			} else if (std::is_integral<T>::value) {
+				const int64_t value = p.read_int();
+				if (static_cast<int64_t>(static_cast<T>(value)) != value) {
+					p.throw_error("Integer out of range");
+				}
+				*some_value = static_cast<T>(value);
+			} else {
+				*some_value = static_cast<T>(p.read_double());
+			}
+		}
+
+		template<typename T>
+		typename std::enable_if<std::is_enum<T>::value>::type
+		parse_into(PullParser& p, T* some_enum)
+		{
+			int value;
+			parse_into(p, &value);
+			*some_enum = static_cast<T>(value);
+		}
+
+		template<typename T>
+		void parse_elements(PullParser& p, T* elements, size_t count)
+		{
+			p.begin_array();
+			size_t i = 0;
+			for (; p.next_element(); ++i) {
+				if (i == count) {
+					p.throw_error("Expected array to be " + std::to_string(count) + " long.");
+				}
+				parse_into(p, &elements[i]);
+			}
+			if (i != count) {
+				p.throw_error("Expected array to be " + std::to_string(count) + " long.");
+			}
+		}
+
+		template<typename T, size_t N>
+		void parse_into(PullParser& p, T (*some_array)[N])
+		{
+			parse_elements(p, *some_array, N);
+		}
+
+		template<typename T>
+		typename std::enable_if<is_std_array<T>::value>::type
+		parse_into(PullParser& p, T* some_array)
+		{
+			parse_elements(p, some_array->data(), some_array->size());
+		}
+
+		template<typename T>
+		typename std::enable_if<is_container<T>::value>::type
+		parse_into(PullParser& p, T* some_container)
+		{
+			p.begin_array();
+			some_container->clear();
+			while (p.next_element()) {
+				some_container->push_back({});
+				parse_into(p, &some_container->back());
+			}
+		}
+
+		template<typename T>
+		typename std::enable_if<is_map<T>::value>::type
+		parse_into(PullParser& p, T* some_map)
+		{
+			p.begin_array();
+			some_map->clear();
+			while (p.next_element()) {
+				typename T::key_type key;
+				typename T::mapped_type value;
+				p.begin_array();
+				if (!p.next_element()) {
+					p.throw_error("Expected a [key, value] array-pair.");
+				}
+				parse_into(p, &key);
+				if (!p.next_element()) {
+					p.throw_error("Expected a [key, value] array-pair.");
+				}
+				parse_into(p, &value);
+				if (p.next_element()) {
+					p.throw_error("Expected a [key, value] array-pair.");
+				}
+				some_map->emplace(std::make_pair(std::move(key), std::move(value)));
+			}
+		}
+
+		template<typename T>
+		typename std::enable_if<visit_struct::traits::is_visitable<T>::value>::type
+		parse_into(PullParser& p, T* some_struct)
+		{
+			using Field = typename StructFields<T>::Field;
+			const auto& fields = StructFields<T>::sorted();
+			const bool check_duplicates = !p.options().object_duplicate_keys;
+			std::vector<bool> seen_fields(check_duplicates ? fields.size() : 0);
+			std::vector<std::string> seen_unknown;
+
+			p.begin_object();
+			std::string key;
+			while (p.next_key(key)) {
+				auto field = std::lower_bound(fields.begin(), fields.end(), key, [](const Field& f, const std::string& k) {
+					return f.name < k;
+				});
+				if (field != fields.end() && field->name == key) {
+					if (check_duplicates) {
+						const size_t index = static_cast<size_t>(field - fields.begin());
+						if (seen_fields[index]) {
+							p.throw_error("Duplicate key: \"" + key + "\"");
+						}
+						seen_fields[index] = true;
+					}
+					field->parse(some_struct, p);
+				} else if (report_unknown_keys<T>::value) {
+					p.throw_error("Failed to deserialize object: unknown key '" + key + "'.");
+				} else {
+					if (check_duplicates) {
+						if (std::find(seen_unknown.begin(), seen_unknown.end(), key) != seen_unknown.end()) {
+							p.throw_error("Duplicate key: \"" + key + "\"");
+						}
+						seen_unknown.push_back(key);
+					}
+					p.skip_value();
+				}
+			}
+		}
+
+		// ----------------------------------------------------------------------------
+		// dump_struct: like dump_string of serialize, but without the Config in between.
+
+		/// Writes `value` as text. Gives the same as dump_string(serialize(value), options),
+		/// but faster, since no Config is built.
+		template<typename T>
+		std::string dump_struct(const T& value, const FormatOptions& options)
+		{
+			PushWriter w(options);
+			serialize(w, value);
+			std::string out;
+			w.finish(out);
+			return out;
+		}
+
+		/// Like the above, but replaces the contents of `out`. Reusing the writer and `out`
+		/// for dumping many values means no allocations once they have grown big enough.
+		template<typename T>
+		void dump_struct(PushWriter& writer, const T& value, std::string& out)
+		{
+			writer.clear();
+			serialize(writer, value);
+			writer.finish(out);
+		}
+
+		inline void serialize(PushWriter& w, const std::string& some_string)
+		{
+			w.write_string(some_string);
+		}
+
+		template<typename T>
+		typename std::enable_if<std::is_arithmetic<T>::value>::type
+		serialize(PushWriter& w, const T& some_value)
+		{
+			if (std::is_same<T, bool>::value) {
+				w.write_bool(some_value != 0);
+			} else if (std::is_floating_point<T>::value) {
+				w.write_double(static_cast<double>(some_value));
+			} else {
+				if (std::is_unsigned<T>::value && static_cast<uint64_t>(some_value) > 0x7fffffffffffffffull) {
+					CONFIGURU_ONERROR("Integer too large to fit into 63 bits");
+				}
+				w.write_int(static_cast<int64_t>(some_value));
+			}
+		}
+
+		template<typename T>
+		typename std::enable_if<std::is_enum<T>::value>::type
+		serialize(PushWriter& w, const T& some_enum)
+		{
+			w.write_int(static_cast<int>(some_enum));
+		}
+
+		template<typename T, size_t N>
+		void serialize(PushWriter& w, const T (&some_array)[N])
+		{
+			w.begin_array();
+			for (size_t i = 0; i < N; ++i) {
+				serialize(w, some_array[i]);
+			}
+			w.end_array();
+		}
+
+		template<typename T>
+		typename std::enable_if<is_container<T>::value || is_std_array<T>::value>::type
+		serialize(PushWriter& w, const T& some_container)
+		{
+			w.begin_array();
+			for (const auto& value : some_container) {
+				serialize(w, value);
+			}
+			w.end_array();
+		}
+
+		template<typename T>
+		typename std::enable_if<is_map<T>::value>::type
+		serialize(PushWriter& w, const T& some_map)
+		{
+			w.begin_array();
+			for (const auto& pair : some_map) {
+				w.begin_array();
+				serialize(w, pair.first);
+				serialize(w, pair.second);
+				w.end_array();
+			}
+			w.end_array();
+		}
+
+		template<typename T>
+		typename std::enable_if<visit_struct::traits::is_visitable<T>::value>::type
+		serialize(PushWriter& w, const T& some_struct)
+		{
+			w.begin_object(StructFields<T>::longest_name());
+			if (w.options().sort_keys) {
+				for (const auto& field : StructFields<T>::sorted()) {
+					w.write_key(field.name);
+					field.write(some_struct, w);
+				}
+			} else {
+				for (const auto* field : StructFields<T>::declared()) {
+					w.write_key(field->name);
+					field->write(some_struct, w);
+				}
+			}
+			w.end_object();
+		}
+	#endif // VISITABLE_STRUCT
+
+} // namespace configuru
+
+namespace std
+{
+	/// So that a Config can be used as a key in an unordered_map.
+	template<>
+	struct hash<configuru::Config>
+	{
+		size_t operator()(const configuru::Config& config) const { return config.hash(); }
+	};
+}
+
+#endif // CONFIGURU_HEADER_HPP
+
+// ----------------------------------------------------------------------------
+// 88 8b    d8 88""Yb 88     888888 8b    d8 888888 88b 88 888888    db    888888 88  dP"Yb  88b 88
+// 88 88b  d88 88__dP 88     88__   88b  d88 88__   88Yb88   88     dPYb     88   88 dP   Yb 88Yb88
+// 88 88YbdP88 88"""  88  .o 88""   88YbdP88 88""   88 Y88   88    dP__Yb    88   88 Yb   dP 88 Y88
+// 88 88 YY 88 88     88ood8 888888 88 YY 88 888888 88  Y8   88   dP""""Yb   88   88  YbodP  88  Y8
+
+/* In one of your .cpp files you need to do the following:
+#define CONFIGURU_IMPLEMENTATION
+#include <configuru.hpp>
+
+This will define all the Configuru functions so that the linker may find them.
+*/
+
+#if defined(CONFIGURU_IMPLEMENTATION) && !defined(CONFIGURU_HAS_BEEN_IMPLEMENTED)
+#define CONFIGURU_HAS_BEEN_IMPLEMENTED
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <limits>
+#include <mutex>
+#include <ostream>
+#include <set>
+#include <thread>
+
+// ----------------------------------------------------------------------------
+namespace configuru
+{
+	void DocInfo::append_include_info(std::string& ret, const std::string& indent) const
+	{
+		if (!includers.empty()) {
+			ret += ", included at:\n";
+			for (auto&& includer : includers) {
+				ret += indent + includer.doc->filename + ":" + std::to_string(includer.line);
+				includer.doc->append_include_info(ret, indent + "    ");
+				ret += "\n";
+			}
+			ret.pop_back();
+		}
+	}
+
+	struct BadLookupInfo
+	{
+		const DocInfo_SP      doc;      // Of parent object
+		const unsigned        line;     // Of parent object
+		const std::string     key;
+
+		#if !CONFIGURU_VALUE_SEMANTICS || CONFIGURU_COPY_ON_WRITE
+			RefCount _ref_count;
+		#endif
+
+		BadLookupInfo(DocInfo_SP doc_, Index line_, std::string key_)
+			: doc(std::move(doc_)), line(line_), key(std::move(key_)) {}
+	};
+
+	Config::Config(const char* str) : _type(String)
+	{
+		CONFIGURU_ASSERT(str != nullptr);
+		_u.str = new std::string(str);
+	}
+
+	Config::Config(std::string str) : _type(String)
+	{
+		_u.str = new std::string(move(str));
+	}
+
+	Config::Config(std::initializer_list<std::pair<std::string, Config>> values) : _type(Uninitialized)
+	{
+		make_object();
+		for (auto&& v : values) {
+			insert_or_assign(v.first, Config(std::move(v.second)));
+		}
+	}
+
+	void Config::make_object()
+	{
+		assert_type(Uninitialized);
+		note_change();
+		_type = Object;
+		_u.object = new ConfigObject();
+	}
+
+	void Config::make_array()
+	{
+		assert_type(Uninitialized);
+		note_change();
+		_type = Array;
+		_u.array = new ConfigArray();
+	}
+
+	void Config::make_packed_array()
+	{
+		make_array();
+		_u.array->_packing = ArrayPacking::Ints;
+	}
+
+	Config Config::object()
+	{
+		Config ret;
+		ret.make_object();
+		return ret;
+	}
+
+	Config Config::object(std::initializer_list<std::pair<std::string, Config>> values)
+	{
+		Config ret;
+		ret.make_object();
+		for (auto&& p : values) {
+			ret.insert_or_assign(p.first, Config(std::move(p.second)));
+		}
+		return ret;
+	}
+
+	Config Config::array()
+	{
+		Config ret;
+		ret.make_array();
+		return ret;
+	}
+
+	Config Config::array(std::initializer_list<Config> values)
+	{
+		Config ret;
+		ret.make_array();
+		ret._u.array->_impl.reserve(values.size());
+		for (auto&& v : values) {
+			ret.push_back(std::move(v));
+		}
+		return ret;
+	}
+
+	void Config::tag(const DocInfo_SP& doc, Index line, Index column)
+	{
+		note_change();
+		_doc = doc;
+		_line = line;
+		(void)column; // TODO: include this info too.
+	}
+
+	// ------------------------------------------------------------------------
+
+	Config::Config(const Config& o) : _type(Uninitialized)
+	{
+		*this = o;
+	}
+
+	Config::Config(Config&& o) noexcept : _type(Uninitialized)
+	{
+		o.note_change();
+		swap_values(o);
+	}
+
+	void Config::swap(Config& o) noexcept
+	{
+		if (&o == this) { return; }
+		note_change();
+		o.note_change();
+		swap_values(o);
+		relink();
+		o.relink();
+	}
+
+	void Config::swap_values(Config& o) noexcept
+	{
+		std::swap(_type,     o._type);
+		std::swap(_u,        o._u);
+		std::swap(_doc,      o._doc);
+		std::swap(_line,     o._line);
+		std::swap(_comments, o._comments);
+	}
+
+	Config& Config::operator=(Config&& o) noexcept
+	{
+		if (&o == this) { return *this; }
+
+		note_change();
+		o.note_change();
+		std::swap(_type, o._type);
+		std::swap(_u,    o._u);
+		relink();
+		o.relink();
+
+		// Remember where we come from even when assigned a new value:
+		if (o._doc || o._line != BAD_INDEX) {
+			std::swap(_doc,  o._doc);
+			std::swap(_line, o._line);
+		}
+
+		if (o._comments) {
+			std::swap(_comments, o._comments);
+		}
+
+		return *this;
+	}
+
+	Config& Config::operator=(const Config& o)
+	{
+		if (&o == this) { return *this; }
+
+		note_change();
+		free();
+
+		_type = o._type;
+		bool copied_contents = false;
+		(void)copied_contents;
+
+		#if CONFIGURU_VALUE_SEMANTICS && !CONFIGURU_COPY_ON_WRITE
+			if (_type == String) {
+				_u.str = new std::string(*o._u.str);
+			} else if (_type == BadLookupType) {
+				_u.bad_lookup = new BadLookupInfo(*o._u.bad_lookup);
+			} else if (_type == Object) {
+				_u.object = new ConfigObject(*o._u.object);
+			} else if (_type == Array) {
+				_u.array = new ConfigArray(*o._u.array);
+			} else {
+				memcpy(&_u, &o._u, sizeof(_u));
+			}
+		#else // Shared nodes:
+			if (_type == String) {
+				_u.str = new std::string(*o._u.str);
+		#if CONFIGURU_VALUE_SEMANTICS // Copy on write
+			} else if (_type == Object && !o.can_share_contents()) {
+				_u.object = new ConfigObject(*o._u.object);
+				copied_contents = true;
+			} else if (_type == Array && !o.can_share_contents()) {
+				_u.array = new ConfigArray(*o._u.array);
+				copied_contents = true;
+		#endif
+			} else {
+				memcpy(&_u, &o._u, sizeof(_u));
+				if (_type == BadLookupType) { _u.bad_lookup->_ref_count.increment(); }
+				if (_type == Array)         { _u.array->_ref_count.increment(); }
+				if (_type == Object)        { _u.object->_ref_count.increment(); }
+			}
+		#endif // Shared nodes
+
+		// Remember where we come from even when assigned a new value:
+		if (o._doc || o._line != BAD_INDEX) {
+			_doc  = o._doc;
+			_line = o._line;
+		}
+
+		if (o._comments) {
+			_comments.reset(new ConfigComments(*o._comments));
+		}
+
+		#if CONFIGURU_VALUE_SEMANTICS && !CONFIGURU_COPY_ON_WRITE
+			o.mark_accessed(true);
+		#elif CONFIGURU_VALUE_SEMANTICS
+			if (copied_contents) { o.mark_accessed(true); }
+		#endif
+
+		return *this;
+	}
+
+	bool Config::can_share_contents() const
+	{
+		#if CONFIGURU_VALUE_SEMANTICS && CONFIGURU_COPY_ON_WRITE
+			if (_type == Array) {
+				const auto& array = *_u.array;
+				return !array._lent.is_set() && (array._packing != ArrayPacking::None || !access_tracking());
+			}
+			if (_type == Object) {
+				return !_u.object->_lent.is_set() && !access_tracking();
+			}
+		#endif
+		return false;
+	}
+
+	Config::~Config()
+	{
+		free();
+	}
+
+	void Config::free()
+	{
+		if (owns_contents()) {
+			std::vector<Config> pending;
+			move_nested_into(pending);
+			while (!pending.empty()) {
+				Config child;
+				child.swap_values(pending.back());
+				pending.pop_back();
+				child.move_nested_into(pending);
+				child.free_node();
+			}
+		}
+		free_node();
+	}
+
+	void Config::free_node()
+	{
+		#if CONFIGURU_VALUE_SEMANTICS && !CONFIGURU_COPY_ON_WRITE
+			if (_type == BadLookupType) {
+				delete _u.bad_lookup;
+			} else if (_type == Object) {
+				delete _u.object;
+			} else if (_type == Array) {
+				delete _u.array;
+			} else if (_type == String) {
+				delete _u.str;
+			}
+		#else // Shared nodes:
+			if (_type == BadLookupType) {
+				if (_u.bad_lookup->_ref_count.decrement()) {
+					delete _u.bad_lookup;
+				}
+			} else if (_type == Object) {
+				if (_u.object->_ref_count.decrement()) {
+					delete _u.object;
+				}
+			} else if (_type == Array) {
+				if (_u.array->_ref_count.decrement()) {
+					delete _u.array;
+				}
+			} else if (_type == String) {
+				delete _u.str;
+			}
+		#endif // Shared nodes
+
+		_type = Uninitialized;
+
+		// Keep _doc, _line, _comments until overwritten/destructor.
+	}
+
+	bool Config::owns_contents() const
+	{
+		#if CONFIGURU_VALUE_SEMANTICS && !CONFIGURU_COPY_ON_WRITE
+			return _type == Array || _type == Object;
+		#else
+			return (_type == Array  && !_u.array->_ref_count.is_shared()) ||
+			       (_type == Object && !_u.object->_ref_count.is_shared());
+		#endif
+	}
+
+	void Config::move_nested_into(std::vector<Config>& pending)
+	{
+		if (_type == Array) {
+			for (auto& child : _u.array->_impl) {
+				if (child.owns_contents()) {
+					pending.emplace_back();
+					pending.back().swap_values(child);
+				}
+			}
+		} else if (_type == Object) {
+			for (auto& pair : _u.object->_impl) {
+				if (pair.second._value.owns_contents()) {
+					pending.emplace_back();
+					pending.back().swap_values(pair.second._value);
+				}
+			}
+		}
+	}
+
+	bool Config::release_last_child(std::vector<Config>& pending)
+	{
+		Config child;
+		if (_type == Array) {
+			auto& array = *_u.array;
+			if (!array._ints.empty() || !array._floats.empty()) {
+				// Freeing plain numbers is cheap no matter how many there are:
+				array._unpacked.clear();
+				std::vector<int64_t>().swap(array._ints);
+				std::vector<double>().swap(array._floats);
+				return true;
+			}
+			if (array._impl.empty()) { return false; }
+			child.swap_values(array._impl.back());
+			array._impl.pop_back();
+		} else if (_type == Object) {
+			auto& impl = _u.object->_impl;
+			if (impl.empty()) { return false; }
+			auto it = std::prev(impl.end());
+			child.swap_values(it->second._value);
+			impl.erase(it);
+		} else {
+			return false;
+		}
+
+		if (child.owns_contents()) {
+			pending.emplace_back();
+			pending.back().swap_values(child);
+		}
+		return true;
+	}
+
+	void Config::detach()
+	{
+		#if CONFIGURU_VALUE_SEMANTICS && CONFIGURU_COPY_ON_WRITE
+			// The children are copied shallowly, so they stay shared until they are changed.
+			if (_type == Array) {
+				auto copy = new ConfigArray(*_u.array);
+				if (_u.array->_ref_count.decrement()) { delete _u.array; }
+				_u.array = copy;
+			} else if (_type == Object) {
+				auto copy = new ConfigObject(*_u.object);
+				if (_u.object->_ref_count.decrement()) { delete _u.object; }
+				_u.object = copy;
+			}
+		#endif
+	}
+
+	// ------------------------------------------------------------------------
+
+	Span<int64_t> Config::as_int_span() const
+	{
+		assert_type(Array);
+		const auto& array = *_u.array;
+		check(array._packing == ArrayPacking::Ints || array.size() == 0, "Expected a packed array of integers");
+		return {array._ints.data(), array._ints.size()};
+	}
+
+	Span<double> Config::as_float_span() const
+	{
+		assert_type(Array);
+		const auto& array = *_u.array;
+		check(array._packing == ArrayPacking::Floats || array.size() == 0, "Expected a packed array of floats");
+		return {array._floats.data(), array._floats.size()};
+	}
+
+	bool Config::push_back_packed(const Config& value)
+	{
+		auto& array = *_u.array;
+		array._unpacked.clear();
+		if (value.has_comments()) { return false; }
+		if (array.size() == 0) {
+			if (value._type == Int)   { array._packing = ArrayPacking::Ints;   }
+			if (value._type == Float) { array._packing = ArrayPacking::Floats; }
+		}
+		if (array._packing == ArrayPacking::Ints && value._type == Int) {
+			array._ints.push_back(value._u.i);
+			return true;
+		}
+		if (array._packing == ArrayPacking::Floats && value._type == Float) {
+			array._floats.push_back(value._u.f);
+			return true;
+		}
+		return false;
+	}
+
+	void Config::unpack_array()
+	{
+		auto& array = *_u.array;
+		if (auto made = array._unpacked.release()) {
+			array._impl.swap(*made);
+		} else {
+			array._impl = unpacked_elements();
+		}
+		array._packing = ArrayPacking::None;
+		std::vector<int64_t>().swap(array._ints);
+		std::vector<double>().swap(array._floats);
+	}
+
+	Config::ConfigArrayImpl Config::unpacked_elements() const
+	{
+		const auto& array = *_u.array;
+		ConfigArrayImpl elements;
+		elements.reserve(array.size());
+		if (array._packing == ArrayPacking::Ints) {
+			for (const auto i : array._ints) {
+				elements.emplace_back(i);
+				elements.back().tag(_doc, _line, BAD_INDEX);
+			}
+		} else if (array._packing == ArrayPacking::Floats) {
+			for (const auto f : array._floats) {
+				elements.emplace_back(f);
+				elements.back().tag(_doc, _line, BAD_INDEX);
+			}
+		}
+		return elements;
+	}
+
+	size_t Config::object_size() const
+	{
+		return as_object()._impl.size();
+	}
+
+	const Config& Config::operator[](const std::string& key) const
+	{
+		auto&& object = as_object()._impl;
+		auto it = object.find(key);
+		if (it == object.end()) {
+			on_error("Key '" + key + "' not in object");
+		} else {
+			const auto& entry = it->second;
+			entry._accessed.mark();
+			return entry._value;
+		}
+	}
+
+	Config& Config::operator[](const std::string& key)
+	{
+		assert_type(Object);
+		before_lending();
+		auto&& object = _u.object->_impl;
+		auto it = object.find(key);
+		if (it == object.end()) {
+			// New entry
+			before_mutation();
+			auto&& entry = object[key];
+			entry._nr = static_cast<Index>(object.size()) - 1;
+			entry._value._type = BadLookupType;
+			entry._value._u.bad_lookup = new BadLookupInfo{_doc, _line, key};
+			lend_value(entry._value);
+			return entry._value;
+		}
+		auto&& entry = it->second;
+		entry._accessed.mark();
+		lend_value(entry._value);
+		return entry._value;
+	}
+
+	bool Config::has_key(const std::string& key) const
+	{
+		return as_object()._impl.count(key) != 0;
+	}
+
+	bool Config::emplace(std::string key, Config value)
+	{
+		auto&& object = object_for_mutation();
+		auto result = object.emplace(
+			std::move(key),
+			Config::ObjectEntry{std::move(value), (unsigned)object.size()});
+		if (result.second) { adopt(result.first->second._value); }
+		return result.second;
+	}
+
+	void Config::insert_or_assign(const std::string& key, Config config)
+	{
+		auto&& object = object_for_mutation();
+		auto&& entry = object[key];
+		if (entry._nr == BAD_INDEX) {
+			// New entry
+			entry._nr = static_cast<Index>(object.size()) - 1;
+		} else {
+			entry._accessed.mark();
+		}
+		entry._value = std::move(config);
+		adopt(entry._value);
+	}
+
+	bool Config::erase(const std::string& key)
+	{
+		auto& object = object_for_mutation();
+		auto it = object.find(key);
+		if (it == object.end()) {
+			return false;
+		} else {
+			object.erase(it);
+			return true;
+		}
+	}
+
+	void Config::insert(size_t ix, Config value)
+	{
+		assert_type(Array);
+		check(ix <= array_size(), "Array index out of range");
+		if (ix == array_size()) {
+			push_back(std::move(value));
+			return;
+		}
+		const auto at = static_cast<std::ptrdiff_t>(ix);
+		if (packs(value)) {
+			before_mutation();
+			auto& packed = *_u.array;
+			packed._unpacked.clear();
+			if (packed._packing == ArrayPacking::Ints) {
+				packed._ints.insert(packed._ints.begin() + at, value._u.i);
+			} else {
+				packed._floats.insert(packed._floats.begin() + at, value._u.f);
+			}
+			return;
+		}
+		auto& array = array_for_mutation();
+		auto it = array.insert(array.begin() + at, std::move(value));
+		adopt(*it);
+	}
+
+	void Config::erase(size_t ix)
+	{
+		assert_type(Array);
+		check(ix < array_size(), "Array index out of range");
+		const auto at = static_cast<std::ptrdiff_t>(ix);
+		if (_u.array->_packing != ArrayPacking::None) {
+			before_mutation();
+			auto& packed = *_u.array;
+			packed._unpacked.clear();
+			if (packed._packing == ArrayPacking::Ints) {
+				packed._ints.erase(packed._ints.begin() + at);
+			} else {
+				packed._floats.erase(packed._floats.begin() + at);
+			}
+			return;
+		}
+		auto& array = array_for_mutation();
+		array.erase(array.begin() + at);
+	}
+
+	Config& Config::lent_element(size_t ix)
+	{
+		assert_type(Array);
+		check(ix < array_size(), "Array index out of range");
+		before_lending();
+		if (_u.array->_packing != ArrayPacking::None) { unpack_array(); }
+		Config& value = _u.array->_impl[ix];
+		lend_value(value);
+		return value;
+	}
+
+	bool Config::packs(const Config& value) const
+	{
+		const auto packing = _u.array->_packing;
+		if (value.has_comments()) { return false; }
+		return (packing == ArrayPacking::Ints   && value._type == Int)
+		    || (packing == ArrayPacking::Floats && value._type == Float);
+	}
+
+	bool Config::set_packed(size_t ix, const Config& value)
+	{
+		assert_type(Array);
+		check(ix < array_size(), "Array index out of range");
+		if (!packs(value)) { return false; }
+		before_mutation();
+		auto& array = *_u.array;
+		array._unpacked.clear();
+		if (array._packing == ArrayPacking::Ints) {
+			array._ints[ix] = value._u.i;
+		} else {
+			array._floats[ix] = value._u.f;
+		}
+		return true;
+	}
+
+	Config::ConfigArrayImpl& Config::lent_elements()
+	{
+		assert_type(Array);
+		before_lending();
+		if (_u.array->_packing != ArrayPacking::None) { unpack_array(); }
+		auto& array = _u.array->_impl;
+		#if CONFIGURU_CONTENT_CACHE
+			for (auto& value : array) {
+				lend_value(value);
+			}
+		#endif
+		return array;
+	}
+
+	/// Arrays and objects this close to the root are cloned/compared in parallel.
+	static const unsigned PARALLEL_DEPTH = 3;
+
+	/// Calls fun(i) for i in [0, count) on the pool if we are close enough to the root, else serially.
+	template<typename Fun>
+	static void for_each_child(ThreadPool* pool, unsigned depth, size_t count, const Fun& fun)
+	{
+		if (pool && depth < PARALLEL_DEPTH && count > 1) {
+			pool->parallel_for(count, fun);
+		} else {
+			for (size_t i = 0; i < count; ++i) {
+				fun(i);
+			}
+		}
+	}
+
+	bool Config::deep_eq(const Config& a, const Config& b)
+	{
+		return deep_eq_tree(a, b, nullptr, 0);
+	}
+
+	bool Config::deep_eq(const Config& a, const Config& b, ThreadPool& pool)
+	{
+		return deep_eq_tree(a, b, &pool, 0);
+	}
+
+	bool Config::deep_eq_tree(const Config& a, const Config& b, ThreadPool* pool, unsigned depth)
+	{
+		if (a._type != b._type) { return false; }
+		if (a._type == Null)   { return true; }
+		if (a._type == Bool)   { return a._u.b    == b._u.b;    }
+		if (a._type == Int)    { return a._u.i    == b._u.i;    }
+		if (a._type == Float)  { return a._u.f    == b._u.f;    }
+		if (a._type == String) { return *a._u.str == *b._u.str; }
+		if (a._type == Object)    {
+			if (a.shares_contents(b)) { return true; }
+			if (a.cached_hash() != 0 && b.cached_hash() != 0 && a.cached_hash() != b.cached_hash()) { return false; }
+			auto&& a_object = a._u.object->_impl;
+			auto&& b_object = b._u.object->_impl;
+			if (a_object.size() != b_object.size()) { return false; }
+			// Both maps are sorted, so equal objects have equal keys in the same order:
+			if (pool && depth < PARALLEL_DEPTH && a_object.size() > 1) {
+				std::vector<std::pair<const Config*, const Config*>> pairs;
+				pairs.reserve(a_object.size());
+				for (auto a_it = a_object.begin(), b_it = b_object.begin(); a_it != a_object.end(); ++a_it, ++b_it) {
+					if (a_it->first != b_it->first) { return false; }
+					pairs.emplace_back(&a_it->second._value, &b_it->second._value);
+				}
+				std::atomic<bool> equal { true };
+				pool->parallel_for(pairs.size(), [&](size_t i) {
+					if (equal.load(std::memory_order_relaxed) &&
+					    !deep_eq_tree(*pairs[i].first, *pairs[i].second, pool, depth + 1)) {
+						equal.store(false, std::memory_order_relaxed);
+					}
+				});
+				return equal.load();
+			}
+			for (auto a_it = a_object.begin(), b_it = b_object.begin(); a_it != a_object.end(); ++a_it, ++b_it) {
+				if (a_it->first != b_it->first) { return false; }
+				if (!deep_eq_tree(a_it->second._value, b_it->second._value, pool, depth + 1)) { return false; }
+			}
+			return true;
+		}
+		if (a._type == Array)    {
+			if (a.shares_contents(b)) { return true; }
+			if (a.cached_hash() != 0 && b.cached_hash() != 0 && a.cached_hash() != b.cached_hash()) { return false; }
+			const auto size = a.array_size();
+			if (size != b.array_size()) { return false; }
+			const auto packing = a.array_packing();
+			if (packing == b.array_packing()) {
+				if (packing == ArrayPacking::Ints)   { return a._u.array->_ints   == b._u.array->_ints;   }
+				if (packing == ArrayPacking::Floats) { return a._u.array->_floats == b._u.array->_floats; }
+			} else {
+				// Compare number by number without unpacking:
+				auto a_it = a.elements().begin();
+				auto b_it = b.elements().begin();
+				for (size_t i = 0; i < size; ++i, ++a_it, ++b_it) {
+					if (!deep_eq_tree(*a_it, *b_it, nullptr, depth + 1)) {
+						return false;
+					}
+				}
+				return true;
+			}
+			auto&& a_array = a._u.array->_impl;
+			auto&& b_array = b._u.array->_impl;
+			std::atomic<bool> equal { true };
+			for_each_child(pool, depth, size, [&](size_t i) {
+				if (equal.load(std::memory_order_relaxed) &&
+				    !deep_eq_tree(a_array[i], b_array[i], pool, depth + 1)) {
+					equal.store(false, std::memory_order_relaxed);
+				}
+			});
+			return equal.load();
+		}
+
+		return false;
+	}
+
+	static size_t hash_combine(size_t seed, uint64_t value)
+	{
+		// Mix the bits of value (splitmix64 finalizer) so that consecutive numbers spread out:
+		value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ull;
+		value = (value ^ (value >> 27)) * 0x94d049bb133111ebull;
+		value =  value ^ (value >> 31);
+		return seed ^ (static_cast<size_t>(value) + 0x9e3779b9u + (seed << 6) + (seed >> 2));
+	}
+
+	static size_t hash_int(int64_t i)
+	{
+		return hash_combine(Config::Int, static_cast<uint64_t>(i));
+	}
+
+	static size_t hash_float(double f)
+	{
+		if (f == 0) { f = 0; } // -0.0 == 0.0
+		uint64_t bits;
+		memcpy(&bits, &f, sizeof(bits));
+		return hash_combine(Config::Float, bits);
+	}
+
+	size_t Config::cached_hash() const
+	{
+		#if CONFIGURU_VALUE_SEMANTICS && CONFIGURU_HASH_CACHE
+			if (const ContentCache* cache = content_cache()) { return cache->hash(); }
+		#endif
+		return 0;
+	}
+
+	bool Config::shares_contents(const Config& other) const
+	{
+		if (_type != other._type) { return false; }
+		if (_type == Array)  { return _u.array  == other._u.array;  }
+		if (_type == Object) { return _u.object == other._u.object; }
+		return false;
+	}
+
+	size_t Config::hash() const
+	{
+		bool remembered;
+		return hash_tree(remembered);
+	}
+
+	size_t Config::hash_tree(bool& remembered) const
+	{
+		remembered = true;
+		if (_type == Bool)   { return hash_combine(_type, _u.b ? 1 : 0); }
+		if (_type == Int)    { return hash_int(_u.i); }
+		if (_type == Float)  { return hash_float(_u.f); }
+		if (_type == String) { return hash_combine(_type, std::hash<std::string>()(*_u.str)); }
+		if (_type != Array && _type != Object) { return hash_combine(_type, 0); }
+
+		size_t hash = cached_hash();
+		if (hash != 0) { return hash; }
+
+		if (_type == Array) {
+			const auto& array = *_u.array;
+			hash = hash_combine(_type, array.size());
+			// A packed array must have the same hash as the unpacked one:
+			if (array._packing == ArrayPacking::Ints) {
+				for (const auto i : array._ints) { hash = hash_combine(hash, hash_int(i)); }
+			} else if (array._packing == ArrayPacking::Floats) {
+				for (const auto f : array._floats) { hash = hash_combine(hash, hash_float(f)); }
+			} else {
+				for (const auto& value : array._impl) {
+					bool value_remembered;
+					hash = hash_combine(hash, value.hash_tree(value_remembered));
+					remembered = remembered && value_remembered;
+				}
+			}
+		} else {
+			hash = hash_combine(_type, _u.object->_impl.size());
+			for (auto&& p : _u.object->_impl) { // Sorted, so the order of insertion does not matter.
+				bool value_remembered;
+				hash = hash_combine(hash, std::hash<std::string>()(p.first));
+				hash = hash_combine(hash, p.second._value.hash_tree(value_remembered));
+				remembered = remembered && value_remembered;
+			}
+		}
+		if (hash == 0) { hash = 1; }
+
+		#if CONFIGURU_VALUE_SEMANTICS && CONFIGURU_HASH_CACHE
+			// If a value in us could not remember its hash, it could change without us knowing:
+			const ContentCache& cache = *content_cache();
+			remembered = remembered && cache.can_remember();
+			if (remembered) { cache.set_hash(hash); }
+		#else
+			remembered = false;
+		#endif
+		return hash;
+	}
+
+	Config Config::clone_tree(const Config& src, ThreadPool* pool, unsigned depth)
+	{
+		Config ret;
+		if (src._type != Array && src._type != Object) {
+			ret = src;
+			return ret;
+		}
+
+		ret._doc  = src._doc;
+		ret._line = src._line;
+		if (src._comments) {
+			ret._comments.reset(new ConfigComments(*src._comments));
+		}
+
+		if (src._type == Array) {
+			const auto& src_array = *src._u.array;
+			ret.make_array();
+			auto& dst_array = *ret._u.array;
+			dst_array._packing = src_array._packing;
+			dst_array._ints    = src_array._ints;
+			dst_array._floats  = src_array._floats;
+			dst_array._impl.resize(src_array._impl.size());
+			for_each_child(pool, depth, src_array._impl.size(), [&](size_t i) {
+				dst_array._impl[i] = clone_tree(src_array._impl[i], pool, depth + 1);
+			});
+		} else {
+			const auto& src_object = src._u.object->_impl;
+			ret.make_object();
+			auto& dst_object = ret._u.object->_impl;
+			if (pool && depth < PARALLEL_DEPTH && src_object.size() > 1) {
+				std::vector<ConfigObjectImpl::const_iterator> entries;
+				entries.reserve(src_object.size());
+				for (auto it = src_object.begin(); it != src_object.end(); ++it) {
+					entries.push_back(it);
+				}
+				std::vector<Config> values(entries.size());
+				pool->parallel_for(entries.size(), [&](size_t i) {
+					values[i] = clone_tree(entries[i]->second._value, pool, depth + 1);
+				});
+				for (size_t i = 0; i < entries.size(); ++i) {
+					dst_object.emplace_hint(dst_object.end(), entries[i]->first,
+						ObjectEntry(std::move(values[i]), entries[i]->second._nr));
+				}
+			} else {
+				// Already sorted, so every insert is at the end:
+				for (auto&& p : src_object) {
+					dst_object.emplace_hint(dst_object.end(), p.first,
+						ObjectEntry(clone_tree(p.second._value, pool, depth + 1), p.second._nr));
+				}
+			}
+		}
+		return ret;
+	}
+
+#if !CONFIGURU_VALUE_SEMANTICS
+	Config Config::deep_clone() const
+	{
+		return clone_tree(*this, nullptr, 0);
+	}
+#endif
+
+	Config Config::deep_clone(ThreadPool& pool) const
+	{
+		Config ret = clone_tree(*this, &pool, 0);
+		#if CONFIGURU_VALUE_SEMANTICS && !CONFIGURU_COPY_ON_WRITE
+			mark_accessed(true); // Like a copy does.
+		#endif
+		return ret;
+	}
+
+	void Config::visit_dangling(const std::function<void(const std::string& key, const Config& value)>& visitor) const
+	{
+		if (!access_tracking()) {
+			return;
+		}
+		if (is_object()) {
+			for (auto&& p : as_object()._impl) {
+				auto&& entry = p.second;
+				auto&& value = entry._value;
+				if (entry._accessed.get()) {
+					value.check_dangling();
+				} else {
+					visitor(p.first, value);
+				}
+			}
+		} else if (is_array()) {
+			for (auto&& e : _u.array->_impl) { // Packed numbers have no keys.
+				e.check_dangling();
+			}
+		}
+	}
+
+	void Config::check_dangling() const
+	{
+		std::string message = "";
+
+		visit_dangling([&](const std::string& key, const Config& value){
+			message += dangling_key_line(key, value);
+		});
+
+		if (!message.empty()) {
+			message = "Dangling keys:" + message;
+			CONFIGURU_ON_DANGLING(message);
+		}
+	}
+
+	void Config::mark_accessed(bool v) const
+	{
+		if (is_object()) {
+			for (auto&& p : as_object()._impl) {
+				auto&& entry = p.second;
+				entry._accessed.set(v);
+				entry._value.mark_accessed(v);
+			}
+		} else if (is_array()) {
+			for (auto&& e : _u.array->_impl) { // Packed numbers have no keys.
+				e.mark_accessed(v);
+			}
+		}
+	}
+
+	std::string Config::dangling_key_line(const std::string& key, const Config& value)
+	{
+		return "\n    " + value.where() + "Key '" + key + "' never accessed.";
+	}
+
+	// Appends what visit_dangling would do on `config`: visit its own unaccessed keys,
+	// and report the nested ones like check_dangling.
+	void Config::collect_dangling(const Config& config, DanglingEvents& out, ThreadPool& pool, unsigned depth)
+	{
+		if (config.is_object()) {
+			const auto& impl = config._u.object->_impl;
+			if (ThreadPool::should_split(depth, impl.size())) {
+				std::vector<ConfigObjectImpl::const_iterator> entries;
+				entries.reserve(impl.size());
+				for (auto it = impl.begin(); it != impl.end(); ++it) {
+					entries.push_back(it);
+				}
+				std::vector<DanglingEvents> partial(pool.num_ranges(entries.size()));
+				pool.parallel_for_ranges(entries.size(), [&](size_t range, size_t begin, size_t end) {
+					for (size_t i = begin; i < end; ++i) {
+						if (entries[i]->second._accessed.get()) {
+							collect_nested_dangling(entries[i]->second._value, partial[range], pool, depth + 1);
+						} else {
+							partial[range].push_back({&entries[i]->first, &entries[i]->second._value, {}});
+						}
+					}
+				});
+				for (auto& events : partial) {
+					std::move(events.begin(), events.end(), std::back_inserter(out));
+				}
+			} else {
+				for (const auto& p : impl) {
+					if (p.second._accessed.get()) {
+						collect_nested_dangling(p.second._value, out, pool, depth + 1);
+					} else {
+						out.push_back({&p.first, &p.second._value, {}});
+					}
+				}
+			}
+		} else if (config.is_array()) {
+			const auto& impl = config._u.array->_impl; // Packed numbers have no keys.
+			if (ThreadPool::should_split(depth, impl.size())) {
+				std::vector<DanglingEvents> partial(pool.num_ranges(impl.size()));
+				pool.parallel_for_ranges(impl.size(), [&](size_t range, size_t begin, size_t end) {
+					for (size_t i = begin; i < end; ++i) {
+						collect_nested_dangling(impl[i], partial[range], pool, depth + 1);
+					}
+				});
+				for (auto& events : partial) {
+					std::move(events.begin(), events.end(), std::back_inserter(out));
+				}
+			} else {
+				for (const auto& e : impl) {
+					collect_nested_dangling(e, out, pool, depth + 1);
+				}
+			}
+		}
+	}
+
+	// Appends what check_dangling would report on `config`.
+	void Config::collect_nested_dangling(const Config& config, DanglingEvents& out, ThreadPool& pool, unsigned depth)
+	{
+		if (!config.is_object() && !config.is_array()) {
+			return;
+		}
+		DanglingEvents events;
+		collect_dangling(config, events, pool, depth);
+		std::string message;
+		for (auto& event : events) {
+			if (event.key) {
+				message += dangling_key_line(*event.key, *event.value);
+			} else {
+				out.push_back(std::move(event));
+			}
+		}
+		if (!message.empty()) {
+			out.push_back({nullptr, nullptr, "Dangling keys:" + message});
+		}
+	}
+
+	void Config::visit_dangling(const std::function<void(const std::string& key, const Config& value)>& visitor, ThreadPool& pool) const
+	{
+		if (!access_tracking()) {
+			return;
+		}
+		DanglingEvents events;
+		collect_dangling(*this, events, pool, 0);
+		for (const auto& event : events) {
+			if (event.key) {
+				visitor(*event.key, *event.value);
+			} else {
+				CONFIGURU_ON_DANGLING(event.message);
+			}
+		}
+	}
+
+	void Config::check_dangling(ThreadPool& pool) const
+	{
+		std::string message = "";
+
+		visit_dangling([&](const std::string& key, const Config& value){
+			message += dangling_key_line(key, value);
+		}, pool);
+
+		if (!message.empty()) {
+			message = "Dangling keys:" + message;
+			CONFIGURU_ON_DANGLING(message);
+		}
+	}
+
+	void Config::mark_accessed_tree(const Config& config, bool v, ThreadPool& pool, unsigned depth)
+	{
+		if (config.is_object()) {
+			const auto& impl = config._u.object->_impl;
+			if (ThreadPool::should_split(depth, impl.size())) {
+				std::vector<const ObjectEntry*> entries;
+				entries.reserve(impl.size());
+				for (const auto& p : impl) {
+					entries.push_back(&p.second);
+				}
+				pool.parallel_for_ranges(entries.size(), [&](size_t, size_t begin, size_t end) {
+					for (size_t i = begin; i < end; ++i) {
+						entries[i]->_accessed.set(v);
+						mark_accessed_tree(entries[i]->_value, v, pool, depth + 1);
+					}
+				});
+			} else {
+				for (const auto& p : impl) {
+					p.second._accessed.set(v);
+					mark_accessed_tree(p.second._value, v, pool, depth + 1);
+				}
+			}
+		} else if (config.is_array()) {
+			const auto& impl = config._u.array->_impl; // Packed numbers have no keys.
+			if (ThreadPool::should_split(depth, impl.size())) {
+				pool.parallel_for_ranges(impl.size(), [&](size_t, size_t begin, size_t end) {
+					for (size_t i = begin; i < end; ++i) {
+						mark_accessed_tree(impl[i], v, pool, depth + 1);
+					}
+				});
+			} else {
+				for (const auto& e : impl) {
+					mark_accessed_tree(e, v, pool, depth + 1);
+				}
+			}
+		}
+	}
+
+	void Config::mark_accessed(bool v, ThreadPool& pool) const
+	{
+		mark_accessed_tree(*this, v, pool, 0);
+	}
+
+	const char* Config::debug_descr() const
+	{
+		switch (_type) {
+			case Bool:   return _u.b ? "true" : "false";
+			case String: return _u.str->c_str();
+			default:     return type_str(_type);
+		}
+	}
+
+	const char* Config::type_str(Type t)
+	{
+		switch (t) {
+			case Uninitialized: return "uninitialized";
+			case BadLookupType: return "undefined";
+			case Null:          return "null";
+			case Bool:          return "bool";
+			case Int:           return "integer";
+			case Float:         return "float";
+			case String:        return "string";
+			case Array:         return "array";
+			case Object:        return "object";
+		}
+		return "BROKEN Config";
+	}
+
+	std::string where_is(const DocInfo_SP& doc, Index line)
+	{
+		if (doc) {
+			std::string ret = doc->filename;
+			if (line != BAD_INDEX) {
+				ret += ":" + std::to_string(line);
+			}
+			doc->append_include_info(ret);
+			ret += ": ";
+			return ret;
+		} else if (line != BAD_INDEX) {
+			return "line " + std::to_string(line) + ": ";
+		} else {
+			return "";
+		}
+	}
+
+	std::string Config::where() const
+	{
+		return where_is(_doc, _line);
+	}
+
+	void Config::on_error(const std::string& msg) const
+	{
+		CONFIGURU_ONERROR(where() + msg);
+		abort(); // We shouldn't get here.
+	}
+
+	void Config::assert_type(Type exepected) const
+	{
+		if (_type == BadLookupType) {
+			auto where = where_is(_u.bad_lookup->doc, _u.bad_lookup->line);
+			CONFIGURU_ONERROR(where + "Failed to find key '" + _u.bad_lookup->key + "'");
+		} else if (_type != exepected) {
+			const auto message = where() + "Expected " + type_str(exepected) + ", got " + type_str(_type);
+			if (_type == Uninitialized && exepected == Object) {
+				CONFIGURU_ONERROR(message + ". Did you forget to call Config::object()?");
+			} else if (_type == Uninitialized && exepected == Array) {
+				CONFIGURU_ONERROR(message + ". Did you forget to call Config::array()?");
+			} else {
+				CONFIGURU_ONERROR(message);
+			}
+		}
+	}
+
+	std::ostream& operator<<(std::ostream& os, const Config& cfg)
+	{
+		auto format = JSON;
+		// Make sure that all config types are serializable:
+		format.inf                 = true;
+		format.nan                 = true;
+		format.write_uninitialized = true;
+		format.end_with_newline    = false;
+		format.mark_accessed       = false;
+		dump(os, cfg, format);
+		return os;
+	}
+
+	// ------------------------------------------------------------------------
+	// FrozenConfig
+
+	struct FrozenBuilder
+	{
+		FrozenConfig::Storage& _s;
+
+		explicit FrozenBuilder(FrozenConfig::Storage& storage) : _s(storage) {}
+
+		uint64_t add_string(const std::string& str)
+		{
+			const uint64_t offset = _s.strings.size();
+			_s.strings += str;
+			_s.strings.push_back('\0');
+			return offset;
+		}
+
+		/// Sizes and indices are stored as 32 bits.
+		static uint32_t to_u32(size_t n, const char* what)
+		{
+			if (n > 0xffffffffu) {
+				CONFIGURU_ONERROR(std::string("freeze: Too many ") + what + " for a FrozenConfig");
+			}
+			return static_cast<uint32_t>(n);
+		}
+
+		uint32_t alloc_nodes(size_t n)
+		{
+			const auto first = to_u32(_s.nodes.size(), "values");
+			to_u32(_s.nodes.size() + n, "values");
+			_s.nodes.resize(_s.nodes.size() + n);
+			return first;
+		}
+
+		// Children are allocated as one block so that they can be found by index.
+		void write(const Config& config, uint32_t node_ix)
+		{
+			FrozenNode node;
+			memset(&node, 0, sizeof(node));
+			node.type = static_cast<uint8_t>(config.type());
+
+			switch (config.type()) {
+				case Config::BadLookupType:
+					node.type = static_cast<uint8_t>(Config::Uninitialized);
+					break;
+				case Config::Bool:  node.u.b = config.as_bool();   break;
+				case Config::Int:   node.u.i = config.as_integer<int64_t>(); break;
+				case Config::Float: node.u.f = config.as_double(); break;
+				case Config::String: {
+					const std::string& str = config.as_string();
+					node.size     = to_u32(str.size(), "characters in a string");
+					node.u.offset = add_string(str);
+					break;
+				}
+				case Config::Array: {
+					const auto packing = config.array_packing();
+					node.packing = static_cast<uint8_t>(packing);
+					node.size    = to_u32(config.array_size(), "array elements");
+					if (packing == Config::ArrayPacking::Ints) {
+						auto span = config.as_int_span();
+						node.u.offset = _s.ints.size();
+						_s.ints.insert(_s.ints.end(), span.begin(), span.end());
+					} else if (packing == Config::ArrayPacking::Floats) {
+						auto span = config.as_float_span();
+						node.u.offset = _s.floats.size();
+						_s.floats.insert(_s.floats.end(), span.begin(), span.end());
+					} else {
+						const auto array = config.elements();
+						const uint32_t first = alloc_nodes(array.size());
+						node.u.children.first = first;
+						uint32_t i = 0;
+						for (const Config& element : array) {
+							write(element, first + i++);
+						}
+					}
+					break;
+				}
+				case Config::Object: {
+					const auto& object = config.as_object()._impl;
+					node.size = to_u32(object.size(), "object entries");
+					const uint32_t first = alloc_nodes(object.size());
+					const auto first_key = to_u32(_s.keys.size(), "keys");
+					to_u32(_s.keys.size() + object.size(), "keys");
+					node.u.children.first     = first;
+					node.u.children.first_key = first_key;
+					_s.keys.resize(_s.keys.size() + object.size());
+					uint32_t i = 0;
+					for (auto&& p : object) { // std::map is already sorted
+						FrozenKey& key = _s.keys[first_key + i];
+						key.size   = to_u32(p.first.size(), "characters in a key");
+						key.nr     = p.second._nr;
+						key.offset = add_string(p.first);
+						write(p.second._value, first + i);
+						++i;
+					}
+					break;
+				}
+				default: break;
+			}
+
+			_s.nodes[node_ix] = node;
+		}
+	};
+
+	FrozenConfig Config::freeze() const
+	{
+		auto storage = std::make_shared<FrozenConfig::Storage>();
+		FrozenBuilder builder(*storage);
+		builder.write(*this, builder.alloc_nodes(1));
+
+		auto& tables = storage->tables;
+		tables.nodes        = storage->nodes.data();
+		tables.keys         = storage->keys.data();
+		tables.ints         = storage->ints.data();
+		tables.floats       = storage->floats.data();
+		tables.strings      = storage->strings.c_str();
+		tables.num_nodes    = storage->nodes.size();
+		tables.num_keys     = storage->keys.size();
+		tables.num_ints     = storage->ints.size();
+		tables.num_floats   = storage->floats.size();
+		tables.strings_size = storage->strings.size();
+		return FrozenConfig(std::move(storage));
+	}
+
+	void FrozenValue::on_error(const std::string& msg) const
+	{
+		CONFIGURU_ONERROR(msg);
+		abort(); // We shouldn't get here.
+	}
+
+	void FrozenValue::assert_type(Config::Type expected) const
+	{
+		if (type() != expected) {
+			on_error(std::string("Expected ") + Config::type_str(expected) + ", got " + Config::type_str(type()));
+		}
+	}
+
+	Span<int64_t> FrozenValue::as_int_span() const
+	{
+		const auto packing = array_packing();
+		check(packing == Config::ArrayPacking::Ints || _node.size == 0, "Expected a packed array of integers");
+		if (packing != Config::ArrayPacking::Ints) { return {}; }
+		return {_tables->ints + _node.u.offset, _node.size};
+	}
+
+	Span<double> FrozenValue::as_float_span() const
+	{
+		const auto packing = array_packing();
+		check(packing == Config::ArrayPacking::Floats || _node.size == 0, "Expected a packed array of floats");
+		if (packing != Config::ArrayPacking::Floats) { return {}; }
+		return {_tables->floats + _node.u.offset, _node.size};
+	}
+
+	FrozenValue FrozenValue::operator[](size_t ix) const
+	{
+		const auto packing = array_packing();
+		check(ix < _node.size, "Array index out of range");
+		if (packing == Config::ArrayPacking::None) {
+			return FrozenValue(_tables, _tables->nodes[_node.u.children.first + ix]);
+		}
+		FrozenNode node;
+		memset(&node, 0, sizeof(node));
+		if (packing == Config::ArrayPacking::Ints) {
+			node.type = static_cast<uint8_t>(Config::Int);
+			node.u.i  = _tables->ints[_node.u.offset + ix];
+		} else {
+			node.type = static_cast<uint8_t>(Config::Float);
+			node.u.f  = _tables->floats[_node.u.offset + ix];
+		}
+		return FrozenValue(_tables, node);
+	}
+
+	const FrozenNode* FrozenValue::find(const std::string& key) const
+	{
+		assert_type(Config::Object);
+		const FrozenKey* keys = _tables->keys + _node.u.children.first_key;
+		size_t lo = 0, hi = _node.size;
+		while (lo < hi) {
+			const size_t mid = lo + (hi - lo) / 2;
+			const FrozenKey& k = keys[mid];
+			const size_t common = (std::min)(static_cast<size_t>(k.size), key.size());
+			int cmp = memcmp(_tables->strings + k.offset, key.data(), common);
+			if (cmp == 0) {
+				cmp = k.size < key.size() ? -1 : k.size > key.size() ? +1 : 0;
+			}
+			if (cmp == 0) {
+				return _tables->nodes + _node.u.children.first + mid;
+			} else if (cmp < 0) {
+				lo = mid + 1;
+			} else {
+				hi = mid;
+			}
+		}
+		return nullptr;
+	}
+
+	FrozenValue FrozenValue::operator[](const std::string& key) const
+	{
+		const FrozenNode* node = find(key);
+		if (!node) {
+			on_error("Failed to find key '" + key + "'");
+		}
+		return FrozenValue(_tables, *node);
+	}
+
+	const char* FrozenObjectIterator::key() const
+	{
+		return _tables->strings + _tables->keys[_object.u.children.first_key + _ix].offset;
+	}
+
+	FrozenValue FrozenObjectIterator::value() const
+	{
+		return FrozenValue(_tables, _tables->nodes[_object.u.children.first + _ix]);
+	}
+
+	Config FrozenValue::thaw(const DocInfo_SP& doc) const
+	{
+		return thaw_tree(doc, 0);
+	}
+
+	Config FrozenValue::thaw_tree(const DocInfo_SP& doc, unsigned depth) const
+	{
+		if (depth > BINARY_MAX_DEPTH) {
+			on_error("Too deeply nested to thaw");
+		}
+		Config ret;
+		switch (type()) {
+			case Config::Null:   ret = Config(nullptr);     break;
+			case Config::Bool:   ret = Config(_node.u.b);   break;
+			case Config::Int:    ret = Config(_node.u.i);   break;
+			case Config::Float:  ret = Config(_node.u.f);   break;
+			case Config::String: ret = Config(as_string()); break;
+			case Config::Array: {
+				const auto packing = array_packing();
+				if (packing == Config::ArrayPacking::Ints)   { ret = Config::array(as_int_span());   break; }
+				if (packing == Config::ArrayPacking::Floats) { ret = Config::array(as_float_span()); break; }
+				ret = Config::array();
+				auto& array = ret.array_for_mutation();
+				array.reserve(_node.size);
+				for (size_t i = 0; i < _node.size; ++i) {
+					array.push_back((*this)[i].thaw_tree(doc, depth + 1));
+				}
+				break;
+			}
+			case Config::Object: {
+				ret = Config::object();
+				auto& object = ret.object_for_mutation();
+				const FrozenKey* keys = _tables->keys + _node.u.children.first_key;
+				for (size_t i = 0; i < _node.size; ++i) {
+					object.emplace_hint(object.end(),
+						std::string(_tables->strings + keys[i].offset, keys[i].size),
+						Config::ObjectEntry(FrozenValue(_tables, _tables->nodes[_node.u.children.first + i]).thaw_tree(doc, depth + 1), keys[i].nr));
+				}
+				break;
+			}
+			default: break;
+		}
+		if (doc) {
+			ret.tag(doc, BAD_INDEX, BAD_INDEX);
+		}
+		return ret;
+	}
+
+	// ------------------------------------------------------------------------
+	// diff / apply_patch
+
+	/// The patch must not change when the configs it was made from do.
+	static Config copy_value(const Config& config)
+	{
+		#if CONFIGURU_VALUE_SEMANTICS
+			return config;
+		#else
+			return config.deep_clone();
+		#endif
+	}
+
+	/// JSON Pointer (RFC 6901) escaping.
+	static std::string escape_pointer_token(const std::string& token)
+	{
+		std::string ret;
+		ret.reserve(token.size());
+		for (char c : token) {
+			if      (c == '~') { ret += "~0"; }
+			else if (c == '/') { ret += "~1"; }
+			else               { ret += c;    }
+		}
+		return ret;
+	}
+
+	static void add_patch_op(Config& patch, const char* op, const std::string& path, const Config* value)
+	{
+		Config entry = Config::object();
+		entry.insert_or_assign("op",   Config(op));
+		entry.insert_or_assign("path", Config(path));
+		if (value) {
+			entry.insert_or_assign("value", copy_value(*value));
+		}
+		patch.push_back(std::move(entry));
+	}
+
+	static bool known_equal(const Config& a, const Config& b, bool trust_hashes)
+	{
+		if (a.type() != b.type()) { return false; }
+		if (a.is_array() || a.is_object()) {
+			if (a.shares_contents(b)) { return true; }
+			// Different hashes means different values, but equal hashes could be a collision:
+			const size_t a_hash = a.cached_hash();
+			const size_t b_hash = b.cached_hash();
+			if (a_hash != 0 && b_hash != 0) {
+				return a_hash == b_hash && (trust_hashes || Config::deep_eq(a, b));
+			}
+		}
+		return false;
+	}
+
+	/// The elements of an array for indexing. The numbers of a packed array are made into Configs here
+	/// rather than in the array itself.
+	struct IndexedElements
+	{
+		Config::ConfigArrayImpl        unpacked;
+		const Config::ConfigArrayImpl* elements;
+
+		explicit IndexedElements(const Config& array)
+		{
+			if (array.array_packing() == Config::ArrayPacking::None) {
+				elements = &array.as_array();
+			} else {
+				const auto view = array.elements();
+				unpacked.assign(view.begin(), view.end());
+				elements = &unpacked;
+			}
+		}
+	};
+
+	static void diff_into(Config& patch, const std::string& path, const Config& from, const Config& to, bool trust_hashes)
+	{
+		if (known_equal(from, to, trust_hashes)) { return; }
+
+		if (from.is_object() && to.is_object()) {
+			const auto& from_object = from.as_object()._impl;
+			const auto& to_object   = to.as_object()._impl;
+			for (auto&& p : from_object) {
+				const auto child_path = path + "/" + escape_pointer_token(p.first);
+				auto it = to_object.find(p.first);
+				if (it == to_object.end()) {
+					add_patch_op(patch, "remove", child_path, nullptr);
+				} else {
+					diff_into(patch, child_path, p.second._value, it->second._value, trust_hashes);
+				}
+			}
+			// Added keys in the order they were added to `to`:
+			using ObjIterator = Config::ConfigObjectImpl::const_iterator;
+			std::vector<ObjIterator> added;
+			for (auto it = to_object.begin(); it != to_object.end(); ++it) {
+				if (from_object.count(it->first) == 0) {
+					added.push_back(it);
+				}
+			}
+			std::sort(added.begin(), added.end(), [](const ObjIterator& a, const ObjIterator& b) {
+				return a->second._nr < b->second._nr;
+			});
+			for (auto&& it : added) {
+				add_patch_op(patch, "add", path + "/" + escape_pointer_token(it->first), &it->second._value);
+			}
+		} else if (from.is_array() && to.is_array()) {
+			const IndexedElements from_elements(from);
+			const IndexedElements to_elements(to);
+			const auto& from_array = *from_elements.elements;
+			const auto& to_array   = *to_elements.elements;
+
+			// Skip what is the same at the start and the end:
+			const size_t max_common = (std::min)(from_array.size(), to_array.size());
+			size_t prefix = 0;
+			while (prefix < max_common &&
+			       (known_equal(from_array[prefix], to_array[prefix], trust_hashes) ||
+			        Config::deep_eq(from_array[prefix], to_array[prefix]))) {
+				++prefix;
+			}
+			size_t suffix = 0;
+			while (prefix + suffix < max_common) {
+				const Config& from_value = from_array[from_array.size() - 1 - suffix];
+				const Config& to_value   = to_array[to_array.size() - 1 - suffix];
+				if (!known_equal(from_value, to_value, trust_hashes) && !Config::deep_eq(from_value, to_value)) { break; }
+				++suffix;
+			}
+			const size_t from_end = from_array.size() - suffix;
+			const size_t to_end   = to_array.size() - suffix;
+
+			// Compare the rest position by position:
+			const size_t changed_end = (std::min)(from_end, to_end);
+			for (size_t i = prefix; i < changed_end; ++i) {
+				diff_into(patch, path + "/" + std::to_string(i), from_array[i], to_array[i], trust_hashes);
+			}
+			for (size_t i = changed_end; i < to_end; ++i) {
+				add_patch_op(patch, "add", path + "/" + std::to_string(i), &to_array[i]);
+			}
+			// Remove from the back, so that the indices stay valid:
+			for (size_t i = from_end; i > changed_end; --i) {
+				add_patch_op(patch, "remove", path + "/" + std::to_string(i - 1), nullptr);
+			}
+		} else if (!Config::deep_eq(from, to)) {
+			add_patch_op(patch, "replace", path, &to);
+		}
+	}
+
+	Config diff(const Config& from, const Config& to, bool trust_hashes)
+	{
+		Config patch = Config::array();
+		diff_into(patch, "", from, to, trust_hashes);
+		return patch;
+	}
+
+	static std::vector<std::string> parse_pointer(const std::string& path)
+	{
+		std::vector<std::string> tokens;
+		if (path.empty()) { return tokens; }
+		if (path[0] != '/') {
+			CONFIGURU_ONERROR("apply_patch: Bad path '" + path + "': must start with '/'");
+		}
+		std::string token;
+		for (size_t i = 1; i <= path.size(); ++i) {
+			if (i == path.size() || path[i] == '/') {
+				tokens.push_back(token);
+				token.clear();
+			} else if (path[i] == '~') {
+				if (i + 1 < path.size() && path[i + 1] == '0') {
+					token += '~';
+				} else if (i + 1 < path.size() && path[i + 1] == '1') {
+					token += '/';
+				} else {
+					CONFIGURU_ONERROR("apply_patch: Bad escape in path '" + path + "'");
+				}
+				++i;
+			} else {
+				token += path[i];
+			}
+		}
+		return tokens;
+	}
+
+	/// Array index for a path token. "-" means one past the end.
+	static size_t parse_array_index(const std::string& token, size_t size, const std::string& path)
+	{
+		if (token == "-") { return size; }
+		if (token.empty() || token.size() > 18 || token.find_first_not_of("0123456789") != std::string::npos ||
+		    (token.size() > 1 && token[0] == '0')) {
+			CONFIGURU_ONERROR("apply_patch: Bad array index '" + token + "' in path '" + path + "'");
+		}
+		return static_cast<size_t>(std::stoull(token));
+	}
+
+	/// The array or object which the last of the (non-empty) `tokens` of `path` is in.
+	static Config& find_patch_parent(Config& config, const std::vector<std::string>& tokens, const std::string& path)
+	{
+		Config* parent = &config;
+		for (size_t i = 0; i + 1 < tokens.size(); ++i) {
+			if (parent->is_object()) {
+				if (!parent->has_key(tokens[i])) {
+					CONFIGURU_ONERROR("apply_patch: Failed to find '" + path + "'");
+				}
+				parent = &(*parent)[tokens[i]];
+			} else if (parent->is_array()) {
+				const size_t ix = parse_array_index(tokens[i], parent->array_size(), path);
+				if (ix >= parent->array_size()) {
+					CONFIGURU_ONERROR("apply_patch: Array index out of range in '" + path + "'");
+				}
+				parent = &(*parent)[ix].ref();
+			} else {
+				CONFIGURU_ONERROR("apply_patch: Failed to find '" + path + "'");
+			}
+		}
+		if (!parent->is_object() && !parent->is_array()) {
+			CONFIGURU_ONERROR("apply_patch: Failed to find '" + path + "'");
+		}
+		return *parent;
+	}
+
+	/// The value at `path`, which must exist.
+	static Config& find_patch_target(Config& config, const std::string& path)
+	{
+		const auto tokens = parse_pointer(path);
+		if (tokens.empty()) { return config; }
+		Config& parent = find_patch_parent(config, tokens, path);
+		const std::string& last = tokens.back();
+		if (parent.is_object()) {
+			if (!parent.has_key(last)) {
+				CONFIGURU_ONERROR("apply_patch: Failed to find '" + path + "'");
+			}
+			return parent[last];
+		} else {
+			const size_t ix = parse_array_index(last, parent.array_size(), path);
+			if (ix >= parent.array_size()) {
+				CONFIGURU_ONERROR("apply_patch: Array index out of range in '" + path + "'");
+			}
+			return parent[ix].ref();
+		}
+	}
+
+	static void patch_add(Config& config, const std::string& path, Config value)
+	{
+		const auto tokens = parse_pointer(path);
+		if (tokens.empty()) {
+			config = std::move(value);
+			return;
+		}
+		Config& parent = find_patch_parent(config, tokens, path);
+		const std::string& last = tokens.back();
+		if (parent.is_object()) {
+			parent.insert_or_assign(last, std::move(value));
+		} else {
+			const size_t size = parent.array_size();
+			const size_t ix   = parse_array_index(last, size, path);
+			if (ix > size) {
+				CONFIGURU_ONERROR("apply_patch: Array index out of range in '" + path + "'");
+			}
+			parent.insert(ix, std::move(value));
+		}
+	}
+
+	/// Removes the value at `path` and returns it.
+	static Config patch_remove(Config& config, const std::string& path)
+	{
+		const auto tokens = parse_pointer(path);
+		if (tokens.empty()) {
+			CONFIGURU_ONERROR("apply_patch: Can't remove the root");
+		}
+		Config& parent = find_patch_parent(config, tokens, path);
+		const std::string& last = tokens.back();
+		Config removed;
+		if (parent.is_object()) {
+			if (!parent.has_key(last)) {
+				CONFIGURU_ONERROR("apply_patch: Failed to find '" + path + "'");
+			}
+			removed = std::move(parent[last]);
+			parent.erase(last);
+		} else {
+			const size_t ix = parse_array_index(last, parent.array_size(), path);
+			if (ix >= parent.array_size()) {
+				CONFIGURU_ONERROR("apply_patch: Array index out of range in '" + path + "'");
+			}
+			removed = parent[ix];
+			parent.erase(ix);
+		}
+		return removed;
+	}
+
+	void apply_patch(Config& config, const Config& patch)
+	{
+		if (!patch.is_array()) {
+			CONFIGURU_ONERROR("apply_patch: Expected the patch to be an array");
+		}
+
+		for (const Config& operation : patch.as_array()) {
+			if (!operation.is_object() || !operation.has_key("op") || !operation.has_key("path")) {
+				CONFIGURU_ONERROR("apply_patch: Expected each operation to be an object with 'op' and 'path'");
+			}
+			const std::string& op   = operation["op"].as_string();
+			const std::string& path = operation["path"].as_string();
+			const bool needs_value  = op == "add" || op == "replace" || op == "test";
+			if (needs_value && !operation.has_key("value")) {
+				CONFIGURU_ONERROR("apply_patch: '" + op + "' of '" + path + "' is missing 'value'");
+			}
+			const bool needs_from = op == "move" || op == "copy";
+			if (needs_from && !operation.has_key("from")) {
+				CONFIGURU_ONERROR("apply_patch: '" + op + "' to '" + path + "' is missing 'from'");
+			}
+
+			if (op == "add") {
+				patch_add(config, path, copy_value(operation["value"]));
+			} else if (op == "remove") {
+				patch_remove(config, path);
+			} else if (op == "replace") {
+				find_patch_target(config, path) = copy_value(operation["value"]);
+			} else if (op == "test") {
+				if (!Config::deep_eq(find_patch_target(config, path), operation["value"])) {
+					CONFIGURU_ONERROR("apply_patch: test of '" + path + "' failed");
+				}
+			} else if (op == "move") {
+				const std::string& from = operation["from"].as_string();
+				if (from == path) { continue; }
+				if (path.compare(0, from.size() + 1, from + "/") == 0) {
+					CONFIGURU_ONERROR("apply_patch: Can't move '" + from + "' into itself");
+				}
+				patch_add(config, path, patch_remove(config, from));
+			} else if (op == "copy") {
+				patch_add(config, path, copy_value(find_patch_target(config, operation["from"].as_string())));
+			} else {
+				CONFIGURU_ONERROR("apply_patch: Unsupported op '" + op + "'");
+			}
+		}
+	}
+
+	// ------------------------------------------------------------------------
+	// OverlayConfig
+
+	OverlayConfig::OverlayConfig(const std::vector<const Config*>& layers)
+		: _layers(layers.rbegin(), layers.rend())
+	{
+		normalize();
+	}
+
+	void OverlayConfig::push_layer(const Config& layer)
+	{
+		_layers.insert(_layers.begin(), &layer);
+		normalize();
+	}
+
+	void OverlayConfig::normalize()
+	{
+		_layers.erase(std::remove_if(_layers.begin(), _layers.end(), [](const Config* layer) {
+			return layer->is_uninitialized() || layer->type() == Config::BadLookupType;
+		}), _layers.end());
+
+		if (_layers.empty()) { return; }
+		if (!_layers[0]->is_object()) {
+			_layers.resize(1);
+			return;
+		}
+		for (size_t i = 1; i < _layers.size(); ++i) {
+			if (!_layers[i]->is_object()) {
+				_layers.resize(i);
+				return;
+			}
+		}
+	}
+
+	const Config& OverlayConfig::top() const
+	{
+		if (_layers.empty()) {
+			CONFIGURU_ONERROR("OverlayConfig has no layers");
+		}
+		return *_layers[0];
+	}
+
+	bool OverlayConfig::has_key(const std::string& key) const
+	{
+		top().assert_type(Config::Object);
+		for (const Config* layer : _layers) {
+			if (layer->has_key(key)) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	OverlayConfig OverlayConfig::operator[](const std::string& key) const
+	{
+		top().assert_type(Config::Object);
+		OverlayConfig ret;
+		for (const Config* layer : _layers) {
+			if (layer->has_key(key)) {
+				ret._layers.push_back(&(*layer)[key]);
+			}
+		}
+		if (ret._layers.empty()) {
+			top().on_error("Key '" + key + "' not in any layer");
+		}
+		ret.normalize();
+		return ret;
+	}
+
+	OverlayConfig::ObjectIterator::ObjectIterator(const std::vector<const Config*>& layers)
+	{
+		for (const Config* layer : layers) {
+			const auto& object = layer->as_object()._impl;
+			_cursors.emplace_back(object.begin(), object.end());
+		}
+		find_next_key();
+	}
+
+	void OverlayConfig::ObjectIterator::find_next_key()
+	{
+		_key = nullptr;
+		for (auto&& cursor : _cursors) {
+			if (cursor.first != cursor.second && (!_key || cursor.first->first < *_key)) {
+				_key = &cursor.first->first;
+			}
+		}
+	}
+
+	OverlayConfig::ObjectIterator& OverlayConfig::ObjectIterator::operator++()
+	{
+		const std::string key = *_key;
+		for (auto&& cursor : _cursors) {
+			if (cursor.first != cursor.second && cursor.first->first == key) {
+				++cursor.first;
+			}
+		}
+		find_next_key();
+		return *this;
+	}
+
+	OverlayConfig OverlayConfig::ObjectIterator::value() const
+	{
+		OverlayConfig ret;
+		for (auto&& cursor : _cursors) {
+			if (cursor.first != cursor.second && cursor.first->first == *_key) {
+				cursor.first->second._accessed.mark();
+				ret._layers.push_back(&cursor.first->second._value);
+			}
+		}
+		ret.normalize();
+		return ret;
+	}
+
+	OverlayConfig::ObjectRange OverlayConfig::as_object() const
+	{
+		top().assert_type(Config::Object);
+		return {ObjectIterator(_layers), ObjectIterator()};
+	}
+
+	Config OverlayConfig::flatten() const
+	{
+		if (!is_object()) {
+			return copy_value(top());
+		}
+
+		// Bottom layer first, in insertion order:
+		std::vector<std::string> keys;
+		std::set<std::string> seen;
+		for (auto layer = _layers.rbegin(); layer != _layers.rend(); ++layer) {
+			using ObjIterator = Config::ConfigObjectImpl::const_iterator;
+			const auto& object = (*layer)->as_object()._impl;
+			std::vector<ObjIterator> entries;
+			for (auto it = object.begin(); it != object.end(); ++it) {
+				if (seen.insert(it->first).second) {
+					entries.push_back(it);
+				}
+			}
+			std::sort(entries.begin(), entries.end(), [](const ObjIterator& a, const ObjIterator& b) {
+				return a->second._nr < b->second._nr;
+			});
+			for (auto&& it : entries) {
+				keys.push_back(it->first);
+			}
+		}
+
+		Config ret = Config::object();
+		for (const auto& key : keys) {
+			ret.insert_or_assign(key, (*this)[key].flatten());
+		}
+		return ret;
+	}
+
+	// ------------------------------------------------------------------------
+	// ThreadPool
+
+	struct ThreadPool::Impl
+	{
+		std::vector<std::thread>          threads;
+		std::deque<std::function<void()>> tasks;
+		std::mutex                        mutex;
+		std::condition_variable           cv;
+		bool                              quit = false;
+
+		/// Runs one queued task, or sleeps until there is one or is_done() returns true.
+		/// Whatever makes is_done() true must then call wake_waiters().
+		template<class IsDone>
+		void run_task_or_wait(const IsDone& is_done)
+		{
+			std::function<void()> task;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				cv.wait(lock, [&]{ return is_done() || !tasks.empty(); });
+				if (is_done()) { return; }
+				task = std::move(tasks.front());
+				tasks.pop_front();
+			}
+			task();
+		}
+
+		void wake_waiters()
+		{
+			{
+				// So that a waiter can't miss it between checking is_done() and going to sleep:
+				std::lock_guard<std::mutex> lock(mutex);
+			}
+			cv.notify_all();
+		}
+
+		void work()
+		{
+			for (;;) {
+				std::function<void()> task;
+				{
+					std::unique_lock<std::mutex> lock(mutex);
+					cv.wait(lock, [this]{ return quit || !tasks.empty(); });
+					if (tasks.empty()) { return; }
+					task = std::move(tasks.front());
+					tasks.pop_front();
+				}
+				task();
+			}
+		}
+	};
+
+	/// One call to parallel_for.
+	struct ParallelForBatch
+	{
+		ThreadPool::Impl&                   pool;
+		const std::function<void(size_t)>& fun;
+		const size_t                        count;
+		std::atomic<size_t>                 next { 0 };
+		std::atomic<size_t>                 done { 0 };
+		std::mutex                          error_mutex;
+		std::exception_ptr                  error;
+
+		ParallelForBatch(ThreadPool::Impl& p, const std::function<void(size_t)>& f, size_t n) : pool(p), fun(f), count(n) {}
+
+		bool is_done() const { return done.load(std::memory_order_acquire) == count; }
+
+		/// Run calls until there are none left.
+		void work()
+		{
+			for (;;) {
+				const size_t i = next.fetch_add(1);
+				if (i >= count) { return; }
+				try {
+					fun(i);
+				} catch (...) {
+					std::lock_guard<std::mutex> lock(error_mutex);
+					if (!error) { error = std::current_exception(); }
+				}
+				if (done.fetch_add(1, std::memory_order_release) + 1 == count) {
+					pool.wake_waiters();
+				}
+			}
+		}
+	};
+
+	ThreadPool::ThreadPool(size_t num_threads) : _impl(new Impl())
+	{
+		if (num_threads == 0) {
+			num_threads = (std::max)(1u, std::thread::hardware_concurrency());
+		}
+		for (size_t i = 0; i < num_threads; ++i) {
+			_impl->threads.emplace_back([this]{ _impl->work(); });
+		}
+	}
+
+	ThreadPool::~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(_impl->mutex);
+			_impl->quit = true;
+		}
+		_impl->cv.notify_all();
+		for (auto& thread : _impl->threads) {
+			thread.join();
+		}
+	}
+
+	size_t ThreadPool::num_threads() const
+	{
+		return _impl->threads.size();
+	}
+
+	void ThreadPool::parallel_for(size_t count, const std::function<void(size_t)>& fun)
+	{
+		if (count == 0) { return; }
+
+		auto batch = std::make_shared<ParallelForBatch>(*_impl, fun, count);
+		const size_t num_helpers = (std::min)(count - 1, _impl->threads.size());
+		{
+			std::lock_guard<std::mutex> lock(_impl->mutex);
+			for (size_t i = 0; i < num_helpers; ++i) {
+				_impl->tasks.emplace_back([batch]{ batch->work(); });
+			}
+		}
+		_impl->cv.notify_all();
+
+		batch->work();
+
+		// Calls may still be running on other threads. Help out with other work while we wait,
+		// so that nested calls to parallel_for can't deadlock, and sleep when there is none:
+		while (!batch->is_done()) {
+			_impl->run_task_or_wait([&]{ return batch->is_done(); });
+		}
+
+		std::exception_ptr error;
+		{
+			// Take it, so that it is not released by whichever thread drops the batch last.
+			std::lock_guard<std::mutex> lock(batch->error_mutex);
+			std::swap(error, batch->error);
+		}
+		if (error) {
+			std::rethrow_exception(error);
+		}
+	}
+
+	size_t ThreadPool::num_ranges(size_t count) const
+	{
+		// A few ranges per thread, so that uneven ranges even out:
+		return (std::min)(count, 4 * (num_threads() + 1));
+	}
+
+	void ThreadPool::parallel_for_ranges(size_t count, const std::function<void(size_t, size_t, size_t)>& fun)
+	{
+		const size_t n = num_ranges(count);
+		parallel_for(n, [&](size_t range) {
+			fun(range, range * count / n, (range + 1) * count / n);
+		});
+	}
+
+	// ------------------------------------------------------------------------
+	// ConfigReclaimer
+
+	struct ConfigReclaimer::Impl
+	{
+		mutable std::mutex      retired_mutex;
+		std::vector<Config>     retired;         ///< Handed to us by retire(), not yet looked at.
+		std::condition_variable cv;
+		bool                    quit = false;
+
+		mutable std::mutex      work_mutex;
+		std::vector<Config>     work;            ///< Left to free, each owning its contents (or a leaf).
+		Config                  current;         ///< Being freed one child at a time.
+
+		std::thread             worker;
+	};
+
+	ConfigReclaimer::ConfigReclaimer(bool background) : _impl(new Impl())
+	{
+		if (background) {
+			_impl->worker = std::thread([this]{
+				for (;;) {
+					{
+						std::unique_lock<std::mutex> lock(_impl->retired_mutex);
+						_impl->cv.wait(lock, [this]{ return _impl->quit || !_impl->retired.empty(); });
+						if (_impl->retired.empty()) { return; }
+					}
+					reclaim_all();
+				}
+			});
+		}
+	}
+
+	ConfigReclaimer::~ConfigReclaimer()
+	{
+		if (_impl->worker.joinable()) {
+			{
+				std::lock_guard<std::mutex> lock(_impl->retired_mutex);
+				_impl->quit = true;
+			}
+			_impl->cv.notify_one();
+			_impl->worker.join();
+		}
+		reclaim_all();
+	}
+
+	void ConfigReclaimer::retire(Config&& config)
+	{
+		{
+			std::lock_guard<std::mutex> lock(_impl->retired_mutex);
+			_impl->retired.emplace_back();
+			_impl->retired.back().swap(config);
+		}
+		_impl->cv.notify_one();
+	}
+
+	bool ConfigReclaimer::reclaim(size_t max_nodes)
+	{
+		std::lock_guard<std::mutex> work_lock(_impl->work_mutex);
+		auto& work    = _impl->work;
+		auto& current = _impl->current;
+
+		for (size_t num_freed = 0; num_freed < max_nodes; ++num_freed) {
+			if (current.is_uninitialized()) {
+				if (work.empty()) {
+					std::lock_guard<std::mutex> lock(_impl->retired_mutex);
+					if (_impl->retired.empty()) { return true; }
+					work.swap(_impl->retired);
+				}
+				current.swap(work.back());
+				work.pop_back();
+			}
+
+			if (!current.owns_contents() || !current.release_last_child(work)) {
+				// Now a leaf, or shared with someone else, so this is cheap:
+				Config done;
+				done.swap(current);
+			}
+		}
+
+		if (!current.is_uninitialized() || !work.empty()) { return false; }
+		std::lock_guard<std::mutex> lock(_impl->retired_mutex);
+		return _impl->retired.empty();
+	}
+
+	void ConfigReclaimer::reclaim_all()
+	{
+		while (!reclaim(4096)) { }
+	}
+
+	bool ConfigReclaimer::empty() const
+	{
+		std::lock_guard<std::mutex> work_lock(_impl->work_mutex);
+		if (!_impl->current.is_uninitialized() || !_impl->work.empty()) { return false; }
+		std::lock_guard<std::mutex> lock(_impl->retired_mutex);
+		return _impl->retired.empty();
+	}
+
+	// ------------------------------------------------------------------------
+	// PersistentConfig
+
+	/// Arrays are a trie of chunks of up to PERSISTENT_CHUNK_SIZE elements (at the bottom) or chunks (above),
+	/// filled from the left. Two arrays of the same size have the same shape.
+	static const unsigned PERSISTENT_CHUNK_BITS = 5;
+	static const size_t   PERSISTENT_CHUNK_SIZE = size_t(1) << PERSISTENT_CHUNK_BITS;
+	static const size_t   PERSISTENT_CHUNK_MASK = PERSISTENT_CHUNK_SIZE - 1;
+
+	struct PersistentConfig::Node
+	{
+		std::string                       str;
+		size_t                            size    = 0; ///< Of an array or object.
+		unsigned                          shift   = 0; ///< Array: how far to shift an index for the child of the top chunk.
+		std::shared_ptr<const ArrayChunk> chunks;      ///< Array: the top chunk, or null if empty.
+		std::shared_ptr<const ObjectTree> entries;     ///< Object: the root of an AVL tree sorted by key, or null if empty.
+		Index                             next_nr = 0; ///< Object: the insertion order of the next new key.
+	};
+
+	struct PersistentConfig::ArrayChunk
+	{
+		std::vector<PersistentConfig>                  values;   ///< At the bottom of the trie.
+		std::vector<std::shared_ptr<const ArrayChunk>> children; ///< Above it.
+	};
+
+	/// An object entry, with the entries sorted before it to the left and after it to the right.
+	/// A change copies the entries on the path to it, which share their key with the original.
+	struct PersistentConfig::ObjectTree
+	{
+		std::shared_ptr<const std::string> key;
+		PersistentConfig                   value;
+		Index                              nr;     ///< Like Config_Entry::_nr.
+		std::shared_ptr<const ObjectTree>  left;
+		std::shared_ptr<const ObjectTree>  right;
+		unsigned                           height; ///< 1 for a leaf.
+	};
+
+	using PersistentChunk_SP = std::shared_ptr<const PersistentConfig::ArrayChunk>;
+	using PersistentTree_SP  = std::shared_ptr<const PersistentConfig::ObjectTree>;
+
+	static const PersistentConfig::ArrayChunk* persistent_leaf(const PersistentConfig::Node& node, size_t ix)
+	{
+		const PersistentConfig::ArrayChunk* chunk = node.chunks.get();
+		for (unsigned shift = node.shift; shift > 0; shift -= PERSISTENT_CHUNK_BITS) {
+			chunk = chunk->children[(ix >> shift) & PERSISTENT_CHUNK_MASK].get();
+		}
+		return chunk;
+	}
+
+	/// A chain of new chunks down to a leaf holding only `value`.
+	static PersistentChunk_SP persistent_path(unsigned shift, PersistentConfig value)
+	{
+		auto chunk = std::make_shared<PersistentConfig::ArrayChunk>();
+		if (shift == 0) {
+			chunk->values.push_back(std::move(value));
+		} else {
+			chunk->children.push_back(persistent_path(shift - PERSISTENT_CHUNK_BITS, std::move(value)));
+		}
+		return chunk;
+	}
+
+	static PersistentChunk_SP persistent_chunk_with(const PersistentChunk_SP& chunk, unsigned shift, size_t ix, PersistentConfig value)
+	{
+		auto copy = std::make_shared<PersistentConfig::ArrayChunk>(*chunk);
+		if (shift == 0) {
+			copy->values[ix & PERSISTENT_CHUNK_MASK] = std::move(value);
+		} else {
+			auto& child = copy->children[(ix >> shift) & PERSISTENT_CHUNK_MASK];
+			child = persistent_chunk_with(child, shift - PERSISTENT_CHUNK_BITS, ix, std::move(value));
+		}
+		return copy;
+	}
+
+	/// `ix` is the size of the array, which must fit under `chunk`.
+	static PersistentChunk_SP persistent_appended(const PersistentChunk_SP& chunk, unsigned shift, size_t ix, PersistentConfig value)
+	{
+		auto copy = std::make_shared<PersistentConfig::ArrayChunk>(*chunk);
+		if (shift == 0) {
+			copy->values.push_back(std::move(value));
+		} else {
+			const size_t child_ix = (ix >> shift) & PERSISTENT_CHUNK_MASK;
+			if (child_ix < copy->children.size()) {
+				copy->children[child_ix] = persistent_appended(copy->children[child_ix], shift - PERSISTENT_CHUNK_BITS, ix, std::move(value));
+			} else {
+				copy->children.push_back(persistent_path(shift - PERSISTENT_CHUNK_BITS, std::move(value)));
+			}
+		}
+		return copy;
+	}
+
+	/// Builds the trie bottom up, in the same shape as appending the values one by one would.
+	static void persistent_set_array(PersistentConfig::Node& node, std::vector<PersistentConfig> values)
+	{
+		node.size = values.size();
+		if (values.empty()) { return; }
+		std::vector<PersistentChunk_SP> level;
+		for (size_t i = 0; i < values.size(); i += PERSISTENT_CHUNK_SIZE) {
+			const size_t end = (std::min)(i + PERSISTENT_CHUNK_SIZE, values.size());
+			auto leaf = std::make_shared<PersistentConfig::ArrayChunk>();
+			leaf->values.assign(std::make_move_iterator(values.begin() + static_cast<std::ptrdiff_t>(i)),
+			                    std::make_move_iterator(values.begin() + static_cast<std::ptrdiff_t>(end)));
+			level.push_back(std::move(leaf));
+		}
+		while (level.size() > 1) {
+			std::vector<PersistentChunk_SP> parents;
+			for (size_t i = 0; i < level.size(); i += PERSISTENT_CHUNK_SIZE) {
+				const size_t end = (std::min)(i + PERSISTENT_CHUNK_SIZE, level.size());
+				auto parent = std::make_shared<PersistentConfig::ArrayChunk>();
+				parent->children.assign(level.begin() + static_cast<std::ptrdiff_t>(i), level.begin() + static_cast<std::ptrdiff_t>(end));
+				parents.push_back(std::move(parent));
+			}
+			level = std::move(parents);
+			node.shift += PERSISTENT_CHUNK_BITS;
+		}
+		node.chunks = std::move(level[0]);
+	}
+
+	/// Arrays of the same size have the same shape, so shared chunks can be skipped.
+	static bool persistent_chunks_eq(const PersistentConfig::ArrayChunk* a, const PersistentConfig::ArrayChunk* b)
+	{
+		if (a == b) { return true; }
+		if (a->values.size() != b->values.size() || a->children.size() != b->children.size()) { return false; }
+		for (size_t i = 0; i < a->values.size(); ++i) {
+			if (!PersistentConfig::deep_eq(a->values[i], b->values[i])) { return false; }
+		}
+		for (size_t i = 0; i < a->children.size(); ++i) {
+			if (!persistent_chunks_eq(a->children[i].get(), b->children[i].get())) { return false; }
+		}
+		return true;
+	}
+
+	static unsigned persistent_height(const PersistentTree_SP& tree)
+	{
+		return tree ? tree->height : 0;
+	}
+
+	static PersistentTree_SP persistent_tree(const std::shared_ptr<const std::string>& key, PersistentConfig value, Index nr,
+	                                         PersistentTree_SP left, PersistentTree_SP right)
+	{
+		auto tree = std::make_shared<PersistentConfig::ObjectTree>();
+		tree->height = 1 + (std::max)(persistent_height(left), persistent_height(right));
+		tree->key    = key;
+		tree->value  = std::move(value);
+		tree->nr     = nr;
+		tree->left   = std::move(left);
+		tree->right  = std::move(right);
+		return tree;
+	}
+
+	/// Like persistent_tree, but rotates so that the heights of the two sides differ by at most one,
+	/// given that they differ by at most two.
+	static PersistentTree_SP persistent_balanced(const std::shared_ptr<const std::string>& key, PersistentConfig value, Index nr,
+	                                             PersistentTree_SP left, PersistentTree_SP right)
+	{
+		const unsigned left_height  = persistent_height(left);
+		const unsigned right_height = persistent_height(right);
+		if (left_height > right_height + 1) {
+			if (persistent_height(left->left) >= persistent_height(left->right)) {
+				return persistent_tree(left->key, left->value, left->nr, left->left,
+					persistent_tree(key, std::move(value), nr, left->right, std::move(right)));
+			} else {
+				const auto& mid = left->right;
+				return persistent_tree(mid->key, mid->value, mid->nr,
+					persistent_tree(left->key, left->value, left->nr, left->left, mid->left),
+					persistent_tree(key, std::move(value), nr, mid->right, std::move(right)));
+			}
+		}
+		if (right_height > left_height + 1) {
+			if (persistent_height(right->right) >= persistent_height(right->left)) {
+				return persistent_tree(right->key, right->value, right->nr,
+					persistent_tree(key, std::move(value), nr, std::move(left), right->left), right->right);
+			} else {
+				const auto& mid = right->left;
+				return persistent_tree(mid->key, mid->value, mid->nr,
+					persistent_tree(key, std::move(value), nr, std::move(left), mid->left),
+					persistent_tree(right->key, right->value, right->nr, mid->right, right->right));
+			}
+		}
+		return persistent_tree(key, std::move(value), nr, std::move(left), std::move(right));
+	}
+
+	static const PersistentConfig::ObjectTree* persistent_find(const PersistentConfig::ObjectTree* tree, const std::string& key)
+	{
+		while (tree) {
+			const int cmp = key.compare(*tree->key);
+			if (cmp == 0) { return tree; }
+			tree = cmp < 0 ? tree->left.get() : tree->right.get();
+		}
+		return nullptr;
+	}
+
+	/// A new key gets the insertion order `nr`. An existing key keeps its own.
+	static PersistentTree_SP persistent_with(const PersistentTree_SP& tree, const std::string& key, PersistentConfig value, Index nr)
+	{
+		if (!tree) {
+			return persistent_tree(std::make_shared<const std::string>(key), std::move(value), nr, nullptr, nullptr);
+		}
+		const int cmp = key.compare(*tree->key);
+		if (cmp < 0) {
+			return persistent_balanced(tree->key, tree->value, tree->nr, persistent_with(tree->left, key, std::move(value), nr), tree->right);
+		} else if (cmp > 0) {
+			return persistent_balanced(tree->key, tree->value, tree->nr, tree->left, persistent_with(tree->right, key, std::move(value), nr));
+		} else {
+			return persistent_tree(tree->key, std::move(value), tree->nr, tree->left, tree->right);
+		}
+	}
+
+	/// `tree` without its first entry, which is returned in `first`.
+	static PersistentTree_SP persistent_without_first(const PersistentTree_SP& tree, const PersistentConfig::ObjectTree** first)
+	{
+		if (!tree->left) {
+			*first = tree.get();
+			return tree->right;
+		}
+		return persistent_balanced(tree->key, tree->value, tree->nr, persistent_without_first(tree->left, first), tree->right);
+	}
+
+	/// The key must be in the tree.
+	static PersistentTree_SP persistent_without(const PersistentTree_SP& tree, const std::string& key)
+	{
+		const int cmp = key.compare(*tree->key);
+		if (cmp < 0) {
+			return persistent_balanced(tree->key, tree->value, tree->nr, persistent_without(tree->left, key), tree->right);
+		} else if (cmp > 0) {
+			return persistent_balanced(tree->key, tree->value, tree->nr, tree->left, persistent_without(tree->right, key));
+		} else if (!tree->left) {
+			return tree->right;
+		} else if (!tree->right) {
+			return tree->left;
+		} else {
+			const PersistentConfig::ObjectTree* first = nullptr;
+			auto right = persistent_without_first(tree->right, &first);
+			return persistent_balanced(first->key, first->value, first->nr, tree->left, std::move(right));
+		}
+	}
+
+	using PersistentSource = std::vector<const Config::ConfigObjectImpl::value_type*>;
+
+	/// A balanced tree of the sorted entries [begin, end).
+	static PersistentTree_SP persistent_build_tree(const PersistentSource& entries, size_t begin, size_t end)
+	{
+		if (begin == end) { return nullptr; }
+		const size_t mid = begin + (end - begin) / 2;
+		auto left  = persistent_build_tree(entries, begin, mid);
+		auto right = persistent_build_tree(entries, mid + 1, end);
+		const auto& entry = *entries[mid];
+		return persistent_tree(std::make_shared<const std::string>(entry.first), PersistentConfig(entry.second._value),
+		                       entry.second._nr, std::move(left), std::move(right));
+	}
+
+	PersistentConfig::PersistentConfig(const char* str) : PersistentConfig(std::string(str)) { }
+
+	PersistentConfig::PersistentConfig(std::string str) : _type(Config::String)
+	{
+		auto node = std::make_shared<Node>();
+		node->str = std::move(str);
+		_node = std::move(node);
+	}
+
+	PersistentConfig::PersistentConfig(const Config& config) : _type(config.type())
+	{
+		switch (_type) {
+			case Config::BadLookupType: _type = Config::Uninitialized; break;
+			case Config::Bool:   _u.b = config.as_bool();   break;
+			case Config::Int:    _u.i = config.as_integer<int64_t>(); break;
+			case Config::Float:  _u.f = config.as_double(); break;
+			case Config::String: {
+				auto node = std::make_shared<Node>();
+				node->str = config.as_string();
+				_node = std::move(node);
+				break;
+			}
+			case Config::Array: {
+				std::vector<PersistentConfig> values;
+				const auto packing = config.array_packing();
+				values.reserve(config.array_size());
+				if (packing == Config::ArrayPacking::Ints) {
+					for (const auto i : config.as_int_span()) { values.emplace_back(static_cast<long long>(i)); }
+				} else if (packing == Config::ArrayPacking::Floats) {
+					for (const auto f : config.as_float_span()) { values.emplace_back(f); }
+				} else {
+					for (const auto& value : config.as_array()) { values.emplace_back(value); }
+				}
+				auto node = std::make_shared<Node>();
+				persistent_set_array(*node, std::move(values));
+				_node = std::move(node);
+				break;
+			}
+			case Config::Object: {
+				const auto& object = config.as_object()._impl;
+				PersistentSource entries;
+				entries.reserve(object.size());
+				auto node = std::make_shared<Node>();
+				for (auto&& p : object) { // std::map is already sorted
+					entries.push_back(&p);
+					node->next_nr = (std::max)(node->next_nr, p.second._nr + 1);
+				}
+				node->size    = object.size();
+				node->entries = persistent_build_tree(entries, 0, entries.size());
+				_node = std::move(node);
+				break;
+			}
+			default: break;
+		}
+	}
+
+	PersistentConfig PersistentConfig::object()
+	{
+		PersistentConfig ret;
+		ret._type = Config::Object;
+		ret._node = std::make_shared<Node>();
+		return ret;
+	}
+
+	PersistentConfig PersistentConfig::array()
+	{
+		PersistentConfig ret;
+		ret._type = Config::Array;
+		ret._node = std::make_shared<Node>();
+		return ret;
+	}
+
+	Config PersistentConfig::to_config() const
+	{
+		switch (_type) {
+			case Config::Null:   return Config(nullptr);
+			case Config::Bool:   return Config(_u.b);
+			case Config::Int:    return Config(_u.i);
+			case Config::Float:  return Config(_u.f);
+			case Config::String: return Config(_node->str);
+			case Config::Array: {
+				Config ret = Config::array();
+				for (const auto& value : as_array()) {
+					ret.push_back(value.to_config());
+				}
+				return ret;
+			}
+			case Config::Object: {
+				Config ret = Config::object();
+				auto& object = ret.object_for_mutation();
+				for (ObjectIterator it(_node->entries.get()), end(nullptr); it != end; ++it) {
+					const ObjectTree* entry = it.current();
+					object.emplace_hint(object.end(), *entry->key, Config::ObjectEntry(entry->value.to_config(), entry->nr));
+				}
+				return ret;
+			}
+			default: return Config();
+		}
+	}
+
+	const std::string& PersistentConfig::as_string() const
+	{
+		assert_type(Config::String);
+		return _node->str;
+	}
+
+	size_t PersistentConfig::array_size() const
+	{
+		assert_type(Config::Array);
+		return _node->size;
+	}
+
+	const PersistentConfig& PersistentConfig::ArrayIterator::operator*() const
+	{
+		if (!_chunk) {
+			_chunk = persistent_leaf(*_node, _ix);
+		}
+		return _chunk->values[_ix & PERSISTENT_CHUNK_MASK];
+	}
+
+	PersistentConfig::ArrayIterator& PersistentConfig::ArrayIterator::operator++()
+	{
+		++_ix;
+		if ((_ix & PERSISTENT_CHUNK_MASK) == 0) {
+			_chunk = nullptr; // On to the next leaf.
+		}
+		return *this;
+	}
+
+	PersistentConfig::ArrayRange PersistentConfig::as_array() const
+	{
+		assert_type(Config::Array);
+		return {{_node.get(), 0}, {_node.get(), _node->size}};
+	}
+
+	const PersistentConfig& PersistentConfig::operator[](size_t ix) const
+	{
+		check(ix < array_size(), "Array index out of range");
+		return persistent_leaf(*_node, ix)->values[ix & PERSISTENT_CHUNK_MASK];
+	}
+
+	PersistentConfig PersistentConfig::with(size_t ix, PersistentConfig value) const
+	{
+		check(ix < array_size(), "Array index out of range");
+		auto node = std::make_shared<Node>(*_node);
+		node->chunks = persistent_chunk_with(_node->chunks, node->shift, ix, std::move(value));
+		PersistentConfig ret = *this;
+		ret._node = std::move(node);
+		return ret;
+	}
+
+	PersistentConfig PersistentConfig::with_appended(PersistentConfig value) const
+	{
+		assert_type(Config::Array);
+		auto node = std::make_shared<Node>(*_node);
+		const size_t ix = node->size;
+		if (!node->chunks) {
+			node->chunks = persistent_path(0, std::move(value));
+		} else if (ix == size_t(1) << (node->shift + PERSISTENT_CHUNK_BITS)) {
+			// The trie is full, so it gets a new top:
+			auto top = std::make_shared<ArrayChunk>();
+			top->children.push_back(node->chunks);
+			top->children.push_back(persistent_path(node->shift, std::move(value)));
+			node->chunks = std::move(top);
+			node->shift += PERSISTENT_CHUNK_BITS;
+		} else {
+			node->chunks = persistent_appended(node->chunks, node->shift, ix, std::move(value));
+		}
+		node->size += 1;
+		PersistentConfig ret = *this;
+		ret._node = std::move(node);
+		return ret;
+	}
+
+	size_t PersistentConfig::object_size() const
+	{
+		assert_type(Config::Object);
+		return _node->size;
+	}
+
+	void PersistentConfig::ObjectIterator::push_left(const ObjectTree* tree)
+	{
+		for (; tree; tree = tree->left.get()) {
+			_stack.push_back(tree);
+		}
+	}
+
+	PersistentConfig::ObjectIterator& PersistentConfig::ObjectIterator::operator++()
+	{
+		const ObjectTree* passed = _stack.back();
+		_stack.pop_back();
+		push_left(passed->right.get());
+		return *this;
+	}
+
+	const std::string& PersistentConfig::ObjectIterator::key() const
+	{
+		return *_stack.back()->key;
+	}
+
+	const PersistentConfig& PersistentConfig::ObjectIterator::value() const
+	{
+		return _stack.back()->value;
+	}
+
+	PersistentConfig::ObjectRange PersistentConfig::as_object() const
+	{
+		assert_type(Config::Object);
+		return {ObjectIterator(_node->entries.get()), ObjectIterator(nullptr)};
+	}
+
+	const PersistentConfig* PersistentConfig::find(const std::string& key) const
+	{
+		assert_type(Config::Object);
+		const ObjectTree* entry = persistent_find(_node->entries.get(), key);
+		return entry ? &entry->value : nullptr;
+	}
+
+	const PersistentConfig& PersistentConfig::operator[](const std::string& key) const
+	{
+		const PersistentConfig* value = find(key);
+		if (!value) {
+			on_error("Key '" + key + "' not in object");
+		}
+		return *value;
+	}
+
+	PersistentConfig PersistentConfig::with(const std::string& key, PersistentConfig value) const
+	{
+		assert_type(Config::Object);
+		auto node = std::make_shared<Node>(*_node);
+		if (!persistent_find(_node->entries.get(), key)) {
+			node->size    += 1;
+			node->next_nr += 1;
+		}
+		node->entries = persistent_with(_node->entries, key, std::move(value), _node->next_nr);
+		PersistentConfig ret = *this;
+		ret._node = std::move(node);
+		return ret;
+	}
+
+	PersistentConfig PersistentConfig::with_path(const std::string* begin, const std::string* end, PersistentConfig value) const
+	{
+		if (begin == end) {
+			return value;
+		}
+		const PersistentConfig* child = find(*begin);
+		const PersistentConfig new_child = child ? child->with_path(begin + 1, end, std::move(value))
+		                                         : object().with_path(begin + 1, end, std::move(value));
+		return with(*begin, new_child);
+	}
+
+	PersistentConfig PersistentConfig::with(std::initializer_list<std::string> path, PersistentConfig value) const
+	{
+		return with_path(path.begin(), path.end(), std::move(value));
+	}
+
+	PersistentConfig PersistentConfig::without(const std::string& key) const
+	{
+		if (!find(key)) {
+			return *this;
+		}
+		auto node = std::make_shared<Node>(*_node);
+		node->entries = persistent_without(_node->entries, key);
+		node->size -= 1;
+		PersistentConfig ret = *this;
+		ret._node = std::move(node);
+		return ret;
+	}
+
+	bool PersistentConfig::deep_eq(const PersistentConfig& a, const PersistentConfig& b)
+	{
+		if (a._type != b._type) { return false; }
+		switch (a._type) {
+			case Config::Null:   return true;
+			case Config::Bool:   return a._u.b == b._u.b;
+			case Config::Int:    return a._u.i == b._u.i;
+			case Config::Float:  return a._u.f == b._u.f;
+			case Config::String: return a._node == b._node || a._node->str == b._node->str;
+			case Config::Array: {
+				if (a._node == b._node) { return true; }
+				if (a._node->size != b._node->size) { return false; }
+				return persistent_chunks_eq(a._node->chunks.get(), b._node->chunks.get());
+			}
+			case Config::Object: {
+				if (a._node == b._node || a._node->entries == b._node->entries) { return true; }
+				if (a._node->size != b._node->size) { return false; }
+				const ObjectIterator end(nullptr);
+				for (ObjectIterator a_it(a._node->entries.get()), b_it(b._node->entries.get()); a_it != end; ++a_it, ++b_it) {
+					if (a_it.key() != b_it.key() || !deep_eq(a_it.value(), b_it.value())) { return false; }
+				}
+				return true;
+			}
+			default: return false;
+		}
+	}
+
+	void PersistentConfig::on_error(const std::string& msg) const
+	{
+		CONFIGURU_ONERROR(msg);
+		abort(); // We shouldn't get here.
+	}
+
+	void PersistentConfig::assert_type(Config::Type expected) const
+	{
+		if (_type != expected) {
+			on_error(std::string("Expected ") + Config::type_str(expected) + ", got " + Config::type_str(_type));
+		}
+	}
+}
+
+// ----------------------------------------------------------------------------
+// 88""Yb    db    88""Yb .dP"Y8 888888 88""Yb
+// 88__dP   dPYb   88__dP `Ybo." 88__   88__dP
+// 88"""   dP__Yb  88"Yb  o.`Y8b 88""   88"Yb
+// 88     dP""""Yb 88  Yb 8bodP' 888888 88  Yb
+
+#include <cerrno>
+#include <cstdlib>
+
+namespace configuru
+{
+	void append(Comments& a, Comments&& b)
+	{
+		for (auto&& entry : b) {
+			a.emplace_back(std::move(entry));
+		}
+	}
+
+	bool ConfigComments::empty() const
+	{
+		return prefix.empty()
+			&& postfix.empty()
+			&& pre_end_brace.empty();
+	}
+
+	void ConfigComments::append(ConfigComments&& other)
+	{
+		configuru::append(this->prefix,        std::move(other.prefix));
+		configuru::append(this->postfix,       std::move(other.postfix));
+		configuru::append(this->pre_end_brace, std::move(other.pre_end_brace));
+	}
+
+	// Returns the number of bytes written, or 0 on error
+	size_t encode_utf8(std::string& dst, uint64_t c)
+	{
+		if (c <= 0x7F)  // 0XXX XXXX - one byte
+		{
+			dst += static_cast<char>(c);
+			return 1;
+		}
+		else if (c <= 0x7FF)  // 110X XXXX - two bytes
+		{
+			dst += static_cast<char>( 0xC0 | (c >> 6) );
+			dst += static_cast<char>( 0x80 | (c & 0x3F) );
+			return 2;
+		}
+		else if (c <= 0xFFFF)  // 1110 XXXX - three bytes
+		{
+			dst += static_cast<char>(0xE0 | (c >> 12));
+			dst += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+			dst += static_cast<char>(0x80 | (c & 0x3F));
+			return 3;
+		}
+		else if (c <= 0x1FFFFF)  // 1111 0XXX - four bytes
+		{
+			dst += static_cast<char>(0xF0 | (c >> 18));
+			dst += static_cast<char>(0x80 | ((c >> 12) & 0x3F));
+			dst += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+			dst += static_cast<char>(0x80 | (c & 0x3F));
+			return 4;
+		}
+		else if (c <= 0x3FFFFFF)  // 1111 10XX - five bytes
+		{
+			dst += static_cast<char>(0xF8 | (c >> 24));
+			dst += static_cast<char>(0x80 | (c >> 18));
+			dst += static_cast<char>(0x80 | ((c >> 12) & 0x3F));
+			dst += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+			dst += static_cast<char>(0x80 | (c & 0x3F));
+			return 5;
+		}
+		else if (c <= 0x7FFFFFFF)  // 1111 110X - six bytes
+		{
+			dst += static_cast<char>(0xFC | (c >> 30));
+			dst += static_cast<char>(0x80 | ((c >> 24) & 0x3F));
+			dst += static_cast<char>(0x80 | ((c >> 18) & 0x3F));
+			dst += static_cast<char>(0x80 | ((c >> 12) & 0x3F));
+			dst += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+			dst += static_cast<char>(0x80 | (c & 0x3F));
+			return 6;
+		}
+		else {
+			return 0; // Error
+		}
+	}
+
+	std::string quote(char c)
+	{
+		if (c == 0)    { return "<eof>";   }
+		if (c == ' ')  { return "<space>"; }
+		if (c == '\n') { return "'\\n'";   }
+		if (c == '\t') { return "'\\t'";   }
+		if (c == '\r') { return "'\\r'";   }
+		if (c == '\b') { return "'\\b'";   }
+		return std::string("'") + c + "'";
+	}
+
+	struct State
+	{
+		const char* ptr;
+		unsigned    line_nr;
+		const char* line_start;
+	};
+
+	struct Parser
+	{
+		Parser(const char* str, const FormatOptions& options, DocInfo_SP doc, ParseInfo& info);
+
+		bool skip_white(Comments* out_comments, int& out_indentation, bool break_on_newline);
+
+		bool skip_white_ignore_comments()
+		{
+			int indentation;
+			return skip_white(nullptr, indentation, false);
+		}
+
+		bool skip_pre_white(Config* config, int& out_indentation)
+		{
+			if (!MAYBE_WHITE[static_cast<uint8_t>(_ptr[0])]) {
+				// Early out
+				out_indentation = -1;
+				return false;
+			}
+
+			Comments comments;
+			bool did_skip = skip_white(&comments, out_indentation, false);
+			if (!comments.empty()) {
+				append(config->parsed_comments().prefix, std::move(comments));
+			}
+			return did_skip;
+		}
+
+		bool skip_post_white(Config* config)
+		{
+			if (!MAYBE_WHITE[static_cast<uint8_t>(_ptr[0])]) {
+				// Early out
+				return false;
+			}
+
+			Comments comments;
+			int indentation;
+			bool did_skip = skip_white(&comments, indentation, true);
+			if (!comments.empty()) {
+				append(config->parsed_comments().postfix, std::move(comments));
+			}
+			return did_skip;
+		}
+
+		Config top_level();
+		void parse_value(Config& out, bool* out_did_skip_postwhites);
+		void parse_array(Config& dst);
+		void parse_array_contents(Config& dst);
+		void parse_object(Config& dst);
+		void parse_object_contents(Config& dst);
+		void parse_int(Config& out);
+		void parse_float(Config& out);
+		void parse_finite_number(Config& dst);
+		std::string parse_string();
+		std::string parse_c_sharp_string();
+		uint64_t parse_hex(int count);
+		void parse_macro(Config& dst);
+		bool looks_like_top_object();
+		void parse_key(std::string& key);
+		void parse_key_separator();
+		std::string parse_include_path();
+
+		// For PullParser. Comments are skipped, and nothing is built.
+		bool pull_next(PullParser::Next& out_next);
+		void pull_scalar(Config& dst);
+		std::string pull_string();
+		void pull_begin(bool object);
+		bool pull_next_item(std::string* out_key);
+		void pull_value_done();
+		bool pull_top_level_done() const { return _pull_started && _pull_frames.empty() && !_pull_peeked; }
+		DocInfo_SP pull_include(std::string& out_path);
+		void pull_finish();
+		void pull_throw_error(const std::string& desc) CONFIGURU_NORETURN
+		{
+			set_state(_pull_state);
+			throw_error(desc);
+		}
+
+		void tag(Config& var)
+		{
+			var.tag(_doc, _line_nr, column());
+		}
+
+		State get_state() const
+		{
+			return { _ptr, _line_nr, _line_start };
+		}
+
+		void set_state(State s) {
+			_ptr        = s.ptr;
+			_line_nr    = s.line_nr;
+			_line_start = s.line_start;
+		}
+
+		Index column() const
+		{
+			return static_cast<unsigned>(_ptr - _line_start + 1);
+		}
+
+		const char* start_of_line() const
+		{
+			return _line_start;
+		}
+
+		const char* end_of_line() const
+		{
+			const char* p = _ptr;
+			while (*p && *p != '\r' && *p != '\n') {
+				++p;
+			}
+			return p;
+		}
+
+		void throw_error(const std::string& desc) CONFIGURU_NORETURN {
+			const char* sol = start_of_line();
+			const char* eol = end_of_line();
+			std::string orientation;
+			for (const char* p = sol; p != eol; ++p) {
+				if (*p == '\t') {
+					orientation += "    ";
+				} else {
+					orientation.push_back(*p);
+				}
+			}
+
+			orientation += "\n";
+			for (const char* p = sol; p != _ptr; ++p) {
+				if (*p == '\t') {
+					orientation += "    ";
+				} else {
+					orientation.push_back(' ');
+				}
+			}
+			orientation += "^";
+
+			throw ParseError(_doc, _line_nr, column(), desc + "\n" + orientation);
+		}
+
+		void throw_indentation_error(int found_tabs, int expected_tabs) {
+			if (_options.enforce_indentation) {
+				char buff[128];
+				snprintf(buff, sizeof(buff), "Bad indentation: expected %d tabs, found %d", found_tabs, expected_tabs);
+				throw_error(buff);
+			}
+		}
+
+		void parse_assert(bool b, const char* error_msg) {
+			if (!b) {
+				throw_error(error_msg);
+			}
+		}
+
+		void parse_assert(bool b, const char* error_msg, const State& error_state) {
+			if (!b) {
+				set_state(error_state);
+				throw_error(error_msg);
+			}
+		}
+
+		void swallow(char c) {
+			if (_ptr[0] == c) {
+				_ptr += 1;
+			} else {
+				throw_error("Expected " + quote(c));
+			}
+		}
+
+		bool try_swallow(const char* str) {
+			auto n = strlen(str);
+			if (strncmp(str, _ptr, n) == 0) {
+				_ptr += n;
+				return true;
+			} else {
+				return false;
+			}
+		}
+
+		void swallow(const char* str, const char* error_msg) {
+			parse_assert(try_swallow(str), error_msg);
+		}
+
+		bool is_reserved_identifier(const char* ptr)
+		{
+			if (strncmp(ptr, "true", 4)==0 || strncmp(ptr, "null", 4)==0) {
+				return !IDENT_CHARS[static_cast<uint8_t>(ptr[4])];
+			} else if (strncmp(ptr, "false", 5)==0) {
 				return !IDENT_CHARS[static_cast<uint8_t>(ptr[5])];
 			} else {
-				return false;
+				return false;
+			}
+		}
+
+	private:
+		bool IDENT_STARTERS[256]     = { 0 };
+		bool IDENT_CHARS[256]        = { 0 };
+		bool MAYBE_WHITE[256]        = { 0 };
+		bool SPECIAL_CHARACTERS[256] = { 0 };
+
+	private:
+		FormatOptions _options;
+		DocInfo_SP    _doc;
+		ParseInfo&    _info;
+
+		const char*   _ptr;
+		Index         _line_nr;
+		const char*   _line_start;
+		int           _indentation = 0; // Expected number of tabs between a \n and the next key/value
+
+		struct PullFrame
+		{
+			State open_state;        ///< Where the [ or { is.
+			bool  implicit;          ///< The top-level object of a file, without braces.
+			bool  object;
+			bool  has_value;
+			bool  separator;         ///< Was there white space after the last value?
+		};
+
+		std::vector<PullFrame> _pull_frames;
+		State                  _pull_state{};         ///< Start of the last key or value, or the container just left.
+		PullParser::Next       _pull_next{};
+		bool                   _pull_peeked = false;  ///< Has _pull_next been found for the coming value?
+		bool                   _pull_started = false; ///< Have we looked at the top level?
+		bool                   _pull_implicit = false; ///< Is the coming value the top-level object, without braces?
+	};
+
+	// --------------------------------------------
+
+	// Sets an inclusive range
+	void set_range(bool lookup[256], char a, char b)
+	{
+		for (char c=a; c<=b; ++c) {
+			lookup[static_cast<uint8_t>(c)] = true;
+		}
+	}
+
+	Parser::Parser(const char* str, const FormatOptions& options, DocInfo_SP doc, ParseInfo& info) : _doc(doc), _info(info)
+	{
+		_options    = options;
+		_line_nr    = 1;
+		_ptr        = str;
+		_line_start = str;
+
+		IDENT_STARTERS[static_cast<uint8_t>('_')] = true;
+		set_range(IDENT_STARTERS, 'a', 'z');
+		set_range(IDENT_STARTERS, 'A', 'Z');
+
+		IDENT_CHARS[static_cast<uint8_t>('_')] = true;
+		set_range(IDENT_CHARS, 'a', 'z');
+		set_range(IDENT_CHARS, 'A', 'Z');
+		set_range(IDENT_CHARS, '0', '9');
+
+		MAYBE_WHITE[static_cast<uint8_t>('\n')] = true;
+		MAYBE_WHITE[static_cast<uint8_t>('\r')] = true;
+		MAYBE_WHITE[static_cast<uint8_t>('\t')] = true;
+		MAYBE_WHITE[static_cast<uint8_t>(' ')]  = true;
+		MAYBE_WHITE[static_cast<uint8_t>('/')]  = true; // Maybe a comment
+
+		SPECIAL_CHARACTERS[static_cast<uint8_t>('\0')] = true;
+		SPECIAL_CHARACTERS[static_cast<uint8_t>('\\')] = true;
+		SPECIAL_CHARACTERS[static_cast<uint8_t>('\"')] = true;
+		SPECIAL_CHARACTERS[static_cast<uint8_t>('\n')] = true;
+		SPECIAL_CHARACTERS[static_cast<uint8_t>('\t')] = true;
+
+		CONFIGURU_ASSERT(_options.indentation != "" || !_options.enforce_indentation);
+	}
+
+	// Returns true if we did skip white-space.
+	// out_indentation is the depth of indentation on the last line we did skip on.
+	// iff out_indentation is -1 there is a non-tab on the last line.
+	bool Parser::skip_white(Comments* out_comments, int& out_indentation, bool break_on_newline)
+	{
+		auto start_ptr = _ptr;
+		out_indentation = 0;
+		bool found_newline = false;
+
+		const std::string& indentation = _options.indentation;
+
+		while (MAYBE_WHITE[static_cast<uint8_t>(_ptr[0])]) {
+			if (_ptr[0] == '\n') {
+				// Unix style newline
+				_ptr += 1;
+				_line_nr += 1;
+				_line_start = _ptr;
+				out_indentation = 0;
+				if (break_on_newline) { return true; }
+				found_newline = true;
+			}
+			else if (_ptr[0] == '\r') {
+				// CR-LF - windows style newline
+				parse_assert(_ptr[1] == '\n', "CR with no LF. \\r only allowed before \\n."); // TODO: this is OK in JSON.
+				_ptr += 2;
+				_line_nr += 1;
+				_line_start = _ptr;
+				out_indentation = 0;
+				if (break_on_newline) { return true; }
+				found_newline = true;
+			}
+			else if (!indentation.empty() &&
+					 strncmp(_ptr, indentation.c_str(), indentation.size()) == 0)
+			{
+				_ptr += indentation.size();
+				if (_options.enforce_indentation && indentation == "\t") {
+					parse_assert(out_indentation != -1, "Tabs should only occur on the start of a line!");
+				}
+				++out_indentation;
+			}
+			else if (_ptr[0] == '\t') {
+				++_ptr;
+				if (_options.enforce_indentation) {
+					parse_assert(out_indentation != -1, "Tabs should only occur on the start of a line!");
+				}
+				++out_indentation;
+			}
+			else if (_ptr[0] == ' ') {
+				if (found_newline && _options.enforce_indentation) {
+					if (indentation == "\t") {
+						throw_error("Found a space at beginning of a line. Indentation must be done using tabs!");
+					} else {
+						throw_error("Indentation should be a multiple of " + std::to_string(indentation.size()) + " spaces.");
+					}
+				}
+				++_ptr;
+				out_indentation = -1;
+			}
+			else if (_ptr[0] == '/' && _ptr[1] == '/') {
+				parse_assert(_options.single_line_comments, "Single line comments forbidden.");
+				// Single line comment
+				auto start = _ptr;
+				_ptr += 2;
+				while (_ptr[0] && _ptr[0] != '\n') {
+					_ptr += 1;
+				}
+				if (out_comments) { out_comments->emplace_back(start, _ptr - start); }
+				out_indentation = 0;
+				if (break_on_newline) { return true; }
+			}
+			else if (_ptr[0] == '/' && _ptr[1] == '*') {
+				parse_assert(_options.block_comments, "Block comments forbidden.");
+				// Multi-line comment
+				auto state = get_state(); // So we can point out the start if there's an error
+				_ptr += 2;
+				unsigned nesting = 1; // We allow nested /**/ comments
+				do
+				{
+					if (_ptr[0]==0) {
+						set_state(state);
+						throw_error("Non-ending /* comment");
+					}
+					else if (_ptr[0]=='/' && _ptr[1]=='*') {
+						_ptr += 2;
+						parse_assert(_options.nesting_block_comments, "Nesting comments (/* /* */ */) forbidden.");
+						nesting += 1;
+					}
+					else if (_ptr[0]=='*' && _ptr[1]=='/') {
+						_ptr += 2;
+						nesting -= 1;
+					}
+					else if (_ptr[0] == '\n') {
+						_ptr += 1;
+						_line_nr += 1;
+						_line_start = _ptr;
+					} else {
+						_ptr += 1;
+					}
+				} while (nesting > 0);
+				if (out_comments) { out_comments->emplace_back(state.ptr, _ptr - state.ptr); }
+				out_indentation = -1;
+				if (break_on_newline) { return true; }
+			}
+			else {
+				break;
+			}
+		}
+
+		if (start_ptr == _ptr) {
+			out_indentation = -1;
+			return false;
+		} else {
+			return true;
+		}
+	}
+
+	/*
+	The top-level can be any value, OR the innerds of an object:
+	foo = 1
+	"bar": 2
+	*/
+	Config Parser::top_level()
+	{
+		const bool is_object = _options.implicit_top_object && looks_like_top_object();
+
+		Config ret;
+		tag(ret);
+
+		if (is_object) {
+			parse_object_contents(ret);
+		} else {
+			parse_array_contents(ret);
+			parse_assert(ret.array_size() <= 1 || _options.implicit_top_array, "Multiple values not allowed without enclosing []");
+		}
+
+		skip_post_white(&ret);
+
+		parse_assert(_ptr[0] == 0, "Expected EoF");
+
+		if (!is_object && ret.array_size() == 0) {
+			if (_options.empty_file) {
+				auto empty_object = Config::object();
+				if (ret.has_comments()) {
+					empty_object.parsed_comments() = std::move(ret.parsed_comments());
+				}
+				return empty_object;
+			} else {
+				throw_error("Empty file");
+			}
+		}
+
+		if (!is_object && ret.array_size() == 1) {
+			// A single value - not an array after all:
+			Config first( std::move(ret[0]) );
+			if (ret.has_comments()) {
+				first.parsed_comments().append(std::move(ret.parsed_comments()));
+			}
+			return first;
+		}
+
+		return ret;
+	}
+
+	// Does a key come first, rather than a value?
+	bool Parser::looks_like_top_object()
+	{
+		bool is_object = false;
+
+		auto state = get_state();
+		skip_white_ignore_comments();
+
+		if (IDENT_STARTERS[static_cast<uint8_t>(_ptr[0])] && !is_reserved_identifier(_ptr)) {
+			is_object = true;
+		} else if (_ptr[0] == '"' || _ptr[0] == '@') {
+			parse_string();
+			skip_white_ignore_comments();
+			is_object = (_ptr[0] == ':' || _ptr[0] == '=');
+		}
+
+		set_state(state); // restore
+		return is_object;
+	}
+
+	void Parser::parse_value(Config& dst, bool* out_did_skip_postwhites)
+	{
+		int line_indentation;
+		skip_pre_white(&dst, line_indentation);
+		tag(dst);
+
+		if (line_indentation >= 0 && _indentation - 1 != line_indentation) {
+			throw_indentation_error(_indentation - 1, line_indentation);
+		}
+
+		if (_ptr[0] == '"' || _ptr[0] == '@') {
+			dst = parse_string();
+		}
+		else if (_ptr[0] == 'n') {
+			parse_assert(_ptr[1]=='u' && _ptr[2]=='l' && _ptr[3]=='l', "Expected 'null'");
+			parse_assert(!IDENT_CHARS[static_cast<uint8_t>(_ptr[4])], "Expected 'null'");
+			_ptr += 4;
+			dst = nullptr;
+		}
+		else if (_ptr[0] == 't') {
+			parse_assert(_ptr[1]=='r' && _ptr[2]=='u' && _ptr[3]=='e', "Expected 'true'");
+			parse_assert(!IDENT_CHARS[static_cast<uint8_t>(_ptr[4])], "Expected 'true'");
+			_ptr += 4;
+			dst = true;
+		}
+		else if (_ptr[0] == 'f') {
+			parse_assert(_ptr[1]=='a' && _ptr[2]=='l' && _ptr[3]=='s' && _ptr[4]=='e', "Expected 'false'");
+			parse_assert(!IDENT_CHARS[static_cast<uint8_t>(_ptr[5])], "Expected 'false'");
+			_ptr += 5;
+			dst = false;
+		}
+		else if (_ptr[0] == '{') {
+			parse_object(dst);
+		}
+		else if (_ptr[0] == '[') {
+			parse_array(dst);
+		}
+		else if (_ptr[0] == '#') {
+			parse_macro(dst);
+		}
+		else if (_ptr[0] == '+' || _ptr[0] == '-' || _ptr[0] == '.' || ('0' <= _ptr[0] && _ptr[0] <= '9')) {
+			// Some kind of number:
+
+			if (_ptr[0] == '-' && _ptr[1] == 'i' && _ptr[2]=='n' && _ptr[3]=='f') {
+				parse_assert(!IDENT_CHARS[static_cast<uint8_t>(_ptr[4])], "Expected -inf");
+				parse_assert(_options.inf, "infinity forbidden.");
+				_ptr += 4;
+				dst = -std::numeric_limits<double>::infinity();
+			}
+			else if (_ptr[0] == '+' && _ptr[1] == 'i' && _ptr[2]=='n' && _ptr[3]=='f') {
+				parse_assert(!IDENT_CHARS[static_cast<uint8_t>(_ptr[4])], "Expected +inf");
+				parse_assert(_options.inf, "infinity forbidden.");
+				_ptr += 4;
+				dst = std::numeric_limits<double>::infinity();
+			}
+			else if (_ptr[0] == '+' && _ptr[1] == 'N' && _ptr[2]=='a' && _ptr[3]=='N') {
+				parse_assert(!IDENT_CHARS[static_cast<uint8_t>(_ptr[4])], "Expected +NaN");
+				parse_assert(_options.nan, "NaN (Not a Number) forbidden.");
+				_ptr += 4;
+				dst = std::numeric_limits<double>::quiet_NaN();
+			} else {
+				parse_finite_number(dst);
+			}
+		} else {
+			throw_error("Expected value");
+		}
+
+		*out_did_skip_postwhites = skip_post_white(&dst);
+	}
+
+	void Parser::parse_array(Config& array)
+	{
+		auto state = get_state();
+
+		swallow('[');
+
+		_indentation += 1;
+		parse_array_contents(array);
+		_indentation -= 1;
+
+		if (_ptr[0] == ']') {
+			_ptr += 1;
+		} else {
+			set_state(state);
+			throw_error("Non-terminated array");
+		}
+	}
+
+	void Parser::parse_array_contents(Config& array_cfg)
+	{
+		array_cfg.make_packed_array();
+
+		Comments next_prefix_comments;
+
+		for (;;)
+		{
+			Config value;
+			if (!next_prefix_comments.empty()) {
+				std::swap(value.parsed_comments().prefix, next_prefix_comments);
+			}
+			int line_indentation;
+			skip_pre_white(&value, line_indentation);
+
+			if (_ptr[0] == ']') {
+				if (line_indentation >= 0 && _indentation - 1 != line_indentation) {
+					throw_indentation_error(_indentation - 1, line_indentation);
+				}
+				if (value.has_comments()) {
+					array_cfg.parsed_comments().pre_end_brace = value.parsed_comments().prefix;
+				}
+				break;
+			}
+
+			if (!_ptr[0]) {
+				if (value.has_comments()) {
+					array_cfg.parsed_comments().pre_end_brace = value.parsed_comments().prefix;
+				}
+				break;
+			}
+
+			if (line_indentation >= 0 && _indentation != line_indentation) {
+				throw_indentation_error(_indentation, line_indentation);
+			}
+
+			if (IDENT_STARTERS[static_cast<uint8_t>(_ptr[0])] && !is_reserved_identifier(_ptr)) {
+				throw_error("Found identifier; expected value. Did you mean to use a {object} rather than a [array]?");
+			}
+
+			bool has_separator;
+			parse_value(value, &has_separator);
+			int ignore;
+			skip_white(&next_prefix_comments, ignore, false);
+
+			auto comma_state = get_state();
+			bool has_comma = _ptr[0] == ',';
+
+			if (has_comma) {
+				_ptr += 1;
+				skip_post_white(&value);
+				has_separator = true;
+			}
+
+			array_cfg.push_back(std::move(value));
+
+			bool is_last_element = !_ptr[0] || _ptr[0] == ']';
+
+			if (is_last_element) {
+				parse_assert(!has_comma || _options.array_trailing_comma,
+					"Trailing comma forbidden.", comma_state);
+			} else {
+				if (_options.array_omit_comma) {
+					parse_assert(has_separator, "Expected a space, newline, comma or ]");
+				} else {
+					parse_assert(has_comma, "Expected a comma or ]");
+				}
+			}
+		}
+	}
+
+	void Parser::parse_object(Config& object)
+	{
+		auto state = get_state();
+
+		swallow('{');
+
+		_indentation += 1;
+		parse_object_contents(object);
+		_indentation -= 1;
+
+		if (_ptr[0] == '}') {
+			_ptr += 1;
+		} else {
+			set_state(state);
+			throw_error("Non-terminated object");
+		}
+	}
+
+	void Parser::parse_object_contents(Config& object)
+	{
+		object.make_object();
+
+		Comments next_prefix_comments;
+
+		for (;;)
+		{
+			Config value;
+			if (!next_prefix_comments.empty()) {
+				std::swap(value.parsed_comments().prefix, next_prefix_comments);
+			}
+			int line_indentation;
+			skip_pre_white(&value, line_indentation);
+
+			if (_ptr[0] == '}') {
+				if (line_indentation >= 0 && _indentation - 1 != line_indentation) {
+					throw_indentation_error(_indentation - 1, line_indentation);
+				}
+				if (value.has_comments()) {
+					object.parsed_comments().pre_end_brace = value.parsed_comments().prefix;
+				}
+				break;
+			}
+
+			if (!_ptr[0]) {
+				if (value.has_comments()) {
+					object.parsed_comments().pre_end_brace = value.parsed_comments().prefix;
+				}
+				break;
+			}
+
+			if (line_indentation >= 0 && _indentation != line_indentation) {
+				throw_indentation_error(_indentation, line_indentation);
+			}
+
+			auto pre_key_state = get_state();
+			std::string key;
+			parse_key(key);
+
+			if (!_options.object_duplicate_keys && object.has_key(key)) {
+				set_state(pre_key_state);
+				throw_error("Duplicate key: \"" + key + "\". Already set at " + object[key].where());
+			}
+
+			parse_key_separator();
+
+			bool has_separator;
+			parse_value(value, &has_separator);
+			int ignore;
+			skip_white(&next_prefix_comments, ignore, false);
+
+			auto comma_state = get_state();
+			bool has_comma = _ptr[0] == ',';
+
+			if (has_comma) {
+				_ptr += 1;
+				skip_post_white(&value);
+				has_separator = true;
+			}
+
+			object.emplace(std::move(key), std::move(value));
+
+			bool is_last_element = !_ptr[0] || _ptr[0] == '}';
+
+			if (is_last_element) {
+				parse_assert(!has_comma || _options.object_trailing_comma,
+					"Trailing comma forbidden.", comma_state);
+			} else {
+				if (_options.object_omit_comma) {
+					parse_assert(has_separator, "Expected a space, newline, comma or }");
+				} else {
+					parse_assert(has_comma, "Expected a comma or }");
+				}
+			}
+		}
+	}
+
+	void Parser::parse_key(std::string& key)
+	{
+		if (IDENT_STARTERS[static_cast<uint8_t>(_ptr[0])] && !is_reserved_identifier(_ptr)) {
+			parse_assert(_options.identifiers_keys, "You need to surround keys with quotes");
+			while (IDENT_CHARS[static_cast<uint8_t>(_ptr[0])]) {
+				key += _ptr[0];
+				_ptr += 1;
+			}
+		}
+		else if (_ptr[0] == '"' || _ptr[0] == '@') {
+			key = parse_string();
+		} else {
+			throw_error("Object key expected (either an identifier or a quoted string), got " + quote(_ptr[0]));
+		}
+	}
+
+	// The : or = between a key and its value.
+	void Parser::parse_key_separator()
+	{
+		bool space_after_key = skip_white_ignore_comments();
+
+		if (_ptr[0] == ':' || (_options.object_separator_equal && _ptr[0] == '=')) {
+			parse_assert(_options.allow_space_before_colon || _ptr[0] != ':' || !space_after_key, "No space allowed before colon");
+			_ptr += 1;
+			skip_white_ignore_comments();
+		} else if (_options.omit_colon_before_object && (_ptr[0] == '{' || _ptr[0] == '#')) {
+			// Ok to omit : in this case
+		} else {
+			if (_options.object_separator_equal && _options.omit_colon_before_object) {
+				throw_error("Expected one of '=', ':', '{' or '#' after object key");
+			} else {
+				throw_error("Expected : after object key");
+			}
+		}
+	}
+
+	void Parser::parse_int(Config& out)
+	{
+		const auto start = _ptr;
+		const auto result = strtoll(start, const_cast<char**>(&_ptr), 10);
+		parse_assert(start < _ptr, "Invalid integer");
+		parse_assert(start[0] != '0' || result == 0, "Integer may not start with a zero");
+		out = result;
+	}
+
+	void Parser::parse_float(Config& out)
+	{
+		const auto start = _ptr;
+		const double result = strtod(start, const_cast<char**>(&_ptr));
+		parse_assert(start < _ptr, "Invalid number");
+		out = result;
+	}
+
+	void Parser::parse_finite_number(Config& out)
+	{
+		const auto pre_sign = _ptr;
+		int sign = +1;
+
+		if (_ptr[0] == '+') {
+			parse_assert(_options.unary_plus, "Prefixing numbers with + is forbidden.");
+			_ptr += 1;
+		}
+		if (_ptr[0] == '-') {
+			_ptr += 1;
+			sign = -1;
+		}
+
+		parse_assert(_ptr[0] != '+' && _ptr[0] != '-', "Duplicate sign");
+
+		// Check if it's an integer:
+		if (_ptr[0] == '0' && _ptr[1] == 'x') {
+			parse_assert(_options.hexadecimal_integers, "Hexadecimal numbers forbidden.");
+			_ptr += 2;
+			auto start = _ptr;
+			out = sign * static_cast<int64_t>(strtoull(start, const_cast<char**>(&_ptr), 16));
+			parse_assert(start < _ptr, "Missing hexaxdecimal digits after 0x");
+			return;
+		}
+
+		if (_ptr[0] == '0' && _ptr[1] == 'b') {
+			parse_assert(_options.binary_integers, "Binary numbers forbidden.");
+			_ptr += 2;
+			auto start = _ptr;
+			out = sign * static_cast<int64_t>(strtoull(start, const_cast<char**>(&_ptr), 2));
+			parse_assert(start < _ptr, "Missing binary digits after 0b");
+			return;
+		}
+
+		const char* p = _ptr;
+
+		while ('0' <= *p && *p <= '9') {
+			p += 1;
+		}
+
+		if (*p == '.' || *p == 'e' || *p == 'E') {
+			_ptr = pre_sign;
+			return parse_float(out);
+		}
+
+		// It looks like an integer - but it may be too long to represent as one!
+		const auto MAX_INT_STR = (sign == +1 ? "9223372036854775807" : "9223372036854775808");
+
+		const auto length = p - _ptr;
+
+		if (length < 19) {
+			_ptr = pre_sign;
+			return parse_int(out);
+		}
+
+		if (length > 19) {
+			_ptr = pre_sign;
+			return parse_float(out); // Uncommon case optimization
+		}
+
+		// Compare fast:
+		for (int i = 0; i < 19; ++i)
+		{
+			if (_ptr[i] > MAX_INT_STR[i]) {
+				_ptr = pre_sign;
+				return parse_float(out);
+			}
+			if (_ptr[i] < MAX_INT_STR[i]) {
+				_ptr = pre_sign;
+				return parse_int(out);
+			}
+		}
+		_ptr = pre_sign;
+		return parse_int(out); // Exactly max int
+	}
+
+	std::string Parser::parse_c_sharp_string()
+	{
+		// C# style verbatim string - everything until the next " except "" which is ":
+		auto state = get_state();
+		parse_assert(_options.str_csharp_verbatim, "C# @-style verbatim strings forbidden.");
+		swallow('@');
+		swallow('"');
+
+		std::string str;
+
+		for (;;) {
+			if (_ptr[0] == 0) {
+				set_state(state);
+				throw_error("Unterminated verbatim string");
+			}
+			else if (_ptr[0] == '\n') {
+				throw_error("Newline in verbatim string");
+			}
+			else if (_ptr[0] == '"' && _ptr[1] == '"') {
+				// Escaped quote
+				_ptr += 2;
+				str.push_back('"');
+			}
+			else if (_ptr[0] == '"') {
+				_ptr += 1;
+				return str;
+			}
+			else {
+				str += _ptr[0];
+				_ptr += 1;
+			}
+		}
+	}
+
+	std::string Parser::parse_string()
+	{
+		if (_ptr[0] == '@') {
+			return parse_c_sharp_string();
+		}
+
+		auto state = get_state();
+		parse_assert(_ptr[0] == '"', "Quote (\") expected");
+
+		if (_ptr[1] == '"' && _ptr[2] == '"') {
+			// Python style multiline string - everything until the next """:
+			parse_assert(_options.str_python_multiline, "Python \"\"\"-style multiline strings forbidden.");
+			_ptr += 3;
+			const char* start = _ptr;
+			for (;;) {
+				if (_ptr[0]==0 || _ptr[1]==0 || _ptr[2]==0) {
+					set_state(state);
+					throw_error("Unterminated multiline string");
+				}
+
+				if (_ptr[0] == '"' && _ptr[1] == '"' && _ptr[2] == '"' && _ptr[3] != '"') {
+					std::string str(start, _ptr);
+					_ptr += 3;
+					return str;
+				}
+
+				if (_ptr[0] == '\n') {
+					_ptr += 1;
+					_line_nr += 1;
+					_line_start = _ptr;
+				} else {
+					_ptr += 1;
+				}
+			}
+		} else {
+			// Normal string
+			_ptr += 1; // Swallow quote
+
+			std::string str;
+
+			for (;;) {
+				// Handle larges swats of safe characters at once:
+				auto safe_end = _ptr;
+				while (!SPECIAL_CHARACTERS[static_cast<uint8_t>(*safe_end)]) {
+					++safe_end;
+				}
+
+				if (_ptr != safe_end) {
+					str.append(_ptr, safe_end - _ptr);
+					_ptr = safe_end;
+				}
+
+				if (_ptr[0] == 0) {
+					set_state(state);
+					throw_error("Unterminated string");
+				}
+				if (_ptr[0] == '"') {
+					_ptr += 1;
+					return str;
+				}
+				if (_ptr[0] == '\n') {
+					throw_error("Newline in string");
+				}
+				if (_ptr[0] == '\t') {
+					parse_assert(_options.str_allow_tab, "Un-escaped tab not allowed in string");
+				}
+
+				if (_ptr[0] == '\\') {
+					// Escape sequence
+					_ptr += 1;
+
+					if (_ptr[0] == '"') {
+						str.push_back('"');
+						_ptr += 1;
+					} else if (_ptr[0] == '\\') {
+						str.push_back('\\');
+						_ptr += 1;
+					} else if (_ptr[0] == '/') {
+						str.push_back('/');
+						_ptr += 1;
+					} else if (_ptr[0] == 'b') {
+						str.push_back('\b');
+						_ptr += 1;
+					} else if (_ptr[0] == 'f') {
+						str.push_back('\f');
+						_ptr += 1;
+					} else if (_ptr[0] == 'n') {
+						str.push_back('\n');
+						_ptr += 1;
+					} else if (_ptr[0] == 'r') {
+						str.push_back('\r');
+						_ptr += 1;
+					} else if (_ptr[0] == 't') {
+						str.push_back('\t');
+						_ptr += 1;
+					} else if (_ptr[0] == 'u') {
+						// Four hexadecimal characters
+						_ptr += 1;
+						uint64_t codepoint = parse_hex(4);
+
+						if (0xD800 <= codepoint && codepoint <= 0xDBFF)
+						{
+							// surrogate pair
+							parse_assert(_ptr[0] == '\\' && _ptr[1] == 'u',
+										 "Missing second unicode surrogate.");
+							_ptr += 2;
+							uint64_t codepoint2 = parse_hex(4);
+							parse_assert(0xDC00 <= codepoint2 && codepoint2 <= 0xDFFF, "Invalid second unicode surrogate");
+							codepoint = (codepoint << 10) + codepoint2 - 0x35FDC00;
+						}
+
+						auto num_bytes_written = encode_utf8(str, codepoint);
+						parse_assert(num_bytes_written > 0, "Bad unicode codepoint");
+					} else if (_ptr[0] == 'U') {
+						// Eight hexadecimal characters
+						parse_assert(_options.str_32bit_unicode, "\\U 32 bit unicodes forbidden.");
+						_ptr += 1;
+						uint64_t unicode = parse_hex(8);
+						auto num_bytes_written = encode_utf8(str, unicode);
+						parse_assert(num_bytes_written > 0, "Bad unicode codepoint");
+					} else {
+						throw_error("Unknown escape character " + quote(_ptr[0]));
+					}
+				} else {
+					str.push_back(_ptr[0]);
+					_ptr += 1;
+				}
+			}
+		}
+	}
+
+	uint64_t Parser::parse_hex(int count)
+	{
+		uint64_t ret = 0;
+		for (int i=0; i<count; ++i) {
+			ret *= 16;
+			char c = _ptr[i];
+			if ('0' <= c && c <= '9') {
+				ret += static_cast<uint64_t>(c - '0');
+			} else if ('a' <= c && c <= 'f') {
+				ret += static_cast<uint64_t>(10 + c - 'a');
+			} else if ('A' <= c && c <= 'F') {
+				ret += static_cast<uint64_t>(10 + c - 'A');
+			} else {
+				throw_error("Expected hexadecimal digit, got " + quote(_ptr[0]));
+			}
+		}
+		_ptr += count;
+		return ret;
+	}
+
+	void Parser::parse_macro(Config& dst)
+	{
+		auto path = parse_include_path();
+
+		auto it = _info.parsed_files.find(path);
+		if (it == _info.parsed_files.end()) {
+			auto child_doc = std::make_shared<DocInfo>(path);
+			child_doc->includers.emplace_back(_doc, _line_nr);
+			dst = parse_file(path.c_str(), _options, child_doc, _info);
+			_info.parsed_files[path] = dst;
+		} else {
+			auto child_doc = it->second.doc();
+			child_doc->includers.emplace_back(_doc, _line_nr);
+			dst = it->second;
+		}
+	}
+
+	// Parses an #include and returns the path of the file, relative to the working directory.
+	std::string Parser::parse_include_path()
+	{
+		parse_assert(_options.allow_macro, "#macros forbidden.");
+
+		swallow("#include", "Expected '#include'");
+		skip_white_ignore_comments();
+
+		bool absolute;
+		char terminator;
+
+		if (_ptr[0] == '"') {
+			absolute = false;
+			terminator = '"';
+		} else if (_ptr[0] == '<') {
+			absolute = true;
+			terminator = '>';
+		} else {
+			throw_error("Expected \" or <");
+		}
+
+		auto state = get_state();
+		_ptr += 1;
+		auto start = _ptr;
+		std::string path;
+		for (;;) {
+			if (_ptr[0] == 0) {
+				set_state(state);
+				throw_error("Unterminated include path");
+			} else if (_ptr[0] == terminator) {
+				path = std::string(start, static_cast<size_t>(_ptr - start));
+				_ptr += 1;
+				break;
+			} else if (_ptr[0] == '\n') {
+				throw_error("Newline in string");
+			} else {
+				_ptr += 1;
+			}
+		}
+
+		if (!absolute) {
+			auto my_path = _doc->filename;
+			auto pos = my_path.find_last_of('/');
+			if (pos != std::string::npos) {
+				auto my_dir = my_path.substr(0, pos+1);
+				path = my_dir + path;
+			}
+		}
+
+		return path;
+	}
+
+	// ----------------------------------------------------------------------------------------
+
+	Config parse_string(const char* str, const FormatOptions& options, DocInfo_SP doc, ParseInfo& info)
+	{
+		Parser p(str, options, doc, info);
+		return p.top_level();
+	}
+
+	Config parse_string(const char* str, const FormatOptions& options, const char* name)
+	{
+		ParseInfo info;
+		return parse_string(str, options, std::make_shared<DocInfo>(name), info);
+	}
+
+	static uint64_t mix64(uint64_t x)
+	{
+		// The finalizer of splitmix64:
+		x ^= x >> 30; x *= 0xbf58476d1ce4e5b9ull;
+		x ^= x >> 27; x *= 0x94d049bb133111ebull;
+		return x ^ (x >> 31);
+	}
+
+	/// Fast, and the same in every build, unlike std::hash. Not cryptographic:
+	/// the parse cache trusts the files next to the configs anyway.
+	static uint64_t hash_bytes(const char* data, size_t size)
+	{
+		uint64_t hash = mix64(size);
+		for (; size >= 8; data += 8, size -= 8) {
+			uint64_t word;
+			memcpy(&word, data, sizeof(word));
+			hash = mix64(hash ^ word);
+		}
+		uint64_t tail = 0;
+		memcpy(&tail, data, size);
+		return mix64(hash ^ tail);
+	}
+
+	static FileStamp stamp_of(const std::string& contents)
+	{
+		FileStamp stamp;
+		stamp.size = contents.size();
+		stamp.hash = hash_bytes(contents.data(), contents.size());
+		return stamp;
+	}
+
+	/// Uses and updates the file "<path>.cache". Defined with the binary formats.
+	static Config parse_file_cached(const std::string& path, const FormatOptions& options);
+
+	std::string read_text_file(const char* path)
+	{
+		FILE* fp = fopen(path, "rb");
+		if (fp == nullptr) {
+			CONFIGURU_ONERROR(std::string("Failed to open '") + path + "' for reading: " + strerror(errno));
+		}
+		std::string contents;
+		fseek(fp, 0, SEEK_END);
+		const auto size = ftell(fp);
+		if (size < 0) {
+			fclose(fp);
+			CONFIGURU_ONERROR(std::string("Failed to find out size of '") + path + "': " + strerror(errno));
+		}
+		contents.resize(static_cast<size_t>(size));
+		rewind(fp);
+		const auto num_read = fread(&contents[0], 1, contents.size(), fp);
+		fclose(fp);
+		if (num_read != contents.size()) {
+			CONFIGURU_ONERROR(std::string("Failed to read from '") + path + "': " + strerror(errno));
+		}
+		return contents;
+	}
+
+	Config parse_file(const std::string& path, const FormatOptions& options, DocInfo_SP doc, ParseInfo& info)
+	{
+		// auto file = util::FILEWrapper::read_text_file(path);
+		auto file = read_text_file(path.c_str());
+		if (options.parse_cache) {
+			info.read_files[path] = stamp_of(file);
+		}
+		return parse_string(file.c_str(), options, doc, info);
+	}
+
+	Config parse_file(const std::string& path, const FormatOptions& options)
+	{
+		if (options.parse_cache) {
+			return parse_file_cached(path, options);
+		}
+		ParseInfo info;
+		return parse_file(path, options, std::make_shared<DocInfo>(path), info);
+	}
+
+	// ----------------------------------------------------------------------------------------
+	// PullParser: the same grammar as above, one value at a time.
+
+	// Returns false if the next value is an #include.
+	bool Parser::pull_next(PullParser::Next& out_next)
+	{
+		if (_pull_peeked) {
+			out_next = _pull_next;
+			return true;
+		}
+
+		int line_indentation;
+		skip_white(nullptr, line_indentation, false);
+
+		if (!_pull_started) {
+			// Like top_level():
+			_pull_started = true;
+			if (line_indentation >= 0 && _indentation != line_indentation) {
+				throw_indentation_error(_indentation, line_indentation);
+			}
+			if (!_ptr[0]) {
+				parse_assert(_options.empty_file, "Empty file");
+				_pull_implicit = true;
+			} else if (_options.implicit_top_object && looks_like_top_object()) {
+				_pull_implicit = true;
+			} else if (IDENT_STARTERS[static_cast<uint8_t>(_ptr[0])] && !is_reserved_identifier(_ptr)) {
+				throw_error("Found identifier; expected value. Did you mean to use a {object} rather than a [array]?");
+			}
+		} else if (line_indentation >= 0 && _indentation - 1 != line_indentation) {
+			throw_indentation_error(_indentation - 1, line_indentation);
+		}
+
+		_pull_state = get_state();
+
+		if (_pull_implicit) {
+			out_next = PullParser::Next::Object;
+		} else if (_ptr[0] == '"' || _ptr[0] == '@') {
+			out_next = PullParser::Next::String;
+		} else if (_ptr[0] == 'n') {
+			out_next = PullParser::Next::Null;
+		} else if (_ptr[0] == 't' || _ptr[0] == 'f') {
+			out_next = PullParser::Next::Bool;
+		} else if (_ptr[0] == '{') {
+			out_next = PullParser::Next::Object;
+		} else if (_ptr[0] == '[') {
+			out_next = PullParser::Next::Array;
+		} else if (_ptr[0] == '#') {
+			return false;
+		} else if (_ptr[0] == '+' || _ptr[0] == '-' || _ptr[0] == '.' || ('0' <= _ptr[0] && _ptr[0] <= '9')) {
+			out_next = PullParser::Next::Number;
+		} else {
+			throw_error("Expected value");
+		}
+
+		_pull_next = out_next;
+		_pull_peeked = true;
+		return true;
+	}
+
+	void Parser::pull_scalar(Config& dst)
+	{
+		_pull_peeked = false;
+		bool separator;
+		parse_value(dst, &separator);
+		if (!_pull_frames.empty()) {
+			_pull_frames.back().separator = separator;
+		}
+	}
+
+	std::string Parser::pull_string()
+	{
+		_pull_peeked = false;
+		std::string str = parse_string();
+		pull_value_done();
+		return str;
+	}
+
+	void Parser::pull_begin(bool object)
+	{
+		_pull_peeked = false;
+		if (_pull_implicit) {
+			_pull_implicit = false;
+			_pull_frames.push_back({get_state(), true, true, false, false});
+		} else {
+			_pull_frames.push_back({get_state(), false, object, false, false});
+			swallow(object ? '{' : '[');
+			_indentation += 1;
+		}
+	}
+
+	// Like an iteration of parse_array_contents or parse_object_contents.
+	// Returns false at the end of the array or object, after leaving it.
+	bool Parser::pull_next_item(std::string* out_key)
+	{
+		PullFrame& frame = _pull_frames.back();
+		CONFIGURU_ASSERT(frame.object == (out_key != nullptr));
+		const char close = frame.object ? '}' : ']';
+
+		if (frame.has_value) {
+			bool has_separator = frame.separator;
+			int ignore;
+			skip_white(nullptr, ignore, false);
+
+			auto comma_state = get_state();
+			bool has_comma = _ptr[0] == ',';
+
+			if (has_comma) {
+				_ptr += 1;
+				skip_white(nullptr, ignore, true);
+				has_separator = true;
+			}
+
+			bool is_last_element = !_ptr[0] || _ptr[0] == close;
+
+			if (is_last_element) {
+				parse_assert(!has_comma || (frame.object ? _options.object_trailing_comma : _options.array_trailing_comma),
+					"Trailing comma forbidden.", comma_state);
+			} else if (frame.object ? _options.object_omit_comma : _options.array_omit_comma) {
+				parse_assert(has_separator, frame.object ? "Expected a space, newline, comma or }" : "Expected a space, newline, comma or ]");
+			} else {
+				parse_assert(has_comma, frame.object ? "Expected a comma or }" : "Expected a comma or ]");
 			}
 		}
 
-	private:
-		bool IDENT_STARTERS[256]     = { 0 };
-		bool IDENT_CHARS[256]        = { 0 };
-		bool MAYBE_WHITE[256]        = { 0 };
-		bool SPECIAL_CHARACTERS[256] = { 0 };
+		int line_indentation;
+		skip_white(nullptr, line_indentation, false);
 
-	private:
-		FormatOptions _options;
-		DocInfo_SP    _doc;
-		ParseInfo&    _info;
+		if (!_ptr[0] || _ptr[0] == close) {
+			if (_ptr[0] && line_indentation >= 0 && _indentation - 1 != line_indentation) {
+				throw_indentation_error(_indentation - 1, line_indentation);
+			}
+			const PullFrame done = frame;
+			_pull_frames.pop_back();
+			if (!done.implicit) {
+				_indentation -= 1;
+				if (_ptr[0] == close) {
+					_ptr += 1;
+				} else {
+					set_state(done.open_state);
+					throw_error(done.object ? "Non-terminated object" : "Non-terminated array");
+				}
+			}
+			_pull_state = done.open_state;
+			pull_value_done();
+			return false;
+		}
 
-		const char*   _ptr;
-		Index         _line_nr;
-		const char*   _line_start;
-		int           _indentation = 0; // Expected number of tabs between a \n and the next key/value
+		if (line_indentation >= 0 && _indentation != line_indentation) {
+			throw_indentation_error(_indentation, line_indentation);
+		}
+
+		frame.has_value = true;
+		_pull_state = get_state();
+
+		if (frame.object) {
+			out_key->clear();
+			parse_key(*out_key);
+			parse_key_separator();
+		} else if (IDENT_STARTERS[static_cast<uint8_t>(_ptr[0])] && !is_reserved_identifier(_ptr)) {
+			throw_error("Found identifier; expected value. Did you mean to use a {object} rather than a [array]?");
+		}
+		return true;
+	}
+
+	// Skips the white space after a value.
+	void Parser::pull_value_done()
+	{
+		int ignore;
+		const bool separator = MAYBE_WHITE[static_cast<uint8_t>(_ptr[0])] && skip_white(nullptr, ignore, true);
+		if (!_pull_frames.empty()) {
+			_pull_frames.back().separator = separator;
+		}
+	}
+
+	DocInfo_SP Parser::pull_include(std::string& out_path)
+	{
+		out_path = parse_include_path();
+		auto child_doc = std::make_shared<DocInfo>(out_path);
+		child_doc->includers.emplace_back(_doc, _line_nr);
+		return child_doc;
+	}
+
+	void Parser::pull_finish()
+	{
+		skip_white_ignore_comments();
+		parse_assert(_ptr[0] == 0, "Expected EoF");
+	}
+
+	struct PullParser::Source
+	{
+		std::string contents; ///< Empty unless we read the file ourselves.
+		Parser      parser;
+
+		Source(const char* str, const FormatOptions& options, DocInfo_SP doc, ParseInfo& info)
+			: parser(str, options, std::move(doc), info) { }
+
+		Source(std::string file, const FormatOptions& options, DocInfo_SP doc, ParseInfo& info)
+			: contents(std::move(file)), parser(contents.c_str(), options, std::move(doc), info) { }
 	};
 
-	// --------------------------------------------
+	static const char* describe(PullParser::Next next)
+	{
+		switch (next) {
+			case PullParser::Next::Null:   return "null";
+			case PullParser::Next::Bool:   return "bool";
+			case PullParser::Next::Number: return "number";
+			case PullParser::Next::String: return "string";
+			case PullParser::Next::Array:  return "array";
+			case PullParser::Next::Object: return "object";
+		}
+		return "BROKEN value";
+	}
 
-	// Sets an inclusive range
-	void set_range(bool lookup[256], char a, char b)
+	PullParser::PullParser(const char* str, const FormatOptions& options, const char* name) : _options(options)
 	{
-		for (char c=a; c<=b; ++c) {
-			lookup[static_cast<uint8_t>(c)] = true;
+		_sources.emplace_back(new Source(str, _options, std::make_shared<DocInfo>(name), _info));
+		_parser = &_sources.back()->parser;
+	}
+
+	PullParser::PullParser(const std::string& path, const FormatOptions& options) : _options(options)
+	{
+		_sources.emplace_back(new Source(read_text_file(path.c_str()), _options, std::make_shared<DocInfo>(path), _info));
+		_parser = &_sources.back()->parser;
+	}
+
+	PullParser::~PullParser() = default;
+
+	PullParser::Next PullParser::next()
+	{
+		Next found;
+		while (!parser().pull_next(found)) {
+			// Continue in the included file:
+			std::string path;
+			auto doc = parser().pull_include(path);
+			_sources.emplace_back(new Source(read_text_file(path.c_str()), _options, std::move(doc), _info));
+			_parser = &_sources.back()->parser;
+		}
+		return found;
+	}
+
+	// Called after each value. If it was all of an included file, we go back to the file that included it.
+	void PullParser::end_value()
+	{
+		while (_sources.size() > 1 && parser().pull_top_level_done()) {
+			parser().pull_finish();
+			_sources.pop_back();
+			_parser = &_sources.back()->parser;
+			parser().pull_value_done();
+		}
+	}
+
+	bool PullParser::read_bool()
+	{
+		const Next found = next();
+		if (found != Next::Bool) {
+			throw_error(std::string("Expected bool, got ") + describe(found));
+		}
+		Config value;
+		parser().pull_scalar(value);
+		end_value();
+		return value.as_bool();
+	}
+
+	int64_t PullParser::read_int()
+	{
+		const Next found = next();
+		if (found != Next::Number) {
+			throw_error(std::string("Expected integer, got ") + describe(found));
+		}
+		Config value;
+		parser().pull_scalar(value);
+		if (!value.is_int()) {
+			throw_error("Expected integer, got float");
+		}
+		end_value();
+		return value.as_integer<int64_t>();
+	}
+
+	double PullParser::read_double()
+	{
+		const Next found = next();
+		if (found != Next::Number) {
+			throw_error(std::string("Expected number, got ") + describe(found));
+		}
+		Config value;
+		parser().pull_scalar(value);
+		end_value();
+		return value.as_double();
+	}
+
+	std::string PullParser::read_string()
+	{
+		const Next found = next();
+		if (found != Next::String) {
+			throw_error(std::string("Expected string, got ") + describe(found));
+		}
+		std::string str = parser().pull_string();
+		end_value();
+		return str;
+	}
+
+	void PullParser::skip_value()
+	{
+		const Next found = next();
+		if (found == Next::Array) {
+			begin_array();
+			while (next_element()) {
+				skip_value();
+			}
+		} else if (found == Next::Object) {
+			begin_object();
+			std::string key;
+			while (next_key(key)) {
+				skip_value();
+			}
+		} else {
+			Config ignored;
+			parser().pull_scalar(ignored);
+			end_value();
+		}
+	}
+
+	void PullParser::begin_array()
+	{
+		const Next found = next();
+		if (found != Next::Array) {
+			throw_error(std::string("Expected array, got ") + describe(found));
+		}
+		parser().pull_begin(false);
+	}
+
+	bool PullParser::next_element()
+	{
+		if (parser().pull_next_item(nullptr)) {
+			return true;
+		}
+		end_value();
+		return false;
+	}
+
+	void PullParser::begin_object()
+	{
+		const Next found = next();
+		if (found != Next::Object) {
+			throw_error(std::string("Expected object, got ") + describe(found));
+		}
+		parser().pull_begin(true);
+	}
+
+	bool PullParser::next_key(std::string& key)
+	{
+		if (parser().pull_next_item(&key)) {
+			return true;
+		}
+		end_value();
+		return false;
+	}
+
+	void PullParser::finish()
+	{
+		parser().pull_finish();
+	}
+
+	void PullParser::throw_error(const std::string& msg)
+	{
+		parser().pull_throw_error(msg);
+	}
+}
+
+// ----------------------------------------------------------------------------
+// Yb        dP 88""Yb 88 888888 888888 88""Yb
+//  Yb  db  dP  88__dP 88   88   88__   88__dP
+//   YbdPYbdP   88"Yb  88   88   88""   88"Yb
+//    YP  YP    88  Yb 88   88   888888 88  Yb
+
+#include <cstdlib>  // strtod
+
+#ifdef _WIN32
+	#include <io.h>     // _write
+#else
+	#include <unistd.h> // write
+#endif
+
+#ifndef CONFIGURU_HAS_SSE2
+	#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+		#define CONFIGURU_HAS_SSE2 1
+	#else
+		#define CONFIGURU_HAS_SSE2 0
+	#endif
+#endif
+
+#if CONFIGURU_HAS_SSE2
+	#include <emmintrin.h>
+	#if defined(__AVX2__)
+		#include <immintrin.h>
+	#endif
+	#if defined(_MSC_VER)
+		#include <intrin.h> // _BitScanForward
+	#endif
+#endif
+
+namespace configuru
+{
+	bool is_identifier(const char* p)
+	{
+		if (*p == '_'
+			 || ('a' <= *p && *p <= 'z')
+			 || ('A' <= *p && *p <= 'Z'))
+		{
+			++p;
+			while (*p) {
+				if (*p == '_'
+					 || ('a' <= *p && *p <= 'z')
+					 || ('A' <= *p && *p <= 'Z')
+					 || ('0' <= *p && *p <= '9'))
+				{
+					++p;
+				} else {
+					return false;
+				}
+			}
+			return true;
+		} else {
+			return false;
+		}
+	}
+
+	bool has_pre_end_brace_comments(const Config& cfg)
+	{
+		return cfg.has_comments() && !cfg.comments().pre_end_brace.empty();
+	}
+
+	// ------------------------------------------------------------------------
+	// Number formatting without snprintf.
+
+	static const char DIGIT_PAIRS[] =
+		"00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+		"40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+		"8081828384858687888990919293949596979899";
+
+	/// Writes the decimal digits of `value` so that they end just before `end`. Returns where they start.
+	static char* format_uint(uint64_t value, char* end)
+	{
+		char* p = end;
+		while (value >= 100) {
+			const auto pair = static_cast<size_t>(value % 100) * 2;
+			value /= 100;
+			p -= 2;
+			p[0] = DIGIT_PAIRS[pair];
+			p[1] = DIGIT_PAIRS[pair + 1];
+		}
+		if (value < 10) {
+			*--p = static_cast<char>('0' + value);
+		} else {
+			p -= 2;
+			p[0] = DIGIT_PAIRS[value * 2];
+			p[1] = DIGIT_PAIRS[value * 2 + 1];
+		}
+		return p;
+	}
+
+	// ------------------------------------------------------------------------
+	// Finding characters which need escaping in strings.
+
+#if CONFIGURU_HAS_SSE2
+	static inline unsigned lowest_bit_index(uint32_t mask)
+	{
+		#if defined(_MSC_VER)
+			unsigned long index;
+			_BitScanForward(&index, mask);
+			return static_cast<unsigned>(index);
+		#else
+			return static_cast<unsigned>(__builtin_ctz(mask));
+		#endif
+	}
+#endif
+
+	/// Returns the first character in [p, end) which can not be written as is in a quoted string, or end.
+	/// These are control characters, quotes and backslashes, and with ensure_ascii anything above 0x7F.
+	/// `safe` is the per-byte answer, used for what is left after the wide checks.
+	static const char* find_unsafe_character(const char* p, const char* end, const bool* safe, bool ensure_ascii)
+	{
+	#if CONFIGURU_HAS_SSE2
+		#if defined(__AVX2__)
+			const __m256i quote_32       = _mm256_set1_epi8('"');
+			const __m256i backslash_32   = _mm256_set1_epi8('\\');
+			const __m256i max_control_32 = _mm256_set1_epi8(0x1F);
+			while (end - p >= 32) {
+				const __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+				__m256i unsafe = _mm256_or_si256(_mm256_cmpeq_epi8(chunk, quote_32), _mm256_cmpeq_epi8(chunk, backslash_32));
+				unsafe = _mm256_or_si256(unsafe, _mm256_cmpeq_epi8(_mm256_min_epu8(chunk, max_control_32), chunk));
+				auto mask = static_cast<uint32_t>(_mm256_movemask_epi8(unsafe));
+				if (ensure_ascii) { mask |= static_cast<uint32_t>(_mm256_movemask_epi8(chunk)); }
+				if (mask != 0) { return p + lowest_bit_index(mask); }
+				p += 32;
+			}
+		#endif
+
+		const __m128i quote       = _mm_set1_epi8('"');
+		const __m128i backslash   = _mm_set1_epi8('\\');
+		const __m128i max_control = _mm_set1_epi8(0x1F);
+		while (end - p >= 16) {
+			const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+			__m128i unsafe = _mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, backslash));
+			unsafe = _mm_or_si128(unsafe, _mm_cmpeq_epi8(_mm_min_epu8(chunk, max_control), chunk)); // <= 0x1F
+			auto mask = static_cast<uint32_t>(_mm_movemask_epi8(unsafe));
+			if (ensure_ascii) { mask |= static_cast<uint32_t>(_mm_movemask_epi8(chunk)); } // The top bits
+			if (mask != 0) { return p + lowest_bit_index(mask); }
+			p += 16;
+		}
+	#else
+		// Eight bytes at a time, using the tricks from https://graphics.stanford.edu/~seander/bithacks.html#HasLessInWord
+		// These may find things that aren't there, but never miss anything, so we look closer on a hit.
+		const uint64_t ones  = 0x0101010101010101ull;
+		const uint64_t highs = 0x8080808080808080ull;
+		while (end - p >= 8) {
+			uint64_t word;
+			memcpy(&word, p, sizeof(word));
+			const uint64_t quotes      = word ^ (ones * '"');
+			const uint64_t backslashes = word ^ (ones * '\\');
+			uint64_t hits = ((word - ones * 0x20) & ~word) | ((quotes - ones) & ~quotes) | ((backslashes - ones) & ~backslashes);
+			if (ensure_ascii) { hits |= word; }
+			if ((hits & highs) != 0) { break; }
+			p += 8;
+		}
+	#endif
+
+		while (p < end && safe[static_cast<uint8_t>(*p)]) {
+			++p;
+		}
+		return p;
+	}
+
+	// Shortest round-trip formatting of floating point numbers, using the Grisu2 algorithm from
+	// "Printing Floating-Point Numbers Quickly and Accurately with Integers" by Florian Loitsch (2010).
+	// The digits always parse back to the exact same number, and are nearly always the shortest such.
+
+	/// A floating point number f * 2^e with a 64 bit significand.
+	struct DiyFp
+	{
+		uint64_t f;
+		int      e;
+
+		/// The upper 64 bits of the 128 bit product, rounded.
+		static DiyFp mul(DiyFp x, DiyFp y)
+		{
+			const uint64_t x_lo = x.f & 0xFFFFFFFFu;
+			const uint64_t x_hi = x.f >> 32;
+			const uint64_t y_lo = y.f & 0xFFFFFFFFu;
+			const uint64_t y_hi = y.f >> 32;
+
+			const uint64_t p0 = x_lo * y_lo;
+			const uint64_t p1 = x_lo * y_hi;
+			const uint64_t p2 = x_hi * y_lo;
+			const uint64_t p3 = x_hi * y_hi;
+
+			uint64_t mid = (p0 >> 32) + (p1 & 0xFFFFFFFFu) + (p2 & 0xFFFFFFFFu);
+			mid += uint64_t(1) << 31; // Round
+			return {p3 + (p1 >> 32) + (p2 >> 32) + (mid >> 32), x.e + y.e + 64};
+		}
+
+		static DiyFp normalize(DiyFp x)
+		{
+			while ((x.f >> 63) == 0) {
+				x.f <<= 1;
+				x.e -= 1;
+			}
+			return x;
+		}
+
+		static DiyFp normalize_to(DiyFp x, int e)
+		{
+			return {x.f << (x.e - e), e};
+		}
+	};
+
+	/// The value, and the boundaries halfway to its neighbors, with the same exponent.
+	struct FloatBoundaries
+	{
+		DiyFp w, minus, plus;
+	};
+
+	/// FloatType is float or double. `value` must be finite and positive.
+	template<typename FloatType, typename Bits>
+	static FloatBoundaries compute_boundaries(FloatType value)
+	{
+		static_assert(sizeof(FloatType) == sizeof(Bits), "Bits must be as big as FloatType");
+		const int      precision  = std::numeric_limits<FloatType>::digits; // Including the hidden bit
+		const int      bias       = std::numeric_limits<FloatType>::max_exponent - 1 + (precision - 1);
+		const int      min_exp    = 1 - bias;
+		const uint64_t hidden_bit = uint64_t(1) << (precision - 1);
+
+		Bits bits;
+		memcpy(&bits, &value, sizeof(bits));
+		const uint64_t biased_exp = static_cast<uint64_t>(bits) >> (precision - 1);
+		const uint64_t fraction   = static_cast<uint64_t>(bits) & (hidden_bit - 1);
+
+		const DiyFp v = biased_exp == 0
+			? DiyFp{fraction, min_exp} // Denormal
+			: DiyFp{fraction + hidden_bit, static_cast<int>(biased_exp) - bias};
+
+		// The distance to the next smaller number is halved when we are a power of two:
+		const bool lower_is_closer = fraction == 0 && biased_exp > 1;
+		const DiyFp plus  = DiyFp::normalize({2 * v.f + 1, v.e - 1});
+		const DiyFp minus = lower_is_closer ? DiyFp{4 * v.f - 1, v.e - 2} : DiyFp{2 * v.f - 1, v.e - 1};
+		return {DiyFp::normalize(v), DiyFp::normalize_to(minus, plus.e), plus};
+	}
+
+	/// 10^k as f * 2^e, for every eighth k.
+	struct CachedPower
+	{
+		uint64_t f;
+		int      e;
+		int      k;
+	};
+
+	static const CachedPower CACHED_POWERS[] = {
+		{ 0xAB70FE17C79AC6CAull, -1060, -300 },
+		{ 0xFF77B1FCBEBCDC4Full, -1034, -292 },
+		{ 0xBE5691EF416BD60Cull, -1007, -284 },
+		{ 0x8DD01FAD907FFC3Cull,  -980, -276 },
+		{ 0xD3515C2831559A83ull,  -954, -268 },
+		{ 0x9D71AC8FADA6C9B5ull,  -927, -260 },
+		{ 0xEA9C227723EE8BCBull,  -901, -252 },
+		{ 0xAECC49914078536Dull,  -874, -244 },
+		{ 0x823C12795DB6CE57ull,  -847, -236 },
+		{ 0xC21094364DFB5637ull,  -821, -228 },
+		{ 0x9096EA6F3848984Full,  -794, -220 },
+		{ 0xD77485CB25823AC7ull,  -768, -212 },
+		{ 0xA086CFCD97BF97F4ull,  -741, -204 },
+		{ 0xEF340A98172AACE5ull,  -715, -196 },
+		{ 0xB23867FB2A35B28Eull,  -688, -188 },
+		{ 0x84C8D4DFD2C63F3Bull,  -661, -180 },
+		{ 0xC5DD44271AD3CDBAull,  -635, -172 },
+		{ 0x936B9FCEBB25C996ull,  -608, -164 },
+		{ 0xDBAC6C247D62A584ull,  -582, -156 },
+		{ 0xA3AB66580D5FDAF6ull,  -555, -148 },
+		{ 0xF3E2F893DEC3F126ull,  -529, -140 },
+		{ 0xB5B5ADA8AAFF80B8ull,  -502, -132 },
+		{ 0x87625F056C7C4A8Bull,  -475, -124 },
+		{ 0xC9BCFF6034C13053ull,  -449, -116 },
+		{ 0x964E858C91BA2655ull,  -422, -108 },
+		{ 0xDFF9772470297EBDull,  -396, -100 },
+		{ 0xA6DFBD9FB8E5B88Full,  -369,  -92 },
+		{ 0xF8A95FCF88747D94ull,  -343,  -84 },
+		{ 0xB94470938FA89BCFull,  -316,  -76 },
+		{ 0x8A08F0F8BF0F156Bull,  -289,  -68 },
+		{ 0xCDB02555653131B6ull,  -263,  -60 },
+		{ 0x993FE2C6D07B7FACull,  -236,  -52 },
+		{ 0xE45C10C42A2B3B06ull,  -210,  -44 },
+		{ 0xAA242499697392D3ull,  -183,  -36 },
+		{ 0xFD87B5F28300CA0Eull,  -157,  -28 },
+		{ 0xBCE5086492111AEBull,  -130,  -20 },
+		{ 0x8CBCCC096F5088CCull,  -103,  -12 },
+		{ 0xD1B71758E219652Cull,   -77,   -4 },
+		{ 0x9C40000000000000ull,   -50,    4 },
+		{ 0xE8D4A51000000000ull,   -24,   12 },
+		{ 0xAD78EBC5AC620000ull,     3,   20 },
+		{ 0x813F3978F8940984ull,    30,   28 },
+		{ 0xC097CE7BC90715B3ull,    56,   36 },
+		{ 0x8F7E32CE7BEA5C70ull,    83,   44 },
+		{ 0xD5D238A4ABE98068ull,   109,   52 },
+		{ 0x9F4F2726179A2245ull,   136,   60 },
+		{ 0xED63A231D4C4FB27ull,   162,   68 },
+		{ 0xB0DE65388CC8ADA8ull,   189,   76 },
+		{ 0x83C7088E1AAB65DBull,   216,   84 },
+		{ 0xC45D1DF942711D9Aull,   242,   92 },
+		{ 0x924D692CA61BE758ull,   269,  100 },
+		{ 0xDA01EE641A708DEAull,   295,  108 },
+		{ 0xA26DA3999AEF774Aull,   322,  116 },
+		{ 0xF209787BB47D6B85ull,   348,  124 },
+		{ 0xB454E4A179DD1877ull,   375,  132 },
+		{ 0x865B86925B9BC5C2ull,   402,  140 },
+		{ 0xC83553C5C8965D3Dull,   428,  148 },
+		{ 0x952AB45CFA97A0B3ull,   455,  156 },
+		{ 0xDE469FBD99A05FE3ull,   481,  164 },
+		{ 0xA59BC234DB398C25ull,   508,  172 },
+		{ 0xF6C69A72A3989F5Cull,   534,  180 },
+		{ 0xB7DCBF5354E9BECEull,   561,  188 },
+		{ 0x88FCF317F22241E2ull,   588,  196 },
+		{ 0xCC20CE9BD35C78A5ull,   614,  204 },
+		{ 0x98165AF37B2153DFull,   641,  212 },
+		{ 0xE2A0B5DC971F303Aull,   667,  220 },
+		{ 0xA8D9D1535CE3B396ull,   694,  228 },
+		{ 0xFB9B7CD9A4A7443Cull,   720,  236 },
+		{ 0xBB764C4CA7A44410ull,   747,  244 },
+		{ 0x8BAB8EEFB6409C1Aull,   774,  252 },
+		{ 0xD01FEF10A657842Cull,   800,  260 },
+		{ 0x9B10A4E5E9913129ull,   827,  268 },
+		{ 0xE7109BFBA19C0C9Dull,   853,  276 },
+		{ 0xAC2820D9623BF429ull,   880,  284 },
+		{ 0x80444B5E7AA7CF85ull,   907,  292 },
+		{ 0xBF21E44003ACDD2Dull,   933,  300 },
+		{ 0x8E679C2F5E44FF8Full,   960,  308 },
+		{ 0xD433179D9C8CB841ull,   986,  316 },
+		{ 0x9E19DB92B4E31BA9ull,  1013,  324 },
+	};
+
+	/// Digit generation works on products with a binary exponent in [GRISU_ALPHA, GRISU_GAMMA].
+	static const int GRISU_ALPHA = -60;
+	static const int GRISU_GAMMA = -32;
+
+	/// A power of ten c such that c * 2^e has a binary exponent in [GRISU_ALPHA, GRISU_GAMMA] (after the 64 bit shift).
+	static CachedPower cached_power_for_binary_exponent(int e)
+	{
+		const int min_dec_exp = -300;
+		const int dec_step    = 8;
+
+		// ceil((GRISU_ALPHA - e - 1) * log10(2)):
+		const int f = GRISU_ALPHA - e - 1;
+		const int k = (f * 78913) / (1 << 18) + static_cast<int>(f > 0);
+		const int index = (-min_dec_exp + k + (dec_step - 1)) / dec_step;
+		CONFIGURU_ASSERT(0 <= index && static_cast<size_t>(index) < sizeof(CACHED_POWERS) / sizeof(CACHED_POWERS[0]));
+		const CachedPower cached = CACHED_POWERS[index];
+		CONFIGURU_ASSERT(GRISU_ALPHA <= cached.e + e + 64 && cached.e + e + 64 <= GRISU_GAMMA);
+		return cached;
+	}
+
+	/// The largest power of ten <= n (n > 0), and its number of digits.
+	static int find_largest_pow10(uint32_t n, uint32_t& pow10)
+	{
+		if (n >= 1000000000) { pow10 = 1000000000; return 10; }
+		if (n >=  100000000) { pow10 =  100000000; return  9; }
+		if (n >=   10000000) { pow10 =   10000000; return  8; }
+		if (n >=    1000000) { pow10 =    1000000; return  7; }
+		if (n >=     100000) { pow10 =     100000; return  6; }
+		if (n >=      10000) { pow10 =      10000; return  5; }
+		if (n >=       1000) { pow10 =       1000; return  4; }
+		if (n >=        100) { pow10 =        100; return  3; }
+		if (n >=         10) { pow10 =         10; return  2; }
+		pow10 = 1;
+		return 1;
+	}
+
+	/// Move the last digit towards the exact value, as long as we stay within the boundaries.
+	static void grisu2_round(char* buf, int len, uint64_t dist, uint64_t delta, uint64_t rest, uint64_t ten_k)
+	{
+		while (rest < dist && delta - rest >= ten_k &&
+		       (rest + ten_k < dist || dist - rest > rest + ten_k - dist)) {
+			buf[len - 1] -= 1;
+			rest += ten_k;
+		}
+	}
+
+	/// Generates the shortest digits of a number in [M_minus, M_plus], as close to w as we can.
+	static void grisu2_digit_gen(char* buf, int& len, int& decimal_exponent, DiyFp M_minus, DiyFp w, DiyFp M_plus)
+	{
+		uint64_t delta = M_plus.f - M_minus.f;
+		uint64_t dist  = M_plus.f - w.f;
+
+		const DiyFp one{uint64_t(1) << -M_plus.e, M_plus.e};
+		auto p1 = static_cast<uint32_t>(M_plus.f >> -one.e); // Integer part
+		uint64_t p2 = M_plus.f & (one.f - 1);                // Fractional part
+
+		uint32_t pow10;
+		int n = find_largest_pow10(p1, pow10);
+		while (n > 0) {
+			const uint32_t d = p1 / pow10;
+			p1 %= pow10;
+			buf[len++] = static_cast<char>('0' + d);
+			n -= 1;
+
+			const uint64_t rest = (static_cast<uint64_t>(p1) << -one.e) + p2;
+			if (rest <= delta) {
+				decimal_exponent += n;
+				grisu2_round(buf, len, dist, delta, rest, static_cast<uint64_t>(pow10) << -one.e);
+				return;
+			}
+			pow10 /= 10;
+		}
+
+		int m = 0;
+		for (;;) {
+			p2 *= 10;
+			buf[len++] = static_cast<char>('0' + (p2 >> -one.e));
+			p2 &= one.f - 1;
+			m += 1;
+			delta *= 10;
+			dist  *= 10;
+			if (p2 <= delta) { break; }
+		}
+		decimal_exponent -= m;
+		grisu2_round(buf, len, dist, delta, p2, one.f);
+	}
+
+	/// Writes the shortest decimal digits of `value` (finite and > 0) to `buf` (at least 17 chars),
+	/// so that value == digits * 10^decimal_exponent when read back as a FloatType. Returns the number of digits.
+	template<typename FloatType, typename Bits>
+	static int grisu2(char* buf, int& decimal_exponent, FloatType value)
+	{
+		const FloatBoundaries b = compute_boundaries<FloatType, Bits>(value);
+		const CachedPower cached = cached_power_for_binary_exponent(b.plus.e);
+		const DiyFp c{cached.f, cached.e};
+
+		const DiyFp w       = DiyFp::mul(b.w,     c);
+		const DiyFp w_minus = DiyFp::mul(b.minus, c);
+		const DiyFp w_plus  = DiyFp::mul(b.plus,  c);
+
+		// Stay clear of the boundaries, which are only known to within one unit:
+		const DiyFp M_minus{w_minus.f + 1, w_minus.e};
+		const DiyFp M_plus {w_plus.f  - 1, w_plus.e};
+
+		int len = 0;
+		decimal_exponent = -cached.k;
+		grisu2_digit_gen(buf, len, decimal_exponent, M_minus, w, M_plus);
+
+		while (len > 1 && buf[len - 1] == '0') {
+			len -= 1;
+			decimal_exponent += 1;
+		}
+		return len;
+	}
+
+	static double parse_as(const char* str, double) { return std::strtod(str, nullptr); }
+	static float  parse_as(const char* str, float)  { return std::strtof(str, nullptr); }
+
+	/// Tries rounding the digits down and up to the first `keep` digits. Returns the new number of digits,
+	/// or `len` if neither gets us back `value`.
+	template<typename FloatType>
+	static int try_fewer_digits(char* digits, int len, int keep, int& decimal_exponent, FloatType value)
+	{
+		const bool prefer_up = digits[keep] >= '5';
+		for (int attempt = 0; attempt < 2; ++attempt) {
+			char candidate[40];
+			memcpy(candidate, digits, static_cast<size_t>(keep));
+			int candidate_len = keep;
+			int candidate_exponent = decimal_exponent + (len - keep);
+			if ((attempt == 0) == prefer_up) {
+				int i = candidate_len - 1;
+				while (i >= 0 && candidate[i] == '9') {
+					candidate[i--] = '0';
+				}
+				if (i < 0) {
+					candidate[0] = '1'; // 999 -> 1000
+					candidate_len = 1;
+					candidate_exponent += keep;
+				} else {
+					candidate[i] += 1;
+				}
+			}
+			while (candidate_len > 1 && candidate[candidate_len - 1] == '0') {
+				candidate_len -= 1;
+				candidate_exponent += 1;
+			}
+
+			// Without a decimal point, so this doesn't depend on the locale:
+			char* end = candidate + candidate_len;
+			*end++ = 'e';
+			if (candidate_exponent < 0) { *end++ = '-'; }
+			char exponent[8];
+			char* exp_end = exponent + sizeof(exponent);
+			char* exp_start = format_uint(static_cast<uint64_t>(candidate_exponent < 0 ? -candidate_exponent : candidate_exponent), exp_end);
+			memcpy(end, exp_start, static_cast<size_t>(exp_end - exp_start));
+			end += exp_end - exp_start;
+			*end = '\0';
+
+			if (parse_as(candidate, value) == value) {
+				memcpy(digits, candidate, static_cast<size_t>(candidate_len));
+				decimal_exponent = candidate_exponent;
+				return candidate_len;
+			}
+		}
+		return len;
+	}
+
+	/// Grisu2 gives more digits than needed for a small fraction of numbers, because it keeps a safety margin
+	/// to the boundaries. Then the shorter number is just outside the margin, so our digits are it followed
+	/// (before the last digit) by a run of zeros or nines, or it is just one digit less. We try both.
+	/// Only called for many digits, where it matters most, so it does not slow down the common case.
+	template<typename FloatType>
+	static int shorten_grisu2(char* digits, int len, int& decimal_exponent, FloatType value)
+	{
+		const char run_digit = digits[len - 2];
+		if (run_digit == '0' || run_digit == '9') {
+			int keep = len - 2;
+			while (keep > 1 && digits[keep - 1] == run_digit) {
+				keep -= 1;
+			}
+			const int new_len = try_fewer_digits(digits, len, keep, decimal_exponent, value);
+			if (new_len != len) { return new_len; }
+		}
+		if (len == std::numeric_limits<FloatType>::max_digits10) {
+			return try_fewer_digits(digits, len, len - 1, decimal_exponent, value);
+		}
+		return len;
+	}
+
+	/// Writes `len` digits times 10^decimal_exponent the way printf("%.*g", precision, ...) would,
+	/// given that there are no more than `precision` digits. Returns the end of the output.
+	static char* format_like_g(char* out, const char* digits, int len, int decimal_exponent, int precision)
+	{
+		const int x = len + decimal_exponent - 1; // The exponent in scientific notation
+
+		if (x < -4 || x >= precision) {
+			*out++ = digits[0];
+			if (len > 1) {
+				*out++ = '.';
+				memcpy(out, digits + 1, static_cast<size_t>(len - 1));
+				out += len - 1;
+			}
+			*out++ = 'e';
+			*out++ = x < 0 ? '-' : '+';
+			const auto abs_x = static_cast<unsigned>(x < 0 ? -x : x);
+			if (abs_x < 10) { *out++ = '0'; }
+			char temp[8];
+			char* end = temp + sizeof(temp);
+			char* start = format_uint(abs_x, end);
+			memcpy(out, start, static_cast<size_t>(end - start));
+			out += end - start;
+		} else if (x < 0) {
+			*out++ = '0';
+			*out++ = '.';
+			for (int i = 0; i < -x - 1; ++i) { *out++ = '0'; }
+			memcpy(out, digits, static_cast<size_t>(len));
+			out += len;
+		} else if (len <= x + 1) {
+			memcpy(out, digits, static_cast<size_t>(len));
+			out += len;
+			for (int i = len; i < x + 1; ++i) { *out++ = '0'; }
+		} else {
+			memcpy(out, digits, static_cast<size_t>(x + 1));
+			out += x + 1;
+			*out++ = '.';
+			memcpy(out, digits + x + 1, static_cast<size_t>(len - x - 1));
+			out += len - x - 1;
 		}
+		return out;
+	}
+
+#if CONFIGURU_VALUE_SEMANTICS && CONFIGURU_DUMP_CACHE
+	/// A number which is the same for FormatOptions that write the same way, and different otherwise.
+	/// Made from every option the Writer reads.
+	static size_t dump_format_id(const FormatOptions& o)
+	{
+		std::string key = o.indentation;
+		key.push_back('\0');
+		for (bool flag : {o.allow_macro, o.array_omit_comma, o.distinct_floats, o.ensure_ascii, o.identifiers_keys,
+		                  o.implicit_top_object, o.inf, o.nan, o.object_align_values, o.omit_colon_before_object,
+		                  o.sort_keys, o.str_python_multiline, o.write_comments, o.write_uninitialized}) {
+			key.push_back(flag ? '1' : '0');
+		}
+
+		static std::mutex s_mutex;
+		static std::map<std::string, size_t> s_ids;
+		std::lock_guard<std::mutex> lock(s_mutex);
+		return s_ids.emplace(key, s_ids.size() + 1).first->second;
 	}
+#endif
 
-	Parser::Parser(const char* str, const FormatOptions& options, DocInfo_SP doc, ParseInfo& info) : _doc(doc), _info(info)
+	struct Writer
 	{
-		_options    = options;
-		_line_nr    = 1;
-		_ptr        = str;
-		_line_start = str;
+		std::string   _out;
+		OutputSink*   _sink = nullptr; ///< If set, _out is handed to it whenever it grows past _flush_size.
+		size_t        _flush_size = 0;
 
-		IDENT_STARTERS[static_cast<uint8_t>('_')] = true;
-		set_range(IDENT_STARTERS, 'a', 'z');
-		set_range(IDENT_STARTERS, 'A', 'Z');
+		/// The entries of the objects we are in the middle of writing, in the order we write them.
+		/// Kept here so that a reused Writer does not allocate.
+		std::vector<Config::ConfigObjectImpl::const_iterator> _pairs;
+		bool          _compact;
+		FormatOptions _options;
+		std::string   _indentation; ///< options.indentation repeated, so most indents are a single append.
+		bool          SAFE_CHARACTERS[256];
+		DocInfo_SP    _doc;
+		ThreadPool*   _pool = nullptr;          ///< If set, big arrays and objects are written on several threads.
+		std::mutex*   _include_mutex = nullptr; ///< Held while writing an included file, if _pool is set.
+		const Config* _root = nullptr;          ///< What we were asked to write, if _pool is set.
+
+	#if CONFIGURU_VALUE_SEMANTICS && CONFIGURU_DUMP_CACHE
+		/// Arrays and objects are only remembered if their output is at most this big. Bigger ones are put
+		/// together from their remembered children each time, so we remember about as much as we write.
+		static const size_t DUMP_CACHE_MAX_SIZE = 16 * 1024;
+		static const size_t NO_CAPTURE = static_cast<size_t>(-1);
+
+		size_t              _format = 0;      ///< From dump_format_id if options.cache_output is set, else 0.
+		std::vector<size_t> _captures;        ///< Where in _out each array and object we may remember starts.
+		size_t              _num_includes = 0;
+		size_t              _num_unstable = 0; ///< Values written which could change without telling the arrays and objects around them.
+	#endif
 
-		IDENT_CHARS[static_cast<uint8_t>('_')] = true;
-		set_range(IDENT_CHARS, 'a', 'z');
-		set_range(IDENT_CHARS, 'A', 'Z');
-		set_range(IDENT_CHARS, '0', '9');
+		Writer(const FormatOptions& options, DocInfo_SP doc)
+			: _options(options), _doc(std::move(doc))
+		{
+			_compact = _options.compact();
 
-		MAYBE_WHITE[static_cast<uint8_t>('\n')] = true;
-		MAYBE_WHITE[static_cast<uint8_t>('\r')] = true;
-		MAYBE_WHITE[static_cast<uint8_t>('\t')] = true;
-		MAYBE_WHITE[static_cast<uint8_t>(' ')]  = true;
-		MAYBE_WHITE[static_cast<uint8_t>('/')]  = true; // Maybe a comment
+			const unsigned MAX_QUICK_INDENT = 16;
+			for (unsigned i = 0; i < MAX_QUICK_INDENT; ++i) {
+				_indentation += _options.indentation;
+			}
 
-		SPECIAL_CHARACTERS[static_cast<uint8_t>('\0')] = true;
-		SPECIAL_CHARACTERS[static_cast<uint8_t>('\\')] = true;
-		SPECIAL_CHARACTERS[static_cast<uint8_t>('\"')] = true;
-		SPECIAL_CHARACTERS[static_cast<uint8_t>('\n')] = true;
-		SPECIAL_CHARACTERS[static_cast<uint8_t>('\t')] = true;
+			for (int i = 0; i < 256; ++i) {
+				SAFE_CHARACTERS[i] = i >= 0x20;
+			}
 
-		CONFIGURU_ASSERT(_options.indentation != "" || !_options.enforce_indentation);
-	}
+			SAFE_CHARACTERS[static_cast<uint8_t>('\\')] = false;
+			SAFE_CHARACTERS[static_cast<uint8_t>('\"')] = false;
+			SAFE_CHARACTERS[static_cast<uint8_t>('\0')] = false;
+			SAFE_CHARACTERS[static_cast<uint8_t>('\b')] = false;
+			SAFE_CHARACTERS[static_cast<uint8_t>('\f')] = false;
+			SAFE_CHARACTERS[static_cast<uint8_t>('\n')] = false;
+			SAFE_CHARACTERS[static_cast<uint8_t>('\r')] = false;
+			SAFE_CHARACTERS[static_cast<uint8_t>('\t')] = false;
 
-	// Returns true if we did skip white-space.
-	// out_indentation is the depth of indentation on the last line we did skip on.
-	// iff out_indentation is -1 there is a non-tab on the last line.
-	bool Parser::skip_white(Comments* out_comments, int& out_indentation, bool break_on_newline)
-	{
-		auto start_ptr = _ptr;
-		out_indentation = 0;
-		bool found_newline = false;
+			if (_options.ensure_ascii) {
+				for (int i = 0x80; i < 256; ++i) {
+					SAFE_CHARACTERS[i] = false;
+				}
+			}
 
-		const std::string& indentation = _options.indentation;
+		#if CONFIGURU_VALUE_SEMANTICS && CONFIGURU_DUMP_CACHE
+			if (_options.cache_output) {
+				_format = dump_format_id(_options);
+			}
+		#endif
+		}
 
-		while (MAYBE_WHITE[static_cast<uint8_t>(_ptr[0])]) {
-			if (_ptr[0] == '\n') {
-				// Unix style newline
-				_ptr += 1;
-				_line_nr += 1;
-				_line_start = _ptr;
-				out_indentation = 0;
-				if (break_on_newline) { return true; }
-				found_newline = true;
+		inline void maybe_flush()
+		{
+			if (_sink && _out.size() >= _flush_size) {
+				flush();
 			}
-			else if (_ptr[0] == '\r') {
-				// CR-LF - windows style newline
-				parse_assert(_ptr[1] == '\n', "CR with no LF. \\r only allowed before \\n."); // TODO: this is OK in JSON.
-				_ptr += 2;
-				_line_nr += 1;
-				_line_start = _ptr;
-				out_indentation = 0;
-				if (break_on_newline) { return true; }
-				found_newline = true;
+		}
+
+		void flush()
+		{
+			if (!_sink || _out.empty()) { return; }
+
+			size_t size = _out.size();
+		#if CONFIGURU_VALUE_SEMANTICS && CONFIGURU_DUMP_CACHE
+			// Hold back what we are about to remember, unless it has grown too big for that:
+			for (auto&& start : _captures) {
+				if (start == NO_CAPTURE) { continue; }
+				if (_out.size() - start > DUMP_CACHE_MAX_SIZE) {
+					start = NO_CAPTURE;
+					continue;
+				}
+				size = start;
+				break;
 			}
-			else if (!indentation.empty() &&
-					 strncmp(_ptr, indentation.c_str(), indentation.size()) == 0)
-			{
-				_ptr += indentation.size();
-				if (_options.enforce_indentation && indentation == "\t") {
-					parse_assert(out_indentation != -1, "Tabs should only occur on the start of a line!");
+			if (size == 0) { return; }
+			for (auto&& start : _captures) {
+				if (start != NO_CAPTURE) { start -= size; }
+			}
+		#endif
+			_sink->write(_out.data(), size);
+			_out.erase(0, size); // Keeps the capacity
+		}
+
+		/// Flushes all of _out, so that we can write to the sink directly after.
+		void flush_all()
+		{
+		#if CONFIGURU_VALUE_SEMANTICS && CONFIGURU_DUMP_CACHE
+			for (auto&& start : _captures) {
+				start = NO_CAPTURE;
+			}
+		#endif
+			flush();
+		}
+
+		inline void write_indent(unsigned indent)
+		{
+			if (_compact) { return; }
+			const size_t size = indent * _options.indentation.size();
+			if (size <= _indentation.size()) {
+				_out.append(_indentation.data(), size);
+			} else {
+				for (unsigned i=0; i<indent; ++i) {
+					_out += _options.indentation;
 				}
-				++out_indentation;
 			}
-			else if (_ptr[0] == '\t') {
-				++_ptr;
-				if (_options.enforce_indentation) {
-					parse_assert(out_indentation != -1, "Tabs should only occur on the start of a line!");
+		}
+
+		void write_prefix_comments(unsigned indent, const Comments& comments)
+		{
+			if (!_options.write_comments) { return; }
+			if (!comments.empty()) {
+				_out.push_back('\n');
+				for (auto&& c : comments) {
+					write_indent(indent);
+					_out += c;
+					_out.push_back('\n');
 				}
-				++out_indentation;
 			}
-			else if (_ptr[0] == ' ') {
-				if (found_newline && _options.enforce_indentation) {
-					if (indentation == "\t") {
-						throw_error("Found a space at beginning of a line. Indentation must be done using tabs!");
-					} else {
-						throw_error("Indentation should be a multiple of " + std::to_string(indentation.size()) + " spaces.");
-					}
+		}
+
+		void write_prefix_comments(unsigned indent, const Config& cfg)
+		{
+			if (!_options.write_comments) { return; }
+			if (cfg.has_comments()) {
+				write_prefix_comments(indent, cfg.comments().prefix);
+			}
+		}
+
+		void write_postfix_comments(unsigned indent, const Comments& comments)
+		{
+			if (!_options.write_comments) { return; }
+			(void)indent; // TODO: reindent comments
+			for (auto&& c : comments) {
+				_out.push_back(' ');;
+				_out += c;
+			}
+		}
+
+		void write_pre_brace_comments(unsigned indent, const Comments& comments)
+		{
+			write_prefix_comments(indent, comments);
+		}
+
+		void write_value(unsigned indent, const Config& config,
+							  bool write_prefix, bool write_postfix)
+		{
+			if (_options.allow_macro && config.doc() && config.doc() != _doc) {
+			#if CONFIGURU_VALUE_SEMANTICS && CONFIGURU_DUMP_CACHE
+				_num_includes += 1;
+			#endif
+				if (_include_mutex) {
+					// The same file may be included by values being written on other threads:
+					std::lock_guard<std::mutex> lock(*_include_mutex);
+					dump_file(config.doc()->filename, config, _options);
+				} else {
+					dump_file(config.doc()->filename, config, _options);
 				}
-				++_ptr;
-				out_indentation = -1;
+				_out += "#include <";
+				_out += config.doc()->filename;
+				_out.push_back('>');
+				return;
 			}
-			else if (_ptr[0] == '/' && _ptr[1] == '/') {
-				parse_assert(_options.single_line_comments, "Single line comments forbidden.");
-				// Single line comment
-				auto start = _ptr;
-				_ptr += 2;
-				while (_ptr[0] && _ptr[0] != '\n') {
-					_ptr += 1;
+
+		#if CONFIGURU_VALUE_SEMANTICS && CONFIGURU_DUMP_CACHE
+			if (has_lent_comments(config)) {
+				_num_unstable += 1;
+			}
+		#endif
+
+			if (write_prefix) {
+				write_prefix_comments(indent, config);
+			}
+
+			if (config.is_null()) {
+				_out += "null";
+			} else if (config.is_bool()) {
+				_out += (config.as_bool() ? "true" : "false");
+			} else if (config.is_int()) {
+				write_int(config.get<int64_t>());
+			} else if (config.is_float()) {
+				write_number( config.as_double() );
+			} else if (config.is_string()) {
+				write_string(config.as_string());
+			} else if (config.is_array() || config.is_object()) {
+			#if CONFIGURU_VALUE_SEMANTICS && CONFIGURU_DUMP_CACHE
+				if (_format != 0) {
+					write_container_cached(indent, config);
+				} else {
+					write_container(indent, config);
+				}
+			#else
+				write_container(indent, config);
+			#endif
+			} else {
+				if (_options.write_uninitialized) {
+					_out += "UNINITIALIZED";
+				} else {
+					CONFIGURU_ONERROR("Failed to serialize uninitialized Config");
 				}
-				if (out_comments) { out_comments->emplace_back(start, _ptr - start); }
-				out_indentation = 0;
-				if (break_on_newline) { return true; }
 			}
-			else if (_ptr[0] == '/' && _ptr[1] == '*') {
-				parse_assert(_options.block_comments, "Block comments forbidden.");
-				// Multi-line comment
-				auto state = get_state(); // So we can point out the start if there's an error
-				_ptr += 2;
-				unsigned nesting = 1; // We allow nested /**/ comments
-				do
-				{
-					if (_ptr[0]==0) {
-						set_state(state);
-						throw_error("Non-ending /* comment");
-					}
-					else if (_ptr[0]=='/' && _ptr[1]=='*') {
-						_ptr += 2;
-						parse_assert(_options.nesting_block_comments, "Nesting comments (/* /* */ */) forbidden.");
-						nesting += 1;
+
+			if (write_postfix) {
+				write_postfix_comments(indent, config.comments().postfix);
+			}
+
+			maybe_flush();
+		}
+
+		/// Writes an array or object, from its opening to its closing bracket.
+		void write_container(unsigned indent, const Config& config)
+		{
+			if (config.is_array()) {
+				if (config.array_size() == 0 && !has_pre_end_brace_comments(config)) {
+					if (_compact) {
+						_out += "[]";
+					} else {
+						_out += "[ ]";
 					}
-					else if (_ptr[0]=='*' && _ptr[1]=='/') {
-						_ptr += 2;
-						nesting -= 1;
+				} else if (_compact || is_simple_array(config)) {
+					_out.push_back('[');
+					if (!_compact) {
+						_out.push_back(' ');
 					}
-					else if (_ptr[0] == '\n') {
-						_ptr += 1;
-						_line_nr += 1;
-						_line_start = _ptr;
+					const size_t size = config.array_size();
+					write_items(config, size, [&](Writer& w, size_t i) {
+						w.write_array_item(indent, config, i, size, false);
+					});
+					write_pre_brace_comments(indent + 1, config.comments().pre_end_brace);
+					_out += "]";
+				} else {
+					_out += "[\n";
+					const size_t size = config.array_size();
+					write_items(config, size, [&](Writer& w, size_t i) {
+						w.write_array_item(indent, config, i, size, true);
+					});
+					write_pre_brace_comments(indent + 1, config.comments().pre_end_brace);
+					write_indent(indent);
+					_out += "]";
+				}
+			} else {
+				if (config.object_size() == 0 && !has_pre_end_brace_comments(config)) {
+					if (_compact) {
+						_out += "{}";
+					} else {
+						_out += "{ }";
+					}
+				} else {
+					if (_compact) {
+						_out.push_back('{');
 					} else {
-						_ptr += 1;
+						_out += "{\n";
 					}
-				} while (nesting > 0);
-				if (out_comments) { out_comments->emplace_back(state.ptr, _ptr - state.ptr); }
-				out_indentation = -1;
-				if (break_on_newline) { return true; }
-			}
-			else {
-				break;
+					write_object_contents(indent + 1, config);
+					write_indent(indent);
+					_out.push_back('}');
+				}
 			}
 		}
 
-		if (start_ptr == _ptr) {
-			out_indentation = -1;
-			return false;
-		} else {
-			return true;
+	#if CONFIGURU_VALUE_SEMANTICS && CONFIGURU_DUMP_CACHE
+		/// What `config` was last written as, if it is an array or object which remembers that.
+		static ContentCache::DumpEntry_SP remembered_dump(const Config& config)
+		{
+			const ContentCache* cache = config.content_cache();
+			return cache ? cache->dump() : nullptr;
 		}
-	}
 
-	/*
-	The top-level can be any value, OR the innerds of an object:
-	foo = 1
-	"bar": 2
-	*/
-	Config Parser::top_level()
-	{
-		bool is_object = false;
+		/// Comments handed out by the non-const Config::comments() could be changed at any time.
+		static bool has_lent_comments(const Config& config)
+		{
+			return config._comments && config._comments->_lent.is_set();
+		}
 
-		if (_options.implicit_top_object)
+		/// Like write_container, but reuses what the array or object was written as the last time,
+		/// if that was done the same way and it has not been changed since.
+		/// If not, the output is remembered for the next time, unless it is too big, has an #include in it,
+		/// has something in it which could change without us hearing of it (see _num_unstable),
+		/// or the array or object has comments of its own before the end brace (those aren't part of what is shared
+		/// between copy-on-write copies).
+		/// Only the outermost arrays and objects we remember keep the output, to not remember things twice.
+		void write_container_cached(unsigned indent, const Config& config)
 		{
-			auto state = get_state();
-			skip_white_ignore_comments();
+			const ContentCache& cache = *config.content_cache();
+			const void* doc = _options.allow_macro ? _doc.get() : nullptr;
 
-			if (IDENT_STARTERS[static_cast<uint8_t>(_ptr[0])] && !is_reserved_identifier(_ptr)) {
-				is_object = true;
-			} else if (_ptr[0] == '"' || _ptr[0] == '@') {
-				parse_string();
-				skip_white_ignore_comments();
-				is_object = (_ptr[0] == ':' || _ptr[0] == '=');
+			if (auto entry = cache.dump()) {
+				if (entry->format == _format && entry->doc == doc && entry->indent == indent) {
+					_out += entry->text;
+					return;
+				}
 			}
 
-			set_state(state); // restore
-		}
+			// What we write now may be remembered by us or by a container we are in,
+			// so a later change in here must go all the way up (see ChangeLink::looked_at):
+			cache.looked_at();
+			const size_t num_unstable = _num_unstable;
+			if (!cache.can_remember()) {
+				_num_unstable += 1;
+			}
 
-		Config ret;
-		tag(ret);
+			if ((config.is_array() ? config.array_size() : config.object_size()) == 0 ||
+			    has_pre_end_brace_comments(config) || _num_unstable != num_unstable || has_lent_comments(config)) {
+				write_container(indent, config);
+				return;
+			}
 
-		if (is_object) {
-			parse_object_contents(ret);
-		} else {
-			parse_array_contents(ret);
-			parse_assert(ret.array_size() <= 1 || _options.implicit_top_array, "Multiple values not allowed without enclosing []");
-		}
+			const size_t capture = _captures.size();
+			const size_t num_includes = _num_includes;
+			_captures.push_back(_out.size());
+			write_container(indent, config);
+			const size_t start = _captures[capture];
+			_captures.pop_back();
 
-		skip_post_white(&ret);
+			if (start == NO_CAPTURE || _out.size() - start > DUMP_CACHE_MAX_SIZE ||
+			    _num_includes != num_includes || _num_unstable != num_unstable) {
+				return;
+			}
 
-		parse_assert(_ptr[0] == 0, "Expected EoF");
+			auto entry = std::make_shared<ContentCache::DumpEntry>();
+			entry->format = _format;
+			entry->doc    = doc;
+			entry->indent = indent;
+			entry->text.assign(_out, start, std::string::npos);
+			cache.set_dump(std::move(entry));
 
-		if (!is_object && ret.array_size() == 0) {
-			if (_options.empty_file) {
-				auto empty_object = Config::object();
-				if (ret.has_comments()) {
-					empty_object.comments() = std::move(ret.comments());
+			// Their output is now part of ours:
+			if (config.is_object()) {
+				for (auto&& p : config._u.object->_impl) {
+					if (auto child_cache = p.second._value.content_cache()) { child_cache->forget_dump(); }
 				}
-				return empty_object;
 			} else {
-				throw_error("Empty file");
+				for (auto&& e : config._u.array->_impl) {
+					if (auto child_cache = e.content_cache()) { child_cache->forget_dump(); }
+				}
 			}
 		}
+	#endif
 
-		if (!is_object && ret.array_size() == 1) {
-			// A single value - not an array after all:
-			Config first( std::move(ret[0]) );
-			if (ret.has_comments()) {
-				first.comments().append(std::move(ret.comments()));
+		/// Element `i` of the `size` in `array`, which is `indent` levels in, with what goes around it.
+		void write_array_item(unsigned indent, const Config& array, size_t i, size_t size, bool multiline)
+		{
+			if (multiline) {
+				if (array.array_packing() == Config::ArrayPacking::None) {
+					write_prefix_comments(indent + 1, array._u.array->_impl[i]);
+				}
+				write_indent(indent + 1);
+				write_array_element(indent + 1, array, i);
+				if (_options.array_omit_comma || i + 1 == size) {
+					_out.push_back('\n');
+				} else {
+					_out += ",\n";
+				}
+			} else {
+				write_array_element(indent + 1, array, i);
+				if (_compact) {
+					if (i + 1 < size) {
+						_out.push_back(',');
+					}
+				} else if (_options.array_omit_comma || i + 1 == size) {
+					_out.push_back(' ');
+				} else {
+					_out += ", ";
+				}
 			}
-			return first;
 		}
 
-		return ret;
-	}
+		void write_array_element(unsigned indent, const Config& array, size_t i)
+		{
+			switch (array.array_packing()) {
+				case Config::ArrayPacking::Ints:   write_int(array.as_int_span()[i]);      break;
+				case Config::ArrayPacking::Floats: write_number(array.as_float_span()[i]); break;
+				default:                           write_value(indent, array._u.array->_impl[i], false, true); return;
+			}
+			maybe_flush();
+		}
 
-	void Parser::parse_value(Config& dst, bool* out_did_skip_postwhites)
-	{
-		int line_indentation;
-		skip_pre_white(&dst, line_indentation);
-		tag(dst);
+		void write_object_contents(unsigned indent, const Config& config)
+		{
+			// Write in same order as input:
+			auto&& object = config.as_object()._impl;
 
-		if (line_indentation >= 0 && _indentation - 1 != line_indentation) {
-			throw_indentation_error(_indentation - 1, line_indentation);
+			using ObjIterator = Config::ConfigObjectImpl::const_iterator;
+			const size_t first = _pairs.size(); // Nested objects use _pairs after us.
+
+			size_t longest_key = 0;
+			bool align_values = !_compact && _options.object_align_values;
+
+			for (auto it=object.begin(); it!=object.end(); ++it) {
+				_pairs.push_back(it);
+				if (align_values) {
+					longest_key = (std::max)(longest_key, it->first.size());
+				}
+			}
+
+			// The map is already sorted by key, and often also in the order the keys were added:
+			if (!_options.sort_keys) {
+				const auto by_nr = [](const ObjIterator& a, const ObjIterator& b) {
+					return a->second._nr < b->second._nr;
+				};
+				if (!std::is_sorted(_pairs.begin() + first, _pairs.end(), by_nr)) {
+					std::sort(_pairs.begin() + first, _pairs.end(), by_nr);
+				}
+			}
+
+			const size_t num_pairs = _pairs.size() - first;
+			write_items(config, num_pairs, [&](Writer& w, size_t i) {
+				// Copied out first, since nested objects grow _pairs when w is us:
+				const ObjIterator it = _pairs[first + i];
+				w.write_object_entry(indent, it, i, num_pairs, longest_key);
+			});
+			_pairs.resize(first);
+
+			write_pre_brace_comments(indent, config.comments().pre_end_brace);
 		}
 
-		if (_ptr[0] == '"' || _ptr[0] == '@') {
-			dst = parse_string();
+		/// Entry `i` of the `num_pairs` in an object. Values are aligned after `longest_key` if enabled.
+		void write_object_entry(unsigned indent, Config::ConfigObjectImpl::const_iterator it,
+		                        size_t i, size_t num_pairs, size_t longest_key)
+		{
+			auto&& value = it->second._value;
+			write_prefix_comments(indent, value);
+			write_indent(indent);
+			write_key(it->first);
+			if (_compact) {
+				_out.push_back(':');
+			} else if (_options.omit_colon_before_object && value.is_object() && value.object_size() != 0) {
+				_out.push_back(' ');
+			} else {
+				_out += ": ";
+				if (_options.object_align_values) {
+					for (size_t j=it->first.size(); j<longest_key; ++j) {
+						_out.push_back(' ');
+					}
+				}
+			}
+			write_value(indent, value, false, true);
+			if (_compact) {
+				if (i + 1 < num_pairs) {
+					_out.push_back(',');
+				}
+			} else if (_options.array_omit_comma || i + 1 == num_pairs) {
+				_out.push_back('\n');
+			} else {
+				_out += ",\n";
+			}
 		}
-		else if (_ptr[0] == 'n') {
-			parse_assert(_ptr[1]=='u' && _ptr[2]=='l' && _ptr[3]=='l', "Expected 'null'");
-			parse_assert(!IDENT_CHARS[static_cast<uint8_t>(_ptr[4])], "Expected 'null'");
-			_ptr += 4;
-			dst = nullptr;
+
+		/// Calls write_item(writer, i) for each of the `count` children of `parent`, with `writer` being us,
+		/// unless we have a pool and the children are worth splitting over its threads.
+		/// Then each range of children is written by its own Writer, and the pieces are put together in order,
+		/// so the output is exactly the same either way.
+		/// A split costs a few Writers and a round trip through the pool, so unlike the parallel traversals
+		/// we only split the root and the big arrays and objects, and not everything near the root.
+		template<typename WriteItem>
+		void write_items(const Config& parent, size_t count, const WriteItem& write_item)
+		{
+			const size_t MIN_SPLIT = 1024;
+			if (!_pool || count < 2 || (&parent != _root && count < MIN_SPLIT)) {
+				for (size_t i = 0; i < count; ++i) {
+					write_item(*this, i);
+				}
+				return;
+			}
+
+			std::vector<std::string> pieces(_pool->num_ranges(count));
+		#if CONFIGURU_VALUE_SEMANTICS && CONFIGURU_DUMP_CACHE
+			// What keeps the arrays and objects around a piece from being remembered counts as if we wrote it:
+			std::vector<size_t> piece_includes(pieces.size(), 0);
+			std::vector<size_t> piece_unstable(pieces.size(), 0);
+		#endif
+			_pool->parallel_for_ranges(count, [&](size_t range, size_t begin, size_t end) {
+				Writer w(_options, _doc);
+				w._pool = _pool;
+				w._include_mutex = _include_mutex;
+				w._root = _root;
+				for (size_t i = begin; i < end; ++i) {
+					write_item(w, i);
+				}
+				pieces[range] = std::move(w._out);
+			#if CONFIGURU_VALUE_SEMANTICS && CONFIGURU_DUMP_CACHE
+				piece_includes[range] = w._num_includes;
+				piece_unstable[range] = w._num_unstable;
+			#endif
+			});
+		#if CONFIGURU_VALUE_SEMANTICS && CONFIGURU_DUMP_CACHE
+			for (size_t range = 0; range < pieces.size(); ++range) {
+				_num_includes += piece_includes[range];
+				_num_unstable += piece_unstable[range];
+			}
+		#endif
+
+			for (auto&& piece : pieces) {
+				if (_sink && piece.size() >= _flush_size) {
+					flush_all();
+					_sink->write(piece.data(), piece.size()); // No need to copy it first
+				} else {
+					_out += piece;
+					maybe_flush();
+				}
+				std::string().swap(piece); // Free it as we go
+			}
 		}
-		else if (_ptr[0] == 't') {
-			parse_assert(_ptr[1]=='r' && _ptr[2]=='u' && _ptr[3]=='e', "Expected 'true'");
-			parse_assert(!IDENT_CHARS[static_cast<uint8_t>(_ptr[4])], "Expected 'true'");
-			_ptr += 4;
-			dst = true;
+
+		/// Compact output without comments or includes (like compact JSON) has no use for most of what
+		/// write_value checks for, so then we use write_compact_value instead.
+		/// The output is the same. Dumps that use a pool or cache_output always go through write_value.
+		bool can_write_compact() const
+		{
+			bool plain = _compact && !_options.write_comments && !_options.allow_macro && !_pool;
+		#if CONFIGURU_VALUE_SEMANTICS && CONFIGURU_DUMP_CACHE
+			plain = plain && _format == 0;
+		#endif
+			return plain;
 		}
-		else if (_ptr[0] == 'f') {
-			parse_assert(_ptr[1]=='a' && _ptr[2]=='l' && _ptr[3]=='s' && _ptr[4]=='e', "Expected 'false'");
-			parse_assert(!IDENT_CHARS[static_cast<uint8_t>(_ptr[5])], "Expected 'false'");
-			_ptr += 5;
-			dst = false;
+
+		void write_compact_value(const Config& config)
+		{
+			switch (config.type()) {
+				case Config::Null:   _out += "null";                                  break;
+				case Config::Bool:   _out += (config.as_bool() ? "true" : "false");   break;
+				case Config::Int:    write_int(config.get<int64_t>());                break;
+				case Config::Float:  write_number(config.as_double());                break;
+				case Config::String: write_string(config.as_string());                break;
+				case Config::Array:  write_compact_array(config);                     break;
+				case Config::Object:
+					_out.push_back('{');
+					write_compact_object_contents(config);
+					_out.push_back('}');
+					break;
+				default:
+					if (_options.write_uninitialized) {
+						_out += "UNINITIALIZED";
+					} else {
+						CONFIGURU_ONERROR("Failed to serialize uninitialized Config");
+					}
+			}
+			maybe_flush();
 		}
-		else if (_ptr[0] == '{') {
-			parse_object(dst);
+
+		void write_compact_array(const Config& config)
+		{
+			_out.push_back('[');
+			switch (config.array_packing()) {
+				case Config::ArrayPacking::Ints: {
+					const auto ints = config.as_int_span();
+					for (size_t i = 0; i < ints.size(); ++i) {
+						if (i != 0) { _out.push_back(','); }
+						write_int(ints[i]);
+						maybe_flush();
+					}
+					break;
+				}
+				case Config::ArrayPacking::Floats: {
+					const auto floats = config.as_float_span();
+					for (size_t i = 0; i < floats.size(); ++i) {
+						if (i != 0) { _out.push_back(','); }
+						write_number(floats[i]);
+						maybe_flush();
+					}
+					break;
+				}
+				default: {
+					bool first = true;
+					for (const auto& element : config.as_array()) {
+						if (!first) { _out.push_back(','); }
+						first = false;
+						write_compact_value(element);
+					}
+				}
+			}
+			_out.push_back(']');
 		}
-		else if (_ptr[0] == '[') {
-			parse_array(dst);
+
+		void write_compact_object_contents(const Config& config)
+		{
+			using ObjIterator = Config::ConfigObjectImpl::const_iterator;
+			auto&& object = config.as_object()._impl;
+
+			const auto write_entry = [this](ObjIterator it, bool first) {
+				if (!first) { _out.push_back(','); }
+				write_key(it->first);
+				_out.push_back(':');
+				write_compact_value(it->second._value);
+			};
+
+			const auto by_nr = [](const Config::ConfigObjectImpl::value_type& a, const Config::ConfigObjectImpl::value_type& b) {
+				return a.second._nr < b.second._nr;
+			};
+			if (_options.sort_keys || std::is_sorted(object.begin(), object.end(), by_nr)) {
+				// No need to sort anything:
+				for (auto it = object.begin(); it != object.end(); ++it) {
+					write_entry(it, it == object.begin());
+				}
+				return;
+			}
+
+			const size_t first = _pairs.size(); // Nested objects use _pairs after us.
+			for (auto it = object.begin(); it != object.end(); ++it) {
+				_pairs.push_back(it);
+			}
+			std::sort(_pairs.begin() + first, _pairs.end(), [](const ObjIterator& a, const ObjIterator& b) {
+				return a->second._nr < b->second._nr;
+			});
+			for (size_t i = first; i < _pairs.size(); ++i) {
+				write_entry(_pairs[i], i == first); // Copied, since nested objects grow _pairs
+			}
+			_pairs.resize(first);
 		}
-		else if (_ptr[0] == '#') {
-			parse_macro(dst);
+
+		void write_key(const std::string& str)
+		{
+			if (_options.identifiers_keys && is_identifier(str.c_str())) {
+				_out += str;
+			} else {
+				write_string(str);
+			}
 		}
-		else if (_ptr[0] == '+' || _ptr[0] == '-' || _ptr[0] == '.' || ('0' <= _ptr[0] && _ptr[0] <= '9')) {
-			// Some kind of number:
 
-			if (_ptr[0] == '-' && _ptr[1] == 'i' && _ptr[2]=='n' && _ptr[3]=='f') {
-				parse_assert(!IDENT_CHARS[static_cast<uint8_t>(_ptr[4])], "Expected -inf");
-				parse_assert(_options.inf, "infinity forbidden.");
-				_ptr += 4;
-				dst = -std::numeric_limits<double>::infinity();
+		void write_int(int64_t val)
+		{
+			char temp_buff[24];
+			char* end = temp_buff + sizeof(temp_buff);
+			if (val < 0) {
+				char* start = format_uint(0 - static_cast<uint64_t>(val), end);
+				*--start = '-';
+				_out.append(start, end);
+			} else {
+				_out.append(format_uint(static_cast<uint64_t>(val), end), end);
 			}
-			else if (_ptr[0] == '+' && _ptr[1] == 'i' && _ptr[2]=='n' && _ptr[3]=='f') {
-				parse_assert(!IDENT_CHARS[static_cast<uint8_t>(_ptr[4])], "Expected +inf");
-				parse_assert(_options.inf, "infinity forbidden.");
-				_ptr += 4;
-				dst = std::numeric_limits<double>::infinity();
+		}
+
+		void write_number(double val)
+		{
+			if (_options.distinct_floats && val == 0 && std::signbit(val)) {
+				_out += "-0.0";
+				return;
 			}
-			else if (_ptr[0] == '+' && _ptr[1] == 'N' && _ptr[2]=='a' && _ptr[3]=='N') {
-				parse_assert(!IDENT_CHARS[static_cast<uint8_t>(_ptr[4])], "Expected +NaN");
-				parse_assert(_options.nan, "NaN (Not a Number) forbidden.");
-				_ptr += 4;
-				dst = std::numeric_limits<double>::quiet_NaN();
+
+			// Whole numbers (that fit in a long long) are written as such:
+			if (-9223372036854775808.0 <= val && val < 9223372036854775808.0 &&
+			    static_cast<double>(static_cast<long long>(val)) == val)
+			{
+				write_int(static_cast<long long>(val));
+				if (_options.distinct_floats) {
+					_out += ".0";
+				}
+				return;
+			}
+
+			if (std::isfinite(val)) {
+				char digits[20];
+				int decimal_exponent;
+				int len;
+				int precision;
+
+				const auto as_float = static_cast<float>(val);
+				if (static_cast<double>(as_float) == val) {
+					// It's actually a float, so we only need the digits to get back the float:
+					len = grisu2<float, uint32_t>(digits, decimal_exponent, std::fabs(as_float));
+					if (len > 6) {
+						len = shorten_grisu2(digits, len, decimal_exponent, std::fabs(as_float));
+					}
+					precision = len <= 6 ? 6 : len <= 8 ? 8 : 9;
+				} else {
+					len = grisu2<double, uint64_t>(digits, decimal_exponent, std::fabs(val));
+					if (len > 15) {
+						len = shorten_grisu2(digits, len, decimal_exponent, std::fabs(val));
+					}
+					// The same layout as the shortest of %.1g, %g, %.16g, %.17g that gets us back val:
+					precision = len <= 1 ? 1 : len <= 6 ? 6 : len <= 16 ? 16 : 17;
+				}
+
+				char temp_buff[32];
+				char* out = temp_buff;
+				if (val < 0) { *out++ = '-'; }
+				out = format_like_g(out, digits, len, decimal_exponent, precision);
+				_out.append(temp_buff, out);
+			} else if (val == +std::numeric_limits<double>::infinity()) {
+				if (!_options.inf) {
+					CONFIGURU_ONERROR("Can't encode infinity");
+				}
+				_out += "+inf";
+			} else if (val == -std::numeric_limits<double>::infinity()) {
+				if (!_options.inf) {
+					CONFIGURU_ONERROR("Can't encode negative infinity");
+				}
+				_out += "-inf";
 			} else {
-				parse_finite_number(dst);
+				if (!_options.nan) {
+					CONFIGURU_ONERROR("Can't encode NaN");
+				}
+				_out += "+NaN";
 			}
-		} else {
-			throw_error("Expected value");
 		}
 
-		*out_did_skip_postwhites = skip_post_white(&dst);
-	}
-
-	void Parser::parse_array(Config& array)
-	{
-		auto state = get_state();
-
-		swallow('[');
+		void write_string(const std::string& str)
+		{
+			const size_t LONG_LINE = 240;
 
-		_indentation += 1;
-		parse_array_contents(array);
-		_indentation -= 1;
+			if (!_options.str_python_multiline      ||
+				_options.ensure_ascii               ||
+				str.find('\n') == std::string::npos ||
+				str.length() < LONG_LINE            ||
+				str.find("\"\"\"") != std::string::npos)
+			{
+				write_quoted_string(str);
+			} else {
+				write_verbatim_string(str);
+			}
+		}
 
-		if (_ptr[0] == ']') {
-			_ptr += 1;
-		} else {
-			set_state(state);
-			throw_error("Non-terminated array");
+		void write_hex_digit(unsigned num)
+		{
+			CONFIGURU_ASSERT(num < 16u);
+			if (num < 10u) { _out.push_back(char('0' + num)); }
+			else { _out.push_back(char('a' + num - 10)); }
 		}
-	}
 
-	void Parser::parse_array_contents(Config& array_cfg)
-	{
-		array_cfg.make_array();
-		auto& array_impl = array_cfg.as_array();
+		void write_hex_16(uint16_t n)
+		{
+			write_hex_digit((n >> 12) & 0x0f);
+			write_hex_digit((n >>  8) & 0x0f);
+			write_hex_digit((n >>  4) & 0x0f);
+			write_hex_digit((n >>  0) & 0x0f);
+		}
 
-		Comments next_prefix_comments;
+		void write_unicode_16(uint16_t c)
+		{
+			_out += "\\u";
+			write_hex_16(c);
+		}
 
-		for (;;)
+		void write_quoted_string(const std::string& str)
 		{
-			Config value;
-			if (!next_prefix_comments.empty()) {
-				std::swap(value.comments().prefix, next_prefix_comments);
-			}
-			int line_indentation;
-			skip_pre_white(&value, line_indentation);
+			_out.push_back('"');
 
-			if (_ptr[0] == ']') {
-				if (line_indentation >= 0 && _indentation - 1 != line_indentation) {
-					throw_indentation_error(_indentation - 1, line_indentation);
+			const char* ptr = str.c_str();
+			const char* end = ptr + str.size();
+			while (ptr < end) {
+				// Output large swats of safe characters at once:
+				auto start = ptr;
+				ptr = find_unsafe_character(ptr, end, SAFE_CHARACTERS, _options.ensure_ascii);
+				if (_sink && static_cast<size_t>(ptr - start) >= _flush_size) {
+					flush_all();
+					_sink->write(start, static_cast<size_t>(ptr - start)); // No need to copy it first
+				} else if (start < ptr) {
+					_out.append(start, ptr - start);
+					maybe_flush();
 				}
-				if (value.has_comments()) {
-					array_cfg.comments().pre_end_brace = value.comments().prefix;
+				if (ptr == end) { break; }
+
+				if (static_cast<uint8_t>(*ptr) >= 0x80) {
+					ptr = write_utf8_as_unicode_escape(ptr, end);
+					continue;
 				}
-				break;
+
+				char c = *ptr;
+				++ptr;
+				if (c == '\\') { _out += "\\\\"; }
+				else if (c == '\"') { _out += "\\\""; }
+				//else if (c == '\'') { _out += "\\\'"; }
+				else if (c == '\0') { _out += "\\0";  }
+				else if (c == '\b') { _out += "\\b";  }
+				else if (c == '\f') { _out += "\\f";  }
+				else if (c == '\n') { _out += "\\n";  }
+				else if (c == '\r') { _out += "\\r";  }
+				else if (c == '\t') { _out += "\\t";  }
+				else /*if (0 <= c && c < 0x20)*/ { write_unicode_16(static_cast<uint16_t>(c)); }
 			}
 
-			if (!_ptr[0]) {
-				if (value.has_comments()) {
-					array_cfg.comments().pre_end_brace = value.comments().prefix;
+			_out.push_back('"');
+		}
+
+		/// Writes the UTF-8 encoded character at `ptr` as \uXXXX, or two of them for a surrogate pair.
+		/// Returns the start of the next character.
+		const char* write_utf8_as_unicode_escape(const char* ptr, const char* end)
+		{
+			const auto lead = static_cast<uint8_t>(*ptr);
+			int num_continuation;
+			uint32_t code;
+			if      ((lead & 0xE0) == 0xC0) { num_continuation = 1; code = lead & 0x1F; }
+			else if ((lead & 0xF0) == 0xE0) { num_continuation = 2; code = lead & 0x0F; }
+			else if ((lead & 0xF8) == 0xF0) { num_continuation = 3; code = lead & 0x07; }
+			else {
+				write_unicode_16(0xFFFD);
+				return ptr + 1;
+			}
+
+			if (end - ptr <= num_continuation) {
+				write_unicode_16(0xFFFD);
+				return ptr + 1;
+			}
+			for (int i = 1; i <= num_continuation; ++i) {
+				const auto byte = static_cast<uint8_t>(ptr[i]);
+				if ((byte & 0xC0) != 0x80) {
+					write_unicode_16(0xFFFD);
+					return ptr + 1;
 				}
-				break;
+				code = (code << 6) | (byte & 0x3F);
 			}
 
-			if (line_indentation >= 0 && _indentation != line_indentation) {
-				throw_indentation_error(_indentation, line_indentation);
+			// No overlong encodings, surrogates or too large code points:
+			static const uint32_t MIN_CODE[] = { 0, 0x80, 0x800, 0x10000 };
+			if (code < MIN_CODE[num_continuation] || code > 0x10FFFF || (0xD800 <= code && code <= 0xDFFF)) {
+				write_unicode_16(0xFFFD);
+				return ptr + 1;
 			}
 
-			if (IDENT_STARTERS[static_cast<uint8_t>(_ptr[0])] && !is_reserved_identifier(_ptr)) {
-				throw_error("Found identifier; expected value. Did you mean to use a {object} rather than a [array]?");
+			if (code >= 0x10000) {
+				code -= 0x10000;
+				write_unicode_16(static_cast<uint16_t>(0xD800 + (code >> 10)));
+				write_unicode_16(static_cast<uint16_t>(0xDC00 + (code & 0x3FF)));
+			} else {
+				write_unicode_16(static_cast<uint16_t>(code));
 			}
+			return ptr + 1 + num_continuation;
+		}
 
-			bool has_separator;
-			parse_value(value, &has_separator);
-			int ignore;
-			skip_white(&next_prefix_comments, ignore, false);
+		void write_verbatim_string(const std::string& str)
+		{
+			_out += "\"\"\"";
+			if (_sink) {
+				flush_all();
+				_sink->write(str.data(), str.size()); // No need to copy it first
+			} else {
+				_out += str;
+			}
+			_out += "\"\"\"";
+		}
 
-			auto comma_state = get_state();
-			bool has_comma = _ptr[0] == ',';
+		bool is_simple(const Config& var)
+		{
+			if (var.is_array()  && var.array_size()  > 0) { return false; }
+			if (var.is_object() && var.object_size() > 0) { return false; }
+			if (_options.write_comments && var.has_comments()) { return false; }
+			return true;
+		}
 
-			if (has_comma) {
-				_ptr += 1;
-				skip_post_white(&value);
-				has_separator = true;
+		bool is_all_numbers(const Config& array)
+		{
+			if (array.array_packing() != Config::ArrayPacking::None) {
+				return true;
 			}
+			for (auto& v: array.as_array()) {
+				if (!v.is_number()) {
+					return false;
+				}
+			}
+			return true;
+		}
 
-			array_impl.emplace_back(std::move(value));
-
-			bool is_last_element = !_ptr[0] || _ptr[0] == ']';
+		bool is_simple_array(const Config& array)
+		{
+			if (array.array_size() <= 16 && is_all_numbers(array)) {
+				return true; // E.g., a 4x4 matrix
+			}
 
-			if (is_last_element) {
-				parse_assert(!has_comma || _options.array_trailing_comma,
-					"Trailing comma forbidden.", comma_state);
-			} else {
-				if (_options.array_omit_comma) {
-					parse_assert(has_separator, "Expected a space, newline, comma or ]");
+			if (array.array_size() > 4) { return false; }
+			size_t estimated_width = 0;
+			for (auto& v: array.as_array()) {
+				if (!is_simple(v)) {
+					return false;
+				}
+				if (v.is_string()) {
+					estimated_width += 2 + v.as_string().size();
 				} else {
-					parse_assert(has_comma, "Expected a comma or ]");
+					estimated_width += 5;
 				}
+				estimated_width += 2;
 			}
+			return estimated_width < 60;
 		}
-	}
+	}; // struct Writer
 
-	void Parser::parse_object(Config& object)
+	static void write_config(Writer& w, const Config& config, const FormatOptions& options)
 	{
-		auto state = get_state();
-
-		swallow('{');
+		if (w.can_write_compact()) {
+			if (options.implicit_top_object && config.is_object()) {
+				w.write_compact_object_contents(config);
+			} else {
+				w.write_compact_value(config);
+			}
+		} else if (options.implicit_top_object && config.is_object()) {
+			w.write_object_contents(0, config);
+		} else {
+			w.write_value(0, config, true, true);
 
-		_indentation += 1;
-		parse_object_contents(object);
-		_indentation -= 1;
+			if (options.end_with_newline && !options.compact())
+			{
+				w._out.push_back('\n'); // Good form
+			}
+		}
 
-		if (_ptr[0] == '}') {
-			_ptr += 1;
-		} else {
-			set_state(state);
-			throw_error("Non-terminated object");
+		if (options.mark_accessed)
+		{
+			config.mark_accessed(true);
 		}
 	}
 
-	void Parser::parse_object_contents(Config& object)
+	std::string dump_string(const Config& config, const FormatOptions& options)
 	{
-		object.make_object();
-
-		Comments next_prefix_comments;
+		return Serializer(options).dump(config);
+	}
 
-		for (;;)
-		{
-			Config value;
-			if (!next_prefix_comments.empty()) {
-				std::swap(value.comments().prefix, next_prefix_comments);
-			}
-			int line_indentation;
-			skip_pre_white(&value, line_indentation);
+	std::string dump_string(const Config& config, const FormatOptions& options, ThreadPool& pool)
+	{
+		std::mutex include_mutex;
+		Writer w(options, config.doc());
+		w._pool = &pool;
+		w._include_mutex = &include_mutex;
+		w._root = &config;
+		write_config(w, config, options);
+		return std::move(w._out);
+	}
 
-			if (_ptr[0] == '}') {
-				if (line_indentation >= 0 && _indentation - 1 != line_indentation) {
-					throw_indentation_error(_indentation - 1, line_indentation);
+	/// A guess at how many bytes Writer::write_value will produce for `config`, `depth` levels down.
+	static size_t estimate_dump_size(const Config& config, size_t indent_size, unsigned depth)
+	{
+		const size_t INT_SIZE   = 6;  // Most ints are small
+		const size_t FLOAT_SIZE = 12;
+
+	#if CONFIGURU_VALUE_SEMANTICS && CONFIGURU_DUMP_CACHE
+		if (auto entry = Writer::remembered_dump(config)) {
+			return entry->text.size(); // Probably what we will write again
+		}
+	#endif
+
+		switch (config.type()) {
+			case Config::Null:   return 4;
+			case Config::Bool:   return 5;
+			case Config::Int:    return INT_SIZE;
+			case Config::Float:  return FLOAT_SIZE;
+			case Config::String: return config.as_string().size() + 2;
+			case Config::Array: {
+				const size_t size = config.array_size();
+				switch (config.array_packing()) {
+					case Config::ArrayPacking::Ints:   return 2 + size * (INT_SIZE + 2);
+					case Config::ArrayPacking::Floats: return 2 + size * (FLOAT_SIZE + 2);
+					default: break;
 				}
-				if (value.has_comments()) {
-					object.comments().pre_end_brace = value.comments().prefix;
+				size_t total = 4 + depth * indent_size;
+				for (const auto& e : config.as_array()) {
+					total += estimate_dump_size(e, indent_size, depth + 1) + 2 + (depth + 1) * indent_size;
 				}
-				break;
+				return total;
 			}
-
-			if (!_ptr[0]) {
-				if (value.has_comments()) {
-					object.comments().pre_end_brace = value.comments().prefix;
+			case Config::Object: {
+				size_t total = 4 + depth * indent_size;
+				for (const auto& p : config.as_object()._impl) {
+					total += p.first.size() + 4 + (depth + 1) * indent_size;
+					total += estimate_dump_size(p.second._value, indent_size, depth + 1);
 				}
-				break;
+				return total;
 			}
+			default: return 16;
+		}
+	}
 
-			if (line_indentation >= 0 && _indentation != line_indentation) {
-				throw_indentation_error(_indentation, line_indentation);
-			}
+	Serializer::Serializer(const FormatOptions& options) : _writer(new Writer(options, nullptr)) {}
 
-			auto pre_key_state = get_state();
-			std::string key;
+	Serializer::~Serializer() = default;
 
-			if (IDENT_STARTERS[static_cast<uint8_t>(_ptr[0])] && !is_reserved_identifier(_ptr)) {
-				parse_assert(_options.identifiers_keys, "You need to surround keys with quotes");
-				while (IDENT_CHARS[static_cast<uint8_t>(_ptr[0])]) {
-					key += _ptr[0];
-					_ptr += 1;
-				}
-			}
-			else if (_ptr[0] == '"' || _ptr[0] == '@') {
-				key = parse_string();
-			} else {
-				throw_error("Object key expected (either an identifier or a quoted string), got " + quote(_ptr[0]));
-			}
+	const FormatOptions& Serializer::options() const
+	{
+		return _writer->_options;
+	}
 
-			if (!_options.object_duplicate_keys && object.has_key(key)) {
-				set_state(pre_key_state);
-				throw_error("Duplicate key: \"" + key + "\". Already set at " + object[key].where());
-			}
+	std::string Serializer::dump(const Config& config)
+	{
+		std::string out;
+		dump_into(config, out);
+		return out;
+	}
+
+	void Serializer::dump_into(const Config& config, std::string& out)
+	{
+		out.clear();
+		const size_t estimate = estimate_size(config);
+		if (out.capacity() < estimate) {
+			out.reserve(estimate);
+		}
+
+		// Write straight into `out`:
+		Writer& w = *_writer;
+		w._doc = config.doc();
+		w._pairs.clear(); // In case the last call failed half way
+	#if CONFIGURU_VALUE_SEMANTICS && CONFIGURU_DUMP_CACHE
+		w._captures.clear();
+	#endif
+		std::swap(w._out, out);
+		try {
+			write_config(w, config, w._options);
+		} catch (...) {
+			std::swap(w._out, out);
+			w._doc = nullptr;
+			throw;
+		}
+		std::swap(w._out, out);
+		w._doc = nullptr;
+	}
+
+	size_t Serializer::estimate_size(const Config& config) const
+	{
+		const auto& options = _writer->_options;
+		const size_t indent_size = options.compact() ? 0 : options.indentation.size();
+		return estimate_dump_size(config, indent_size, 0) + 1;
+	}
+
+	// ----------------------------------------------------------------------------------------
+	// PushWriter: what Writer::write_value does, with the values handed to us one at a time.
+
+	struct PushWriter::Impl
+	{
+		/// Arrays of more elements than this never fit on one line (see Writer::is_simple_array).
+		static const size_t MAX_ONE_LINE = 16;
+
+		/// An array or object we are in the middle of.
+		struct Frame
+		{
+			bool     array;
+			bool     implicit;      ///< The top-level object, written without braces.
+			bool     colon_pending; ///< An object after a key, with omit_colon_before_object: is it empty?
+			unsigned indent;        ///< Of the values in it.
+			size_t   count;         ///< Values so far.
+			size_t   longest_key;
+			size_t   key_size;      ///< Of the last key.
+			size_t   pad;           ///< If colon_pending: how far to align the value after the colon.
+
+			// The Writer puts short arrays of simple values on one line. Until we know if this one is,
+			// we write it over several lines, and remember where the first elements are:
+			size_t   start;         ///< Right after the [.
+			bool     all_numbers;
+			bool     all_simple;
+			size_t   width;
+			size_t   element_begin[MAX_ONE_LINE];
+			size_t   element_end[MAX_ONE_LINE];
+		};
+
+		Writer             writer;
+		std::vector<Frame> frames;
+		std::string        one_line; ///< Where the elements of an array are put together on one line.
+		bool               implicit_top = false;
+
+		explicit Impl(const FormatOptions& options) : writer(options, nullptr) {}
+
+		unsigned value_indent() const
+		{
+			return frames.empty() ? 0 : frames.back().indent;
+		}
 
-			bool space_after_key = skip_white_ignore_comments();
+		Frame& push_frame(bool array, unsigned indent, size_t longest_key)
+		{
+			frames.emplace_back();
+			Frame& f = frames.back();
+			f.array = array;
+			f.implicit = false;
+			f.colon_pending = false;
+			f.indent = indent;
+			f.count = 0;
+			f.longest_key = longest_key;
+			f.key_size = 0;
+			f.pad = 0;
+			f.start = writer._out.size();
+			f.all_numbers = true;
+			f.all_simple = true;
+			f.width = 0;
+			return f;
+		}
+
+		size_t pad_after_key(const Frame& object) const
+		{
+			if (!writer._options.object_align_values || object.key_size >= object.longest_key) {
+				return 0;
+			}
+			return object.longest_key - object.key_size;
+		}
 
-			if (_ptr[0] == ':' || (_options.object_separator_equal && _ptr[0] == '=')) {
-				parse_assert(_options.allow_space_before_colon || _ptr[0] != ':' || !space_after_key, "No space allowed before colon");
-				_ptr += 1;
-				skip_white_ignore_comments();
-			} else if (_options.omit_colon_before_object && (_ptr[0] == '{' || _ptr[0] == '#')) {
-				// Ok to omit : in this case
-			} else {
-				if (_options.object_separator_equal && _options.omit_colon_before_object) {
-					throw_error("Expected one of '=', ':', '{' or '#' after object key");
+		/// What goes before a value: the comma and indentation in an array, or the colon after a key.
+		/// Returns true (without writing the colon) if it depends on whether the value, which is an object, is empty.
+		bool begin_value(bool is_object)
+		{
+			if (frames.empty()) { return false; }
+
+			Frame& f = frames.back();
+			std::string& out = writer._out;
+			if (f.array) {
+				if (writer._compact) {
+					if (f.count != 0) {
+						out.push_back(',');
+					}
 				} else {
-					throw_error("Expected : after object key");
+					if (f.count == 0 || writer._options.array_omit_comma) {
+						out.push_back('\n');
+					} else {
+						out += ",\n";
+					}
+					writer.write_indent(f.indent);
+				}
+				if (f.count < MAX_ONE_LINE) {
+					f.element_begin[f.count] = out.size();
 				}
+				f.count += 1;
+			} else if (writer._compact) {
+				out.push_back(':');
+			} else if (is_object && writer._options.omit_colon_before_object) {
+				return true;
+			} else {
+				out += ": ";
+				out.append(pad_after_key(f), ' ');
 			}
+			return false;
+		}
 
-			bool has_separator;
-			parse_value(value, &has_separator);
-			int ignore;
-			skip_white(&next_prefix_comments, ignore, false);
+		/// Notes what the value was, in case we are in an array that may go on one line.
+		void end_value(bool is_number, bool is_simple, size_t width)
+		{
+			if (frames.empty()) { return; }
 
-			auto comma_state = get_state();
-			bool has_comma = _ptr[0] == ',';
+			Frame& f = frames.back();
+			if (!f.array || f.count > MAX_ONE_LINE) { return; }
+			f.element_end[f.count - 1] = writer._out.size();
+			f.all_numbers = f.all_numbers && is_number;
+			f.all_simple = f.all_simple && is_simple;
+			f.width += width + 2;
+		}
+	};
 
-			if (has_comma) {
-				_ptr += 1;
-				skip_post_white(&value);
-				has_separator = true;
-			}
+	PushWriter::PushWriter(const FormatOptions& options) : _impl(new Impl(options)) {}
 
-			object.emplace(std::move(key), std::move(value));
+	PushWriter::~PushWriter() = default;
 
-			bool is_last_element = !_ptr[0] || _ptr[0] == '}';
+	const FormatOptions& PushWriter::options() const
+	{
+		return _impl->writer._options;
+	}
 
-			if (is_last_element) {
-				parse_assert(!has_comma || _options.object_trailing_comma,
-					"Trailing comma forbidden.", comma_state);
-			} else {
-				if (_options.object_omit_comma) {
-					parse_assert(has_separator, "Expected a space, newline, comma or }");
-				} else {
-					parse_assert(has_comma, "Expected a comma or }");
-				}
-			}
-		}
+	void PushWriter::write_null()
+	{
+		_impl->begin_value(false);
+		_impl->writer._out += "null";
+		_impl->end_value(false, true, 5);
 	}
 
-	void Parser::parse_int(Config& out)
+	void PushWriter::write_bool(bool value)
 	{
-		const auto start = _ptr;
-		const auto result = strtoll(start, const_cast<char**>(&_ptr), 10);
-		parse_assert(start < _ptr, "Invalid integer");
-		parse_assert(start[0] != '0' || result == 0, "Integer may not start with a zero");
-		out = result;
+		_impl->begin_value(false);
+		_impl->writer._out += (value ? "true" : "false");
+		_impl->end_value(false, true, 5);
 	}
 
-	void Parser::parse_float(Config& out)
+	void PushWriter::write_int(int64_t value)
 	{
-		const auto start = _ptr;
-		const double result = strtod(start, const_cast<char**>(&_ptr));
-		parse_assert(start < _ptr, "Invalid number");
-		out = result;
+		_impl->begin_value(false);
+		_impl->writer.write_int(value);
+		_impl->end_value(true, true, 5);
 	}
 
-	void Parser::parse_finite_number(Config& out)
+	void PushWriter::write_double(double value)
 	{
-		const auto pre_sign = _ptr;
-		int sign = +1;
+		_impl->begin_value(false);
+		_impl->writer.write_number(value);
+		_impl->end_value(true, true, 5);
+	}
 
-		if (_ptr[0] == '+') {
-			parse_assert(_options.unary_plus, "Prefixing numbers with + is forbidden.");
-			_ptr += 1;
-		}
-		if (_ptr[0] == '-') {
-			_ptr += 1;
-			sign = -1;
-		}
+	void PushWriter::write_string(const std::string& value)
+	{
+		_impl->begin_value(false);
+		_impl->writer.write_string(value);
+		_impl->end_value(false, true, 2 + value.size());
+	}
 
-		parse_assert(_ptr[0] != '+' && _ptr[0] != '-', "Duplicate sign");
+	void PushWriter::begin_array()
+	{
+		Impl& s = *_impl;
+		s.begin_value(false);
+		s.writer._out.push_back('[');
+		s.push_frame(true, s.value_indent() + 1, 0);
+	}
 
-		// Check if it's an integer:
-		if (_ptr[0] == '0' && _ptr[1] == 'x') {
-			parse_assert(_options.hexadecimal_integers, "Hexadecimal numbers forbidden.");
-			_ptr += 2;
-			auto start = _ptr;
-			out = sign * static_cast<int64_t>(strtoull(start, const_cast<char**>(&_ptr), 16));
-			parse_assert(start < _ptr, "Missing hexaxdecimal digits after 0x");
-			return;
+	void PushWriter::end_array()
+	{
+		Impl& s = *_impl;
+		CONFIGURU_ASSERT(!s.frames.empty() && s.frames.back().array);
+		std::string& out = s.writer._out;
+		const Impl::Frame& f = s.frames.back();
+		const size_t count = f.count;
+
+		if (count == 0) {
+			out += (s.writer._compact ? "]" : " ]");
+		} else if (s.writer._compact) {
+			out.push_back(']');
+		} else if ((count <= Impl::MAX_ONE_LINE && f.all_numbers) || (count <= 4 && f.all_simple && f.width < 60)) {
+			s.one_line.clear();
+			for (size_t i = 0; i < count; ++i) {
+				s.one_line.append(out, f.element_begin[i], f.element_end[i] - f.element_begin[i]);
+				s.one_line += (s.writer._options.array_omit_comma || i + 1 == count ? " " : ", ");
+			}
+			out.resize(f.start);
+			out.push_back(' ');
+			out += s.one_line;
+			out.push_back(']');
+		} else {
+			out.push_back('\n');
+			s.writer.write_indent(f.indent - 1);
+			out.push_back(']');
 		}
 
-		if (_ptr[0] == '0' && _ptr[1] == 'b') {
-			parse_assert(_options.binary_integers, "Binary numbers forbidden.");
-			_ptr += 2;
-			auto start = _ptr;
-			out = sign * static_cast<int64_t>(strtoull(start, const_cast<char**>(&_ptr), 2));
-			parse_assert(start < _ptr, "Missing binary digits after 0b");
+		s.frames.pop_back();
+		s.end_value(false, count == 0, 5);
+	}
+
+	void PushWriter::begin_object(size_t longest_key)
+	{
+		Impl& s = *_impl;
+		if (s.frames.empty() && s.writer._options.implicit_top_object) {
+			// Without the braces:
+			s.push_frame(false, 0, longest_key).implicit = true;
+			s.implicit_top = true;
 			return;
 		}
 
-		const char* p = _ptr;
+		const unsigned indent = s.value_indent() + 1;
+		const bool colon_pending = s.begin_value(true);
+		const size_t pad = colon_pending ? s.pad_after_key(s.frames.back()) : 0;
+		if (!colon_pending) {
+			s.writer._out.push_back('{');
+		}
+		Impl::Frame& f = s.push_frame(false, indent, longest_key);
+		f.colon_pending = colon_pending;
+		f.pad = pad;
+	}
 
-		while ('0' <= *p && *p <= '9') {
-			p += 1;
+	void PushWriter::write_key(const std::string& key)
+	{
+		Impl& s = *_impl;
+		CONFIGURU_ASSERT(!s.frames.empty() && !s.frames.back().array);
+		Impl::Frame& f = s.frames.back();
+		std::string& out = s.writer._out;
+
+		if (f.count == 0) {
+			if (f.colon_pending) {
+				out += " {";
+				f.colon_pending = false;
+			}
+			if (!s.writer._compact && !f.implicit) {
+				out.push_back('\n');
+			}
+		} else if (s.writer._compact) {
+			out.push_back(',');
+		} else if (s.writer._options.array_omit_comma) {
+			out.push_back('\n');
+		} else {
+			out += ",\n";
 		}
 
-		if (*p == '.' || *p == 'e' || *p == 'E') {
-			_ptr = pre_sign;
-			return parse_float(out);
+		s.writer.write_indent(f.indent);
+		s.writer.write_key(key);
+		f.key_size = key.size();
+		f.count += 1;
+	}
+
+	void PushWriter::end_object()
+	{
+		Impl& s = *_impl;
+		CONFIGURU_ASSERT(!s.frames.empty() && !s.frames.back().array);
+		std::string& out = s.writer._out;
+		const Impl::Frame& f = s.frames.back();
+		const size_t count = f.count;
+
+		if (f.implicit) {
+			if (count != 0 && !s.writer._compact) {
+				out.push_back('\n');
+			}
+		} else if (count == 0) {
+			if (f.colon_pending) {
+				out += ": ";
+				out.append(f.pad, ' ');
+				out.push_back('{');
+			}
+			out += (s.writer._compact ? "}" : " }");
+		} else if (s.writer._compact) {
+			out.push_back('}');
+		} else {
+			out.push_back('\n');
+			s.writer.write_indent(f.indent - 1);
+			out.push_back('}');
 		}
 
-		// It looks like an integer - but it may be too long to represent as one!
-		const auto MAX_INT_STR = (sign == +1 ? "9223372036854775807" : "9223372036854775808");
+		s.frames.pop_back();
+		s.end_value(false, count == 0, 5);
+	}
 
-		const auto length = p - _ptr;
+	void PushWriter::finish(std::string& out)
+	{
+		Impl& s = *_impl;
+		CONFIGURU_ASSERT(s.frames.empty());
+		const FormatOptions& options = s.writer._options;
+		if (!s.implicit_top && options.end_with_newline && !options.compact()) {
+			s.writer._out.push_back('\n'); // Good form
+		}
+		std::swap(s.writer._out, out);
+		clear();
+	}
 
-		if (length < 19) {
-			_ptr = pre_sign;
-			return parse_int(out);
-		}
+	void PushWriter::clear()
+	{
+		_impl->writer._out.clear();
+		_impl->frames.clear();
+		_impl->implicit_top = false;
+	}
 
-		if (length > 19) {
-			_ptr = pre_sign;
-			return parse_float(out); // Uncommon case optimization
+	static void dump(OutputSink& sink, const Config& config, const FormatOptions& options,
+	                 ThreadPool* pool, size_t buffer_size)
+	{
+		std::mutex include_mutex;
+		Writer w(options, config.doc());
+		w._sink = &sink;
+		w._flush_size = buffer_size;
+		w._out.reserve(buffer_size);
+		if (pool) {
+			w._pool = pool;
+			w._include_mutex = &include_mutex;
+			w._root = &config;
+		}
+		write_config(w, config, options);
+		w.flush();
+	}
+
+	void dump(OutputSink& sink, const Config& config, const FormatOptions& options, size_t buffer_size)
+	{
+		dump(sink, config, options, nullptr, buffer_size);
+	}
+
+	void dump(OutputSink& sink, const Config& config, const FormatOptions& options, ThreadPool& pool,
+	          size_t buffer_size)
+	{
+		dump(sink, config, options, &pool, buffer_size);
+	}
+
+	struct OstreamSink : public OutputSink
+	{
+		std::ostream& _os;
+		explicit OstreamSink(std::ostream& os) : _os(os) {}
+
+		void write(const char* data, size_t size) override
+		{
+			_os.write(data, static_cast<std::streamsize>(size));
+			if (!_os) {
+				CONFIGURU_ONERROR("Failed to write to stream");
+			}
 		}
+	};
 
-		// Compare fast:
-		for (int i = 0; i < 19; ++i)
+	struct FileSink : public OutputSink
+	{
+		FILE*       _fp;
+		const char* _name;
+		FileSink(FILE* fp, const char* name) : _fp(fp), _name(name) {}
+
+		void write(const char* data, size_t size) override
 		{
-			if (_ptr[i] > MAX_INT_STR[i]) {
-				_ptr = pre_sign;
-				return parse_float(out);
+			if (fwrite(data, 1, size, _fp) != size) {
+				CONFIGURU_ONERROR(std::string("Failed to write to '") + _name + "': " + strerror(errno));
 			}
-			if (_ptr[i] < MAX_INT_STR[i]) {
-				_ptr = pre_sign;
-				return parse_int(out);
+		}
+	};
+
+	struct FdSink : public OutputSink
+	{
+		int _fd;
+		explicit FdSink(int fd) : _fd(fd) {}
+
+		void write(const char* data, size_t size) override
+		{
+			while (size > 0) {
+				#ifdef _WIN32
+					const auto num_written = ::_write(_fd, data, static_cast<unsigned>((std::min)(size, size_t(1) << 30)));
+				#else
+					const auto num_written = ::write(_fd, data, size);
+				#endif
+				if (num_written < 0) {
+					if (errno == EINTR) { continue; }
+					CONFIGURU_ONERROR(std::string("Failed to write to file descriptor: ") + strerror(errno));
+				}
+				data += num_written;
+				size -= static_cast<size_t>(num_written);
 			}
 		}
-		_ptr = pre_sign;
-		return parse_int(out); // Exactly max int
+	};
+
+	void dump(std::ostream& os, const Config& config, const FormatOptions& options)
+	{
+		OstreamSink sink(os);
+		dump(sink, config, options);
 	}
 
-	std::string Parser::parse_c_sharp_string()
+	void dump(FILE* fp, const Config& config, const FormatOptions& options)
 	{
-		// C# style verbatim string - everything until the next " except "" which is ":
-		auto state = get_state();
-		parse_assert(_options.str_csharp_verbatim, "C# @-style verbatim strings forbidden.");
-		swallow('@');
-		swallow('"');
+		FileSink sink(fp, "FILE");
+		dump(sink, config, options);
+	}
 
-		std::string str;
+	void dump_fd(int fd, const Config& config, const FormatOptions& options)
+	{
+		FdSink sink(fd);
+		dump(sink, config, options);
+	}
 
-		for (;;) {
-			if (_ptr[0] == 0) {
-				set_state(state);
-				throw_error("Unterminated verbatim string");
-			}
-			else if (_ptr[0] == '\n') {
-				throw_error("Newline in verbatim string");
-			}
-			else if (_ptr[0] == '"' && _ptr[1] == '"') {
-				// Escaped quote
-				_ptr += 2;
-				str.push_back('"');
-			}
-			else if (_ptr[0] == '"') {
-				_ptr += 1;
-				return str;
-			}
-			else {
-				str += _ptr[0];
-				_ptr += 1;
-			}
+	static void dump_file(const std::string& path, const configuru::Config& config, const FormatOptions& options,
+	                      ThreadPool* pool)
+	{
+		auto fp = fopen(path.c_str(), "wb");
+		if (fp == nullptr) {
+			CONFIGURU_ONERROR("Failed to open '" + path + "' for writing: " + strerror(errno));
+		}
+		try {
+			FileSink sink(fp, path.c_str());
+			dump(sink, config, options, pool, 64 * 1024);
+		} catch (...) {
+			fclose(fp);
+			throw;
+		}
+		if (fclose(fp) != 0) {
+			CONFIGURU_ONERROR("Failed to write to '" + path + "': " + strerror(errno));
 		}
 	}
 
-	std::string Parser::parse_string()
+	void dump_file(const std::string& path, const configuru::Config& config, const FormatOptions& options)
 	{
-		if (_ptr[0] == '@') {
-			return parse_c_sharp_string();
-		}
+		dump_file(path, config, options, nullptr);
+	}
 
-		auto state = get_state();
-		parse_assert(_ptr[0] == '"', "Quote (\") expected");
+	void dump_file(const std::string& path, const configuru::Config& config, const FormatOptions& options,
+	               ThreadPool& pool)
+	{
+		dump_file(path, config, options, &pool);
+	}
+} // namespace configuru
 
-		if (_ptr[1] == '"' && _ptr[2] == '"') {
-			// Python style multiline string - everything until the next """:
-			parse_assert(_options.str_python_multiline, "Python \"\"\"-style multiline strings forbidden.");
-			_ptr += 3;
-			const char* start = _ptr;
-			for (;;) {
-				if (_ptr[0]==0 || _ptr[1]==0 || _ptr[2]==0) {
-					set_state(state);
-					throw_error("Unterminated multiline string");
-				}
+// ----------------------------------------------------------------------------
+// 88""Yb 88 88b 88    db    88""Yb Yb  dP
+// 88__dP 88 88Yb88   dPYb   88__dP  YbdP
+// 88""Yb 88 88 Y88  dP__Yb  88"Yb    8P
+// 88oodP 88 88  Y8 dP""""Yb 88  Yb   dP
+
+#include <chrono>
+#include <istream>
+
+#ifndef _WIN32
+	#include <fcntl.h>    // open
+	#include <sys/mman.h> // mmap
+	#include <sys/stat.h> // fstat
+#endif
 
-				if (_ptr[0] == '"' && _ptr[1] == '"' && _ptr[2] == '"' && _ptr[3] != '"') {
-					std::string str(start, _ptr);
-					_ptr += 3;
-					return str;
-				}
+namespace configuru
+{
+	/// Can `value` be written as a 32 bit float and read back exactly?
+	static bool fits_float32(double value)
+	{
+		if (std::isnan(value) || std::isinf(value)) { return true; }
+		if (std::fabs(value) > std::numeric_limits<float>::max()) { return false; }
+		return static_cast<double>(static_cast<float>(value)) == value;
+	}
 
-				if (_ptr[0] == '\n') {
-					_ptr += 1;
-					_line_nr += 1;
-					_line_start = _ptr;
-				} else {
-					_ptr += 1;
-				}
-			}
-		} else {
-			// Normal string
-			_ptr += 1; // Swallow quote
+	/// The walk over a Config and the output buffer, shared by the CBOR and MessagePack writers.
+	/// `Format` writes the individual values: write_null, write_bool, write_int, write_float,
+	/// write_string, write_array_head and write_map_head.
+	template<typename Format>
+	struct BinaryWriter
+	{
+		std::string   _out;
+		OutputSink*   _sink = nullptr;
+		size_t        _flush_size = 0;
 
-			std::string str;
+		/// The entries of the objects we are in the middle of writing, like Writer::_pairs.
+		std::vector<Config::ConfigObjectImpl::const_iterator> _pairs;
 
-			for (;;) {
-				// Handle larges swats of safe characters at once:
-				auto safe_end = _ptr;
-				while (!SPECIAL_CHARACTERS[static_cast<uint8_t>(*safe_end)]) {
-					++safe_end;
-				}
+		void put(uint8_t byte)
+		{
+			_out.push_back(static_cast<char>(byte));
+		}
 
-				if (_ptr != safe_end) {
-					str.append(_ptr, safe_end - _ptr);
-					_ptr = safe_end;
-				}
+		/// Big-endian, as both formats want it.
+		void put_be(uint64_t value, unsigned num_bytes)
+		{
+			char bytes[8];
+			for (unsigned i = 0; i < num_bytes; ++i) {
+				bytes[i] = static_cast<char>(value >> (8 * (num_bytes - 1 - i)));
+			}
+			_out.append(bytes, num_bytes);
+		}
 
-				if (_ptr[0] == 0) {
-					set_state(state);
-					throw_error("Unterminated string");
-				}
-				if (_ptr[0] == '"') {
-					_ptr += 1;
-					return str;
-				}
-				if (_ptr[0] == '\n') {
-					throw_error("Newline in string");
-				}
-				if (_ptr[0] == '\t') {
-					parse_assert(_options.str_allow_tab, "Un-escaped tab not allowed in string");
-				}
+		/// Four bytes if fits_float32(value), else eight.
+		void put_float(double value)
+		{
+			if (fits_float32(value)) {
+				const auto f = static_cast<float>(value);
+				uint32_t bits;
+				memcpy(&bits, &f, sizeof(bits));
+				put_be(bits, 4);
+			} else {
+				uint64_t bits;
+				memcpy(&bits, &value, sizeof(bits));
+				put_be(bits, 8);
+			}
+		}
 
-				if (_ptr[0] == '\\') {
-					// Escape sequence
-					_ptr += 1;
+		void put_bytes(const std::string& str)
+		{
+			if (_sink && str.size() >= _flush_size) {
+				flush();
+				_sink->write(str.data(), str.size()); // No need to copy it first
+			} else {
+				_out += str;
+			}
+		}
 
-					if (_ptr[0] == '"') {
-						str.push_back('"');
-						_ptr += 1;
-					} else if (_ptr[0] == '\\') {
-						str.push_back('\\');
-						_ptr += 1;
-					} else if (_ptr[0] == '/') {
-						str.push_back('/');
-						_ptr += 1;
-					} else if (_ptr[0] == 'b') {
-						str.push_back('\b');
-						_ptr += 1;
-					} else if (_ptr[0] == 'f') {
-						str.push_back('\f');
-						_ptr += 1;
-					} else if (_ptr[0] == 'n') {
-						str.push_back('\n');
-						_ptr += 1;
-					} else if (_ptr[0] == 'r') {
-						str.push_back('\r');
-						_ptr += 1;
-					} else if (_ptr[0] == 't') {
-						str.push_back('\t');
-						_ptr += 1;
-					} else if (_ptr[0] == 'u') {
-						// Four hexadecimal characters
-						_ptr += 1;
-						uint64_t codepoint = parse_hex(4);
+		inline void maybe_flush()
+		{
+			if (_sink && _out.size() >= _flush_size) {
+				flush();
+			}
+		}
 
-						if (0xD800 <= codepoint && codepoint <= 0xDBFF)
-						{
-							// surrogate pair
-							parse_assert(_ptr[0] == '\\' && _ptr[1] == 'u',
-										 "Missing second unicode surrogate.");
-							_ptr += 2;
-							uint64_t codepoint2 = parse_hex(4);
-							parse_assert(0xDC00 <= codepoint2 && codepoint2 <= 0xDFFF, "Invalid second unicode surrogate");
-							codepoint = (codepoint << 10) + codepoint2 - 0x35FDC00;
-						}
+		void flush()
+		{
+			if (_sink && !_out.empty()) {
+				_sink->write(_out.data(), _out.size());
+				_out.clear(); // Keeps the capacity
+			}
+		}
 
-						auto num_bytes_written = encode_utf8(str, codepoint);
-						parse_assert(num_bytes_written > 0, "Bad unicode codepoint");
-					} else if (_ptr[0] == 'U') {
-						// Eight hexadecimal characters
-						parse_assert(_options.str_32bit_unicode, "\\U 32 bit unicodes forbidden.");
-						_ptr += 1;
-						uint64_t unicode = parse_hex(8);
-						auto num_bytes_written = encode_utf8(str, unicode);
-						parse_assert(num_bytes_written > 0, "Bad unicode codepoint");
-					} else {
-						throw_error("Unknown escape character " + quote(_ptr[0]));
+		void write_value(const Config& config)
+		{
+			auto& format = static_cast<Format&>(*this);
+			switch (config.type()) {
+				case Config::Null:   format.write_null();                        break;
+				case Config::Bool:   format.write_bool(config.as_bool());        break;
+				case Config::Int:    format.write_int(config.get<int64_t>());    break;
+				case Config::Float:  format.write_float(config.as_double());     break;
+				case Config::String: format.write_string(config.as_string());    break;
+				case Config::Array:  write_array(config);                        break;
+				case Config::Object: write_object(config);                       break;
+				default:
+					CONFIGURU_ONERROR("Failed to serialize uninitialized Config");
+			}
+			maybe_flush();
+		}
+
+		void write_array(const Config& config)
+		{
+			auto& format = static_cast<Format&>(*this);
+			format.write_array_head(config.array_size());
+			switch (config.array_packing()) {
+				case Config::ArrayPacking::Ints:
+					for (const int64_t value : config.as_int_span()) {
+						format.write_int(value);
+						maybe_flush();
+					}
+					break;
+				case Config::ArrayPacking::Floats:
+					for (const double value : config.as_float_span()) {
+						format.write_float(value);
+						maybe_flush();
+					}
+					break;
+				default:
+					for (const Config& element : config.as_array()) {
+						write_value(element);
 					}
-				} else {
-					str.push_back(_ptr[0]);
-					_ptr += 1;
-				}
 			}
 		}
-	}
 
-	uint64_t Parser::parse_hex(int count)
-	{
-		uint64_t ret = 0;
-		for (int i=0; i<count; ++i) {
-			ret *= 16;
-			char c = _ptr[i];
-			if ('0' <= c && c <= '9') {
-				ret += static_cast<uint64_t>(c - '0');
-			} else if ('a' <= c && c <= 'f') {
-				ret += static_cast<uint64_t>(10 + c - 'a');
-			} else if ('A' <= c && c <= 'F') {
-				ret += static_cast<uint64_t>(10 + c - 'A');
-			} else {
-				throw_error("Expected hexadecimal digit, got " + quote(_ptr[0]));
+		/// The entries are written in the order they were added.
+		void write_object(const Config& config)
+		{
+			using ObjIterator = Config::ConfigObjectImpl::const_iterator;
+			auto& format = static_cast<Format&>(*this);
+			auto&& object = config.as_object()._impl;
+			format.write_map_head(object.size());
+
+			const size_t first = _pairs.size(); // Nested objects use _pairs after us.
+			for (auto it = object.begin(); it != object.end(); ++it) {
+				_pairs.push_back(it);
 			}
+			const auto by_nr = [](const ObjIterator& a, const ObjIterator& b) {
+				return a->second._nr < b->second._nr;
+			};
+			if (!std::is_sorted(_pairs.begin() + first, _pairs.end(), by_nr)) {
+				std::sort(_pairs.begin() + first, _pairs.end(), by_nr);
+			}
+			for (size_t i = first; i < first + object.size(); ++i) {
+				const ObjIterator it = _pairs[i]; // Copied out first, since nested objects grow _pairs
+				format.write_string(it->first);
+				write_value(it->second._value);
+			}
+			_pairs.resize(first);
 		}
-		_ptr += count;
-		return ret;
-	}
+	};
 
-	void Parser::parse_macro(Config& dst)
+	struct CborWriter : public BinaryWriter<CborWriter>
 	{
-		parse_assert(_options.allow_macro, "#macros forbidden.");
+		enum Major : uint8_t { UNSIGNED = 0, NEGATIVE = 1, TEXT = 3, ARRAY = 4, MAP = 5 };
 
-		swallow("#include", "Expected '#include'");
-		skip_white_ignore_comments();
+		/// The initial byte, and the argument in as few bytes as possible.
+		void write_head(Major major, uint64_t argument)
+		{
+			const auto initial = static_cast<uint8_t>(major << 5);
+			if (argument < 24) {
+				put(static_cast<uint8_t>(initial | argument));
+			} else if (argument <= 0xff) {
+				put(initial | 24);
+				put_be(argument, 1);
+			} else if (argument <= 0xffff) {
+				put(initial | 25);
+				put_be(argument, 2);
+			} else if (argument <= 0xffffffff) {
+				put(initial | 26);
+				put_be(argument, 4);
+			} else {
+				put(initial | 27);
+				put_be(argument, 8);
+			}
+		}
 
-		bool absolute;
-		char terminator;
+		void write_null()          { put(0xf6); }
+		void write_bool(bool b)    { put(b ? 0xf5 : 0xf4); }
+		void write_float(double f) { put(fits_float32(f) ? 0xfa : 0xfb); put_float(f); }
 
-		if (_ptr[0] == '"') {
-			absolute = false;
-			terminator = '"';
-		} else if (_ptr[0] == '<') {
-			absolute = true;
-			terminator = '>';
-		} else {
-			throw_error("Expected \" or <");
+		void write_int(int64_t value)
+		{
+			if (value >= 0) {
+				write_head(UNSIGNED, static_cast<uint64_t>(value));
+			} else {
+				write_head(NEGATIVE, ~static_cast<uint64_t>(value)); // -1 - value
+			}
 		}
 
-		auto state = get_state();
-		_ptr += 1;
-		auto start = _ptr;
-		std::string path;
-		for (;;) {
-			if (_ptr[0] == 0) {
-				set_state(state);
-				throw_error("Unterminated include path");
-			} else if (_ptr[0] == terminator) {
-				path = std::string(start, static_cast<size_t>(_ptr - start));
-				_ptr += 1;
-				break;
-			} else if (_ptr[0] == '\n') {
-				throw_error("Newline in string");
+		void write_string(const std::string& str)
+		{
+			write_head(TEXT, str.size());
+			put_bytes(str);
+		}
+
+		void write_array_head(size_t size) { write_head(ARRAY, size); }
+		void write_map_head(size_t size)   { write_head(MAP, size);   }
+	};
+
+	struct MsgpackWriter : public BinaryWriter<MsgpackWriter>
+	{
+		/// The fix-format for sizes up to `max_fix`, else the smallest of the others that fits.
+		/// `format_8` is zero for arrays and maps, which have no such format.
+		void write_size(uint64_t size, unsigned max_fix, uint8_t fix, uint8_t format_8, uint8_t format_16, uint8_t format_32)
+		{
+			if (size <= max_fix) {
+				put(static_cast<uint8_t>(fix | size));
+			} else if (format_8 != 0 && size <= 0xff) {
+				put(format_8);
+				put_be(size, 1);
+			} else if (size <= 0xffff) {
+				put(format_16);
+				put_be(size, 2);
+			} else if (size <= 0xffffffff) {
+				put(format_32);
+				put_be(size, 4);
 			} else {
-				_ptr += 1;
+				CONFIGURU_ONERROR("Too big for MessagePack: " + std::to_string(size) + " bytes or elements");
 			}
 		}
 
-		if (!absolute) {
-			auto my_path = _doc->filename;
-			auto pos = my_path.find_last_of('/');
-			if (pos != std::string::npos) {
-				auto my_dir = my_path.substr(0, pos+1);
-				path = my_dir + path;
+		void write_null()          { put(0xc0); }
+		void write_bool(bool b)    { put(b ? 0xc3 : 0xc2); }
+		void write_float(double f) { put(fits_float32(f) ? 0xca : 0xcb); put_float(f); }
+
+		void write_int(int64_t value)
+		{
+			const auto bits = static_cast<uint64_t>(value); // Two's complement for the negative ones
+			if (value >= 0) {
+				if      (value < 128)        { put(static_cast<uint8_t>(value)); }
+				else if (value <= 0xff)       { put(0xcc); put_be(bits, 1); }
+				else if (value <= 0xffff)     { put(0xcd); put_be(bits, 2); }
+				else if (value <= 0xffffffff) { put(0xce); put_be(bits, 4); }
+				else                          { put(0xcf); put_be(bits, 8); }
+			} else {
+				if      (value >= -32)        { put(static_cast<uint8_t>(bits)); }
+				else if (value >= INT8_MIN)   { put(0xd0); put_be(bits, 1); }
+				else if (value >= INT16_MIN)  { put(0xd1); put_be(bits, 2); }
+				else if (value >= INT32_MIN)  { put(0xd2); put_be(bits, 4); }
+				else                          { put(0xd3); put_be(bits, 8); }
 			}
 		}
 
-		auto it = _info.parsed_files.find(path);
-		if (it == _info.parsed_files.end()) {
-			auto child_doc = std::make_shared<DocInfo>(path);
-			child_doc->includers.emplace_back(_doc, _line_nr);
-			dst = parse_file(path.c_str(), _options, child_doc, _info);
-			_info.parsed_files[path] = dst;
-		} else {
-			auto child_doc = it->second.doc();
-			child_doc->includers.emplace_back(_doc, _line_nr);
-			dst = it->second;
+		void write_string(const std::string& str)
+		{
+			write_size(str.size(), 31, 0xa0, 0xd9, 0xda, 0xdb);
+			put_bytes(str);
 		}
+
+		void write_array_head(size_t size) { write_size(size, 15, 0x90, 0, 0xdc, 0xdd); }
+		void write_map_head(size_t size)   { write_size(size, 15, 0x80, 0, 0xde, 0xdf); }
+	};
+
+	template<typename Format>
+	static std::string dump_binary(const Config& config)
+	{
+		Format w;
+		w.write_value(config);
+		config.mark_accessed(true);
+		return std::move(w._out);
 	}
 
-	// ----------------------------------------------------------------------------------------
+	template<typename Format>
+	static void dump_binary(OutputSink& sink, const Config& config, size_t buffer_size)
+	{
+		Format w;
+		w._sink = &sink;
+		w._flush_size = buffer_size;
+		w._out.reserve(buffer_size);
+		w.write_value(config);
+		w.flush();
+		config.mark_accessed(true);
+	}
 
-	Config parse_string(const char* str, const FormatOptions& options, DocInfo_SP doc, ParseInfo& info)
+	std::string dump_cbor(const Config& config)
 	{
-		Parser p(str, options, doc, info);
-		return p.top_level();
+		return dump_binary<CborWriter>(config);
 	}
 
-	Config parse_string(const char* str, const FormatOptions& options, const char* name)
+	void dump_cbor(OutputSink& sink, const Config& config, size_t buffer_size)
 	{
-		ParseInfo info;
-		return parse_string(str, options, std::make_shared<DocInfo>(name), info);
+		dump_binary<CborWriter>(sink, config, buffer_size);
 	}
 
-	std::string read_text_file(const char* path)
+	std::string dump_msgpack(const Config& config)
 	{
-		FILE* fp = fopen(path, "rb");
-		if (fp == nullptr) {
-			CONFIGURU_ONERROR(std::string("Failed to open '") + path + "' for reading: " + strerror(errno));
+		return dump_binary<MsgpackWriter>(config);
+	}
+
+	void dump_msgpack(OutputSink& sink, const Config& config, size_t buffer_size)
+	{
+		dump_binary<MsgpackWriter>(sink, config, buffer_size);
+	}
+
+	// ------------------------------------------------------------------------
+
+	/// Where the binary parsers read from when parsing from memory.
+	class MemoryInput
+	{
+	public:
+		MemoryInput(const void* data, size_t size)
+			: _start(static_cast<const uint8_t*>(data)), _ptr(_start), _end(_start + size) {}
+
+		size_t offset()    const { return static_cast<size_t>(_ptr - _start); }
+		size_t remaining() const { return static_cast<size_t>(_end - _ptr);   }
+
+		/// The next byte, or -1 at the end.
+		int get() { return _ptr < _end ? *_ptr++ : -1; }
+
+		bool read(void* out, size_t size)
+		{
+			if (size > remaining()) { return false; }
+			memcpy(out, _ptr, size);
+			_ptr += size;
+			return true;
 		}
-		std::string contents;
-		fseek(fp, 0, SEEK_END);
-		const auto size = ftell(fp);
-		if (size < 0) {
-			fclose(fp);
-			CONFIGURU_ONERROR(std::string("Failed to find out size of '") + path + "': " + strerror(errno));
+
+		bool read_append(std::string& out, size_t size)
+		{
+			if (size > remaining()) { return false; }
+			out.append(reinterpret_cast<const char*>(_ptr), size);
+			_ptr += size;
+			return true;
 		}
-		contents.resize(static_cast<size_t>(size));
-		rewind(fp);
-		const auto num_read = fread(&contents[0], 1, contents.size(), fp);
-		fclose(fp);
-		if (num_read != contents.size()) {
-			CONFIGURU_ONERROR(std::string("Failed to read from '") + path + "': " + strerror(errno));
+
+	private:
+		const uint8_t* _start;
+		const uint8_t* _ptr;
+		const uint8_t* _end;
+	};
+
+	/// Where the binary parsers read from when parsing from a stream.
+	/// Reads exactly what it is asked for, so nothing after the value is consumed.
+	class StreamInput
+	{
+	public:
+		explicit StreamInput(std::streambuf* buf) : _buf(buf) {}
+
+		size_t offset() const { return _offset; }
+
+		/// The next byte, or -1 at the end.
+		int get()
+		{
+			using Traits = std::streambuf::traits_type;
+			const auto c = _buf ? _buf->sbumpc() : Traits::eof();
+			if (Traits::eq_int_type(c, Traits::eof())) { return -1; }
+			_offset += 1;
+			return static_cast<uint8_t>(Traits::to_char_type(c));
+		}
+
+		bool read(void* out, size_t size)
+		{
+			if (!_buf) { return size == 0; }
+			const auto num_read = static_cast<size_t>(_buf->sgetn(static_cast<char*>(out), static_cast<std::streamsize>(size)));
+			_offset += num_read;
+			return num_read == size;
+		}
+
+		bool read_append(std::string& out, size_t size)
+		{
+			// In pieces, so a made-up size does not make us allocate more than there is to read:
+			const size_t PIECE_SIZE = 64 * 1024;
+			while (size > 0) {
+				const size_t piece = (std::min)(size, PIECE_SIZE);
+				const size_t old_size = out.size();
+				out.resize(old_size + piece);
+				if (!read(&out[old_size], piece)) { return false; }
+				size -= piece;
+			}
+			return true;
+		}
+
+	private:
+		std::streambuf* _buf;
+		size_t          _offset = 0;
+	};
+
+	/// What the CBOR and MessagePack parsers have in common.
+	template<typename Input>
+	class BinaryParser
+	{
+	public:
+		BinaryParser(Input& input, const char* name) : _in(input), _name(name) {}
+
+	protected:
+		void throw_error(size_t offset, const std::string& msg) const CONFIGURU_NORETURN
+		{
+			throw ParseError(_name, offset, msg);
 		}
-		return contents;
-	}
 
-	Config parse_file(const std::string& path, const FormatOptions& options, DocInfo_SP doc, ParseInfo& info)
-	{
-		// auto file = util::FILEWrapper::read_text_file(path);
-		auto file = read_text_file(path.c_str());
-		return parse_string(file.c_str(), options, doc, info);
-	}
+		uint8_t read_byte()
+		{
+			const int c = _in.get();
+			if (c < 0) { throw_error(_in.offset(), "Unexpected end of data"); }
+			return static_cast<uint8_t>(c);
+		}
 
-	Config parse_file(const std::string& path, const FormatOptions& options)
-	{
-		ParseInfo info;
-		return parse_file(path, options, std::make_shared<DocInfo>(path), info);
-	}
-}
+		uint64_t read_be(unsigned num_bytes)
+		{
+			uint8_t bytes[8];
+			if (!_in.read(bytes, num_bytes)) { throw_error(_in.offset(), "Unexpected end of data"); }
+			uint64_t value = 0;
+			for (unsigned i = 0; i < num_bytes; ++i) {
+				value = (value << 8) | bytes[i];
+			}
+			return value;
+		}
 
-// ----------------------------------------------------------------------------
-// Yb        dP 88""Yb 88 888888 888888 88""Yb
-//  Yb  db  dP  88__dP 88   88   88__   88__dP
-//   YbdPYbdP   88"Yb  88   88   88""   88"Yb
-//    YP  YP    88  Yb 88   88   888888 88  Yb
+		void read_string(std::string& out, uint64_t size)
+		{
+			if (size > std::numeric_limits<size_t>::max() || !_in.read_append(out, static_cast<size_t>(size))) {
+				throw_error(_in.offset(), "Unexpected end of data in a string of " + std::to_string(size) + " bytes");
+			}
+		}
 
-#include <cstdlib>  // strtod
+		double read_float32()
+		{
+			const auto bits = static_cast<uint32_t>(read_be(4));
+			float value;
+			memcpy(&value, &bits, sizeof(value));
+			return value;
+		}
 
-namespace configuru
-{
-	bool is_identifier(const char* p)
-	{
-		if (*p == '_'
-			 || ('a' <= *p && *p <= 'z')
-			 || ('A' <= *p && *p <= 'Z'))
+		double read_float64()
 		{
-			++p;
-			while (*p) {
-				if (*p == '_'
-					 || ('a' <= *p && *p <= 'z')
-					 || ('A' <= *p && *p <= 'Z')
-					 || ('0' <= *p && *p <= '9'))
-				{
-					++p;
-				} else {
-					return false;
-				}
+			const uint64_t bits = read_be(8);
+			double value;
+			memcpy(&value, &bits, sizeof(value));
+			return value;
+		}
+
+		/// `magnitude` for a positive integer, else -1 - `magnitude`.
+		Config make_int(uint64_t magnitude, bool negative, size_t offset) const
+		{
+			if (magnitude > static_cast<uint64_t>(std::numeric_limits<int64_t>::max())) {
+				throw_error(offset, "Integer too large to fit into 64 bits");
 			}
-			return true;
-		} else {
-			return false;
+			const auto i = static_cast<long long>(magnitude);
+			return Config(negative ? -1 - i : i);
 		}
-	}
 
-	bool has_pre_end_brace_comments(const Config& cfg)
-	{
-		return cfg.has_comments() && !cfg.comments().pre_end_brace.empty();
-	}
+		/// Call when entering an array or object, and leave() when done with it.
+		void enter(size_t offset)
+		{
+			if (++_depth > BINARY_MAX_DEPTH) {
+				throw_error(offset, "Arrays and objects nested too deep");
+			}
+		}
 
-	struct Writer
+		void leave() { _depth -= 1; }
+
+		Input&      _in;
+		const char* _name;
+		unsigned    _depth = 0;
+	};
+
+	template<typename Input>
+	class CborParser : public BinaryParser<Input>
 	{
-		std::string   _out;
-		bool          _compact;
-		FormatOptions _options;
-		bool          SAFE_CHARACTERS[256];
-		DocInfo_SP    _doc;
+	public:
+		CborParser(Input& input, const char* name) : BinaryParser<Input>(input, name) {}
 
-		Writer(const FormatOptions& options, DocInfo_SP doc)
-			: _options(options), _doc(std::move(doc))
+		Config parse_value()
 		{
-			_compact = _options.compact();
+			size_t offset = this->_in.offset();
+			const uint8_t initial = read_initial(this->read_byte(), offset);
+			return parse_value(initial, offset);
+		}
 
-			for (int i = 0; i < 256; ++i) {
-				SAFE_CHARACTERS[i] = i >= 0x20;
+	private:
+		static const uint8_t BREAK = 0xff;
+		static const uint8_t TAG   = 6;
+
+		/// Tags say how to interpret the value after them. We just take the value,
+		/// so this skips past any tags starting at `initial`, and returns the initial byte of the value.
+		uint8_t read_initial(uint8_t initial, size_t& offset)
+		{
+			while ((initial >> 5) == TAG) {
+				read_argument(initial, offset);
+				offset = this->_in.offset();
+				initial = this->read_byte();
 			}
+			return initial;
+		}
 
-			SAFE_CHARACTERS[static_cast<uint8_t>('\\')] = false;
-			SAFE_CHARACTERS[static_cast<uint8_t>('\"')] = false;
-			SAFE_CHARACTERS[static_cast<uint8_t>('\0')] = false;
-			SAFE_CHARACTERS[static_cast<uint8_t>('\b')] = false;
-			SAFE_CHARACTERS[static_cast<uint8_t>('\f')] = false;
-			SAFE_CHARACTERS[static_cast<uint8_t>('\n')] = false;
-			SAFE_CHARACTERS[static_cast<uint8_t>('\r')] = false;
-			SAFE_CHARACTERS[static_cast<uint8_t>('\t')] = false;
+		/// The argument for an initial byte which is not for an indefinite length or a float.
+		uint64_t read_argument(uint8_t initial, size_t offset)
+		{
+			const uint8_t info = initial & 0x1f;
+			if (info < 24)  { return info; }
+			if (info == 24) { return this->read_be(1); }
+			if (info == 25) { return this->read_be(2); }
+			if (info == 26) { return this->read_be(4); }
+			if (info == 27) { return this->read_be(8); }
+			this->throw_error(offset, "Unexpected additional information " + std::to_string(info) + " in initial byte");
 		}
 
-		inline void write_indent(unsigned indent)
+		/// A byte string or text string, of either definite or indefinite length.
+		void parse_string(std::string& out, uint8_t initial, size_t offset)
 		{
-			if (_compact) { return; }
-			for (unsigned i=0; i<indent; ++i) {
-				_out += _options.indentation;
+			if ((initial & 0x1f) != 31) {
+				this->read_string(out, read_argument(initial, offset));
+				return;
+			}
+			// Indefinite length: definite-length chunks of the same type until a break.
+			for (;;) {
+				const size_t chunk_offset = this->_in.offset();
+				const uint8_t chunk = this->read_byte();
+				if (chunk == BREAK) { return; }
+				if ((chunk >> 5) != (initial >> 5) || (chunk & 0x1f) == 31) {
+					this->throw_error(chunk_offset, "Bad chunk in an indefinite-length string");
+				}
+				this->read_string(out, read_argument(chunk, chunk_offset));
 			}
 		}
 
-		void write_prefix_comments(unsigned indent, const Comments& comments)
+		static double half_to_double(uint16_t half)
 		{
-			if (!_options.write_comments) { return; }
-			if (!comments.empty()) {
-				_out.push_back('\n');
-				for (auto&& c : comments) {
-					write_indent(indent);
-					_out += c;
-					_out.push_back('\n');
-				}
+			const int exponent = (half >> 10) & 0x1f;
+			const int mantissa = half & 0x3ff;
+			double value;
+			if (exponent == 0) {
+				value = std::ldexp(mantissa, -24);
+			} else if (exponent == 31) {
+				value = mantissa == 0 ? std::numeric_limits<double>::infinity() : std::numeric_limits<double>::quiet_NaN();
+			} else {
+				value = std::ldexp(mantissa + 1024, exponent - 25);
 			}
+			return (half & 0x8000) ? -value : value;
 		}
 
-		void write_prefix_comments(unsigned indent, const Config& cfg)
+		Config parse_array(uint8_t initial, size_t offset)
 		{
-			if (!_options.write_comments) { return; }
-			if (cfg.has_comments()) {
-				write_prefix_comments(indent, cfg.comments().prefix);
+			Config array;
+			array.make_packed_array();
+			if ((initial & 0x1f) == 31) {
+				for (;;) {
+					size_t element_offset = this->_in.offset();
+					const uint8_t element = this->read_byte();
+					if (element == BREAK) { break; }
+					array.push_back(parse_value(read_initial(element, element_offset), element_offset));
+				}
+			} else {
+				// No reserve: the size may be made up, and then we run out of data soon enough.
+				const uint64_t size = read_argument(initial, offset);
+				for (uint64_t i = 0; i < size; ++i) {
+					array.push_back(parse_value());
+				}
 			}
+			return array;
 		}
 
-		void write_postfix_comments(unsigned indent, const Comments& comments)
+		Config parse_object(uint8_t initial, size_t offset)
 		{
-			if (!_options.write_comments) { return; }
-			(void)indent; // TODO: reindent comments
-			for (auto&& c : comments) {
-				_out.push_back(' ');;
-				_out += c;
+			Config object;
+			object.make_object();
+			const bool indefinite = (initial & 0x1f) == 31;
+			const uint64_t size = indefinite ? 0 : read_argument(initial, offset);
+			for (uint64_t i = 0; indefinite || i < size; ++i) {
+				size_t key_offset = this->_in.offset();
+				uint8_t key_initial = this->read_byte();
+				if (indefinite && key_initial == BREAK) { break; }
+				key_initial = read_initial(key_initial, key_offset);
+				if ((key_initial >> 5) != 2 && (key_initial >> 5) != 3) {
+					this->throw_error(key_offset, "Object keys must be strings");
+				}
+				std::string key;
+				parse_string(key, key_initial, key_offset);
+				if (!object.emplace(std::move(key), parse_value())) {
+					this->throw_error(key_offset, "Duplicate key");
+				}
 			}
+			return object;
 		}
 
-		void write_pre_brace_comments(unsigned indent, const Comments& comments)
+		Config parse_value(uint8_t initial, size_t offset)
 		{
-			write_prefix_comments(indent, comments);
+			switch (initial >> 5) {
+				case 0: return this->make_int(read_argument(initial, offset), false, offset);
+				case 1: return this->make_int(read_argument(initial, offset), true,  offset);
+				case 2:
+				case 3: {
+					std::string str;
+					parse_string(str, initial, offset);
+					return Config(std::move(str));
+				}
+				case 4: {
+					this->enter(offset);
+					Config array = parse_array(initial, offset);
+					this->leave();
+					return array;
+				}
+				case 5: {
+					this->enter(offset);
+					Config object = parse_object(initial, offset);
+					this->leave();
+					return object;
+				}
+				default: // 7: floats and simple values. Tags (6) are skipped by read_initial.
+					switch (initial & 0x1f) {
+						case 20: return Config(false);
+						case 21: return Config(true);
+						case 22: // null
+						case 23: // undefined
+							return Config(nullptr);
+						case 25: return Config(half_to_double(static_cast<uint16_t>(this->read_be(2))));
+						case 26: return Config(this->read_float32());
+						case 27: return Config(this->read_float64());
+						case 31: this->throw_error(offset, "Unexpected break");
+						default: this->throw_error(offset, "Unsupported simple value");
+					}
+			}
 		}
+	};
 
-		void write_value(unsigned indent, const Config& config,
-							  bool write_prefix, bool write_postfix)
+	template<typename Input>
+	class MsgpackParser : public BinaryParser<Input>
+	{
+	public:
+		MsgpackParser(Input& input, const char* name) : BinaryParser<Input>(input, name) {}
+
+		Config parse_value()
 		{
-			if (_options.allow_macro && config.doc() && config.doc() != _doc) {
-				dump_file(config.doc()->filename, config, _options);
-				_out += "#include <";
-				_out += config.doc()->filename;
-				_out.push_back('>');
-				return;
+			const size_t offset = this->_in.offset();
+			const uint8_t type = this->read_byte();
+
+			if (type <= 0x7f) { return Config(static_cast<long long>(type)); }
+			if (type >= 0xe0) { return Config(static_cast<long long>(type) - 0x100); }
+			if (type <= 0x8f) { return parse_object(type & 0x0f, offset); }
+			if (type <= 0x9f) { return parse_array(type & 0x0f, offset); }
+			if (type <= 0xbf) { return parse_string(type & 0x1f); }
+
+			switch (type) {
+				case 0xc0: return Config(nullptr);
+				case 0xc2: return Config(false);
+				case 0xc3: return Config(true);
+				case 0xc4: return parse_string(this->read_be(1)); // bin
+				case 0xc5: return parse_string(this->read_be(2));
+				case 0xc6: return parse_string(this->read_be(4));
+				case 0xca: return Config(this->read_float32());
+				case 0xcb: return Config(this->read_float64());
+				case 0xcc: return this->make_int(this->read_be(1), false, offset);
+				case 0xcd: return this->make_int(this->read_be(2), false, offset);
+				case 0xce: return this->make_int(this->read_be(4), false, offset);
+				case 0xcf: return this->make_int(this->read_be(8), false, offset);
+				case 0xd0: return Config(static_cast<long long>(static_cast<int8_t> (this->read_be(1))));
+				case 0xd1: return Config(static_cast<long long>(static_cast<int16_t>(this->read_be(2))));
+				case 0xd2: return Config(static_cast<long long>(static_cast<int32_t>(this->read_be(4))));
+				case 0xd3: return Config(static_cast<long long>(static_cast<int64_t>(this->read_be(8))));
+				case 0xd9: return parse_string(this->read_be(1));
+				case 0xda: return parse_string(this->read_be(2));
+				case 0xdb: return parse_string(this->read_be(4));
+				case 0xdc: return parse_array(this->read_be(2), offset);
+				case 0xdd: return parse_array(this->read_be(4), offset);
+				case 0xde: return parse_object(this->read_be(2), offset);
+				case 0xdf: return parse_object(this->read_be(4), offset);
+				case 0xc1: this->throw_error(offset, "Reserved type byte 0xc1");
+				default:   this->throw_error(offset, "Extension types are not supported");
 			}
+		}
 
-			if (write_prefix) {
-				write_prefix_comments(indent, config);
+	private:
+		Config parse_string(uint64_t size)
+		{
+			std::string str;
+			this->read_string(str, size);
+			return Config(std::move(str));
+		}
+
+		Config parse_array(uint64_t size, size_t offset)
+		{
+			this->enter(offset);
+			Config array;
+			array.make_packed_array();
+			// No reserve: the size may be made up, and then we run out of data soon enough.
+			for (uint64_t i = 0; i < size; ++i) {
+				array.push_back(parse_value());
 			}
+			this->leave();
+			return array;
+		}
 
-			if (config.is_null()) {
-				_out += "null";
-			} else if (config.is_bool()) {
-				_out += (config.as_bool() ? "true" : "false");
-			} else if (config.is_int()) {
-				char temp_buff[64];
-				snprintf(temp_buff, sizeof(temp_buff), "%lld", static_cast<long long>(config));
-				_out += temp_buff;
-			} else if (config.is_float()) {
-				write_number( config.as_double() );
-			} else if (config.is_string()) {
-				write_string(config.as_string());
-			} else if (config.is_array()) {
-				if (config.array_size() == 0 && !has_pre_end_brace_comments(config)) {
-					if (_compact) {
-						_out += "[]";
-					} else {
-						_out += "[ ]";
-					}
-				} else if (_compact || is_simple_array(config)) {
-					_out.push_back('[');
-					if (!_compact) {
-						_out.push_back(' ');
-					}
-					auto&& array = config.as_array();
-					for (size_t i = 0; i < array.size(); ++i) {
-						write_value(indent + 1, array[i], false, true);
-						if (_compact) {
-							if (i + 1 < array.size()) {
-								_out.push_back(',');
-							}
-						} else if (_options.array_omit_comma || i + 1 == array.size()) {
-							_out.push_back(' ');
-						} else {
-							_out += ", ";
-						}
-					}
-					write_pre_brace_comments(indent + 1, config.comments().pre_end_brace);
-					_out += "]";
-				} else {
-					_out += "[\n";
-					auto&& array = config.as_array();
-					for (size_t i = 0; i < array.size(); ++i) {
-						write_prefix_comments(indent + 1, array[i]);
-						write_indent(indent + 1);
-						write_value(indent + 1, array[i], false, true);
-						if (_options.array_omit_comma || i + 1 == array.size()) {
-							_out.push_back('\n');
-						} else {
-							_out += ",\n";
-						}
-					}
-					write_pre_brace_comments(indent + 1, config.comments().pre_end_brace);
-					write_indent(indent);
-					_out += "]";
+		Config parse_object(uint64_t size, size_t offset)
+		{
+			this->enter(offset);
+			Config object;
+			object.make_object();
+			for (uint64_t i = 0; i < size; ++i) {
+				const size_t key_offset = this->_in.offset();
+				Config key = parse_value();
+				if (!key.is_string()) {
+					this->throw_error(key_offset, "Object keys must be strings");
 				}
-			} else if (config.is_object()) {
-				if (config.object_size() == 0 && !has_pre_end_brace_comments(config)) {
-					if (_compact) {
-						_out += "{}";
-					} else {
-						_out += "{ }";
-					}
-				} else {
-					if (_compact) {
-						_out.push_back('{');
-					} else {
-						_out += "{\n";
-					}
-					write_object_contents(indent + 1, config);
-					write_indent(indent);
-					_out.push_back('}');
+				if (!object.emplace(key.as_string(), parse_value())) {
+					this->throw_error(key_offset, "Duplicate key");
 				}
-			} else {
-				if (_options.write_uninitialized) {
-					_out += "UNINITIALIZED";
-				} else {
-					CONFIGURU_ONERROR("Failed to serialize uninitialized Config");
+			}
+			this->leave();
+			return object;
+		}
+	};
+
+	template<typename Parser>
+	static Config parse_binary(const void* data, size_t size, const char* name)
+	{
+		MemoryInput input(data, size);
+		Config config = Parser(input, name).parse_value();
+		if (input.remaining() != 0) {
+			throw ParseError(name, input.offset(), "Expected end of data after the value");
+		}
+		return config;
+	}
+
+	Config parse_cbor(const void* data, size_t size, const char* name)
+	{
+		return parse_binary<CborParser<MemoryInput>>(data, size, name);
+	}
+
+	Config parse_cbor(std::istream& is, const char* name)
+	{
+		StreamInput input(is.rdbuf());
+		return CborParser<StreamInput>(input, name).parse_value();
+	}
+
+	Config parse_msgpack(const void* data, size_t size, const char* name)
+	{
+		return parse_binary<MsgpackParser<MemoryInput>>(data, size, name);
+	}
+
+	Config parse_msgpack(std::istream& is, const char* name)
+	{
+		StreamInput input(is.rdbuf());
+		return MsgpackParser<StreamInput>(input, name).parse_value();
+	}
+
+	// ------------------------------------------------------------------------
+	// Snapshots
+
+	struct SnapshotHeader
+	{
+		char     magic[8];     ///< SNAPSHOT_MAGIC
+		uint32_t version;      ///< SNAPSHOT_VERSION
+		uint32_t byte_order;   ///< SNAPSHOT_BYTE_ORDER, as written by the machine that wrote the file
+		uint64_t num_nodes;
+		uint64_t num_keys;
+		uint64_t num_ints;
+		uint64_t num_floats;
+		uint64_t strings_size;
+		uint64_t reserved;
+	};
+
+	static_assert(sizeof(SnapshotHeader) == 64, "Snapshot layout changed");
+	static_assert(sizeof(FrozenNode) == 16 && sizeof(FrozenKey) == 16, "Snapshot layout changed");
+
+	static const char     SNAPSHOT_MAGIC[8]   = {'C', 'F', 'G', 'S', 'N', 'A', 'P', '\0'};
+	static const uint32_t SNAPSHOT_BYTE_ORDER = 0x01020304;
+
+	/// Pads the strings, so that the next snapshot in a stream of them starts aligned.
+	static size_t snapshot_padding(size_t strings_size)
+	{
+		return (8 - strings_size % 8) % 8;
+	}
+
+	void dump_snapshot(OutputSink& sink, const FrozenConfig& frozen)
+	{
+		const FrozenTables& tables = frozen.tables();
+
+		SnapshotHeader header;
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+		header.version      = SNAPSHOT_VERSION;
+		header.byte_order   = SNAPSHOT_BYTE_ORDER;
+		header.num_nodes    = tables.num_nodes;
+		header.num_keys     = tables.num_keys;
+		header.num_ints     = tables.num_ints;
+		header.num_floats   = tables.num_floats;
+		header.strings_size = tables.strings_size;
+
+		const auto write = [&](const void* data, size_t size) {
+			if (size != 0) { sink.write(static_cast<const char*>(data), size); }
+		};
+		write(&header,        sizeof(header));
+		write(tables.nodes,   tables.num_nodes  * sizeof(FrozenNode));
+		write(tables.keys,    tables.num_keys   * sizeof(FrozenKey));
+		write(tables.ints,    tables.num_ints   * sizeof(int64_t));
+		write(tables.floats,  tables.num_floats * sizeof(double));
+		write(tables.strings, tables.strings_size);
+		const char zeros[8] = {};
+		write(zeros, snapshot_padding(tables.strings_size));
+	}
+
+	std::string dump_snapshot(const FrozenConfig& frozen)
+	{
+		struct StringSink : public OutputSink
+		{
+			std::string out;
+			void write(const char* data, size_t size) override { out.append(data, size); }
+		};
+		StringSink sink;
+		dump_snapshot(sink, frozen);
+		return std::move(sink.out);
+	}
+
+	void dump_snapshot_file(const std::string& path, const FrozenConfig& frozen)
+	{
+		auto fp = fopen(path.c_str(), "wb");
+		if (fp == nullptr) {
+			CONFIGURU_ONERROR("Failed to open '" + path + "' for writing: " + strerror(errno));
+		}
+		try {
+			FileSink sink(fp, path.c_str());
+			dump_snapshot(sink, frozen);
+		} catch (...) {
+			fclose(fp);
+			throw;
+		}
+		if (fclose(fp) != 0) {
+			CONFIGURU_ONERROR("Failed to write to '" + path + "': " + strerror(errno));
+		}
+	}
+
+	/// Checks a snapshot and finds its tables. Reports the first problem found.
+	class SnapshotReader
+	{
+	public:
+		size_t      error_offset = 0;
+		std::string error;
+
+		/// Only checks the header and the size if `check_tables` is false.
+		bool read(const void* data, size_t size, bool check_tables, FrozenTables& tables)
+		{
+			_data = static_cast<const char*>(data);
+			if (reinterpret_cast<uintptr_t>(data) % 8 != 0) {
+				return fail(0, "Snapshot memory is not 8 byte aligned");
+			}
+			SnapshotHeader header;
+			if (size < sizeof(header)) { return fail(0, "Too small to be a snapshot"); }
+			memcpy(&header, data, sizeof(header));
+			if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0) {
+				return fail(0, "Not a snapshot");
+			}
+			if (header.byte_order != SNAPSHOT_BYTE_ORDER) {
+				return fail(12, "Snapshot was written on a machine with a different byte order");
+			}
+			if (header.version != SNAPSHOT_VERSION) {
+				return fail(8, "Snapshot version " + std::to_string(header.version) +
+				               ", expected " + std::to_string(SNAPSHOT_VERSION));
+			}
+			if (header.num_nodes == 0) { return fail(16, "Snapshot without a root node"); }
+
+			// Each table must fit in what is left, which also keeps the multiplications from overflowing:
+			size_t offset = sizeof(header);
+			size_t offsets[5];
+			const uint64_t counts[5] = {header.num_nodes, header.num_keys, header.num_ints, header.num_floats, header.strings_size};
+			const size_t   sizes[5]  = {sizeof(FrozenNode), sizeof(FrozenKey), sizeof(int64_t), sizeof(double), 1};
+			for (int i = 0; i < 5; ++i) {
+				if (counts[i] > (size - offset) / sizes[i]) {
+					return fail(16 + 8 * i, "Snapshot is truncated");
 				}
+				offsets[i] = offset;
+				offset += static_cast<size_t>(counts[i]) * sizes[i];
 			}
-
-			if (write_postfix) {
-				write_postfix_comments(indent, config.comments().postfix);
+			if (size - offset != snapshot_padding(static_cast<size_t>(header.strings_size))) {
+				return fail(offset, "Unexpected size of snapshot");
 			}
+
+			tables.nodes        = reinterpret_cast<const FrozenNode*>(_data + offsets[0]);
+			tables.keys         = reinterpret_cast<const FrozenKey*>(_data + offsets[1]);
+			tables.ints         = reinterpret_cast<const int64_t*>(_data + offsets[2]);
+			tables.floats       = reinterpret_cast<const double*>(_data + offsets[3]);
+			tables.strings      = _data + offsets[4];
+			tables.num_nodes    = static_cast<size_t>(header.num_nodes);
+			tables.num_keys     = static_cast<size_t>(header.num_keys);
+			tables.num_ints     = static_cast<size_t>(header.num_ints);
+			tables.num_floats   = static_cast<size_t>(header.num_floats);
+			tables.strings_size = static_cast<size_t>(header.strings_size);
+
+			return !check_tables || check_nodes(tables);
 		}
 
-		void write_object_contents(unsigned indent, const Config& config)
-		{
-			// Write in same order as input:
-			auto&& object = config.as_object()._impl;
+	private:
+		const char* _data = nullptr;
 
-			using ObjIterator = Config::ConfigObjectImpl::const_iterator;
-			std::vector<ObjIterator> pairs;
-			pairs.reserve(object.size());
+		bool fail(size_t offset, const std::string& msg)
+		{
+			error_offset = offset;
+			error = msg;
+			return false;
+		}
 
-			size_t longest_key = 0;
-			bool align_values = !_compact && _options.object_align_values;
+		size_t offset_of(const void* ptr) const
+		{
+			return static_cast<size_t>(static_cast<const char*>(ptr) - _data);
+		}
 
-			for (auto it=object.begin(); it!=object.end(); ++it) {
-				pairs.push_back(it);
-				if (align_values) {
-					longest_key = (std::max)(longest_key, it->first.size());
-				}
-			}
+		static bool in_range(uint64_t first, uint64_t count, size_t table_size)
+		{
+			return first <= table_size && count <= table_size - first;
+		}
 
-			if (_options.sort_keys) {
-				std::sort(begin(pairs), end(pairs), [](const ObjIterator& a, const ObjIterator& b) {
-					return a->first < b->first;
-				});
-			} else {
-				std::sort(begin(pairs), end(pairs), [](const ObjIterator& a, const ObjIterator& b) {
-					return a->second._nr < b->second._nr;
-				});
-			}
+		/// A zero-terminated string of `size` bytes at `offset` into the strings table.
+		static bool valid_string(const FrozenTables& tables, uint64_t offset, uint32_t size)
+		{
+			return in_range(offset, uint64_t(size) + 1, tables.strings_size) && tables.strings[offset + size] == '\0';
+		}
 
-			size_t i = 0;
-			for (auto&& it : pairs) {
-				auto&& value = it->second._value;
-				write_prefix_comments(indent, value);
-				write_indent(indent);
-				write_key(it->first);
-				if (_compact) {
-					_out.push_back(':');
-				} else if (_options.omit_colon_before_object && value.is_object() && value.object_size() != 0) {
-					_out.push_back(' ');
-				} else {
-					_out += ": ";
-					if (align_values) {
-						for (size_t j=it->first.size(); j<longest_key; ++j) {
-							_out.push_back(' ');
+		/// Everything FrozenValue relies on: no reads outside of the tables, and sorted keys for find().
+		/// Children come after their parent (as freeze() puts them), so there can be no cycles.
+		/// Every node but the root is the child of exactly one array or object, so thawing can't blow up,
+		/// and they are nested no deeper than BINARY_MAX_DEPTH, so it can't overflow the stack.
+		bool check_nodes(const FrozenTables& tables)
+		{
+			std::vector<uint16_t> depths(tables.num_nodes, 0); // Zero until we have seen the parent.
+			depths[0] = 1;
+			for (size_t ix = 0; ix < tables.num_nodes; ++ix) {
+				const FrozenNode& node = tables.nodes[ix];
+				if (depths[ix] == 0) {
+					return fail(offset_of(&node), "Node is not in any array or object");
+				}
+				switch (node.type) {
+					case Config::Uninitialized:
+					case Config::Null:
+					case Config::Int:
+					case Config::Float:
+						break;
+					case Config::Bool: {
+						uint8_t b;
+						memcpy(&b, &node.u.b, 1);
+						if (b > 1) { return fail(offset_of(&node), "Bad bool"); }
+						break;
+					}
+					case Config::String:
+						if (!valid_string(tables, node.u.offset, node.size)) {
+							return fail(offset_of(&node), "String out of range");
 						}
+						break;
+					case Config::Array: {
+						const auto packing = node.packing;
+						const bool ok =
+							packing == uint8_t(Config::ArrayPacking::Ints)   ? in_range(node.u.offset, node.size, tables.num_ints)   :
+							packing == uint8_t(Config::ArrayPacking::Floats) ? in_range(node.u.offset, node.size, tables.num_floats) :
+							packing == uint8_t(Config::ArrayPacking::None)   && node.u.children.first > ix &&
+							                                                    in_range(node.u.children.first, node.size, tables.num_nodes);
+						if (!ok) { return fail(offset_of(&node), "Array elements out of range"); }
+						break;
 					}
+					case Config::Object:
+						if (node.u.children.first <= ix ||
+						    !in_range(node.u.children.first, node.size, tables.num_nodes) ||
+						    !in_range(node.u.children.first_key, node.size, tables.num_keys)) {
+							return fail(offset_of(&node), "Object entries out of range");
+						}
+						break;
+					default:
+						return fail(offset_of(&node), "Bad node type " + std::to_string(node.type));
 				}
-				write_value(indent, value, false, true);
-				if (_compact) {
-					if (i + 1 < pairs.size()) {
-						_out.push_back(',');
-					}
-				} else if (_options.array_omit_comma || i + 1 == pairs.size()) {
-					_out.push_back('\n');
-				} else {
-					_out += ",\n";
+				if (node.type == Config::Object && !check_keys(tables, node)) {
+					return false;
+				}
+				const bool has_child_nodes = node.type == Config::Object ||
+					(node.type == Config::Array && node.packing == uint8_t(Config::ArrayPacking::None));
+				if (has_child_nodes && !claim_children(node, depths[ix], depths)) {
+					return false;
 				}
-				i += 1;
 			}
-
-			write_pre_brace_comments(indent, config.comments().pre_end_brace);
+			return true;
 		}
 
-		void write_key(const std::string& str)
+		/// Sets the depth of the children of `parent`, which is at `depth`.
+		bool claim_children(const FrozenNode& parent, unsigned depth, std::vector<uint16_t>& depths)
 		{
-			if (_options.identifiers_keys && is_identifier(str.c_str())) {
-				_out += str;
-			} else {
-				write_string(str);
+			if (parent.size == 0) { return true; }
+			if (depth > BINARY_MAX_DEPTH) {
+				return fail(offset_of(&parent), "Too deeply nested");
+			}
+			for (uint32_t i = 0; i < parent.size; ++i) {
+				const size_t child = parent.u.children.first + i;
+				if (depths[child] != 0) {
+					return fail(offset_of(&parent), "Node is in more than one array or object");
+				}
+				depths[child] = static_cast<uint16_t>(depth + 1);
 			}
+			return true;
 		}
 
-		void write_number(double val)
+		bool check_keys(const FrozenTables& tables, const FrozenNode& object)
 		{
-			if (_options.distinct_floats && val == 0 && std::signbit(val)) {
-				_out += "-0.0";
-				return;
-			}
-
-			const auto as_int = static_cast<long long>(val);
-			if (static_cast<double>(as_int) == val) {
-				char temp_buff[64];
-				snprintf(temp_buff, sizeof(temp_buff), "%lld", as_int);
-				_out += temp_buff;
-				if (_options.distinct_floats) {
-					_out += ".0";
+			const FrozenKey* keys = tables.keys + object.u.children.first_key;
+			for (uint32_t i = 0; i < object.size; ++i) {
+				if (!valid_string(tables, keys[i].offset, keys[i].size)) {
+					return fail(offset_of(&keys[i]), "Key out of range");
+				}
+				if (i > 0) {
+					const FrozenKey& prev = keys[i - 1];
+					const size_t common = (std::min)(prev.size, keys[i].size);
+					const int cmp = memcmp(tables.strings + prev.offset, tables.strings + keys[i].offset, common);
+					if (cmp > 0 || (cmp == 0 && prev.size >= keys[i].size)) {
+						return fail(offset_of(&keys[i]), "Keys not sorted");
+					}
 				}
-				return;
 			}
+			return true;
+		}
+	};
 
-			if (std::isfinite(val)) {
-				char temp_buff[64];
+	bool validate_snapshot(const void* data, size_t size, std::string* error)
+	{
+		SnapshotReader reader;
+		FrozenTables tables;
+		if (reader.read(data, size, true, tables)) { return true; }
+		if (error) {
+			*error = "byte " + std::to_string(reader.error_offset) + ": " + reader.error;
+		}
+		return false;
+	}
 
-				const auto as_float = static_cast<float>(val);
-				if (static_cast<double>(as_float) == val) {
-					// It's actually a float!
-					snprintf(temp_buff, sizeof(temp_buff), "%g", as_float);
-					if (std::strtof(temp_buff, nullptr) == as_float) {
+	static FrozenConfig view_snapshot(const void* data, size_t size, const std::string& name,
+	                                  SnapshotCheck check, std::shared_ptr<const void> mapping)
+	{
+		auto storage = std::make_shared<FrozenConfig::Storage>();
+		SnapshotReader reader;
+		if (!reader.read(data, size, check == SnapshotCheck::Validate, storage->tables)) {
+			throw ParseError(name, reader.error_offset, reader.error);
+		}
+		storage->mapping = std::move(mapping);
+		return FrozenConfig(std::move(storage));
+	}
 
-						_out += temp_buff;
-					} else {
-						snprintf(temp_buff, sizeof(temp_buff), "%.8g", as_float);
-						_out += temp_buff;
-					}
-					return;
-				}
+	FrozenConfig view_snapshot(const void* data, size_t size, const char* name, SnapshotCheck check)
+	{
+		return view_snapshot(data, size, name, check, nullptr);
+	}
 
-				// Try single digit of precision (for denormals):
-				snprintf(temp_buff, sizeof(temp_buff), "%.1g", val);
-				if (std::strtod(temp_buff, nullptr) == val) {
-					_out += temp_buff;
-					return;
-				}
+	/// The contents of the file at `path`, mapped into memory (or read into aligned memory where we can't map).
+	/// Returns nullptr and sets `error` on failure.
+	static std::shared_ptr<const void> map_file(const std::string& path, size_t& size, std::string& error)
+	{
+		#ifdef _WIN32
+			auto fp = fopen(path.c_str(), "rb");
+			if (fp == nullptr) {
+				error = "Failed to open '" + path + "' for reading: " + strerror(errno);
+				return nullptr;
+			}
+			fseek(fp, 0, SEEK_END);
+			const auto end = ftell(fp);
+			fseek(fp, 0, SEEK_SET);
+			size = end < 0 ? 0 : static_cast<size_t>(end);
+			auto memory = std::make_shared<std::vector<uint64_t>>(size / 8 + 1);
+			const bool ok = end >= 0 && fread(memory->data(), 1, size, fp) == size;
+			fclose(fp);
+			if (!ok) {
+				error = "Failed to read '" + path + "'";
+				return nullptr;
+			}
+			return std::shared_ptr<const void>(memory, memory->data());
+		#else
+			const int fd = ::open(path.c_str(), O_RDONLY);
+			if (fd < 0) {
+				error = "Failed to open '" + path + "' for reading: " + strerror(errno);
+				return nullptr;
+			}
+			struct stat st;
+			if (fstat(fd, &st) != 0) {
+				error = "Failed to stat '" + path + "': " + strerror(errno);
+				::close(fd);
+				return nullptr;
+			}
+			size = static_cast<size_t>(st.st_size);
+			if (size == 0) {
+				::close(fd);
+				static const uint64_t s_empty = 0;
+				return std::shared_ptr<const void>(&s_empty, [](const void*) {});
+			}
+			void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+			const int map_errno = errno;
+			::close(fd); // The mapping stays valid without it
+			if (data == MAP_FAILED) {
+				error = "Failed to map '" + path + "': " + strerror(map_errno);
+				return nullptr;
+			}
+			const size_t mapped_size = size;
+			return std::shared_ptr<const void>(data, [mapped_size](const void* ptr) {
+				munmap(const_cast<void*>(ptr), mapped_size);
+			});
+		#endif
+	}
 
-				// Try default digits of precision:
-				snprintf(temp_buff, sizeof(temp_buff), "%g", val);
-				if (std::strtod(temp_buff, nullptr) == val) {
-					_out += temp_buff;
-					return;
-				}
+	FrozenConfig map_snapshot_file(const std::string& path, SnapshotCheck check)
+	{
+		size_t size = 0;
+		std::string error;
+		auto mapping = map_file(path, size, error);
+		if (!mapping) {
+			CONFIGURU_ONERROR(error);
+		}
+		const void* data = mapping.get();
+		return view_snapshot(data, size, path, check, std::move(mapping));
+	}
 
-				// Try 16 digits of precision:
-				snprintf(temp_buff, sizeof(temp_buff), "%.16g", val);
-				if (std::strtod(temp_buff, nullptr) == val) {
-					_out += temp_buff;
-					return;
-				}
+	// ------------------------------------------------------------------------
+	// Parse cache: "<path>.cache" holds what parsing <path> gave, as a snapshot.
+	// Before it is the file list: the size and hash of every file read when parsing,
+	// so we know when the cache is stale. After it are the ParseCacheNotes.
 
-				// Nope, full 17 digits needed:
-				snprintf(temp_buff, sizeof(temp_buff), "%.17g", val);
-				_out += temp_buff;
-			} else if (val == +std::numeric_limits<double>::infinity()) {
-				if (!_options.inf) {
-					CONFIGURU_ONERROR("Can't encode infinity");
-				}
-				_out += "+inf";
-			} else if (val == -std::numeric_limits<double>::infinity()) {
-				if (!_options.inf) {
-					CONFIGURU_ONERROR("Can't encode negative infinity");
-				}
-				_out += "-inf";
-			} else {
-				if (!_options.nan) {
-					CONFIGURU_ONERROR("Can't encode NaN");
-				}
-				_out += "+NaN";
-			}
-		}
+	struct ParseCacheHeader
+	{
+		char     magic[8];        ///< PARSE_CACHE_MAGIC
+		uint32_t version;         ///< PARSE_CACHE_VERSION
+		uint32_t num_files;
+		uint64_t options_hash;    ///< hash_parse_options
+		uint64_t snapshot_offset; ///< After the file list. 8 byte aligned.
+		uint64_t notes_offset;    ///< After the snapshot.
+	};
 
-		void write_string(const std::string& str)
+	/// Followed by the path, padded to a multiple of 8 bytes.
+	struct ParseCacheFile
+	{
+		uint64_t size;
+		uint64_t hash;
+		uint64_t path_size;
+	};
+
+	static const char     PARSE_CACHE_MAGIC[8]  = {'C', 'F', 'G', 'C', 'A', 'C', 'H', 'E'};
+	static const uint32_t PARSE_CACHE_VERSION   = 2;
+
+	/// What a snapshot leaves out of a parsed Config: the file and line each value came from, and its comments.
+	/// So that a Config loaded from the cache is the same as a parsed one, down to where() and how it is dumped
+	/// (with its comments, and its #includes as #includes).
+	/// First come the documents, each after the ones that #include it, and then the notes of every value,
+	/// in the order thaw() makes them. The values of a packed array are not Configs, so they have no notes.
+	struct ParseCacheNotes
+	{
+		static const uint32_t NO_DOC = static_cast<uint32_t>(-1);
+
+		std::map<const DocInfo*, uint32_t> doc_ixs;
+		std::string                        docs;
+		std::string                        values;
+
+		static void put(std::string& out, uint32_t value)
 		{
-			const size_t LONG_LINE = 240;
+			out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+		}
 
-			if (!_options.str_python_multiline      ||
-				str.find('\n') == std::string::npos ||
-				str.length() < LONG_LINE            ||
-				str.find("\"\"\"") != std::string::npos)
-			{
-				write_quoted_string(str);
-			} else {
-				write_verbatim_string(str);
-			}
+		static void put(std::string& out, const std::string& str)
+		{
+			put(out, static_cast<uint32_t>(str.size()));
+			out += str;
 		}
 
-		void write_hex_digit(unsigned num)
+		static void put(std::string& out, const Comments& comments)
 		{
-			CONFIGURU_ASSERT(num < 16u);
-			if (num < 10u) { _out.push_back(char('0' + num)); }
-			else { _out.push_back(char('a' + num - 10)); }
+			put(out, static_cast<uint32_t>(comments.size()));
+			for (auto&& comment : comments) { put(out, comment); }
 		}
 
-		void write_hex_16(uint16_t n)
+		uint32_t doc_ix(const DocInfo_SP& doc)
 		{
-			write_hex_digit((n >> 12) & 0x0f);
-			write_hex_digit((n >>  8) & 0x0f);
-			write_hex_digit((n >>  4) & 0x0f);
-			write_hex_digit((n >>  0) & 0x0f);
+			if (!doc) { return NO_DOC; }
+			auto it = doc_ixs.find(doc.get());
+			if (it != doc_ixs.end()) { return it->second; }
+
+			std::string includers;
+			put(includers, static_cast<uint32_t>(doc->includers.size()));
+			for (auto&& includer : doc->includers) {
+				put(includers, doc_ix(includer.doc));
+				put(includers, includer.line);
+			}
+			const auto ix = static_cast<uint32_t>(doc_ixs.size());
+			doc_ixs[doc.get()] = ix;
+			put(docs, doc->filename);
+			docs += includers;
+			return ix;
 		}
 
-		void write_unicode_16(uint16_t c)
+		void add(const Config& config)
 		{
-			_out += "\\u";
-			write_hex_16(c);
+			put(values, doc_ix(config.doc()));
+			put(values, config.line());
+			const ConfigComments& comments = config.comments();
+			put(values, comments.prefix);
+			put(values, comments.postfix);
+			put(values, comments.pre_end_brace);
+
+			if (config.is_array() && config.array_packing() == Config::ArrayPacking::None) {
+				for (auto&& element : config._u.array->_impl) { add(element); }
+			} else if (config.is_object()) {
+				for (auto&& p : config._u.object->_impl) { add(p.second._value); }
+			}
 		}
 
-		void write_quoted_string(const std::string& str)
+		static std::string of(const Config& config)
 		{
-			_out.push_back('"');
+			ParseCacheNotes notes;
+			notes.add(config);
+			std::string out;
+			put(out, static_cast<uint32_t>(notes.doc_ixs.size()));
+			return out + notes.docs + notes.values;
+		}
 
-			const char* ptr = str.c_str();
-			const char* end = ptr + str.size();
-			while (ptr < end) {
-				// Output large swats of safe characters at once:
-				auto start = ptr;
-				while (SAFE_CHARACTERS[static_cast<uint8_t>(*ptr)]) {
-					++ptr;
-				}
-				if (start < ptr) {
-					_out.append(start, ptr - start);
-				}
-				if (ptr == end) { break; }
+		// ----------------------------------------
+		// Reading them back. Everything returns false if the notes are damaged.
 
-				char c = *ptr;
-				++ptr;
-				if (c == '\\') { _out += "\\\\"; }
-				else if (c == '\"') { _out += "\\\""; }
-				//else if (c == '\'') { _out += "\\\'"; }
-				else if (c == '\0') { _out += "\\0";  }
-				else if (c == '\b') { _out += "\\b";  }
-				else if (c == '\f') { _out += "\\f";  }
-				else if (c == '\n') { _out += "\\n";  }
-				else if (c == '\r') { _out += "\\r";  }
-				else if (c == '\t') { _out += "\\t";  }
-				else /*if (0 <= c && c < 0x20)*/ { write_unicode_16(static_cast<uint16_t>(c)); }
-			}
+		const char*             _ptr;
+		const char*             _end;
+		std::vector<DocInfo_SP> _docs;
 
-			_out.push_back('"');
+		bool get(uint32_t& value)
+		{
+			if (static_cast<size_t>(_end - _ptr) < sizeof(value)) { return false; }
+			memcpy(&value, _ptr, sizeof(value));
+			_ptr += sizeof(value);
+			return true;
 		}
 
-		void write_verbatim_string(const std::string& str)
+		bool get(std::string& str)
 		{
-			_out += "\"\"\"";
-			_out += str;
-			_out += "\"\"\"";
+			uint32_t size;
+			if (!get(size) || static_cast<size_t>(_end - _ptr) < size) { return false; }
+			str.assign(_ptr, size);
+			_ptr += size;
+			return true;
 		}
 
-		bool is_simple(const Config& var)
+		bool get(Comments& comments)
 		{
-			if (var.is_array()  && var.array_size()  > 0) { return false; }
-			if (var.is_object() && var.object_size() > 0) { return false; }
-			if (_options.write_comments && var.has_comments()) { return false; }
+			uint32_t count;
+			if (!get(count) || static_cast<size_t>(_end - _ptr) / sizeof(uint32_t) < count) { return false; }
+			comments.resize(count);
+			for (auto&& comment : comments) {
+				if (!get(comment)) { return false; }
+			}
 			return true;
 		}
 
-		bool is_all_numbers(const Config& array)
+		/// The first document is the file we parsed, which is `root_doc`.
+		bool get_docs(const DocInfo_SP& root_doc)
 		{
-			for (auto& v: array.as_array()) {
-				if (!v.is_number()) {
-					return false;
+			uint32_t num_docs;
+			if (!get(num_docs)) { return false; }
+			for (uint32_t i = 0; i < num_docs; ++i) {
+				std::string filename;
+				uint32_t num_includers;
+				if (!get(filename) || !get(num_includers)) { return false; }
+				auto doc = i == 0 ? root_doc : std::make_shared<DocInfo>(filename);
+				for (uint32_t j = 0; j < num_includers; ++j) {
+					uint32_t includer, line;
+					if (!get(includer) || !get(line) || includer >= i) { return false; }
+					doc->includers.emplace_back(_docs[includer], line);
 				}
+				_docs.push_back(std::move(doc));
 			}
 			return true;
 		}
 
-		bool is_simple_array(const Config& array)
+		bool apply(Config& config)
 		{
-			if (array.array_size() <= 16 && is_all_numbers(array)) {
-				return true; // E.g., a 4x4 matrix
+			uint32_t doc, line;
+			if (!get(doc) || !get(line) || (doc != NO_DOC && doc >= _docs.size())) { return false; }
+			config.tag(doc == NO_DOC ? nullptr : _docs[doc], line, BAD_INDEX);
+
+			ConfigComments comments;
+			if (!get(comments.prefix) || !get(comments.postfix) || !get(comments.pre_end_brace)) { return false; }
+			if (!comments.empty()) {
+				config.parsed_comments() = std::move(comments);
 			}
 
-			if (array.array_size() > 4) { return false; }
-			size_t estimated_width = 0;
-			for (auto& v: array.as_array()) {
-				if (!is_simple(v)) {
-					return false;
+			if (config.is_array() && config.array_packing() == Config::ArrayPacking::None) {
+				for (auto&& element : config._u.array->_impl) {
+					if (!apply(element)) { return false; }
 				}
-				if (v.is_string()) {
-					estimated_width += 2 + v.as_string().size();
-				} else {
-					estimated_width += 5;
+			} else if (config.is_object()) {
+				for (auto&& p : config._u.object->_impl) {
+					if (!apply(p.second._value)) { return false; }
 				}
-				estimated_width += 2;
 			}
-			return estimated_width < 60;
+			return true;
 		}
-	}; // struct Writer
 
-	std::string dump_string(const Config& config, const FormatOptions& options)
+		static bool apply(const char* data, size_t size, const DocInfo_SP& root_doc, Config& config)
+		{
+			ParseCacheNotes notes;
+			notes._ptr = data;
+			notes._end = data + size;
+			return notes.get_docs(root_doc) && notes.apply(config) && notes._ptr == notes._end;
+		}
+	};
+
+	/// The options which change what parsing gives.
+	static uint64_t hash_parse_options(const FormatOptions& o)
 	{
-		Writer w(options, config.doc());
+		const bool flags[] = {
+			o.enforce_indentation, o.empty_file, o.implicit_top_object, o.implicit_top_array,
+			o.single_line_comments, o.block_comments, o.nesting_block_comments,
+			o.inf, o.nan, o.hexadecimal_integers, o.binary_integers, o.unary_plus, o.distinct_floats,
+			o.array_omit_comma, o.array_trailing_comma,
+			o.identifiers_keys, o.object_separator_equal, o.allow_space_before_colon, o.omit_colon_before_object,
+			o.object_omit_comma, o.object_trailing_comma, o.object_duplicate_keys,
+			o.str_csharp_verbatim, o.str_python_multiline, o.str_32bit_unicode, o.str_allow_tab,
+			o.allow_macro,
+		};
+		std::string key = o.indentation;
+		key.push_back('\0');
+		for (const bool flag : flags) {
+			key.push_back(flag ? '1' : '0');
+		}
+		return hash_bytes(key.data(), key.size());
+	}
 
-		if (options.implicit_top_object && config.is_object()) {
-			w.write_object_contents(0, config);
-		} else {
-			w.write_value(0, config, true, true);
+	/// Like read_text_file, but returns false instead of reporting errors.
+	static bool try_read_file(const std::string& path, std::string& contents)
+	{
+		FILE* fp = fopen(path.c_str(), "rb");
+		if (fp == nullptr) { return false; }
+		const bool ok = fseek(fp, 0, SEEK_END) == 0 && ftell(fp) >= 0;
+		if (ok) {
+			contents.resize(static_cast<size_t>(ftell(fp)));
+			rewind(fp);
+		}
+		const bool read_all = ok && fread(&contents[0], 1, contents.size(), fp) == contents.size();
+		fclose(fp);
+		return read_all;
+	}
 
-			if (options.end_with_newline && !options.compact())
-			{
-				w._out.push_back('\n'); // Good form
-			}
+	/// Returns false if there is no cache, or it is stale or damaged, for parsing `path` (with `text`).
+	static bool load_parse_cache(const std::string& cache_path, const FormatOptions& options,
+	                             const std::string& path, const std::string& text,
+	                             const DocInfo_SP& doc, Config& config)
+	{
+		size_t size = 0;
+		std::string error;
+		const auto mapping = map_file(cache_path, size, error);
+		if (!mapping) { return false; }
+		const char* data = static_cast<const char*>(mapping.get());
+
+		ParseCacheHeader header;
+		if (size < sizeof(header)) { return false; }
+		memcpy(&header, data, sizeof(header));
+		if (memcmp(header.magic, PARSE_CACHE_MAGIC, sizeof(header.magic)) != 0 ||
+		    header.version != PARSE_CACHE_VERSION ||
+		    header.options_hash != hash_parse_options(options) ||
+		    header.snapshot_offset > header.notes_offset || header.notes_offset > size ||
+		    header.snapshot_offset % 8 != 0) {
+			return false;
 		}
 
-		if (options.mark_accessed)
-		{
-			config.mark_accessed(true);
+		size_t offset = sizeof(header);
+		std::string contents;
+		for (uint32_t i = 0; i < header.num_files; ++i) {
+			ParseCacheFile file;
+			if (header.snapshot_offset - offset < sizeof(file)) { return false; }
+			memcpy(&file, data + offset, sizeof(file));
+			offset += sizeof(file);
+			if (file.path_size > header.snapshot_offset - offset) { return false; }
+			const std::string file_path(data + offset, static_cast<size_t>(file.path_size));
+			offset += static_cast<size_t>((file.path_size + 7) / 8 * 8);
+
+			const std::string* file_contents = &text;
+			if (file_path != path) {
+				if (!try_read_file(file_path, contents)) { return false; }
+				file_contents = &contents;
+			}
+			const FileStamp stamp = stamp_of(*file_contents);
+			if (stamp.size != file.size || stamp.hash != file.hash) { return false; }
+		}
+
+		try {
+			const size_t snapshot_size = static_cast<size_t>(header.notes_offset - header.snapshot_offset);
+			const FrozenConfig frozen = view_snapshot(data + header.snapshot_offset, snapshot_size,
+			                                          cache_path, SnapshotCheck::Validate, mapping);
+			config = frozen.thaw();
+		} catch (const ParseError&) {
+			return false;
 		}
-		return std::move(w._out);
+		return ParseCacheNotes::apply(data + header.notes_offset, size - static_cast<size_t>(header.notes_offset),
+		                              doc, config);
 	}
 
-	static void write_text_file(const char* path, const std::string& data)
+	/// Writes to a temporary file which is then renamed, so readers never see half a cache.
+	/// Failing to write the cache is not an error: we just parse again next time.
+	static void save_parse_cache(const std::string& cache_path, const FormatOptions& options,
+	                             const std::map<std::string, FileStamp>& files, const Config& config)
 	{
-		auto fp = fopen(path, "wb");
-		if (fp == nullptr) {
-			CONFIGURU_ONERROR(std::string("Failed to open '") + path + "' for writing: " + strerror(errno));
+		std::string head(sizeof(ParseCacheHeader), '\0');
+		for (auto&& p : files) {
+			ParseCacheFile file;
+			file.size      = p.second.size;
+			file.hash      = p.second.hash;
+			file.path_size = p.first.size();
+			head.append(reinterpret_cast<const char*>(&file), sizeof(file));
+			head += p.first;
+			head.resize((head.size() + 7) / 8 * 8, '\0');
+		}
+
+		ParseCacheHeader header;
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, PARSE_CACHE_MAGIC, sizeof(header.magic));
+		header.version         = PARSE_CACHE_VERSION;
+		header.num_files       = static_cast<uint32_t>(files.size());
+		header.options_hash    = hash_parse_options(options);
+		header.snapshot_offset = head.size();
+		memcpy(&head[0], &header, sizeof(header));
+
+		const auto unique = std::hash<std::thread::id>()(std::this_thread::get_id()) ^
+		                    static_cast<size_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+		const std::string temp_path = cache_path + ".tmp" + std::to_string(unique);
+		FILE* fp = fopen(temp_path.c_str(), "wb");
+		if (fp == nullptr) { return; }
+		bool ok = fwrite(head.data(), 1, head.size(), fp) == head.size();
+		if (ok) {
+			try {
+				FileSink sink(fp, temp_path.c_str());
+				dump_snapshot(sink, config.freeze());
+			} catch (const std::exception&) {
+				ok = false;
+			}
+		}
+		// Now that we know where the snapshot ends:
+		const long notes_offset = ok ? ftell(fp) : -1;
+		if (notes_offset >= 0) {
+			const std::string notes = ParseCacheNotes::of(config);
+			header.notes_offset = static_cast<uint64_t>(notes_offset);
+			ok = fwrite(notes.data(), 1, notes.size(), fp) == notes.size() &&
+			     fseek(fp, 0, SEEK_SET) == 0 &&
+			     fwrite(&header, 1, sizeof(header), fp) == sizeof(header);
+		} else {
+			ok = false;
 		}
-		auto num_bytes_written = fwrite(data.data(), 1, data.size(), fp);
-		fclose(fp);
-		if (num_bytes_written != data.size()) {
-			CONFIGURU_ONERROR(std::string("Failed to write to '") + path + "': " + strerror(errno));
+		ok = fclose(fp) == 0 && ok;
+		if (ok && std::rename(temp_path.c_str(), cache_path.c_str()) != 0) {
+			// Windows won't rename over an existing file:
+			std::remove(cache_path.c_str());
+			ok = std::rename(temp_path.c_str(), cache_path.c_str()) == 0;
+		}
+		if (!ok) {
+			std::remove(temp_path.c_str());
 		}
 	}
 
-	void dump_file(const std::string& path, const configuru::Config& config, const FormatOptions& options)
+	static Config parse_file_cached(const std::string& path, const FormatOptions& options)
 	{
-		auto str = dump_string(config, options);
-		write_text_file(path.c_str(), str);
+		const std::string text = read_text_file(path.c_str());
+		const std::string cache_path = path + ".cache";
+		auto doc = std::make_shared<DocInfo>(path);
+
+		Config config;
+		if (load_parse_cache(cache_path, options, path, text, doc, config)) {
+			return config;
+		}
+
+		ParseInfo info;
+		info.read_files[path] = stamp_of(text);
+		config = parse_string(text.c_str(), options, doc, info);
+		save_parse_cache(cache_path, options, info.read_files, config);
+		return config;
 	}
 } // namespace configuru
 
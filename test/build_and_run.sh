@@ -31,4 +31,28 @@ cmake -DCMAKE_BUILD_TYPE="Debug" -DCONFIGURU_VALUE_SEMANTICS="OFF" -DCONFIGURU_I
 make
 ./configuru_test $@
 
+echo "Testing CONFIGURU_VALUE_SEMANTICS=ON + CONFIGURU_COPY_ON_WRITE=ON + CONFIGURU_HASH_CACHE=ON"
+rm -rf *
+cmake -DCMAKE_BUILD_TYPE="Debug" -DCONFIGURU_VALUE_SEMANTICS="ON" -DCONFIGURU_IMPLICIT_CONVERSIONS="OFF" -DCONFIGURU_COPY_ON_WRITE="ON" -DCONFIGURU_HASH_CACHE="ON" ..
+make
+./configuru_test $@
+
+echo "Testing CONFIGURU_VALUE_SEMANTICS=ON + CONFIGURU_HASH_CACHE=ON"
+rm -rf *
+cmake -DCMAKE_BUILD_TYPE="Debug" -DCONFIGURU_VALUE_SEMANTICS="ON" -DCONFIGURU_IMPLICIT_CONVERSIONS="ON" -DCONFIGURU_HASH_CACHE="ON" ..
+make
+./configuru_test $@
+
+echo "Testing CONFIGURU_VALUE_SEMANTICS=ON + CONFIGURU_DUMP_CACHE=ON"
+rm -rf *
+cmake -DCMAKE_BUILD_TYPE="Debug" -DCONFIGURU_VALUE_SEMANTICS="ON" -DCONFIGURU_IMPLICIT_CONVERSIONS="ON" -DCONFIGURU_DUMP_CACHE="ON" ..
+make
+./configuru_test $@
+
+echo "Testing CONFIGURU_VALUE_SEMANTICS=OFF + CONFIGURU_ATOMIC_REF_COUNT=OFF"
+rm -rf *
+cmake -DCMAKE_BUILD_TYPE="Debug" -DCONFIGURU_VALUE_SEMANTICS="OFF" -DCONFIGURU_IMPLICIT_CONVERSIONS="OFF" -DCONFIGURU_ATOMIC_REF_COUNT="OFF" ..
+make
+./configuru_test $@
+
 echo "All tests passed!"
@@ -22,6 +22,9 @@
 #include "simple_test.hpp"
 
 #include <iostream>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
 
 #include <boost/filesystem.hpp>
 
@@ -107,8 +110,22 @@ void test_special()
 	test_roundtrip(JSON, 3.14000010490417);
 	test_roundtrip(JSON, 1234567890123456ll);
 
+	test_roundtrip(JSON, -1.23280104e+33f); // Needs all 9 digits
+	test_roundtrip(JSON, 0.776754);
+	test_roundtrip(JSON, 2.2250738585072009e-308);
+
 	test_writer(JSON, "3.14 (double)", 3.14,  "3.14");
 	test_writer(JSON, "3.14f (float)", 3.14f, "3.14");
+	test_writer(JSON, "0.776754",          0.776754,   "0.776754");
+	test_writer(JSON, "123456.7",          123456.7,   "123456.7");
+	test_writer(JSON, "1e-5",              1e-5,       "1e-05");
+	test_writer(JSON, "1.5e20",            1.5e20,     "1.5e+20");
+	test_writer(JSON, "5e-324",            5e-324,     "5e-324");
+	test_writer(JSON, "-0.0",              -0.0,       "-0.0");
+	test_writer(JSON, "2^53 (double)",     9007199254740992.0, "9007199254740992.0");
+	test_writer(JSON, "1/3",               1.0 / 3.0,  "0.3333333333333333");
+	test_writer(JSON, "int64 min",         std::numeric_limits<int64_t>::min(), "-9223372036854775808");
+	test_writer(CFG,  "2.0 (CFG)",         2.0,        "2.0");
 }
 
 void test_roundtrip_string()
@@ -170,6 +187,233 @@ void test_strings()
 	test_string("\"\\uD834\\uDD1E\"",           "\xF0\x9D\x84\x9E"); // G clef sign U+1D11E
 }
 
+struct PieceSink : public OutputSink
+{
+	std::string out;
+	size_t      num_pieces = 0;
+	size_t      largest    = 0;
+
+	void write(const char* data, size_t size) override
+	{
+		out.append(data, size);
+		num_pieces += 1;
+		largest = (std::max)(largest, size);
+	}
+};
+
+void test_streaming_dump()
+{
+	Config cfg = Config::object();
+	for (int i = 0; i < 100; ++i) {
+		cfg["key_" + std::to_string(i)] = Config::array({i, i * 0.5, "some \"quoted\" text\n", Config::object({{"nested", true}})});
+	}
+	cfg["long_string"] = std::string(1000, 'x');
+	cfg["packed"] = Config::array(std::vector<int>(500, 42));
+
+	for (auto&& options : {CFG, JSON, FORGIVING}) {
+		const std::string expected = dump_string(cfg, options);
+
+		PieceSink sink;
+		dump(sink, cfg, options, 256);
+		TEST_EQ(sink.out, expected);
+		TEST(sink.num_pieces > 10);
+		TEST(sink.largest <= 1000); // Long strings are passed on as they are, without buffering.
+
+		std::ostringstream os;
+		dump(os, cfg, options);
+		TEST_EQ(os.str(), expected);
+	}
+
+	std::ostringstream os;
+	os << cfg;
+	auto json_no_newline = JSON;
+	json_no_newline.end_with_newline = false;
+	TEST_EQ(os.str(), dump_string(cfg, json_no_newline));
+
+	auto fp = tmpfile();
+	TEST(fp != nullptr);
+	dump(fp, cfg, JSON);
+	const auto size = static_cast<size_t>(ftell(fp));
+	fclose(fp);
+	TEST_EQ(size, dump_string(cfg, JSON).size());
+
+	// A failing sink stops the dump:
+	struct FailingSink : public OutputSink
+	{
+		void write(const char*, size_t) override { CONFIGURU_ONERROR("Disk full"); }
+	};
+	FailingSink failing;
+	TEST_THROW(dump(failing, cfg, JSON, 64), std::runtime_error);
+}
+
+void test_string_escaping()
+{
+	auto json = JSON;
+	json.end_with_newline = false;
+	auto ascii = json;
+	ascii.ensure_ascii = true;
+
+	TEST_EQ(dump_string(Config("caf\xC3\xA9"), json), "\"caf\xC3\xA9\"");
+	TEST_EQ(dump_string(Config("caf\xC3\xA9"), ascii), "\"caf\\u00e9\"");
+	TEST_EQ(dump_string(Config("\xF0\x9D\x84\x9E"), ascii), "\"\\ud834\\udd1e\""); // G clef, as a surrogate pair
+	TEST_EQ(dump_string(Config("bad \xFF byte"), ascii), "\"bad \\ufffd byte\"");
+	TEST_EQ(dump_string(Config("cut \xE2\x82"), ascii), "\"cut \\ufffd\\ufffd\"");
+
+	// Long strings, with things to escape at every position in and around the wide checks:
+	const std::string filler = "The quick brown fox jumps over the lazy dog. ";
+	for (const char* special : {"\"", "\\", "\n", "\x01", "\x1F", "\xC3\xA9", "\xE2\x82\xAC"}) {
+		bool round_trips = true;
+		bool is_ascii = true;
+		for (size_t pos = 0; pos < 70; ++pos) {
+			std::string str = filler + filler;
+			str.insert(pos, special);
+			for (auto&& options : {json, ascii}) {
+				const std::string dumped = dump_string(Config(str), options);
+				round_trips &= parse_string(dumped.c_str(), JSON, "escaping").as_string() == str;
+				if (options.ensure_ascii) {
+					is_ascii &= std::all_of(dumped.begin(), dumped.end(), [](char c) { return 0x20 <= c && c < 0x7F; });
+				}
+			}
+		}
+		TEST(round_trips);
+		TEST(is_ascii);
+	}
+}
+
+void test_serializer()
+{
+	Serializer serializer(JSON);
+	std::string out;
+	const char* data = nullptr;
+	for (int i = 0; i < 100; ++i) {
+		Config cfg = Config::object({
+			{"id",     i},
+			{"name",   "sample_" + std::to_string(i % 10)},
+			{"values", Config::array({i * 0.5, i * 1.5})},
+			{"tags",   Config::object({{"a", true}, {"b", nullptr}})},
+		});
+		serializer.dump_into(cfg, out);
+		TEST_EQ(out, dump_string(cfg, JSON));
+		TEST_EQ(serializer.dump(cfg), out);
+		if (i == 50) { data = out.data(); }
+		if (i > 50)  { TEST(out.data() == data); } // No reallocation
+	}
+
+	auto cfg = parse_string("a: [1, 2.5, \"three\"], b: { c: [1 2 3 4] }, long: \"0123456789012345678901234567890123456789\"", CFG, "estimate");
+	for (auto&& options : {CFG, JSON}) {
+		const size_t actual = dump_string(cfg, options).size();
+		const size_t estimate = Serializer(options).estimate_size(cfg);
+		TEST(actual / 2 <= estimate && estimate <= actual * 2);
+	}
+
+	auto bad = Config::array({1.0, std::numeric_limits<double>::quiet_NaN()});
+	Serializer strict(JSON);
+	TEST_THROW(strict.dump_into(bad, out), std::runtime_error);
+	strict.dump_into(cfg, out); // Still usable after an error
+	TEST_EQ(out, dump_string(cfg, JSON));
+}
+
+void test_compact_dump()
+{
+	auto compact_json = JSON;
+	compact_json.indentation = "";
+	auto sorted = compact_json;
+	sorted.sort_keys = true;
+
+	Config cfg = Config::object();
+	cfg["zebra"] = Config::object({{"b", 1}, {"a", Config::array({1.5, 2.5})}});
+	cfg["apple"] = Config::array({nullptr, true, "text\n", Config::object()});
+	cfg["mango"] = Config::array(std::vector<int>{1, 2, 3});
+	cfg["zebra"]["c"] = Config::object({{"y", Config::array()}, {"x", -0.0}});
+
+	TEST_EQ(dump_string(cfg, compact_json),
+		"{\"zebra\":{\"b\":1,\"a\":[1.5,2.5],\"c\":{\"y\":[],\"x\":-0.0}},"
+		"\"apple\":[null,true,\"text\\n\",{}],\"mango\":[1,2,3]}");
+	TEST_EQ(dump_string(cfg, sorted),
+		"{\"apple\":[null,true,\"text\\n\",{}],\"mango\":[1,2,3],"
+		"\"zebra\":{\"a\":[1.5,2.5],\"b\":1,\"c\":{\"x\":-0.0,\"y\":[]}}}");
+
+	auto compact_cfg = CFG;
+	compact_cfg.indentation = "";
+	compact_cfg.write_comments = false;
+	compact_cfg.allow_macro = false;
+	TEST_EQ(dump_string(cfg, compact_cfg),
+		"zebra:{b:1,a:[1.5,2.5],c:{y:[],x:-0.0}},apple:[null,true,\"text\\n\",{}],mango:[1,2,3]");
+
+	TEST_THROW(dump_string(Config::array({Config()}), compact_json), std::runtime_error);
+}
+
+void test_binary_formats()
+{
+	Config cfg = Config::object();
+	cfg["zebra"] = Config::object({{"b", 1}, {"a", Config::array({1.5, 0.1})}});
+	cfg["apple"] = Config::array({nullptr, true, false, "text\n", Config::object(), Config::array()});
+	cfg["ints"] = Config::array(std::vector<long long>{0, 23, 24, 255, 256, 65536, -1, -33, -129, 4294967296LL,
+		std::numeric_limits<long long>::min(), std::numeric_limits<long long>::max()});
+	cfg["long_string"] = std::string(1000, 'x');
+
+	struct BinaryFormat
+	{
+		std::string (*dump)(const Config&);
+		Config (*parse)(const void*, size_t, const char*);
+		Config (*parse_stream)(std::istream&, const char*);
+	};
+	const BinaryFormat formats[] = {
+		{dump_cbor,    parse_cbor,    parse_cbor},
+		{dump_msgpack, parse_msgpack, parse_msgpack},
+	};
+	for (auto&& format : formats) {
+		const std::string binary = format.dump(cfg);
+		const Config parsed = format.parse(binary.data(), binary.size(), "binary");
+		TEST(Config::deep_eq(parsed, cfg));
+		TEST_EQ(dump_string(parsed, JSON), dump_string(cfg, JSON)); // Same key order
+
+		std::istringstream is(binary + "after");
+		TEST(Config::deep_eq(format.parse_stream(is, "stream"), cfg));
+		std::string rest;
+		is >> rest;
+		TEST_EQ(rest, "after");
+
+		TEST_THROW(format.parse(binary.data(), binary.size() - 1, "truncated"), ParseError);
+		const std::string trailing = binary + '\0';
+		TEST_THROW(format.parse(trailing.data(), trailing.size(), "trailing"), ParseError);
+	}
+
+	PieceSink sink;
+	dump_cbor(sink, cfg, 64);
+	TEST_EQ(sink.out, dump_cbor(cfg));
+	TEST(sink.largest <= 1100); // The long string is passed on as it is
+
+	// Known encodings:
+	TEST_EQ(dump_cbor(Config::array({1, 2, 3})), "\x83\x01\x02\x03");
+	TEST_EQ(dump_cbor(Config(-500)), std::string("\x39\x01\xf3", 3));
+	TEST_EQ(dump_cbor(Config(1.5)), std::string("\xfa\x3f\xc0\x00\x00", 5)); // Fits in a float
+	TEST_EQ(dump_cbor(Config::object({{"a", nullptr}})), "\xa1\x61""a\xf6");
+	TEST_EQ(dump_msgpack(Config::array({1, -1, 200})), "\x93\x01\xff\xcc\xc8");
+	TEST_EQ(dump_msgpack(Config::object({{"a", true}})), "\x81\xa1""a\xc3");
+
+	// Things we only read: tags, half floats, indefinite lengths, byte strings.
+	const std::string cbor_extras("\xd8\x20\x9f\xf9\x3e\x00\x5f\x41""a\x41""b\xff\xff", 13);
+	TEST_EQ(dump_string(parse_cbor(cbor_extras.data(), cbor_extras.size(), "extras"), JSON), "[ 1.5, \"ab\" ]\n");
+
+	const auto error_offset = [](const std::string& binary, bool cbor) -> size_t {
+		try {
+			cbor ? parse_cbor(binary.data(), binary.size(), "bad") : parse_msgpack(binary.data(), binary.size(), "bad");
+		} catch (const ParseError& e) {
+			return e.offset();
+		}
+		return 0;
+	};
+	TEST_EQ(error_offset(std::string("\x82\x01", 2), true), 2u);                            // Truncated
+	TEST_EQ(error_offset(std::string("\x81\x1b\xff\xff\xff\xff\xff\xff\xff\xff", 10), true), 1u); // Too big
+	TEST_EQ(error_offset(std::string("\xa2\x61""a\x01\x61""a\x02", 7), true), 4u);         // Duplicate key
+	TEST_EQ(error_offset(std::string("\xa1\x01\x02", 3), true), 1u);                        // Key not a string
+	TEST_EQ(error_offset(std::string("\x81\xc1", 2), false), 1u);                           // Reserved
+	TEST_EQ(error_offset(std::string(100000, '\x81'), true), BINARY_MAX_DEPTH);             // Too deep
+	TEST_EQ(error_offset(std::string(100000, '\x91'), false), BINARY_MAX_DEPTH);
+	TEST_EQ(error_offset(std::string("\x7a\xff\xff\xff\xff", 5), true), 5u);                // Made-up length
+}
+
 void test_doubles()
 {
 	auto test_double = [&](const std::string& json, const double expected)
@@ -353,6 +597,11 @@ void run_unit_tests()
 	test_bad_usage();
 	test_strings();
 	test_doubles();
+	test_serializer();
+	test_compact_dump();
+	test_binary_formats();
+	test_string_escaping();
+	test_streaming_dump();
 	test_roundtrip_string();
 }
 
@@ -525,6 +774,12 @@ void test_check_dangling()
 		const_cfg.mark_accessed(false);
 		TEST_THROW(const_cfg.check_dangling(), std::exception);
 
+		set_access_tracking(false);
+		TEST_NOTHROW(const_cfg.check_dangling());
+		(void)const_cfg["value"];
+		set_access_tracking(true);
+		TEST_THROW(const_cfg.check_dangling(), std::exception);
+
 		std::cout << "object contents: " << std::endl;
 		for (const auto& p : const_cfg.as_object())
 		{
@@ -555,6 +810,20 @@ void test_check_dangling()
 		TEST(mut_cfg["array"]  == "array");
 		TEST(mut_cfg["object"] == "object");
 	}
+
+	{
+		// Indexing a const array does not mark the rest of the element as accessed:
+		const auto const_cfg = parse_string("{ arr: [ { x: 1, y: 2 } ] }", CFG, "arr_of_objects");
+		TEST_EQ((int)const_cfg["arr"][0]["x"], 1);
+		try {
+			const_cfg.check_dangling();
+			TEST_FAIL("Should have thrown");
+		} catch (std::exception& e) {
+			std::string msg = e.what();
+			TEST(msg.find("'y'") != std::string::npos);
+			TEST(msg.find("'x'") == std::string::npos);
+		}
+	}
 }
 
 void test_comments()
@@ -670,6 +939,192 @@ void test_copy_semantics()
 #endif
 }
 
+#if CONFIGURU_VALUE_SEMANTICS
+void test_copy_on_write()
+{
+	const Config original = parse_string("array: [1 2 3], mixed: [\"a\" [\"b\"]], object: { nested: { key: \"value\" } }", CFG, "cow");
+
+	Config copy = original;
+#if CONFIGURU_COPY_ON_WRITE
+	// A copy needs keys of its own to track accesses in, so while tracking is on only packed arrays are shared:
+	TEST(!copy.shares_contents(original));
+	TEST(static_cast<const Config&>(copy)["array"].shares_contents(original["array"]));
+#endif
+	copy["array"].push_back(4);
+	copy["mixed"][1].push_back("c");
+	copy["object"]["nested"]["key"] = "changed";
+	copy["object"]["new_key"] = true;
+	copy.erase("mixed");
+
+	TEST_EQ(original["array"].array_size(), 3u);
+	TEST_EQ(original["mixed"][1].array_size(), 1u);
+	TEST_EQ(original["object"]["nested"]["key"], "value");
+	TEST(!original["object"].has_key("new_key"));
+
+	TEST_EQ(copy["array"].array_size(), 4u);
+	TEST_EQ(copy["object"]["nested"]["key"], "changed");
+	TEST(!copy.has_key("mixed"));
+
+	// Copies of copies, and mutation of the original while copies exist:
+	Config a = original;
+	Config b = a;
+	a["array"].as_array().clear();
+	TEST_EQ(a["array"].array_size(), 0u);
+	TEST_EQ(b["array"].array_size(), 3u);
+	TEST(Config::deep_eq(b, original));
+
+	// References taken before a copy only change the original:
+	Config cfg = parse_string("a: 1, list: [\"x\", \"z\"]", CFG, "cow");
+	Config& r = cfg["a"];
+	Config& l = cfg["list"];
+	Config cfg_copy = cfg;
+	r = 5;
+	l.push_back("y");
+	TEST_EQ((int)cfg["a"], 5);
+	TEST_EQ(cfg["list"].array_size(), 3u);
+	TEST_EQ((int)cfg_copy["a"], 1);
+	TEST_EQ(cfg_copy["list"].array_size(), 2u);
+
+	Config& nested = cfg["list"][0].ref();
+	Config list_copy = cfg["list"];
+	nested = "changed";
+	TEST_EQ(list_copy[0], "x");
+	TEST_EQ(cfg["list"][0], "changed");
+
+#if CONFIGURU_COPY_ON_WRITE
+	set_access_tracking(false);
+
+	// Built configs share too:
+	const Config built = Config::object({{"list", Config::array({1, "two"})}, {"key", "value"}});
+	const Config built_copy = built;
+	TEST(built_copy.shares_contents(built));
+	TEST(built_copy["list"].shares_contents(built["list"]));
+
+	// No copy shares with an object which has handed out a reference, as long as it lives:
+	Config edited = built;
+	Config& key = edited["key"];
+	const Config first_copy  = edited;
+	const Config second_copy = edited;
+	key = "edited";
+	TEST(!first_copy.shares_contents(edited));
+	TEST(!second_copy.shares_contents(edited));
+	TEST_EQ(first_copy["key"], "value");
+	TEST_EQ(second_copy["key"], "value");
+	TEST_EQ(edited["key"], "edited");
+	TEST(second_copy["list"].shares_contents(edited["list"]));
+
+	// Nor with one being iterated over:
+	Config counters = Config::object({{"a", 1}, {"b", 2}});
+	std::vector<Config> snapshots;
+	for (auto& p : counters.as_object()) {
+		snapshots.push_back(counters);
+		p.value() = 0;
+	}
+	TEST_EQ((int)snapshots[0]["a"], 1);
+	TEST_EQ((int)snapshots[0]["b"], 2);
+	TEST_EQ((int)snapshots[1]["a"], 0);
+	TEST_EQ((int)snapshots[1]["b"], 2);
+
+	set_access_tracking(true);
+#endif
+}
+
+void test_dump_cache()
+{
+	Config cfg = parse_string(TEST_CFG, CFG, "test_cfg");
+	Config list = Config::array();
+	for (int i = 0; i < 2000; ++i) {
+		list.push_back(Config::object({{"id", i}, {"tags", Config::array({"a", i % 2 == 0})}}));
+	}
+	cfg["list"] = std::move(list);
+	cfg["packed"] = Config::array(std::vector<double>{1.5, 2.5});
+
+	auto cached_cfg = CFG;
+	cached_cfg.cache_output = true;
+	auto cached_json = JSON;
+	cached_json.cache_output = true;
+
+	ThreadPool pool(2);
+	auto check = [&]() {
+		for (auto&& options : {cached_cfg, cached_json}) {
+			auto uncached = options;
+			uncached.cache_output = false;
+			const std::string expected = dump_string(cfg, uncached);
+			TEST_EQ(dump_string(cfg, options), expected);
+			TEST_EQ(dump_string(cfg, options), expected);
+
+			PieceSink sink;
+			dump(sink, cfg, options, 256);
+			TEST_EQ(sink.out, expected);
+
+			TEST_EQ(dump_string(cfg, options, pool), expected);
+		}
+	};
+
+	check();
+	cfg["list"][1500]["id"] = "changed";
+	check();
+	cfg["list"][7]["tags"].push_back(nullptr);
+	check();
+	cfg["list"].erase(3);
+	check();
+	cfg.insert_or_assign("new_key", Config::object({{"x", 1}}));
+	check();
+	cfg.erase("packed");
+	check();
+
+	// Writing the top object with and without braces:
+	auto braced_cfg = cached_cfg;
+	braced_cfg.implicit_top_object = false;
+	for (auto&& options : {cached_cfg, braced_cfg, cached_cfg}) {
+		auto uncached = options;
+		uncached.cache_output = false;
+		TEST_EQ(dump_string(cfg, options), dump_string(cfg, uncached));
+	}
+
+	Serializer serializer(cached_json);
+	TEST_EQ(serializer.dump(cfg), dump_string(cfg, JSON));
+
+#if CONFIGURU_DUMP_CACHE
+	// Changing a value deep down is noticed by all its parents:
+	(void)dump_string(cfg, cached_json);
+	cfg["list"][42]["id"] = -1;
+	TEST_EQ(dump_string(cfg, cached_json), dump_string(cfg, JSON));
+	check();
+#endif
+
+	// Changes made through references, whether they were looked up before or after the last dump:
+	Config small = parse_string("a: { b: 0, c: [1, 2] }\nd: { e: \"e\" }", CFG, "small");
+	Config& held = small["d"]["e"];
+	TEST_EQ(dump_string(small, cached_cfg), dump_string(small, CFG));
+	Config& r = small["a"]["b"];
+	r = 1;
+	TEST_EQ(dump_string(small, cached_cfg), dump_string(small, CFG));
+	held = Config::array({1, 2, 3});
+	TEST_EQ(dump_string(small, cached_cfg), dump_string(small, CFG));
+	held[1] = "two";
+	TEST_EQ(dump_string(small, cached_cfg), dump_string(small, CFG));
+	auto& elements = small["a"]["c"].as_array();
+	TEST_EQ(dump_string(small, cached_cfg), dump_string(small, CFG));
+	elements.push_back(3);
+	TEST_EQ(dump_string(small, cached_cfg), dump_string(small, CFG));
+	for (auto& p : small["a"].as_object()) {
+		(void)dump_string(small, cached_cfg);
+		p.value() = p.key();
+	}
+	TEST_EQ(dump_string(small, cached_cfg), dump_string(small, CFG));
+
+	// Comments handed out by comments() can be changed at any time:
+	ConfigComments& comments = small["d"].comments();
+	TEST_EQ(dump_string(small, cached_cfg), dump_string(small, CFG));
+	comments.prefix.push_back("// Added after the dump");
+	TEST_EQ(dump_string(small, cached_cfg), dump_string(small, CFG));
+	held.comments().postfix.push_back("// Also");
+	TEST_EQ(dump_string(small, cached_cfg), dump_string(small, CFG));
+	TEST(dump_string(small, cached_cfg).find("// Also") != std::string::npos);
+}
+#endif
+
 void test_swap()
 {
 	Config a{{ "message", "hello" }};
@@ -705,6 +1160,902 @@ void test_get_or()
 	}
 }
 
+void test_packed_arrays()
+{
+	auto cfg = parse_string("ints: [1 2 3 4 5], floats: [0.5, 1.5], mixed: [1, 2.5], strings: [\"a\"]", CFG, "packed");
+	TEST(cfg["ints"].array_packing()    == Config::ArrayPacking::Ints);
+	TEST(cfg["floats"].array_packing()  == Config::ArrayPacking::Floats);
+	TEST(cfg["mixed"].array_packing()   == Config::ArrayPacking::None);
+	TEST(cfg["strings"].array_packing() == Config::ArrayPacking::None);
+
+	auto ints = cfg["ints"].as_int_span();
+	TEST_EQ(ints.size(), 5u);
+	TEST_EQ(ints[4], 5);
+	TEST_EQ(cfg["floats"].as_float_span()[1], 1.5);
+	TEST_THROW(cfg["floats"].as_int_span(), std::exception);
+
+#if !CONFIGURU_IMPLICIT_CONVERSIONS
+	auto as_vector = (std::vector<double>)cfg["ints"];
+	TEST_EQ(as_vector.size(), 5u);
+	TEST_EQ(as_vector[2], 3.0);
+	TEST_THROW((std::vector<std::string>)cfg["ints"], std::exception);
+#endif
+
+	TEST_EQ(dump_string(cfg["ints"], JSON), "[ 1, 2, 3, 4, 5 ]\n");
+	TEST_EQ(dump_string(cfg["floats"], CFG), "[ 0.5 1.5 ]\n");
+
+	const auto from_vector = Config::array(std::vector<float>{0.25f, 2.0f});
+	TEST(from_vector.array_packing() == Config::ArrayPacking::Floats);
+	TEST_EQ(from_vector, Config::array({0.25, 2.0}));
+	TEST_EQ(Config(std::vector<int>{7, 8}), Config::array({7, 8}));
+
+	// Reading through a const Config does not unpack:
+	const Config& const_cfg = cfg;
+	TEST_EQ((int)const_cfg["ints"][1], 2);
+	TEST_EQ(const_cfg["ints"][1].where(), const_cfg["ints"].where());
+	double sum = 0;
+	for (const Config& f : const_cfg["floats"].as_array()) {
+		sum += (double)f;
+	}
+	TEST_EQ(sum, 2.0);
+#if !CONFIGURU_IMPLICIT_CONVERSIONS
+	const auto as_std_array = (std::array<int, 5>)const_cfg["ints"];
+	TEST_EQ(as_std_array[4], 5);
+	const auto as_pair = (std::pair<double, double>)const_cfg["floats"];
+	TEST_EQ(as_pair.second, 1.5);
+#endif
+	TEST_THROW(const_cfg["ints"][5], std::exception);
+	TEST_EQ(const_cfg["ints"][1], const_cfg["ints"].as_array()[1]);
+	int64_t total = 0;
+	for (const Config& i : const_cfg["ints"].elements()) {
+		total += (int64_t)i;
+	}
+	TEST_EQ(total, 15);
+	TEST_EQ((int)const_cfg["ints"].get_packed(4), 5);
+	TEST_EQ(const_cfg["ints"].get_packed(4).where(), const_cfg["ints"].where());
+	TEST_THROW(const_cfg["ints"].get_packed(5), std::exception);
+	TEST(cfg["ints"].array_packing()   == Config::ArrayPacking::Ints);
+	TEST(cfg["floats"].array_packing() == Config::ArrayPacking::Floats);
+
+	// Pushing a number of the packed type keeps it packed:
+	cfg["ints"].push_back(6);
+	TEST(cfg["ints"].array_packing() == Config::ArrayPacking::Ints);
+	TEST_EQ(cfg["ints"].array_size(), 6u);
+
+	// Anything else turns it into a normal array:
+	cfg["ints"].push_back("seven");
+	TEST(cfg["ints"].array_packing() == Config::ArrayPacking::None);
+	TEST_EQ(cfg["ints"].array_size(), 7u);
+	TEST_EQ((int)cfg["ints"][5], 6);
+	TEST_EQ(cfg["ints"][6], "seven");
+
+	// Reading and writing numbers of the packed type through indexing keeps it packed:
+	TEST_EQ((double)cfg["floats"][0], 0.5);
+	cfg["floats"][1] = 2.5;
+	TEST_EQ((double)cfg["floats"][1], 2.5);
+	TEST_EQ((double)const_cfg["floats"].as_array()[1], 2.5);
+	cfg["floats"].insert(0, 0.25);
+	cfg["floats"].erase(1);
+	TEST_EQ(cfg["floats"], Config::array({0.25, 2.5}));
+	const Config moved = std::move(cfg["floats"][0]);
+	TEST_EQ((double)moved, 0.25);
+	TEST(cfg["floats"].array_packing() == Config::ArrayPacking::Floats);
+
+	// Writing anything else unpacks it:
+	cfg["floats"][0] = 1;
+	TEST(cfg["floats"].array_packing() == Config::ArrayPacking::None);
+	TEST_EQ(cfg["floats"], Config::array({1, 2.5}));
+
+	// So does asking for a reference:
+	auto numbers = Config::array({1, 2});
+	Config& first = numbers[0].ref();
+	TEST(numbers.array_packing() == Config::ArrayPacking::None);
+	first = "one";
+	TEST_EQ(numbers, Config::array({"one", 2}));
+
+	// Elements of a normal array are read in place, and can be moved out:
+	auto objects = parse_string("[{x: 1}, {x: 2}]", CFG, "objects");
+	const Config& const_objects = objects;
+	TEST_EQ(const_objects[1]["x"].where(), "objects:1: ");
+	objects[1]["x"] = 3;
+	TEST_EQ((int)const_objects[1]["x"], 3);
+	const Config taken = std::move(objects[0]);
+	TEST_EQ((int)taken["x"], 1);
+	TEST_EQ((int)objects[1]["x"], 3);
+}
+
+void test_frozen_config()
+{
+	const auto cfg = parse_string(
+		"zeta: 1, alpha: \"hello\", nested: { pi: 3.14, flag: true, nothing: null }, "
+		"ints: [1 2 3], mixed: [1 \"two\" { three: 3 }]", CFG, "frozen");
+	const FrozenConfig frozen = cfg.freeze();
+
+	TEST(frozen.is_object());
+	TEST_EQ(frozen.object_size(), 5u);
+	TEST_EQ(frozen["zeta"].get<int>(), 1);
+	TEST_EQ(as<std::string>(frozen["alpha"]), "hello");
+	TEST_EQ(std::string(frozen["alpha"].c_str()), "hello");
+	TEST_EQ((float)frozen["nested"]["pi"], 3.14f);
+	TEST_EQ((bool)frozen["nested"]["flag"], true);
+	TEST(frozen["nested"]["nothing"].is_null());
+	TEST(frozen.has_key("ints"));
+	TEST(!frozen.has_key("zet"));
+	TEST_EQ(frozen.get_or("missing", 42), 42);
+	TEST_EQ(frozen.get_or("alpha", "default"), "hello");
+	TEST_THROW(frozen["missing"], std::exception);
+	TEST_THROW(frozen["alpha"].as_double(), std::exception);
+
+	TEST(frozen["ints"].array_packing() == Config::ArrayPacking::Ints);
+	TEST_EQ(frozen["ints"].as_int_span()[2], 3);
+	TEST_EQ(frozen["ints"][1].get<int>(), 2);
+	TEST_EQ(frozen["mixed"][2]["three"].get<int>(), 3);
+	TEST_THROW(frozen["mixed"][3], std::exception);
+
+	int sum = 0;
+	for (FrozenValue value : frozen["ints"].as_array()) {
+		sum += value.get<int>();
+	}
+	TEST_EQ(sum, 6);
+
+	std::string keys;
+	for (auto&& entry : frozen.as_object()) {
+		keys += entry.key();
+		keys += " ";
+	}
+	TEST_EQ(keys, "alpha ints mixed nested zeta ");
+
+	// Reading the frozen config must not mark anything as accessed:
+	TEST_THROW(cfg.check_dangling(), std::exception);
+
+	// Thawing restores values and key order:
+	const Config thawed = frozen.thaw();
+	TEST(Config::deep_eq(thawed, cfg));
+	TEST_EQ(dump_string(thawed, JSON), dump_string(cfg, JSON));
+}
+
+void test_snapshot()
+{
+	const auto cfg = parse_string(
+		"zeta: 1, alpha: \"hello\", nested: { pi: 3.14, flag: true, nothing: null }, "
+		"ints: [1 2 3], floats: [0.5 1.5], mixed: [1 \"two\" { three: 3 }], empty: {}", CFG, "snapshot");
+	const std::string snapshot = dump_snapshot(cfg.freeze());
+	TEST_EQ(snapshot.size() % 8, 0u);
+
+	// std::string is not guaranteed to be 8 byte aligned:
+	std::vector<uint64_t> memory(snapshot.size() / 8);
+	memcpy(memory.data(), snapshot.data(), snapshot.size());
+	TEST(validate_snapshot(memory.data(), snapshot.size()));
+
+	const FrozenConfig view = view_snapshot(memory.data(), snapshot.size(), "memory");
+	TEST_EQ(view["alpha"].get<std::string>(), "hello");
+	TEST_EQ(view["ints"].as_int_span()[2], 3);
+	TEST_EQ(view["mixed"][2]["three"].get<int>(), 3);
+	TEST(Config::deep_eq(view.thaw(), cfg));
+	TEST_EQ(dump_string(view.thaw(), JSON), dump_string(cfg, JSON));
+
+	const auto path = (fs::temp_directory_path() / fs::unique_path("configuru_%%%%%%%%.snapshot")).string();
+	dump_snapshot_file(path, cfg.freeze());
+	{
+		const FrozenConfig mapped = map_snapshot_file(path);
+		TEST_EQ(mapped["nested"]["pi"].get<double>(), 3.14);
+		TEST_EQ(dump_string(mapped.thaw(), JSON), dump_string(cfg, JSON));
+	}
+	fs::remove(path);
+	TEST_THROW(map_snapshot_file(path), std::runtime_error);
+
+	// Damaged snapshots are caught by the validator, but not by the header check alone:
+	const auto damaged = [&](size_t offset, uint8_t byte) {
+		std::vector<uint64_t> copy = memory;
+		reinterpret_cast<uint8_t*>(copy.data())[offset] = byte;
+		std::string error;
+		const bool valid = validate_snapshot(copy.data(), snapshot.size(), &error);
+		TEST_THROW(view_snapshot(copy.data(), snapshot.size(), "damaged"), ParseError);
+		return !valid && !error.empty();
+	};
+	const size_t root = 64;
+	TEST(damaged(0, 'X'));              // Magic
+	TEST(damaged(root, 42));            // Type of the root
+	TEST(damaged(root + 8, 0));         // Children of the root pointing at the root
+	TEST(damaged(root + 12, 0xff));     // Keys of the root out of range
+	const size_t strings_size = memory[6];
+	const size_t strings_end = snapshot.size() - (8 - strings_size % 8) % 8;
+	TEST(damaged(strings_end - 1, 'x')); // Last string not zero-terminated
+
+	// Two objects sharing the same children:
+	{
+		std::vector<uint64_t> copy = memory;
+		FrozenNode* nodes = reinterpret_cast<FrozenNode*>(reinterpret_cast<char*>(copy.data()) + root);
+		FrozenNode& mixed  = nodes[nodes[0].u.children.first + 4];
+		FrozenNode& nested = nodes[nodes[0].u.children.first + 5];
+		TEST_EQ(mixed.size, nested.size);
+		nested.u.children.first = mixed.u.children.first;
+		std::string error;
+		TEST(!validate_snapshot(copy.data(), snapshot.size(), &error));
+		TEST_THROW(view_snapshot(copy.data(), snapshot.size(), "overlapping"), ParseError);
+	}
+
+	// Too deep to thaw without running out of stack:
+	{
+		Config deep = 1;
+		for (unsigned i = 0; i < BINARY_MAX_DEPTH + 10; ++i) {
+			Config parent = Config::array();
+			parent.push_back(std::move(deep));
+			deep = std::move(parent);
+		}
+		const FrozenConfig frozen = deep.freeze();
+		TEST_THROW(frozen.thaw(), std::runtime_error);
+		const std::string deep_snapshot = dump_snapshot(frozen);
+		std::vector<uint64_t> deep_memory(deep_snapshot.size() / 8);
+		memcpy(deep_memory.data(), deep_snapshot.data(), deep_snapshot.size());
+		std::string error;
+		TEST(!validate_snapshot(deep_memory.data(), deep_snapshot.size(), &error));
+		TEST(error.find("Too deeply nested") != std::string::npos);
+	}
+
+	std::string error;
+	TEST(!validate_snapshot(memory.data(), snapshot.size() - 8, &error));
+	TEST(!validate_snapshot(reinterpret_cast<const char*>(memory.data()) + 1, snapshot.size() - 1, &error));
+	TEST_THROW(view_snapshot(memory.data(), 10, "short"), ParseError);
+
+	std::vector<uint64_t> bad_keys = memory;
+	reinterpret_cast<uint8_t*>(bad_keys.data())[root + 12] = 0xff;
+	TEST_NOTHROW(view_snapshot(bad_keys.data(), snapshot.size(), "trusted", SnapshotCheck::Trusted));
+}
+
+void test_parse_cache()
+{
+	const auto dir = fs::temp_directory_path() / fs::unique_path("configuru_%%%%%%%%");
+	fs::create_directories(dir);
+	const std::string main_path = (dir / "main.cfg").string();
+	const std::string include_path = (dir / "included.cfg").string();
+	const std::string cache_path = main_path + ".cache";
+	const auto write_file = [](const std::string& path, const std::string& contents) {
+		FILE* fp = fopen(path.c_str(), "wb");
+		fwrite(contents.data(), 1, contents.size(), fp);
+		fclose(fp);
+	};
+	write_file(main_path, "// The main file\na: 1 // One\nb: [1, 2.5, \"three\"]\nincluded: #include \"included.cfg\"\n");
+	write_file(include_path, "/* Included */\nx: true\ny: [1, 2, 3]\n");
+
+	auto options = CFG;
+	options.parse_cache = true;
+
+	// A cache hit leaves the cache file alone, while a miss writes a new one:
+	const std::time_t long_ago = 1000000000;
+	const auto parse = [&](const FormatOptions& opts, bool& hit) {
+		if (fs::exists(cache_path)) { fs::last_write_time(cache_path, long_ago); }
+		Config config = parse_file(main_path, opts);
+		hit = fs::last_write_time(cache_path) == long_ago;
+		return config;
+	};
+	bool hit;
+
+	const Config parsed = parse(options, hit);
+	TEST(!hit);
+	TEST(fs::exists(cache_path));
+	const Config cached = parse(options, hit);
+	TEST(hit);
+	TEST(Config::deep_eq(cached, parsed));
+
+	// The same down to comments, includes and where the values came from:
+	TEST_EQ(dump_string(cached, JSON), dump_string(parsed, JSON));
+	TEST_EQ(dump_string(cached, CFG), dump_string(parsed, CFG));
+	TEST(dump_string(cached, CFG).find("#include") != std::string::npos);
+	TEST(dump_string(cached, CFG).find("// One") != std::string::npos);
+	TEST_EQ(cached.where(), parsed.where());
+	TEST_EQ(cached["a"].where(), parsed["a"].where());
+	TEST_EQ(cached["b"][2].where(), parsed["b"][2].where());
+	TEST_EQ(cached["included"].where(), parsed["included"].where());
+	TEST_EQ(cached["included"]["x"].where(), parsed["included"]["x"].where());
+	TEST_EQ(cached["included"]["y"].where(), parsed["included"]["y"].where());
+	TEST_EQ(cached["included"]["x"].where(), include_path + ":2, included at:\n    " + main_path + ":4: ");
+	TEST_EQ(cached["included"]["x"].comments().prefix.size(), 1u);
+
+	// A change to an included file makes the cache stale:
+	write_file(include_path, "x: false\n");
+	const Config changed = parse(options, hit);
+	TEST(!hit);
+	TEST_EQ((bool)changed["included"]["x"], false);
+	parse(options, hit);
+	TEST(hit);
+
+	// So do other options:
+	auto json_ish = options;
+	json_ish.identifiers_keys = true;
+	json_ish.object_duplicate_keys = true;
+	parse(json_ish, hit);
+	TEST(!hit);
+
+	// A damaged cache is ignored, and replaced:
+	write_file(cache_path, "garbage");
+	parse(options, hit);
+	TEST(!hit);
+	parse(options, hit);
+	TEST(hit);
+
+	fs::remove_all(dir);
+}
+
+void test_hash()
+{
+	const auto parsed = parse_string("{ \"b\": [1, 2.5, \"three\"], \"a\": { \"x\": -0.0 }, \"ints\": [1, 2] }", JSON, "hash");
+	Config built = Config::object();
+	built["a"] = Config{{"x", 0.0}};
+	built["ints"] = Config::array({1, 2}); // Not packed
+	built["b"] = Config::array({1, 2.5, "three"});
+	TEST(parsed["ints"].array_packing() == Config::ArrayPacking::Ints);
+	TEST(built["ints"].array_packing() == Config::ArrayPacking::None);
+
+	TEST_EQ(parsed, built);
+	TEST_EQ(parsed.hash(), built.hash());
+	TEST_EQ(std::hash<Config>()(parsed), parsed.hash());
+	TEST(Config(1).hash() != Config(1.0).hash());
+	TEST(Config("1").hash() != Config(1).hash());
+
+	const size_t before = built.hash();
+	built["b"].push_back(4);
+	TEST(built.hash() != before);
+	TEST(!Config::deep_eq(parsed, built));
+	built["b"].erase(3);
+	TEST_EQ(built.hash(), before);
+	TEST(Config::deep_eq(parsed, built));
+
+	// Changes deep down are noticed by all containers above them:
+	TEST_EQ(built.hash(), before);
+	built["a"]["x"] = 1.0;
+	TEST(built.hash() != before);
+	TEST(!Config::deep_eq(parsed, built));
+	TEST_EQ(diff(parsed, built).array_size(), 1u);
+	built["a"]["x"] = 0.0;
+	TEST_EQ(built.hash(), before);
+	TEST(Config::deep_eq(parsed, built));
+	TEST_EQ(diff(parsed, built).array_size(), 0u);
+
+#if CONFIGURU_HASH_CACHE
+	// The remembered hash is kept when other Configs change:
+	built["zz"] = 1;
+	const size_t with_zz = built.hash();
+	TEST_EQ(built.cached_hash(), with_zz);
+	Config other = 5;
+	Config moved = std::move(other);
+	other = moved;
+	TEST_EQ(built.cached_hash(), with_zz);
+	built.erase("zz");
+	TEST_EQ(built.hash(), before);
+#endif
+
+	// Changes made through references held since the hash was taken are noticed too:
+	const char* TREE = "{ \"x\": { \"y\": 1 }, \"list\": [{ \"z\": 1 }] }";
+	Config a = parse_string(TREE, JSON, "a");
+	const Config b = parse_string(TREE, JSON, "b");
+	Config& y = a["x"]["y"];
+	Config& z = a["list"][0]["z"];
+	const size_t tree_hash = a.hash();
+	TEST_EQ(b.hash(), tree_hash);
+#if CONFIGURU_HASH_CACHE
+	TEST_EQ(a.cached_hash(), tree_hash); // Remembered, even though references into it are held
+#endif
+	y = 5;
+	TEST(a.hash() != tree_hash);
+	TEST(a != b);
+	y = 1;
+	TEST_EQ(a.hash(), tree_hash);
+	TEST(a == b);
+	z = "changed";
+	TEST(a.hash() != tree_hash);
+	TEST(a != b);
+	z = 1;
+	TEST(a == b);
+
+	for (auto& p : a["x"].as_object()) {
+		a.hash();
+		p.value() = 2;
+	}
+	TEST(a.hash() != tree_hash);
+	TEST(a != b);
+	a["x"]["y"] = 1;
+	TEST(a == b);
+
+	// Also when the std::vector of an array has been handed out:
+	auto& list = a["list"].as_array();
+	TEST_EQ(a.hash(), tree_hash);
+	list[0]["z"] = 2;
+	TEST(a.hash() != tree_hash);
+	TEST(a != b);
+	list.pop_back();
+	TEST(a != b);
+
+	std::unordered_map<Config, std::string> names;
+	names[Config::array({1, 2})] = "one-two";
+	names[Config("one")]         = "one";
+	TEST_EQ(names[parsed["ints"]], "one-two");
+	TEST_EQ(names.count(Config("one")), 1u);
+	TEST_EQ(names.count(Config("two")), 0u);
+}
+
+void test_diff_and_patch()
+{
+	const char* FROM = R"({
+		"name":    "server",
+		"ports":   [80, 443, 8080],
+		"limits":  { "low": 1, "high": 10 },
+		"weird/key~": 1,
+		"old":     true
+	})";
+	const char* TO = R"({
+		"name":    "server",
+		"ports":   [80, 8443],
+		"limits":  { "low": 1, "high": 20 },
+		"weird/key~": 2,
+		"tags":    ["a", "b"],
+		"extra":   null
+	})";
+	const auto from = parse_string(FROM, JSON, "from");
+	const auto to   = parse_string(TO,   JSON, "to");
+
+	const Config patch = diff(from, to);
+	const auto expected = parse_string(R"([
+		{ "op": "replace", "path": "/limits/high",  "value": 20 },
+		{ "op": "remove",  "path": "/old" },
+		{ "op": "replace", "path": "/ports/1",      "value": 8443 },
+		{ "op": "remove",  "path": "/ports/2" },
+		{ "op": "replace", "path": "/weird~1key~0", "value": 2 },
+		{ "op": "add",     "path": "/tags",         "value": ["a", "b"] },
+		{ "op": "add",     "path": "/extra",        "value": null }
+	])", JSON, "expected");
+	TEST(Config::deep_eq(patch, expected));
+	TEST_EQ(diff(from, from).array_size(), 0u);
+
+	// Shared arrays and objects are not looked into, and equal hashes are double-checked:
+	const Config ports = from["ports"];
+	TEST_EQ(ports.shares_contents(from["ports"]), !CONFIGURU_VALUE_SEMANTICS || CONFIGURU_COPY_ON_WRITE);
+	TEST_EQ(diff(ports, from["ports"]).array_size(), 0u);
+	TEST(!Config(1).shares_contents(Config(1)));
+	const Config other_ports = Config::array({80, 443, 8081});
+	TEST(other_ports.hash() != ports.hash());
+	TEST_EQ(diff(ports, other_ports).array_size(), 1u);
+
+	// Diffing does not count as accessing:
+	TEST_THROW(from.check_dangling(), std::exception);
+
+	Config patched = parse_string(FROM, JSON, "from");
+	apply_patch(patched, patch);
+	TEST(Config::deep_eq(patched, to));
+
+	// The patch round-trips through JSON:
+	patched = parse_string(FROM, JSON, "from");
+	apply_patch(patched, parse_string(dump_string(patch, JSON).c_str(), JSON, "patch"));
+	TEST(Config::deep_eq(patched, to));
+
+	// Replacing the root:
+	Config number = 42;
+	apply_patch(number, diff(Config(42), Config("text")));
+	TEST_EQ(number, "text");
+
+	Config array = Config::array({1, 2, 3});
+	apply_patch(array, parse_string(R"([
+		{ "op": "add",    "path": "/1", "value": "inserted" },
+		{ "op": "add",    "path": "/-", "value": "last" },
+		{ "op": "remove", "path": "/0" },
+		{ "op": "test",   "path": "/0", "value": "inserted" }
+	])", JSON, "array_patch"));
+	TEST_EQ(dump_string(array, JSON), "[ \"inserted\", 2, 3, \"last\" ]\n");
+
+	// Inserting or removing elements gives one op each, wherever they are:
+	const Config long_array = parse_string("[1, 2, 3, 4, 5, 6]", JSON, "long");
+	const Config inserted   = parse_string("[0, 1, 2, 3, 4, 5, 6]", JSON, "inserted");
+	const Config removed    = parse_string("[1, 2, 4, 5, 6]", JSON, "removed");
+	TEST(Config::deep_eq(diff(long_array, inserted), parse_string(R"([{ "op": "add", "path": "/0", "value": 0 }])", JSON, "")));
+	TEST(Config::deep_eq(diff(long_array, removed),  parse_string(R"([{ "op": "remove", "path": "/2" }])", JSON, "")));
+	TEST(Config::deep_eq(diff(Config::array({"a", 1, "b"}), Config::array({"a", 2, 3, "b"})), parse_string(R"([
+		{ "op": "replace", "path": "/1", "value": 2 },
+		{ "op": "add",     "path": "/2", "value": 3 }
+	])", JSON, "")));
+	for (auto&& pair : {std::make_pair(long_array, inserted), std::make_pair(inserted, removed), std::make_pair(removed, long_array)}) {
+		Config result = parse_string(dump_string(pair.first, JSON).c_str(), JSON, "result");
+		apply_patch(result, diff(pair.first, pair.second));
+		TEST(Config::deep_eq(result, pair.second));
+	}
+
+	// Trusting equal remembered hashes:
+	const Config left  = Config::object({{"a", Config::array({1, 2})}});
+	const Config right = Config::object({{"a", Config::array({1, 2})}});
+	(void)left.hash();
+	(void)right.hash();
+	TEST_EQ(diff(left, right, true).array_size(), 0u);
+	TEST_EQ(diff(left, right).array_size(), 0u);
+
+	// move and copy:
+	Config moving = parse_string(R"({ "a": { "b": [1, 2] }, "c": 3 })", JSON, "moving");
+	apply_patch(moving, parse_string(R"([
+		{ "op": "copy", "from": "/a/b",   "path": "/d" },
+		{ "op": "move", "from": "/a/b/0", "path": "/a/b/-" },
+		{ "op": "move", "from": "/c",     "path": "/a/c" },
+		{ "op": "move", "from": "/d",     "path": "/d" }
+	])", JSON, "move_patch"));
+	TEST(Config::deep_eq(moving, parse_string(R"({ "a": { "b": [2, 1], "c": 3 }, "d": [1, 2] })", JSON, "")));
+	TEST_THROW(apply_patch(moving, parse_string(R"([{ "op": "move", "from": "/a", "path": "/a/x" }])", JSON, "")), std::exception);
+	TEST_THROW(apply_patch(moving, parse_string(R"([{ "op": "copy", "path": "/x" }])", JSON, "")), std::exception);
+
+	Config object = Config::object();
+	TEST_THROW(apply_patch(object, parse_string(R"([{ "op": "remove", "path": "/missing" }])", JSON, "")), std::exception);
+	TEST_THROW(apply_patch(object, parse_string(R"([{ "op": "move", "path": "/a", "from": "/b" }])", JSON, "")), std::exception);
+	TEST_THROW(apply_patch(array,  parse_string(R"([{ "op": "test", "path": "/0", "value": 1 }])", JSON, "")), std::exception);
+}
+
+void test_overlay_config()
+{
+	const auto defaults = parse_string(R"({
+		"name":    "default",
+		"limits":  { "low": 1, "high": 10 },
+		"servers": ["a", "b"],
+		"debug":   { "level": 1 }
+	})", JSON, "defaults");
+	const auto file = parse_string(R"({
+		"limits":  { "high": 20 },
+		"servers": ["c"],
+		"extra":   true
+	})", JSON, "file");
+	Config overrides = parse_string(R"({
+		"name":  "override",
+		"debug": false
+	})", JSON, "overrides");
+
+	OverlayConfig overlay({&defaults, &file});
+	overlay.push_layer(overrides);
+	TEST_EQ(overlay.num_layers(), 3u);
+
+	TEST_EQ(overlay["name"].get<std::string>(), "override");
+	TEST_EQ(overlay["limits"]["high"].get<int>(), 20);
+	TEST_EQ(overlay["limits"]["low"].get<int>(), 1);
+	TEST_EQ(overlay["limits"].num_layers(), 2u);
+	TEST_EQ(overlay["servers"].top().array_size(), 1u);
+	TEST_EQ(overlay["debug"].get<bool>(), false); // Replaces the object below
+	TEST_EQ(overlay["debug"].num_layers(), 1u);
+	TEST_EQ(overlay.get_or("missing", 42), 42);
+	TEST_EQ(overlay["limits"].get_or("low", 0), 1);
+	TEST_THROW(overlay["missing"], std::exception);
+
+	// No copies:
+	TEST_EQ(&overlay["servers"].top(), &file["servers"]);
+
+	// Changes to a layer are seen right away:
+	overrides["limits"] = Config{{"high", 30}};
+	TEST_EQ(overlay["limits"]["high"].get<int>(), 30);
+	TEST_EQ(overlay["limits"]["low"].get<int>(), 1);
+
+	std::string keys;
+	for (auto&& p : overlay.as_object()) {
+		keys += p.key() + "=" + std::to_string(p.value().num_layers()) + " ";
+	}
+	TEST_EQ(keys, "debug=1 extra=1 limits=3 name=1 servers=1 ");
+
+	const Config flat = overlay.flatten();
+	TEST_EQ(dump_string(flat, JSON), dump_string(parse_string(R"({
+		"name":    "override",
+		"limits":  { "low": 1, "high": 30 },
+		"servers": ["c"],
+		"debug":   false,
+		"extra":   true
+	})", JSON, "expected"), JSON));
+}
+
+void test_parallel_clone_and_eq()
+{
+	Config big = Config::object();
+	for (int i = 0; i < 20; ++i) {
+		Config child = Config::object();
+		for (int j = 0; j < 50; ++j) {
+			child.insert_or_assign("key_" + std::to_string(j), Config::array({i, j, "text", Config::object({{"nested", j * 0.5}})}));
+		}
+		child.insert_or_assign("packed", Config::array(std::vector<int>{i, i + 1, i + 2}));
+		big.insert_or_assign("child_" + std::to_string(i), std::move(child));
+	}
+
+	ThreadPool pool(4);
+	TEST_EQ(pool.num_threads(), 4u);
+
+	const Config clone = big.deep_clone(pool);
+	TEST(Config::deep_eq(big, clone));
+	TEST(Config::deep_eq(big, clone, pool));
+	TEST_EQ(dump_string(clone, JSON), dump_string(big, JSON));
+
+	Config changed = big.deep_clone(pool);
+	changed["child_13"]["key_42"][3]["nested"] = "different";
+	TEST(!Config::deep_eq(big, changed));
+	TEST(!Config::deep_eq(big, changed, pool));
+	TEST_EQ((std::string)big["child_13"]["key_42"][2], "text");
+	TEST_EQ((double)big["child_13"]["key_42"][3]["nested"], 21.0);
+
+	// Packed vs unpacked arrays are still equal:
+	TEST(Config::deep_eq(Config::array(std::vector<int>{1, 2}), Config::array({1, 2})));
+
+	// Exceptions are passed on to the caller, also from nested calls:
+	std::atomic<int> sum { 0 };
+	pool.parallel_for(10, [&](size_t i) {
+		pool.parallel_for(10, [&](size_t j) { sum += static_cast<int>(i * j); });
+	});
+	TEST_EQ(sum.load(), 2025);
+	TEST_THROW(pool.parallel_for(10, [](size_t i) { if (i == 7) { throw std::runtime_error("seven"); } }), std::runtime_error);
+}
+
+void test_parallel_visit()
+{
+	Config big = Config::object();
+	for (int i = 0; i < 10; ++i) {
+		Config list = Config::array();
+		for (int j = 0; j < 3000; ++j) {
+			list.push_back(Config::object({{"name", "n" + std::to_string(j)}, {"value", j}}));
+		}
+		big.insert_or_assign("list_" + std::to_string(i), std::move(list));
+	}
+	big.insert_or_assign("packed", Config::array(std::vector<int>{1, 2, 3}));
+
+	ThreadPool pool(4);
+
+	std::atomic<size_t> num_visited { 0 };
+	parallel_visit_configs(big, [&](const Config&) { ++num_visited; }, pool);
+	TEST_EQ(num_visited.load(), 1u + 10u * (1u + 3000u * 3u) + 4u);
+
+	// The reduction is in the same order as a sequential visit:
+	std::vector<std::string> expected;
+	visit_configs(big, [&](const Config& cfg) {
+		if (cfg.is_string()) { expected.push_back(cfg.as_string()); }
+	});
+	using Strings = std::vector<std::string>;
+	const Strings names = parallel_reduce(big, Strings(),
+		[](const Config& cfg) { return cfg.is_string() ? Strings{cfg.as_string()} : Strings(); },
+		[](Strings a, const Strings& b) { a.insert(a.end(), b.begin(), b.end()); return a; },
+		pool);
+	TEST(names == expected);
+
+	const int64_t sum = parallel_reduce(big, int64_t(0),
+		[](const Config& cfg) { return cfg.is_int() ? cfg.get<int64_t>() : int64_t(0); },
+		[](int64_t a, int64_t b) { return a + b; },
+		pool);
+	TEST_EQ(sum, 10 * (2999 * 3000 / 2) + 6);
+
+	auto cfg = parse_string("a: 1, b: { c: 2, d: 3 }, e: [{ f: 4 }]", CFG, "dangling");
+	cfg.mark_accessed(false, pool);
+	(void)cfg["b"]["c"];
+	(void)cfg["b"]["d"];
+	std::vector<std::string> dangling;
+	cfg.visit_dangling([&](const std::string& key, const Config&) { dangling.push_back(key); }, pool);
+#if CONFIGURU_ACCESS_TRACKING
+	TEST(dangling == std::vector<std::string>({"a", "e"}));
+#endif
+	cfg.mark_accessed(true, pool);
+	TEST_NOTHROW(cfg.check_dangling(pool));
+
+#if CONFIGURU_ACCESS_TRACKING
+	// Passing a pool does not change what is reported, or in which order:
+	auto what = [](const std::function<void()>& f) -> std::string {
+		try { f(); } catch (std::exception& e) { return e.what(); }
+		return "";
+	};
+	big.mark_accessed(false, pool);
+	(void)big["list_3"][1234]["name"];
+	(void)big["list_7"][42]["value"];
+	const std::string expected_message = what([&]{ big.check_dangling(); });
+	TEST(expected_message.find("Key 'value' never accessed.") != std::string::npos);
+	TEST_EQ(what([&]{ big.check_dangling(pool); }), expected_message);
+
+	dangling.clear();
+	big["list_3"].mark_accessed(true, pool);
+	big["list_7"].mark_accessed(true, pool);
+	big.visit_dangling([&](const std::string& key, const Config&) { dangling.push_back(key); }, pool);
+	TEST(dangling == std::vector<std::string>({"list_0", "list_1", "list_2", "list_4", "list_5", "list_6", "list_8", "list_9", "packed"}));
+#endif
+}
+
+void test_parallel_dump()
+{
+	Config big = parse_string(TEST_CFG, CFG, "test_cfg");
+	Config list = Config::array();
+	for (int i = 0; i < 3000; ++i) {
+		list.push_back(Config::object({
+			{"name", "n" + std::to_string(i)},
+			{"a_longer_key", i * 0.25},
+			{"tags", Config::array({"x", i % 3 == 0, nullptr})},
+		}));
+	}
+	big["list"] = std::move(list);
+	big["packed"] = Config::array(std::vector<int>(2000, 7));
+	big["nested"] = Config::object({{"deeper", Config::array({Config::array({1, 2}), Config::object({{"z", 1}, {"y", 2}})})}});
+
+	auto compact_json = JSON;
+	compact_json.indentation = "";
+	auto sorted = CFG;
+	sorted.sort_keys = true;
+	sorted.array_omit_comma = true;
+
+	ThreadPool pool(4);
+	for (auto&& options : {CFG, JSON, FORGIVING, compact_json, sorted}) {
+		const std::string expected = dump_string(big, options);
+		TEST_EQ(dump_string(big, options, pool), expected);
+
+		PieceSink sink;
+		dump(sink, big, options, pool, 256);
+		TEST_EQ(sink.out, expected);
+	}
+
+	big["list"][1234]["a_longer_key"] = std::numeric_limits<double>::quiet_NaN();
+	TEST_THROW(dump_string(big, JSON, pool), std::runtime_error);
+}
+
+void test_config_reclaimer()
+{
+	// Deep enough to overflow the stack if freed recursively:
+	{
+		Config deep = Config::array();
+		Config* node = &deep;
+		for (int i = 0; i < 200000; ++i) {
+			node->push_back(Config::array());
+			node = &(*node)[0].ref();
+		}
+	}
+
+	auto make_big = []() {
+		Config big = Config::object();
+		for (int i = 0; i < 10; ++i) {
+			Config child = Config::array();
+			for (int j = 0; j < 100; ++j) {
+				child.push_back(Config::object({{"text", "value"}, {"list", Config::array({j, "x"})}}));
+			}
+			big.insert_or_assign("child_" + std::to_string(i), std::move(child));
+		}
+		return big;
+	};
+
+	ConfigReclaimer reclaimer;
+	TEST(reclaimer.empty());
+	Config live = make_big();
+	const Config kept = live["child_3"];
+	Config next = make_big();
+	std::swap(live, next);
+	reclaimer.retire(std::move(next));
+	TEST(next.is_uninitialized());
+	TEST(!reclaimer.empty());
+
+	int num_slices = 1;
+	while (!reclaimer.reclaim(100)) { ++num_slices; }
+	TEST(num_slices > 10);
+	TEST(reclaimer.empty());
+	TEST_EQ((int)kept[42]["list"][0], 42);
+	TEST_EQ((std::string)live["child_9"][99]["text"], "value");
+
+	{
+		ConfigReclaimer background(true);
+		for (int i = 0; i < 4; ++i) {
+			background.retire(make_big());
+		}
+	}
+}
+
+void test_persistent_config()
+{
+	const auto cfg = parse_string("name: \"v1\", limits: { low: 1, high: 10 }, list: [1 2 3]", CFG, "persistent");
+	const PersistentConfig v1(cfg);
+
+	TEST_EQ(v1["name"].as_string(), "v1");
+	TEST_EQ(as<int>(v1["limits"]["high"]), 10);
+	TEST_EQ(v1["list"][2].get<int>(), 3);
+	TEST_EQ(v1.get_or("missing", 7), 7);
+	TEST_THROW(v1["missing"], std::exception);
+
+	const auto v2 = v1.with({"limits", "high"}, 20).with("name", "v2");
+	const auto v3 = v2.with({"new", "nested"}, true).without("list");
+	const auto v4 = v1.with("list", v1["list"].with_appended(4).with(0, "zero"));
+
+	// Old versions are unchanged:
+	TEST_EQ(v1["name"].as_string(), "v1");
+	TEST_EQ(v1["limits"]["high"].get<int>(), 10);
+	TEST_EQ(v1["list"].array_size(), 3u);
+
+	TEST_EQ(v2["name"].as_string(), "v2");
+	TEST_EQ(v2["limits"]["high"].get<int>(), 20);
+	TEST(v2["list"] == v1["list"]);
+	TEST(v3["new"]["nested"].get<bool>());
+	TEST(!v3.has_key("list"));
+	TEST_EQ(v4["list"].array_size(), 4u);
+	TEST_EQ(v4["list"][0].as_string(), "zero");
+	TEST(v4["limits"] == v1["limits"]);
+	TEST(v1 != v2);
+
+	// Unchanged subtrees are shared:
+	TEST_EQ(&v2["list"][0], &v1["list"][0]);
+	TEST_EQ(&v4["limits"]["low"], &v1["limits"]["low"]);
+
+	std::string keys;
+	for (auto&& p : v3.as_object()) {
+		keys += p.key() + " ";
+	}
+	TEST_EQ(keys, "limits name new ");
+
+	// Converting back keeps the key order, and new keys are added last:
+	TEST(Config::deep_eq(v1.to_config(), cfg));
+	TEST_EQ(dump_string(v3.to_config(), JSON), "{\n\t\"name\":   \"v2\",\n\t\"limits\": {\n\t\t\"low\":  1,\n\t\t\"high\": 20\n\t},\n\t\"new\":    {\n\t\t\"nested\": true\n\t}\n}\n");
+
+	// Big arrays and objects, compared with a std::vector and a std::map:
+	auto array = PersistentConfig::array();
+	std::vector<int> expected_array;
+	for (int i = 0; i < 2000; ++i) {
+		array = array.with_appended(i);
+		expected_array.push_back(i);
+	}
+	const auto big_array = array;
+	for (size_t i = 0; i < 2000; i += 7) {
+		array = array.with(i, -1);
+		expected_array[i] = -1;
+	}
+	TEST_EQ(array.array_size(), expected_array.size());
+	bool array_ok = true;
+	size_t ix = 0;
+	for (const PersistentConfig& e : array.as_array()) {
+		array_ok &= e.get<int>() == expected_array[ix] && array[ix].get<int>() == expected_array[ix];
+		++ix;
+	}
+	TEST(array_ok);
+	TEST_EQ(big_array[7].get<int>(), 7);
+	const auto changed = big_array.with(10, -1);
+	TEST_EQ(&changed[1500], &big_array[1500]); // Only the chunks on the way to element 10 are copied.
+	TEST(&changed[11] != &big_array[11]);
+	TEST(array != big_array);
+	TEST(PersistentConfig(big_array.to_config()) == big_array);
+
+	auto object = PersistentConfig::object();
+	std::map<std::string, int> expected_object;
+	unsigned seed = 1;
+	for (int i = 0; i < 3000; ++i) {
+		seed = seed * 1103515245u + 12345u;
+		const std::string key = "k" + std::to_string((seed >> 16) % 500);
+		if (i % 3 == 2) {
+			object = object.without(key);
+			expected_object.erase(key);
+		} else {
+			object = object.with(key, i);
+			expected_object[key] = i;
+		}
+	}
+	TEST_EQ(object.object_size(), expected_object.size());
+	bool object_ok = true;
+	auto expected_it = expected_object.begin();
+	for (auto&& p : object.as_object()) {
+		object_ok &= expected_it != expected_object.end() && p.key() == expected_it->first && p.value().get<int>() == expected_it->second;
+		++expected_it;
+	}
+	TEST(object_ok && expected_it == expected_object.end());
+	TEST(PersistentConfig(object.to_config()) == object);
+}
+
+#if CONFIGURU_ATOMIC_REF_COUNT
+void test_threaded_copies()
+{
+	const auto cfg = parse_string("array: [1 \"two\" [3]], object: { key: \"value\" }", CFG, "threaded");
+	const Config original = cfg;
+
+	std::vector<std::thread> threads;
+	for (int t = 0; t < 8; ++t) {
+		threads.emplace_back([&cfg]() {
+			for (int i = 0; i < 10000; ++i) {
+				Config array  = cfg["array"];
+				Config object = cfg["object"];
+				Config nested = array;
+				(void)nested;
+			}
+		});
+	}
+	for (auto& thread : threads) {
+		thread.join();
+	}
+
+	TEST_EQ(cfg["array"].array_size(), 3u);
+	TEST_EQ(cfg["object"]["key"], "value");
+	TEST(Config::deep_eq(cfg, original));
+}
+#endif
+
 // ----------------------------------------------------------------------------
 
 struct TestStruct
@@ -720,6 +2071,18 @@ bool operator==(const TestStruct& a, const TestStruct& b)
 }
 VISITABLE_STRUCT(TestStruct, some_int, some_string);
 
+struct StrictStruct
+{
+	TestStruct  nested;
+	float       weight = 1;
+	std::vector<int> ids;
+};
+VISITABLE_STRUCT(StrictStruct, weight, nested, ids);
+
+namespace configuru {
+	template <> struct report_unknown_keys<StrictStruct> : std::true_type { };
+}
+
 void test_serialize_deserialize()
 {
 	std::vector<std::string> errors;
@@ -745,6 +2108,158 @@ void test_serialize_deserialize()
 	configuru::deserialize(&after, configuru::serialize(before), store_errors);
 	TEST(errors.empty());
 	TEST_EQ(before, after);
+
+	// Unknown keys are ignored, and left unaccessed:
+	const auto with_extra = configuru::parse_string("{some_int: 3, extra: 4, some_string: \"x\"}", CFG, "extra");
+	configuru::deserialize(&test_struct, with_extra, store_errors);
+	TEST(errors.empty());
+	TEST_EQ(test_struct.some_int,    3);
+	TEST_EQ(test_struct.some_string, "x");
+	TEST_THROW(with_extra.check_dangling(), std::runtime_error);
+
+	// ...unless the struct asks for them to be reported:
+	StrictStruct strict;
+	const auto strict_cfg = configuru::parse_string(
+		"{aaa: 0, weight: 2.5, nested: {some_int: 5, typo: 6}, ids: [1, 2], zzz: 0}", CFG, "strict");
+	configuru::deserialize(&strict, strict_cfg, store_errors);
+	TEST_EQ(errors.size(), 2u);
+	TEST_EQ(strict.weight, 2.5f);
+	TEST_EQ(strict.nested.some_int, 5);
+	TEST_EQ(strict.ids.size(), 2u);
+	TEST(errors.size() == 2 && errors[0].find("'aaa'") != std::string::npos && errors[1].find("'zzz'") != std::string::npos);
+}
+
+enum class Shape { Circle, Square };
+
+struct Settings
+{
+	std::string                name;
+	bool                       enabled = false;
+	unsigned char              level = 0;
+	double                     scale = 1;
+	Shape                      shape = Shape::Circle;
+	std::array<int, 3>         rgb {{0, 0, 0}};
+	float                      position[2] = {0, 0};
+	std::vector<TestStruct>    items;
+	std::map<std::string, int> limits;
+};
+VISITABLE_STRUCT(Settings, name, enabled, level, scale, shape, rgb, position, items, limits);
+
+void test_parse_into()
+{
+	const char* text =
+		"// The same as deserialize(parse_string(...)):\n"
+		"name:     \"test\"\n"
+		"enabled:  true\n"
+		"level:    7\n"
+		"scale:    2\n"
+		"shape:    1\n"
+		"rgb:      [255, 128, 0]\n"
+		"position: [1.5, -2]\n"
+		"unknown:  {ignored: [1, 2, {three: 4}]}\n"
+		"items:    [{some_int: 1}, {some_string: \"two\", some_int: 2}]\n"
+		"limits:   [[\"a\", 1], [\"b\", 2]]\n";
+
+	Settings parsed;
+	parse_into(text, CFG, parsed);
+	Settings deserialized;
+	deserialize(&deserialized, parse_string(text, CFG, "string"), nullptr);
+	TEST_EQ(dump_string(serialize(parsed), CFG), dump_string(serialize(deserialized), CFG));
+	TEST_EQ(parsed.name, "test");
+	TEST_EQ(parsed.level, 7);
+	TEST_EQ(parsed.scale, 2.0);
+	TEST(parsed.shape == Shape::Square);
+	TEST_EQ(parsed.rgb[1], 128);
+	TEST_EQ(parsed.position[1], -2.0f);
+	TEST_EQ(parsed.items.size(), 2u);
+	TEST_EQ(parsed.items[0].some_string, "hello");
+	TEST_EQ(parsed.items[1].some_string, "two");
+	TEST_EQ(parsed.limits["b"], 2);
+
+	std::vector<int> ints;
+	parse_into("[1, 2, 3]", JSON, ints);
+	TEST_EQ(ints.size(), 3u);
+
+	// Errors are reported where they are, and syntax errors just like parse_string does:
+	const auto error_at = [](const std::function<void()>& parse) {
+		try {
+			parse();
+		} catch (ParseError& e) {
+			return std::to_string(e.line()) + ":" + std::to_string(e.column());
+		}
+		return std::string("no error");
+	};
+	for (const char* bad : {
+		"name: \"x\"\nlevel 7",
+		"items: [\n\t{some_int: 1,,}\n]",
+		"rgb: [1, 2, 3",
+		"items: [{}, {},, {}]",
+		"name: \"x\", name: \"y\"",
+		"",
+	}) {
+		const std::string expected = error_at([&]() { parse_string(bad, CFG, "bad"); });
+		TEST_EQ(error_at([&]() { Settings s; parse_into(bad, CFG, s); }), expected);
+	}
+	TEST_EQ(error_at([]() { Settings s; parse_into("level: 1\nscale: \"big\"", CFG, s); }), "2:8");
+	TEST_EQ(error_at([]() { Settings s; parse_into("level: 300", CFG, s); }), "1:8");
+	TEST_EQ(error_at([]() { Settings s; parse_into("rgb: [1, 2]", CFG, s); }), "1:6");
+	TEST_EQ(error_at([]() { Settings s; parse_into("rgb: [1, 2, 3, 4]", CFG, s); }), "1:16");
+	TEST_EQ(error_at([]() { StrictStruct s; parse_into("{\"weight\": 1, \"typo\": 2}", JSON, s); }), "1:15");
+	TEST_EQ(error_at([]() { std::vector<int> v; parse_into("[1, 2.5]", JSON, v); }), "1:5");
+	TEST_EQ(error_at([]() { std::vector<int> v; parse_into("[1] [2]", CFG, v); }), "1:5"); // One value only
+
+	// Includes are followed:
+	const auto dir = fs::temp_directory_path() / fs::unique_path("configuru_%%%%%%%%");
+	fs::create_directories(dir);
+	const std::string main_path = (dir / "main.cfg").string();
+	const auto write_file = [](const std::string& path, const std::string& contents) {
+		FILE* fp = fopen(path.c_str(), "wb");
+		fwrite(contents.data(), 1, contents.size(), fp);
+		fclose(fp);
+	};
+	write_file(main_path, "name: \"main\"\nitems: #include \"items.cfg\"\nlevel: 3\n");
+	write_file((dir / "items.cfg").string(), "[{some_int: 5}]\n");
+	Settings from_file;
+	parse_file_into(main_path, CFG, from_file);
+	TEST_EQ(from_file.name, "main");
+	TEST_EQ(from_file.items.size(), 1u);
+	TEST_EQ(from_file.items[0].some_int, 5);
+	TEST_EQ(from_file.level, 3);
+	fs::remove_all(dir);
+}
+
+void test_dump_struct()
+{
+	Settings settings;
+	settings.name = "with \"quotes\"";
+	settings.rgb = {{1, 2, 3}};
+	settings.items = {{"a", 1}, {"b", 2}};
+	settings.limits = {{"x", 1}};
+
+	auto aligned = CFG;
+	aligned.object_align_values = true;
+	aligned.omit_colon_before_object = true;
+	auto sorted = JSON;
+	sorted.sort_keys = true;
+	auto compact = JSON;
+	compact.indentation = "";
+
+	// The same as going through a Config:
+	for (const auto& options : {CFG, JSON, aligned, sorted, compact}) {
+		TEST_EQ(dump_struct(settings, options), dump_string(serialize(settings), options));
+		TEST_EQ(dump_struct(settings.items, options), dump_string(serialize(settings.items), options));
+	}
+
+	// A writer and output can be reused:
+	PushWriter writer(CFG);
+	std::string out;
+	dump_struct(writer, settings, out);
+	dump_struct(writer, settings, out);
+	TEST_EQ(out, dump_string(serialize(settings), CFG));
+
+	Settings round_trip;
+	parse_into(out.c_str(), CFG, round_trip);
+	TEST_EQ(dump_struct(round_trip, CFG), out);
 }
 
 // ----------------------------------------------------------------------------
@@ -784,6 +2299,9 @@ int main()
 {
 	printf("CONFIGURU_VALUE_SEMANTICS:      %s\n", CONFIGURU_VALUE_SEMANTICS      ? "ON" : "OFF");
 	printf("CONFIGURU_IMPLICIT_CONVERSIONS: %s\n", CONFIGURU_IMPLICIT_CONVERSIONS ? "ON" : "OFF");
+	printf("CONFIGURU_ATOMIC_REF_COUNT:     %s\n", CONFIGURU_ATOMIC_REF_COUNT     ? "ON" : "OFF");
+	printf("CONFIGURU_COPY_ON_WRITE:        %s\n", CONFIGURU_COPY_ON_WRITE        ? "ON" : "OFF");
+	printf("CONFIGURU_HASH_CACHE:           %s\n", CONFIGURU_HASH_CACHE           ? "ON" : "OFF");
 
 	parse_and_print();
 	configuru_vs_nlohmann();
@@ -793,9 +2311,30 @@ int main()
 	test_conversions();
 	run_unit_tests();
 	test_copy_semantics();
+#if CONFIGURU_VALUE_SEMANTICS
+	test_copy_on_write();
+	test_dump_cache();
+#endif
 	test_swap();
 	test_get_or();
+	test_packed_arrays();
+	test_frozen_config();
+	test_snapshot();
+	test_parse_cache();
+	test_persistent_config();
+	test_hash();
+	test_diff_and_patch();
+	test_overlay_config();
+	test_parallel_clone_and_eq();
+	test_parallel_visit();
+	test_parallel_dump();
+	test_config_reclaimer();
+#if CONFIGURU_ATOMIC_REF_COUNT
+	test_threaded_copies();
+#endif
 	test_serialize_deserialize();
+	test_parse_into();
+	test_dump_struct();
 
 	// ------------------------------------------------------------------------
 